@@ -31,6 +31,26 @@
 
 #include "gsttranscoder.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#endif
+#ifdef G_OS_WIN32
+#include <io.h>
+#endif
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
 GST_DEBUG_CATEGORY_STATIC (gst_transcoder_debug);
 #define GST_CAT_DEFAULT gst_transcoder_debug
 
@@ -38,7 +58,22 @@ GST_DEBUG_CATEGORY_STATIC (gst_transcoder_debug);
 #define DEFAULT_POSITION GST_CLOCK_TIME_NONE
 #define DEFAULT_DURATION GST_CLOCK_TIME_NONE
 #define DEFAULT_POSITION_UPDATE_INTERVAL_MS 100
+#define DEFAULT_POSITION_UPDATE_DELTA 0
 #define DEFAULT_AVOID_REENCODING   FALSE
+#define DEFAULT_N_SEGMENTS 1
+
+/* Segments shorter than that are not worth a pipeline of their own */
+#define MIN_SEGMENT_DURATION (10 * GST_SECOND)
+/* Longest work lost when a checkpointed job gets interrupted */
+#define CHECKPOINT_SEGMENT_DURATION (5 * 60 * GST_SECOND)
+#define CHECKPOINT_FILE "checkpoint.ini"
+#define DISCOVERER_TIMEOUT (10 * GST_SECOND)
+/* How often the encoding targets on disk are checked for changes */
+#define PROFILE_CACHE_CHECK_INTERVAL G_USEC_PER_SEC
+/* Sources bigger than that only get sampled to look up the output cache */
+#define OUTPUT_CACHE_FULL_HASH_SIZE (64 * 1024 * 1024)
+#define OUTPUT_CACHE_N_SAMPLES 16
+#define OUTPUT_CACHE_SAMPLE_SIZE (1024 * 1024)
 
 GQuark
 gst_transcoder_error_quark (void)
@@ -63,6 +98,22 @@ enum
   PROP_PIPELINE,
   PROP_POSITION_UPDATE_INTERVAL,
   PROP_AVOID_REENCODING,
+  PROP_N_SEGMENTS,
+  PROP_MAIN_CONTEXT,
+  PROP_HARDWARE_POLICY,
+  PROP_COLLECT_STATS,
+  PROP_POSITION_UPDATE_DELTA,
+  PROP_MP4_MODE,
+  PROP_CHECKPOINT_DIR,
+  PROP_START_TIME,
+  PROP_STOP_TIME,
+  PROP_SEEK_MODE,
+  PROP_LIVE,
+  PROP_LATENCY_BUDGET,
+  PROP_LATENCY,
+  PROP_DEADLINE,
+  PROP_MAX_MEMORY,
+  PROP_OUTPUT_CACHE_DIR,
   PROP_LAST
 };
 
@@ -73,6 +124,8 @@ enum
   SIGNAL_DONE,
   SIGNAL_ERROR,
   SIGNAL_WARNING,
+  SIGNAL_STATS_UPDATED,
+  SIGNAL_LATENCY_CHANGED,
   SIGNAL_LAST
 };
 
@@ -80,6 +133,20 @@ typedef struct
 {
 } LinuxCpuUsageData;
 
+typedef struct
+{
+  GstTranscoder *transcoder;
+  GstElement *pipeline;
+  GSource *bus_source;
+
+  GstClockTime start;
+  GstClockTime stop;
+  gchar *location;
+  gchar *part_location;
+  gboolean last;
+  gboolean done;
+} GstTranscoderSegment;
+
 struct _GstTranscoder
 {
   GstObject parent;
@@ -97,14 +164,65 @@ struct _GstTranscoder
 
   GstElement *transcodebin;
   GstBus *bus;
+  GSource *bus_source;
   GstState target_state, current_state;
   gboolean is_live, is_eos;
   GSource *tick_source, *ready_timeout_source;
 
   guint position_update_interval_ms;
+  /* Event driven progress, the position is only read from the transcoder
+   * thread */
+  GstClockTime position_update_delta;
+  GstClockTime last_position_update;
   gint wanted_cpu_usage;
 
   GstClockTime last_duration;
+  /* Latency of the live pipeline, protected by the object lock */
+  GstClockTime latency;
+  /* Monotonic time the current run was started at, in microseconds */
+  gint64 run_start;
+
+  /* Additional outputs encoded from the same decoded streams */
+  guint n_renditions;
+
+  /* Segmented transcoding, only touched from the transcoder thread */
+  guint n_segments;
+  GPtrArray *segments;
+  guint n_segments_done;
+  gchar *segments_dir;
+  /* Segments are started as running ones are done */
+  GstEncodingProfile *segment_profile;
+  guint segment_cpu_usage;
+  guint max_running_segments;
+  guint n_segments_running;
+  guint next_segment;
+  /* Settings of the pipeline replaced to concatenate the segments, the
+   * source is only put back once the pipeline is stopped */
+  gboolean concat_overridden;
+  gboolean concat_saved_avoid_reencoding;
+  GstElement *concat_saved_source;
+  gboolean concat_source_pending;
+
+  /* Segments kept across runs so that an interrupted job resumes, the
+   * directory is protected by the object lock */
+  gchar *checkpoint_dir;
+  gboolean segments_checkpointed;
+
+  /* Range of the source to transcode, protected by the object lock */
+  GstClockTime start_time;
+  GstClockTime stop_time;
+
+  /* First pass of two-pass encoding, only touched from the transcoder
+   * thread */
+  GstElement *analysis_pipeline;
+  GSource *analysis_bus_source;
+  gchar *multipass_cache_file;
+
+  /* Outputs of previous jobs, the directory is protected by the object
+   * lock, the file the output gets cached as is only touched from the
+   * transcoder thread */
+  gchar *output_cache_dir;
+  gchar *output_cache_file;
 };
 
 struct _GstTranscoderClass
@@ -132,9 +250,17 @@ static void gst_transcoder_get_property (GObject * object, guint prop_id,
 static void gst_transcoder_constructed (GObject * object);
 
 static gpointer gst_transcoder_main (gpointer data);
+static gpointer gst_transcoder_init_once (G_GNUC_UNUSED gpointer user_data);
+static GOnce init_once = G_ONCE_INIT;
+static void gst_transcoder_attach_bus (GstTranscoder * self);
+static void gst_transcoder_detach_bus (GstTranscoder * self);
 
 static gboolean gst_transcoder_set_position_update_interval_internal (gpointer
     user_data);
+static void segments_cleanup_full (GstTranscoder * self, gboolean done);
+static void segments_cleanup (GstTranscoder * self);
+static void segments_restore_source (GstTranscoder * self);
+static void multipass_cleanup (GstTranscoder * self);
 
 
 /**
@@ -146,6 +272,9 @@ static gboolean gst_transcoder_set_position_update_interval_internal (gpointer
  * Sets @cpu_usage as target percentage CPU usage of the process running the
  * transcoding task. It will modulate the transcoding speed to reach that target
  * usage.
+ *
+ * Setting @cpu_usage to 100 disables throttling entirely and the transcoding
+ * runs as fast as possible.
  */
 void
 gst_transcoder_set_cpu_usage (GstTranscoder * self, gint cpu_usage)
@@ -157,6 +286,27 @@ gst_transcoder_set_cpu_usage (GstTranscoder * self, gint cpu_usage)
   GST_OBJECT_UNLOCK (self);
 }
 
+/**
+ * gst_transcoder_get_cpu_usage:
+ * @self: The GstTranscoder to get the CPU usage target from.
+ *
+ * Returns: The percentage of the CPU the transcoding tries to use, see
+ * gst_transcoder_set_cpu_usage().
+ */
+gint
+gst_transcoder_get_cpu_usage (GstTranscoder * self)
+{
+  gint cpu_usage;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), 100);
+
+  GST_OBJECT_LOCK (self);
+  cpu_usage = self->wanted_cpu_usage;
+  GST_OBJECT_UNLOCK (self);
+
+  return cpu_usage;
+}
+
 static void
 gst_transcoder_init (GstTranscoder * self)
 {
@@ -166,11 +316,14 @@ gst_transcoder_init (GstTranscoder * self)
 
   g_cond_init (&self->cond);
 
-  self->context = g_main_context_new ();
-  self->loop = g_main_loop_new (self->context, FALSE);
   self->wanted_cpu_usage = 100;
+  self->n_segments = DEFAULT_N_SEGMENTS;
+  self->stop_time = GST_CLOCK_TIME_NONE;
+  self->latency = GST_CLOCK_TIME_NONE;
 
   self->position_update_interval_ms = DEFAULT_POSITION_UPDATE_INTERVAL_MS;
+  self->position_update_delta = DEFAULT_POSITION_UPDATE_DELTA;
+  self->last_position_update = GST_CLOCK_TIME_NONE;
 
   GST_TRACE_OBJECT (self, "Initialized");
 }
@@ -180,6 +333,9 @@ gst_transcoder_class_init (GstTranscoderClass * klass)
 {
   GObjectClass *gobject_class = (GObjectClass *) klass;
 
+  /* Transcoders can also be created with g_object_new() */
+  g_once (&init_once, gst_transcoder_init_once, NULL);
+
   gobject_class->set_property = gst_transcoder_set_property;
   gobject_class->get_property = gst_transcoder_get_property;
   gobject_class->dispose = gst_transcoder_dispose;
@@ -232,6 +388,247 @@ gst_transcoder_class_init (GstTranscoderClass * klass)
       "Whether to re-encode portions of compatible video streams that lay on segment boundaries",
       DEFAULT_AVOID_REENCODING, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+  /**
+   * GstTranscoder:n-segments:
+   *
+   * Number of time ranges the source is split into, each of them being
+   * transcoded in its own pipeline in parallel before they get concatenated
+   * into the final container. 0 means one segment per CPU and 1 disables
+   * segmented transcoding. Segmented transcoding is only used for seekable
+   * sources with video, it silently falls back to a regular transcoding
+   * otherwise.
+   *
+   * While segments are being transcoded, the position is the sum of their
+   * progress, it then reflects the progress of their concatenation.
+   *
+   * The segments are written to a temporary directory, or to
+   * #GstTranscoder:checkpoint-dir, with the video already encoded and the
+   * audio encoded losslessly with FLAC, or kept raw when flacenc is not
+   * available; that is about 600MiB per hour of stereo audio.
+   */
+  param_specs[PROP_N_SEGMENTS] =
+      g_param_spec_uint ("n-segments", "Number of segments",
+      "Number of segments to transcode in parallel, 0 means one per CPU",
+      0, G_MAXUINT, DEFAULT_N_SEGMENTS,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:main-context:
+   *
+   * The #GMainContext the bus of the pipeline is watched from. When %NULL,
+   * the transcoder creates its own context and runs it in a dedicated
+   * thread, otherwise the caller is responsible for running the context,
+   * which can be shared between several transcoders.
+   */
+  param_specs[PROP_MAIN_CONTEXT] =
+      g_param_spec_boxed ("main-context", "Main context",
+      "The GMainContext to watch the pipeline bus from", G_TYPE_MAIN_CONTEXT,
+      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:hardware-policy:
+   *
+   * Whether hardware video decoders and encoders are preferred, required or
+   * forbidden, see #GstTranscoderHardwarePolicy.
+   */
+  param_specs[PROP_HARDWARE_POLICY] =
+      g_param_spec_enum ("hardware-policy", "Hardware policy",
+      "How hardware video codecs are selected",
+      GST_TYPE_TRANSCODER_HARDWARE_POLICY, GST_TRANSCODER_HARDWARE_POLICY_AUTO,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:position-update-delta:
+   *
+   * When non zero, the position reported by
+   * #GstTranscoder::position-updated is the progress recorded by the
+   * encoders instead of the result of a position query through the
+   * pipeline, and the signal is only emitted once the position advanced by
+   * at least that much since the previous emission. The position is still
+   * queried while segments are transcoded.
+   */
+  param_specs[PROP_POSITION_UPDATE_DELTA] =
+      g_param_spec_uint64 ("position-update-delta", "Position update delta",
+      "Minimum progress between two position-updated signals, 0 queries the "
+      "position on each update", 0, G_MAXUINT64, DEFAULT_POSITION_UPDATE_DELTA,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:collect-stats:
+   *
+   * Whether to collect the per stream statistics reported by
+   * gst_transcoder_get_stats() and #GstTranscoder::stats-updated. It has to
+   * be set before running the transcoder.
+   */
+  param_specs[PROP_COLLECT_STATS] =
+      g_param_spec_boolean ("collect-stats", "Collect stats",
+      "Whether to collect per stream statistics", FALSE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:mp4-mode:
+   *
+   * How MP4 and QuickTime outputs are laid out so that they can be played
+   * while they are still being written, without a second pass to move the
+   * moov atom, see #GstTranscoderMp4Mode.
+   */
+  param_specs[PROP_MP4_MODE] =
+      g_param_spec_enum ("mp4-mode", "MP4 mode",
+      "How MP4 muxers lay out their output",
+      GST_TYPE_TRANSCODER_MP4_MODE, GST_TRANSCODER_MP4_MODE_NORMAL,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:checkpoint-dir:
+   *
+   * Directory the transcoded segments are kept in until the job is done.
+   * When set, seekable sources with video are always transcoded in
+   * segments of at most a few minutes, #GstTranscoder:n-segments of them
+   * running at the same time. Each segment starts on a keyframe and is
+   * only kept once it has been fully written, so running the transcoder
+   * again with the same directory after an interruption only transcodes
+   * the missing segments before concatenating them into the output.
+   * Segments transcoded from another source or with other video settings
+   * are discarded.
+   */
+  param_specs[PROP_CHECKPOINT_DIR] =
+      g_param_spec_string ("checkpoint-dir", "Checkpoint directory",
+      "Directory to keep the transcoded segments in to resume interrupted"
+      " jobs", NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:start-time:
+   *
+   * Position in the source where transcoding starts, the source is seeked
+   * there before anything gets encoded, see #GstTranscoder:seek-mode. It has
+   * to be set before running the transcoder.
+   */
+  param_specs[PROP_START_TIME] =
+      g_param_spec_uint64 ("start-time", "Start time",
+      "Position of the source where to start transcoding", 0, G_MAXUINT64, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:stop-time:
+   *
+   * Position in the source where transcoding stops, #GST_CLOCK_TIME_NONE to
+   * transcode until the end. It has to be set before running the
+   * transcoder.
+   */
+  param_specs[PROP_STOP_TIME] =
+      g_param_spec_uint64 ("stop-time", "Stop time",
+      "Position of the source where to stop transcoding", 0, G_MAXUINT64,
+      GST_CLOCK_TIME_NONE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:seek-mode:
+   *
+   * How the start of the range set with #GstTranscoder:start-time is found,
+   * see #GstTranscoderSeekMode. Snapping to the preceding keyframe lets the
+   * streams passed through with #GstTranscoder:avoid-reencoding start on a
+   * decodable frame, so that a clip only costs demuxing and muxing the GOPs
+   * it covers.
+   */
+  param_specs[PROP_SEEK_MODE] =
+      g_param_spec_enum ("seek-mode", "Seek mode",
+      "How the start of the range to transcode is found",
+      GST_TYPE_TRANSCODER_SEEK_MODE, GST_TRANSCODER_SEEK_MODE_ACCURATE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:live:
+   *
+   * Transcode a live source, such as an RTMP or SRT stream, with a bounded
+   * latency. The CPU usage is not throttled and the output is written as
+   * soon as it is encoded; the video encoders are tuned not to hold frames
+   * back and the decoded frames which could not reach the encoders within
+   * #GstTranscoder:latency-budget of their capture are dropped instead of
+   * delaying the following ones. Live sources are never transcoded in
+   * segments nor in several passes. It has to be set before running the
+   * transcoder.
+   */
+  param_specs[PROP_LIVE] =
+      g_param_spec_boolean ("live", "Live",
+      "Bound the latency of live streams by dropping late frames", FALSE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:latency-budget:
+   *
+   * In #GstTranscoder:live mode, how long the decoded frames can take to
+   * reach the encoders after being captured, later ones are dropped.
+   */
+  param_specs[PROP_LATENCY_BUDGET] =
+      g_param_spec_uint64 ("latency-budget", "Latency budget",
+      "How late frames can reach the encoders in live mode (in ns)", 0,
+      G_MAXUINT64, 2 * GST_SECOND, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:latency:
+   *
+   * The latency the live pipeline is currently configured with, or
+   * #GST_CLOCK_TIME_NONE when the source is not live. It is updated each
+   * time an element changes its latency, see
+   * #GstTranscoder::latency-changed.
+   */
+  param_specs[PROP_LATENCY] =
+      g_param_spec_uint64 ("latency", "Latency",
+      "Latency of the live pipeline", 0, G_MAXUINT64, GST_CLOCK_TIME_NONE,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:deadline:
+   *
+   * How long the transcoding may take, #GST_CLOCK_TIME_NONE for no
+   * deadline. When set, the CPU usage set with gst_transcoder_set_cpu_usage()
+   * is not enforced by sleeping anymore; instead, when the job is CPU bound
+   * and would end after the deadline at its current pace, the output is
+   * degraded step by step: the video encoders are switched to faster
+   * settings, then the video framerate is halved, then the streams other
+   * than the first audio and video ones are dropped. Each step is reported
+   * with a "transcodebin-degradation" element message on the bus of the
+   * #GstTranscoder:pipeline.
+   */
+  param_specs[PROP_DEADLINE] =
+      g_param_spec_uint64 ("deadline", "Deadline",
+      "How long transcoding may take before degrading the output (in ns)", 0,
+      G_MAXUINT64, GST_CLOCK_TIME_NONE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:max-memory:
+   *
+   * How many bytes the queues of the job can hold, 0 for unlimited. Close
+   * to the limit the queues stop growing and stall the upstream elements;
+   * if the job still needs more, it fails with
+   * #GST_TRANSCODER_ERROR_MEMORY_LIMIT instead of getting the process
+   * killed.
+   */
+  param_specs[PROP_MAX_MEMORY] =
+      g_param_spec_uint64 ("max-memory", "Max memory",
+      "Max bytes queued by the job, 0 for unlimited", 0, G_MAXUINT64, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoder:output-cache-dir:
+   *
+   * Directory keeping the outputs of the successful jobs, named after a
+   * hash of the content of the source, of #GstTranscoder:profile and of the
+   * settings changing the output. Running a job whose output is cached
+   * copies it to the destination instead of transcoding, whatever the name
+   * of the source is. Sources bigger than 64MiB are identified by their
+   * size and 16 evenly spaced samples of 1MiB only.
+   *
+   * Only local sources and destinations are cached, and not when
+   * #GstTranscoder:live or #GstTranscoder:deadline is set, when renditions
+   * are added or when elements are set on the #GstTranscoder:pipeline. The
+   * directory is never pruned.
+   */
+  param_specs[PROP_OUTPUT_CACHE_DIR] =
+      g_param_spec_string ("output-cache-dir", "Output cache directory",
+      "Directory to cache the outputs in to skip transcoding identical jobs",
+      NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (gobject_class, PROP_LAST, param_specs);
 
   signals[SIGNAL_POSITION_UPDATED] =
@@ -258,6 +655,32 @@ gst_transcoder_class_init (GstTranscoderClass * klass)
       g_signal_new ("warning", G_TYPE_FROM_CLASS (klass),
       G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL,
       NULL, NULL, G_TYPE_NONE, 2, G_TYPE_ERROR, GST_TYPE_STRUCTURE);
+
+  /**
+   * GstTranscoder::stats-updated:
+   * @transcoder: The #GstTranscoder
+   * @stats: The snapshot returned by gst_transcoder_get_stats()
+   *
+   * Emitted along with #GstTranscoder::position-updated. The stats are only
+   * gathered when a handler is connected.
+   */
+  signals[SIGNAL_STATS_UPDATED] =
+      g_signal_new ("stats-updated", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL,
+      NULL, NULL, G_TYPE_NONE, 1, GST_TYPE_STRUCTURE);
+
+  /**
+   * GstTranscoder::latency-changed:
+   * @transcoder: The #GstTranscoder
+   * @latency: The new #GstTranscoder:latency
+   *
+   * Emitted when the latency of a live pipeline changes, for example when
+   * an encoder starts buffering more frames.
+   */
+  signals[SIGNAL_LATENCY_CHANGED] =
+      g_signal_new ("latency-changed", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL,
+      NULL, NULL, G_TYPE_NONE, 1, GST_TYPE_CLOCK_TIME);
 }
 
 static void
@@ -275,10 +698,13 @@ gst_transcoder_dispose (GObject * object)
 
     g_main_loop_unref (self->loop);
     self->loop = NULL;
+  } else if (self->bus) {
+    gst_transcoder_detach_bus (self);
+  }
 
+  if (self->context) {
     g_main_context_unref (self->context);
     self->context = NULL;
-
   }
 
   G_OBJECT_CLASS (parent_class)->dispose (object);
@@ -293,6 +719,10 @@ gst_transcoder_finalize (GObject * object)
 
   g_free (self->source_uri);
   g_free (self->dest_uri);
+  g_free (self->checkpoint_dir);
+  gst_clear_object (&self->concat_saved_source);
+  g_free (self->output_cache_dir);
+  g_free (self->output_cache_file);
   if (self->signal_dispatcher)
     g_object_unref (self->signal_dispatcher);
   g_cond_clear (&self->cond);
@@ -314,15 +744,53 @@ gst_transcoder_constructed (GObject * object)
       "dest-uri", self->dest_uri, "profile", self->profile,
       "cpu-usage", self->wanted_cpu_usage, NULL);
 
-  GST_OBJECT_LOCK (self);
-  self->thread = g_thread_new ("GstTranscoder", gst_transcoder_main, self);
-  while (!self->loop || !g_main_loop_is_running (self->loop))
-    g_cond_wait (&self->cond, GST_OBJECT_GET_LOCK (self));
-  GST_OBJECT_UNLOCK (self);
+  if (self->context) {
+    gst_transcoder_attach_bus (self);
+  } else {
+    self->context = g_main_context_new ();
+    self->loop = g_main_loop_new (self->context, FALSE);
+
+    GST_OBJECT_LOCK (self);
+    self->thread = g_thread_new ("GstTranscoder", gst_transcoder_main, self);
+    while (!g_main_loop_is_running (self->loop))
+      g_cond_wait (&self->cond, GST_OBJECT_GET_LOCK (self));
+    GST_OBJECT_UNLOCK (self);
+  }
 
   G_OBJECT_CLASS (parent_class)->constructed (object);
 }
 
+/* While segments are being transcoded, the position is the sum of the
+ * progress of each of them */
+static gboolean
+get_position (GstTranscoder * self, gint64 * position)
+{
+  guint i;
+
+  if (self->analysis_pipeline)
+    return gst_element_query_position (self->analysis_pipeline,
+        GST_FORMAT_TIME, position);
+
+  if (!self->segments || self->n_segments_done == self->segments->len)
+    return gst_element_query_position (self->transcodebin, GST_FORMAT_TIME,
+        position);
+
+  *position = 0;
+  for (i = 0; i < self->segments->len; i++) {
+    GstTranscoderSegment *segment = g_ptr_array_index (self->segments, i);
+    gint64 segment_position;
+
+    if (segment->done)
+      *position += segment->stop - segment->start;
+    else if (segment->pipeline
+        && gst_element_query_position (segment->pipeline, GST_FORMAT_TIME,
+            &segment_position) && segment_position > segment->start)
+      *position += MIN (segment_position, segment->stop) - segment->start;
+  }
+
+  return TRUE;
+}
+
 static void
 gst_transcoder_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec)
@@ -367,6 +835,80 @@ gst_transcoder_set_property (GObject * object, guint prop_id,
       g_object_set (self->transcodebin, "avoid-reencoding",
           g_value_get_boolean (value), NULL);
       break;
+    case PROP_N_SEGMENTS:
+      GST_OBJECT_LOCK (self);
+      self->n_segments = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_CHECKPOINT_DIR:
+      GST_OBJECT_LOCK (self);
+      g_free (self->checkpoint_dir);
+      self->checkpoint_dir = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_OUTPUT_CACHE_DIR:
+      GST_OBJECT_LOCK (self);
+      g_free (self->output_cache_dir);
+      self->output_cache_dir = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_START_TIME:
+      GST_OBJECT_LOCK (self);
+      self->start_time = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STOP_TIME:
+      GST_OBJECT_LOCK (self);
+      self->stop_time = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SEEK_MODE:
+      g_object_set (self->transcodebin, "seek-mode", g_value_get_enum (value),
+          NULL);
+      break;
+    case PROP_LIVE:
+      g_object_set (self->transcodebin, "live", g_value_get_boolean (value),
+          NULL);
+      break;
+    case PROP_LATENCY_BUDGET:
+      g_object_set (self->transcodebin, "latency-budget",
+          g_value_get_uint64 (value), NULL);
+      break;
+    case PROP_DEADLINE:
+    {
+      GstClockTime deadline = g_value_get_uint64 (value);
+
+      g_object_set (self->transcodebin, "deadline", deadline, NULL);
+      gst_util_set_object_arg (G_OBJECT (self->transcodebin),
+          "throttling-mode",
+          GST_CLOCK_TIME_IS_VALID (deadline) ? "degrade" : "clock");
+      break;
+    }
+    case PROP_MAX_MEMORY:
+      g_object_set (self->transcodebin, "max-memory",
+          g_value_get_uint64 (value), NULL);
+      break;
+    case PROP_MAIN_CONTEXT:
+      self->context = g_value_dup_boxed (value);
+      break;
+    case PROP_HARDWARE_POLICY:
+      /* Both enums share their values */
+      g_object_set (self->transcodebin, "hardware-policy",
+          g_value_get_enum (value), NULL);
+      break;
+    case PROP_MP4_MODE:
+      g_object_set (self->transcodebin, "mp4-mode", g_value_get_enum (value),
+          NULL);
+      break;
+    case PROP_COLLECT_STATS:
+      g_object_set (self->transcodebin, "collect-stats",
+          g_value_get_boolean (value), NULL);
+      break;
+    case PROP_POSITION_UPDATE_DELTA:
+      GST_OBJECT_LOCK (self);
+      self->position_update_delta = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -396,8 +938,7 @@ gst_transcoder_get_property (GObject * object, guint prop_id,
       if (self->is_eos)
         position = self->last_duration;
       else
-        gst_element_query_position (self->transcodebin, GST_FORMAT_TIME,
-            &position);
+        get_position (self, &position);
       g_value_set_uint64 (value, position);
       GST_TRACE_OBJECT (self, "Returning position=%" GST_TIME_FORMAT,
           GST_TIME_ARGS (g_value_get_uint64 (value)));
@@ -406,8 +947,9 @@ gst_transcoder_get_property (GObject * object, guint prop_id,
     case PROP_DURATION:{
       gint64 duration = 0;
 
-      gst_element_query_duration (self->transcodebin, GST_FORMAT_TIME,
-          &duration);
+      if (!gst_element_query_duration (self->transcodebin, GST_FORMAT_TIME,
+              &duration) && self->segments)
+        duration = self->last_duration;
       g_value_set_uint64 (value, duration);
       GST_TRACE_OBJECT (self, "Returning duration=%" GST_TIME_FORMAT,
           GST_TIME_ARGS (g_value_get_uint64 (value)));
@@ -436,6 +978,108 @@ gst_transcoder_get_property (GObject * object, guint prop_id,
       g_value_set_boolean (value, avoid_reencoding);
       break;
     }
+    case PROP_N_SEGMENTS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->n_segments);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_CHECKPOINT_DIR:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->checkpoint_dir);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_OUTPUT_CACHE_DIR:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->output_cache_dir);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_START_TIME:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->start_time);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STOP_TIME:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->stop_time);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SEEK_MODE:
+    {
+      gint mode;
+
+      g_object_get (self->transcodebin, "seek-mode", &mode, NULL);
+      g_value_set_enum (value, mode);
+      break;
+    }
+    case PROP_LIVE:
+    {
+      gboolean live;
+
+      g_object_get (self->transcodebin, "live", &live, NULL);
+      g_value_set_boolean (value, live);
+      break;
+    }
+    case PROP_LATENCY_BUDGET:
+    {
+      guint64 budget;
+
+      g_object_get (self->transcodebin, "latency-budget", &budget, NULL);
+      g_value_set_uint64 (value, budget);
+      break;
+    }
+    case PROP_LATENCY:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->latency);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_DEADLINE:
+    {
+      guint64 deadline;
+
+      g_object_get (self->transcodebin, "deadline", &deadline, NULL);
+      g_value_set_uint64 (value, deadline);
+      break;
+    }
+    case PROP_MAX_MEMORY:
+    {
+      guint64 max_memory;
+
+      g_object_get (self->transcodebin, "max-memory", &max_memory, NULL);
+      g_value_set_uint64 (value, max_memory);
+      break;
+    }
+    case PROP_HARDWARE_POLICY:
+    {
+      gint policy;
+
+      g_object_get (self->transcodebin, "hardware-policy", &policy, NULL);
+      g_value_set_enum (value, policy);
+      break;
+    }
+    case PROP_MP4_MODE:
+    {
+      gint mode;
+
+      g_object_get (self->transcodebin, "mp4-mode", &mode, NULL);
+      g_value_set_enum (value, mode);
+      break;
+    }
+    case PROP_POSITION_UPDATE_DELTA:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->position_update_delta);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_COLLECT_STATS:
+    {
+      gboolean collect_stats;
+
+      g_object_get (self->transcodebin, "collect-stats", &collect_stats, NULL);
+      g_value_set_boolean (value, collect_stats);
+      break;
+    }
+    case PROP_MAIN_CONTEXT:
+      g_value_set_boxed (value, self->loop ? NULL : self->context);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -482,20 +1126,78 @@ position_updated_signal_data_free (PositionUpdatedSignalData * data)
   g_free (data);
 }
 
+typedef struct
+{
+  GstTranscoder *transcoder;
+  GstStructure *stats;
+} StatsUpdatedSignalData;
+
+static void
+stats_updated_dispatch (gpointer user_data)
+{
+  StatsUpdatedSignalData *data = user_data;
+
+  if (data->transcoder->target_state >= GST_STATE_PAUSED)
+    g_signal_emit (data->transcoder, signals[SIGNAL_STATS_UPDATED], 0,
+        data->stats);
+}
+
+static void
+stats_updated_signal_data_free (StatsUpdatedSignalData * data)
+{
+  g_object_unref (data->transcoder);
+  gst_structure_free (data->stats);
+  g_free (data);
+}
+
+/* With a position update delta, the progress recorded by the encoders is
+ * used and nothing is reported until it advanced enough */
+static gboolean
+get_tick_position (GstTranscoder * self, gint64 * position)
+{
+  guint64 progress;
+  GstClockTime delta;
+
+  GST_OBJECT_LOCK (self);
+  delta = self->position_update_delta;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!delta || self->segments || self->analysis_pipeline)
+    return get_position (self, position);
+
+  g_object_get (self->transcodebin, "progress", &progress, NULL);
+  if (GST_CLOCK_TIME_IS_VALID (self->last_position_update)
+      && progress < self->last_position_update + delta)
+    return FALSE;
+
+  self->last_position_update = progress;
+  *position = progress;
+
+  return TRUE;
+}
+
 static gboolean
 tick_cb (gpointer user_data)
 {
   GstTranscoder *self = GST_TRANSCODER (user_data);
+  gboolean position_handler, stats_handler;
   gint64 position;
 
+  /* Unlike g_signal_handler_find() this does not walk the handlers, and
+   * nothing has to be queried when no one listens */
+  position_handler = g_signal_has_handler_pending (self,
+      signals[SIGNAL_POSITION_UPDATED], 0, FALSE);
+  stats_handler = g_signal_has_handler_pending (self,
+      signals[SIGNAL_STATS_UPDATED], 0, FALSE);
+  if (!position_handler && !stats_handler)
+    return G_SOURCE_CONTINUE;
+
   if (self->target_state >= GST_STATE_PAUSED
-      && gst_element_query_position (self->transcodebin, GST_FORMAT_TIME,
-          &position)) {
+      && get_tick_position (self, &position)) {
     GST_LOG_OBJECT (self, "Position %" GST_TIME_FORMAT,
         GST_TIME_ARGS (position));
 
-    if (g_signal_handler_find (self, G_SIGNAL_MATCH_ID,
-            signals[SIGNAL_POSITION_UPDATED], 0, NULL, NULL, NULL) != 0) {
+    if (position_handler) {
       PositionUpdatedSignalData *data = g_new0 (PositionUpdatedSignalData, 1);
 
       data->transcoder = g_object_ref (self);
@@ -504,6 +1206,16 @@ tick_cb (gpointer user_data)
           position_updated_dispatch, data,
           (GDestroyNotify) position_updated_signal_data_free);
     }
+
+    if (stats_handler) {
+      StatsUpdatedSignalData *data = g_new0 (StatsUpdatedSignalData, 1);
+
+      data->transcoder = g_object_ref (self);
+      data->stats = gst_transcoder_get_stats (self);
+      gst_transcoder_signal_dispatcher_dispatch (self->signal_dispatcher, self,
+          stats_updated_dispatch, data,
+          (GDestroyNotify) stats_updated_signal_data_free);
+    }
   }
 
   return G_SOURCE_CONTINUE;
@@ -578,12 +1290,15 @@ emit_error (GstTranscoder * self, GError * err, const GstStructure * details)
   g_error_free (err);
 
   remove_tick_source (self);
+  segments_cleanup (self);
+  multipass_cleanup (self);
 
   self->target_state = GST_STATE_NULL;
   self->current_state = GST_STATE_NULL;
   self->is_live = FALSE;
   self->is_eos = FALSE;
   gst_element_set_state (self->transcodebin, GST_STATE_NULL);
+  segments_restore_source (self);
 }
 
 static void
@@ -639,6 +1354,15 @@ error_cb (G_GNUC_UNUSED GstBus * bus, GstMessage * msg, gpointer user_data)
   gst_message_parse_error (msg, &err, &debug);
   gst_message_parse_error_details (msg, (const GstStructure **) &details);
 
+  if (details && gst_structure_has_name (details,
+          "uritranscodebin-memory-limit")) {
+    GError *memory_err = g_error_new_literal (GST_TRANSCODER_ERROR,
+        GST_TRANSCODER_ERROR_MEMORY_LIMIT, err->message);
+
+    g_error_free (err);
+    err = memory_err;
+  }
+
   if (!details)
     details = gst_structure_new_empty ("details");
   else
@@ -708,6 +1432,18 @@ eos_dispatch (gpointer user_data)
   g_signal_emit (user_data, signals[SIGNAL_DONE], 0);
 }
 
+static void
+emit_done (GstTranscoder * self)
+{
+  if (g_signal_handler_find (self, G_SIGNAL_MATCH_ID,
+          signals[SIGNAL_DONE], 0, NULL, NULL, NULL) != 0) {
+    gst_transcoder_signal_dispatcher_dispatch (self->signal_dispatcher, self,
+        eos_dispatch, g_object_ref (self), (GDestroyNotify) g_object_unref);
+  }
+}
+
+static void output_cache_store (GstTranscoder * self);
+
 static void
 eos_cb (G_GNUC_UNUSED GstBus * bus, G_GNUC_UNUSED GstMessage * msg,
     gpointer user_data)
@@ -718,14 +1454,17 @@ eos_cb (G_GNUC_UNUSED GstBus * bus, G_GNUC_UNUSED GstMessage * msg,
 
   gst_element_query_duration (self->transcodebin, GST_FORMAT_TIME,
       (gint64 *) & self->last_duration);
+  /* Always report the final position */
+  self->last_position_update = GST_CLOCK_TIME_NONE;
   tick_cb (self);
   remove_tick_source (self);
+  segments_cleanup_full (self, TRUE);
+  multipass_cleanup (self);
+  /* Before notifying, the output may be moved away once done */
+  if (self->output_cache_file)
+    output_cache_store (self);
 
-  if (g_signal_handler_find (self, G_SIGNAL_MATCH_ID,
-          signals[SIGNAL_DONE], 0, NULL, NULL, NULL) != 0) {
-    gst_transcoder_signal_dispatcher_dispatch (self->signal_dispatcher, self,
-        eos_dispatch, g_object_ref (self), (GDestroyNotify) g_object_unref);
-  }
+  emit_done (self);
   self->is_eos = TRUE;
 }
 
@@ -793,6 +1532,85 @@ emit_duration_changed (GstTranscoder * self, GstClockTime duration)
   }
 }
 
+typedef struct
+{
+  GstTranscoder *transcoder;
+  GstClockTime latency;
+} LatencyChangedSignalData;
+
+static void
+latency_changed_dispatch (gpointer user_data)
+{
+  LatencyChangedSignalData *data = user_data;
+
+  if (data->transcoder->target_state >= GST_STATE_PAUSED) {
+    g_signal_emit (data->transcoder, signals[SIGNAL_LATENCY_CHANGED], 0,
+        data->latency);
+    g_object_notify_by_pspec (G_OBJECT (data->transcoder),
+        param_specs[PROP_LATENCY]);
+  }
+}
+
+static void
+latency_changed_signal_data_free (LatencyChangedSignalData * data)
+{
+  g_object_unref (data->transcoder);
+  g_free (data);
+}
+
+/* Reads back the latency the live pipeline got configured with, which is
+ * how far behind the source the output is once the queues are drained */
+static void
+update_latency (GstTranscoder * self)
+{
+  GstQuery *query;
+  gboolean live = FALSE;
+  GstClockTime latency = GST_CLOCK_TIME_NONE, old_latency;
+  guint64 budget = GST_CLOCK_TIME_NONE;
+
+  query = gst_query_new_latency ();
+  if (gst_element_query (self->transcodebin, query))
+    gst_query_parse_latency (query, &live, &latency, NULL);
+  gst_query_unref (query);
+
+  if (!live)
+    latency = GST_CLOCK_TIME_NONE;
+
+  GST_OBJECT_LOCK (self);
+  old_latency = self->latency;
+  self->latency = latency;
+  GST_OBJECT_UNLOCK (self);
+
+  if (latency == old_latency)
+    return;
+
+  GST_DEBUG_OBJECT (self, "Latency changed %" GST_TIME_FORMAT,
+      GST_TIME_ARGS (latency));
+
+  g_object_get (self->transcodebin, "live", &live, "latency-budget", &budget,
+      NULL);
+  if (live && GST_CLOCK_TIME_IS_VALID (latency) && latency > budget) {
+    gchar *message = g_strdup_printf ("The pipeline latency (%"
+        GST_TIME_FORMAT ") is higher than the latency budget (%"
+        GST_TIME_FORMAT ")", GST_TIME_ARGS (latency), GST_TIME_ARGS (budget));
+
+    emit_warning (self, g_error_new_literal (GST_TRANSCODER_ERROR,
+            GST_TRANSCODER_ERROR_FAILED, message), NULL);
+    g_free (message);
+  }
+
+  if (g_signal_handler_find (self, G_SIGNAL_MATCH_ID,
+          signals[SIGNAL_LATENCY_CHANGED], 0, NULL, NULL, NULL) != 0) {
+    LatencyChangedSignalData *data = g_new0 (LatencyChangedSignalData, 1);
+
+    data->transcoder = g_object_ref (self);
+    data->latency = latency;
+    gst_transcoder_signal_dispatcher_dispatch (self->signal_dispatcher, self,
+        latency_changed_dispatch, data,
+        (GDestroyNotify) latency_changed_signal_data_free);
+  }
+}
+
 static void
 state_changed_cb (G_GNUC_UNUSED GstBus * bus, GstMessage * msg,
     gpointer user_data)
@@ -821,6 +1639,9 @@ state_changed_cb (G_GNUC_UNUSED GstBus * bus, GstMessage * msg,
     if (new_state == GST_STATE_PLAYING
         && pending_state == GST_STATE_VOID_PENDING) {
       add_tick_source (self);
+      /* The initial latency is distributed without any message */
+      if (self->is_live)
+        update_latency (self);
     }
   }
 }
@@ -847,6 +1668,7 @@ latency_cb (G_GNUC_UNUSED GstBus * bus, G_GNUC_UNUSED GstMessage * msg,
   GST_DEBUG_OBJECT (self, "Latency changed");
 
   gst_bin_recalculate_latency (GST_BIN (self->transcodebin));
+  update_latency (self);
 }
 
 static void
@@ -912,29 +1734,16 @@ element_cb (G_GNUC_UNUSED GstBus * bus, GstMessage * msg, gpointer user_data)
 }
 
 
-static gpointer
-gst_transcoder_main (gpointer data)
+static void
+gst_transcoder_attach_bus (GstTranscoder * self)
 {
-  GstTranscoder *self = GST_TRANSCODER (data);
   GstBus *bus;
-  GSource *source;
-  GSource *bus_source;
 
-  GST_TRACE_OBJECT (self, "Starting main thread");
-
-  g_main_context_push_thread_default (self->context);
-
-  source = g_idle_source_new ();
-  g_source_set_callback (source, (GSourceFunc) main_loop_running_cb, self,
-      NULL);
-  g_source_attach (source, self->context);
-  g_source_unref (source);
-
-  self->bus = bus = gst_element_get_bus (self->transcodebin);
-  bus_source = gst_bus_create_watch (bus);
-  g_source_set_callback (bus_source, (GSourceFunc) gst_bus_async_signal_func,
-      NULL, NULL);
-  g_source_attach (bus_source, self->context);
+  self->bus = bus = gst_element_get_bus (self->transcodebin);
+  self->bus_source = gst_bus_create_watch (bus);
+  g_source_set_callback (self->bus_source,
+      (GSourceFunc) gst_bus_async_signal_func, NULL, NULL);
+  g_source_attach (self->bus_source, self->context);
 
   g_signal_connect (G_OBJECT (bus), "message::error", G_CALLBACK (error_cb),
       self);
@@ -958,18 +1767,23 @@ gst_transcoder_main (gpointer data)
   self->current_state = GST_STATE_NULL;
   self->is_eos = FALSE;
   self->is_live = FALSE;
+  GST_OBJECT_LOCK (self);
+  self->latency = GST_CLOCK_TIME_NONE;
+  GST_OBJECT_UNLOCK (self);
+}
 
-  GST_TRACE_OBJECT (self, "Starting main loop");
-  g_main_loop_run (self->loop);
-  GST_TRACE_OBJECT (self, "Stopped main loop");
-
-  g_source_destroy (bus_source);
-  g_source_unref (bus_source);
-  gst_object_unref (bus);
+static void
+gst_transcoder_detach_bus (GstTranscoder * self)
+{
+  g_source_destroy (self->bus_source);
+  g_source_unref (self->bus_source);
+  self->bus_source = NULL;
+  gst_object_unref (self->bus);
+  self->bus = NULL;
 
   remove_tick_source (self);
-
-  g_main_context_pop_thread_default (self->context);
+  segments_cleanup (self);
+  multipass_cleanup (self);
 
   self->target_state = GST_STATE_NULL;
   self->current_state = GST_STATE_NULL;
@@ -977,6 +1791,33 @@ gst_transcoder_main (gpointer data)
     gst_element_set_state (self->transcodebin, GST_STATE_NULL);
     g_clear_object (&self->transcodebin);
   }
+}
+
+static gpointer
+gst_transcoder_main (gpointer data)
+{
+  GstTranscoder *self = GST_TRANSCODER (data);
+  GSource *source;
+
+  GST_TRACE_OBJECT (self, "Starting main thread");
+
+  g_main_context_push_thread_default (self->context);
+
+  source = g_idle_source_new ();
+  g_source_set_callback (source, (GSourceFunc) main_loop_running_cb, self,
+      NULL);
+  g_source_attach (source, self->context);
+  g_source_unref (source);
+
+  gst_transcoder_attach_bus (self);
+
+  GST_TRACE_OBJECT (self, "Starting main loop");
+  g_main_loop_run (self->loop);
+  GST_TRACE_OBJECT (self, "Stopped main loop");
+
+  gst_transcoder_detach_bus (self);
+
+  g_main_context_pop_thread_default (self->context);
 
   GST_TRACE_OBJECT (self, "Stopped main thread");
 
@@ -1015,6 +1856,138 @@ create_encoding_profile (const gchar * pname)
   return profile;
 }
 
+/* Parsed profiles, keyed by their serialization and shared by all the
+ * transcoders of the process. The cache is flushed whenever the encoding
+ * targets found on disk change. */
+static struct
+{
+  GMutex lock;
+  GHashTable *profiles;
+  guint64 targets_stamp;
+  gint64 last_check;
+} profile_cache;
+
+/* Sums up the name, size and modification time of the encoding target
+ * files below @path (which are laid out as <category>/<target>.gep) */
+static guint64
+get_targets_tree_stamp (const gchar * path, guint depth)
+{
+  GDir *dir;
+  GStatBuf st;
+  guint64 stamp;
+  const gchar *name;
+
+  if (g_stat (path, &st) < 0)
+    return 0;
+
+  stamp = g_str_hash (path) + (guint64) st.st_mtime * 31 + st.st_size;
+  if (depth == 0 || !g_file_test (path, G_FILE_TEST_IS_DIR))
+    return stamp;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (!dir)
+    return stamp;
+
+  while ((name = g_dir_read_name (dir))) {
+    gchar *child = g_build_filename (path, name, NULL);
+
+    stamp += get_targets_tree_stamp (child, depth - 1);
+    g_free (child);
+  }
+  g_dir_close (dir);
+
+  return stamp;
+}
+
+/* Looks at the same directories as gst_encoding_target_load() */
+static guint64
+get_targets_stamp (void)
+{
+  guint i;
+  gchar *path;
+  guint64 stamp;
+  const gchar *const *system_dirs;
+  const gchar *env_path = g_getenv ("GST_ENCODING_TARGET_PATH");
+
+  path = g_build_filename (g_get_user_data_dir (), "gstreamer-1.0",
+      "encoding-profiles", NULL);
+  stamp = get_targets_tree_stamp (path, 2);
+  g_free (path);
+
+  for (system_dirs = g_get_system_data_dirs (); *system_dirs; system_dirs++) {
+    path = g_build_filename (*system_dirs, "gstreamer-1.0",
+        "encoding-profiles", NULL);
+    stamp += get_targets_tree_stamp (path, 2);
+    g_free (path);
+  }
+
+  if (env_path) {
+    gchar **env_dirs = g_strsplit (env_path, G_SEARCHPATH_SEPARATOR_S, -1);
+
+    for (i = 0; env_dirs[i]; i++)
+      stamp += get_targets_tree_stamp (env_dirs[i], 2);
+    g_strfreev (env_dirs);
+  }
+
+  return stamp;
+}
+
+/**
+ * gst_transcoder_create_encoding_profile:
+ * @profile_string: The serialized #GstEncodingProfile, either a
+ * "target/profile" name or a caps based description
+ *
+ * Creates the #GstEncodingProfile described by @profile_string. Parsed
+ * profiles are cached process wide so that the encoding targets only get
+ * loaded from disk again when they change.
+ *
+ * Returns: (transfer full) (nullable): a new #GstEncodingProfile, owned by
+ * the caller, or %NULL if @profile_string could not be parsed.
+ */
+GstEncodingProfile *
+gst_transcoder_create_encoding_profile (const gchar * profile_string)
+{
+  gint64 now;
+  GstEncodingProfile *profile;
+
+  g_return_val_if_fail (profile_string, NULL);
+
+  g_once (&init_once, gst_transcoder_init_once, NULL);
+
+  g_mutex_lock (&profile_cache.lock);
+  if (!profile_cache.profiles)
+    profile_cache.profiles = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, gst_object_unref);
+
+  now = g_get_monotonic_time ();
+  if (!profile_cache.last_check
+      || now - profile_cache.last_check >= PROFILE_CACHE_CHECK_INTERVAL) {
+    guint64 stamp = get_targets_stamp ();
+
+    if (stamp != profile_cache.targets_stamp) {
+      GST_DEBUG ("Encoding targets changed, flushing the profile cache");
+      g_hash_table_remove_all (profile_cache.profiles);
+      profile_cache.targets_stamp = stamp;
+    }
+    profile_cache.last_check = now;
+  }
+
+  profile = g_hash_table_lookup (profile_cache.profiles, profile_string);
+  if (!profile) {
+    profile = create_encoding_profile (profile_string);
+    if (profile)
+      g_hash_table_insert (profile_cache.profiles, g_strdup (profile_string),
+          profile);
+  }
+
+  /* Users are free to modify the profile they get */
+  if (profile)
+    profile = gst_encoding_profile_copy (profile);
+  g_mutex_unlock (&profile_cache.lock);
+
+  return profile;
+}
+
 /**
  * gst_transcoder_new:
  * @source_uri: The URI of the media stream to transcode
@@ -1031,7 +2004,7 @@ gst_transcoder_new (const gchar * source_uri,
 {
   GstEncodingProfile *profile;
 
-  profile = create_encoding_profile (encoding_profile);
+  profile = gst_transcoder_create_encoding_profile (encoding_profile);
 
   return gst_transcoder_new_full (source_uri, dest_uri, profile, NULL);
 }
@@ -1053,9 +2026,7 @@ gst_transcoder_new_full (const gchar * source_uri,
     const gchar * dest_uri, GstEncodingProfile * profile,
     GstTranscoderSignalDispatcher * signal_dispatcher)
 {
-  static GOnce once = G_ONCE_INIT;
-
-  g_once (&once, gst_transcoder_init_once, NULL);
+  g_once (&init_once, gst_transcoder_init_once, NULL);
 
   g_return_val_if_fail (source_uri, NULL);
   g_return_val_if_fail (dest_uri, NULL);
@@ -1132,28 +2103,160 @@ gst_transcoder_run (GstTranscoder * self, GError ** error)
   return TRUE;
 }
 
-/**
- * gst_transcoder_run_async:
- * @self: The GstTranscoder to run
- *
- * Run the transcoder task asynchonously. You should connect
- * to the 'done' signal to be notified about when the
- * transcoding is done, and to the 'error' signal to be
- * notified about any error.
- */
-void
-gst_transcoder_run_async (GstTranscoder * self)
+/* Identifies the source, and its version for local files, in cache keys */
+static void
+checksum_source (GstTranscoder * self, GChecksum * checksum)
 {
-  GstStateChangeReturn state_ret;
+  GStatBuf statbuf;
+  gchar *filename;
 
-  GST_DEBUG_OBJECT (self, "Play");
+  g_checksum_update (checksum, (const guchar *) self->source_uri, -1);
 
-  if (!self->profile) {
-    emit_error (self, g_error_new (GST_TRANSCODER_ERROR,
-            GST_TRANSCODER_ERROR_FAILED, "No \"profile\" provided"), NULL);
+  filename = gst_uri_get_location (self->source_uri);
+  if (filename && gst_uri_has_protocol (self->source_uri, "file")
+      && g_stat (filename, &statbuf) == 0) {
+    gchar *tmp = g_strdup_printf ("%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT,
+        (gint64) statbuf.st_size, (gint64) statbuf.st_mtime);
+
+    g_checksum_update (checksum, (const guchar *) tmp, -1);
+    g_free (tmp);
+  }
+  g_free (filename);
+}
+
+static void
+checksum_caps (GChecksum * checksum, GstCaps * caps)
+{
+  gchar *tmp = caps ? gst_caps_to_string (caps) : NULL;
+
+  g_checksum_update (checksum, (const guchar *) GST_STR_NULL (tmp), -1);
+  g_free (tmp);
+  if (caps)
+    gst_caps_unref (caps);
+}
+
+/* Identifies how a stream gets encoded in cache keys */
+static void
+checksum_profile (GChecksum * checksum, GstEncodingProfile * profile)
+{
+  gchar *tmp;
+
+  checksum_caps (checksum, gst_encoding_profile_get_format (profile));
+  checksum_caps (checksum, gst_encoding_profile_get_restriction (profile));
+
+  tmp = g_strdup_printf ("%s:%s",
+      GST_STR_NULL (gst_encoding_profile_get_preset (profile)),
+      GST_STR_NULL (gst_encoding_profile_get_preset_name (profile)));
+  g_checksum_update (checksum, (const guchar *) tmp, -1);
+  g_free (tmp);
+}
+
+static void
+segment_free (GstTranscoderSegment * segment)
+{
+  if (segment->bus_source) {
+    g_source_destroy (segment->bus_source);
+    g_source_unref (segment->bus_source);
+  }
+
+  if (segment->pipeline) {
+    gst_element_set_state (segment->pipeline, GST_STATE_NULL);
+    gst_object_unref (segment->pipeline);
+  }
+
+  g_free (segment->location);
+  g_free (segment->part_location);
+  g_free (segment);
+}
+
+static void
+segments_remove_files (const gchar * dirname)
+{
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (dirname, 0, NULL);
+  if (!dir)
+    return;
+
+  while ((name = g_dir_read_name (dir))) {
+    gchar *path;
+
+    if (!g_str_has_prefix (name, "segment-") && g_strcmp0 (name,
+            CHECKPOINT_FILE))
+      continue;
+
+    path = g_build_filename (dirname, name, NULL);
+    g_unlink (path);
+    g_free (path);
+  }
+  g_dir_close (dir);
+}
 
+/* The segments of a checkpointed job are only removed once it is done */
+static void
+segments_cleanup_full (GstTranscoder * self, gboolean done)
+{
+  if (!self->segments)
     return;
+
+  g_ptr_array_unref (self->segments);
+  self->segments = NULL;
+  self->n_segments_done = 0;
+  self->n_segments_running = 0;
+  self->next_segment = 0;
+  g_clear_object (&self->segment_profile);
+
+  if (self->concat_overridden) {
+    g_object_set (self->transcodebin, "profile", self->profile,
+        "avoid-reencoding", self->concat_saved_avoid_reencoding, NULL);
+    self->concat_overridden = FALSE;
+    self->concat_source_pending = TRUE;
+  }
+
+  if (!self->segments_checkpointed) {
+    segments_remove_files (self->segments_dir);
+    g_rmdir (self->segments_dir);
+  } else if (done) {
+    segments_remove_files (self->segments_dir);
+  } else {
+    GST_INFO_OBJECT (self, "Keeping the transcoded segments in %s",
+        self->segments_dir);
   }
+  self->segments_checkpointed = FALSE;
+  g_clear_pointer (&self->segments_dir, g_free);
+}
+
+static void
+segments_cleanup (GstTranscoder * self)
+{
+  segments_cleanup_full (self, FALSE);
+}
+
+static void
+segments_restore_source (GstTranscoder * self)
+{
+  GstState state;
+
+  if (!self->concat_source_pending)
+    return;
+
+  GST_OBJECT_LOCK (self->transcodebin);
+  state = GST_STATE (self->transcodebin);
+  GST_OBJECT_UNLOCK (self->transcodebin);
+  if (state > GST_STATE_READY)
+    return;
+
+  g_object_set (self->transcodebin, "source", self->concat_saved_source,
+      NULL);
+  gst_clear_object (&self->concat_saved_source);
+  self->concat_source_pending = FALSE;
+}
+
+static gboolean
+start_transcoding (GstTranscoder * self)
+{
+  GstStateChangeReturn state_ret;
 
   self->target_state = GST_STATE_PLAYING;
   state_ret = gst_element_set_state (self->transcodebin, GST_STATE_PLAYING);
@@ -1161,201 +2264,1948 @@ gst_transcoder_run_async (GstTranscoder * self)
   if (state_ret == GST_STATE_CHANGE_FAILURE) {
     emit_error (self, g_error_new (GST_TRANSCODER_ERROR,
             GST_TRANSCODER_ERROR_FAILED, "Could not start transcoding"), NULL);
-    return;
+    return FALSE;
   } else if (state_ret == GST_STATE_CHANGE_NO_PREROLL) {
     self->is_live = TRUE;
     GST_DEBUG_OBJECT (self, "Pipeline is live");
+    if (!gst_transcoder_get_live (self))
+      GST_WARNING_OBJECT (self, "Live source transcoded without the \"live\""
+          " mode, the latency is unbounded");
+  }
+
+  return TRUE;
+}
+
+static void
+segments_source_pad_added_cb (GstElement * splitmuxsrc, GstPad * pad,
+    GstElement * mux)
+{
+  GstPad *muxpad = gst_element_get_compatible_pad (mux, pad, NULL);
+
+  if (!muxpad || gst_pad_link (pad, muxpad) != GST_PAD_LINK_OK)
+    GST_ELEMENT_ERROR (splitmuxsrc, CORE, NEGOTIATION, (NULL),
+        ("Could not remux %" GST_PTR_FORMAT, pad));
+
+  if (muxpad)
+    gst_object_unref (muxpad);
+}
+
+/* Concatenates the segments back into a single matroska stream */
+static GstElement *
+make_segments_source (GstTranscoder * self)
+{
+  GstPad *pad;
+  gchar *location;
+  GstElement *bin, *splitmuxsrc, *mux;
+
+  splitmuxsrc = gst_element_factory_make ("splitmuxsrc", NULL);
+  mux = gst_element_factory_make ("matroskamux", NULL);
+  if (!splitmuxsrc || !mux) {
+    if (splitmuxsrc)
+      gst_object_unref (splitmuxsrc);
+    if (mux)
+      gst_object_unref (mux);
+
+    return NULL;
+  }
+
+  bin = gst_bin_new ("segments-source");
+  gst_bin_add_many (GST_BIN (bin), splitmuxsrc, mux, NULL);
+
+  location = g_build_filename (self->segments_dir, "segment-*.mkv", NULL);
+  g_object_set (splitmuxsrc, "location", location, NULL);
+  g_free (location);
+  g_signal_connect (splitmuxsrc, "pad-added",
+      G_CALLBACK (segments_source_pad_added_cb), mux);
+
+  pad = gst_element_get_static_pad (mux, "src");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("src", pad));
+  gst_object_unref (pad);
+
+  return bin;
+}
+
+/* Once all segments are done, the regular pipeline remuxes them into the
+ * final container, only encoding the audio streams */
+static void
+segments_concat (GstTranscoder * self)
+{
+  const GList *tmp;
+  GstElement *source;
+  GstEncodingProfile *profile;
+
+  GST_INFO_OBJECT (self, "All %d segments transcoded, concatenating them",
+      self->segments->len);
+
+  source = make_segments_source (self);
+  if (!source) {
+    emit_error (self, g_error_new (GST_TRANSCODER_ERROR,
+            GST_TRANSCODER_ERROR_FAILED, "Missing splitmuxsrc or matroskamux "
+            "to concatenate the segments, check your installation"), NULL);
+    return;
+  }
+
+  /* Without restrictions the video streams get passed through */
+  profile = gst_encoding_profile_copy (self->profile);
+  for (tmp =
+      gst_encoding_container_profile_get_profiles
+      (GST_ENCODING_CONTAINER_PROFILE (profile)); tmp; tmp = tmp->next) {
+    if (GST_IS_ENCODING_VIDEO_PROFILE (tmp->data))
+      gst_encoding_profile_set_restriction (tmp->data, NULL);
+  }
+
+  /* The segments only hold the range to transcode, the settings of the job
+   * are put back once done */
+  g_object_get (self->transcodebin, "source", &self->concat_saved_source,
+      "avoid-reencoding", &self->concat_saved_avoid_reencoding, NULL);
+  self->concat_overridden = TRUE;
+  g_object_set (self->transcodebin, "source", source, "profile", profile,
+      "avoid-reencoding", TRUE, "start-time", (guint64) 0, "stop-time",
+      GST_CLOCK_TIME_NONE, NULL);
+  gst_object_unref (profile);
+
+  start_transcoding (self);
+}
+
+static void segments_start_pending (GstTranscoder * self);
+
+static void
+segment_done (GstTranscoderSegment * segment)
+{
+  GstTranscoder *self = segment->transcoder;
+
+  GST_DEBUG_OBJECT (self, "Segment %" GST_TIME_FORMAT " -- %" GST_TIME_FORMAT
+      " done", GST_TIME_ARGS (segment->start), GST_TIME_ARGS (segment->stop));
+
+  gst_element_set_state (segment->pipeline, GST_STATE_NULL);
+  if (g_rename (segment->part_location, segment->location) < 0) {
+    emit_error (self, g_error_new (GST_TRANSCODER_ERROR,
+            GST_TRANSCODER_ERROR_FAILED, "Could not rename %s: %s",
+            segment->part_location, g_strerror (errno)), NULL);
+    return;
   }
 
-  return;
+  segment->done = TRUE;
+  self->n_segments_done++;
+  self->n_segments_running--;
+  if (self->n_segments_done == self->segments->len)
+    segments_concat (self);
+  else
+    segments_start_pending (self);
 }
 
 static gboolean
-gst_transcoder_set_position_update_interval_internal (gpointer user_data)
+segment_bus_cb (GstBus * bus, GstMessage * msg, GstTranscoderSegment * segment)
 {
-  GstTranscoder *self = user_data;
+  GstTranscoder *self = segment->transcoder;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_ERROR:
+      /* Tears all the segments down, including this one */
+      error_cb (bus, msg, self);
+      return G_SOURCE_REMOVE;
+    case GST_MESSAGE_WARNING:
+      warning_cb (bus, msg, self);
+      break;
+    case GST_MESSAGE_EOS:
+      segment_done (segment);
+      break;
+    default:
+      break;
+  }
 
-  GST_OBJECT_LOCK (self);
+  return G_SOURCE_CONTINUE;
+}
 
-  if (self->tick_source) {
-    remove_tick_source (self);
-    add_tick_source (self);
+/* The audio streams are only encoded once the segments are concatenated,
+ * FLAC keeps them lossless while taking a fraction of the disk space raw
+ * audio needs for long sources */
+static GstCaps *
+get_segment_audio_format (void)
+{
+  GstElementFactory *flacenc = gst_element_factory_find ("flacenc");
+
+  if (flacenc) {
+    gst_object_unref (flacenc);
+
+    return gst_caps_from_string ("audio/x-flac");
   }
 
-  GST_OBJECT_UNLOCK (self);
+  return gst_caps_from_string ("audio/x-raw, format=(string)F32LE, "
+      "layout=(string)interleaved");
+}
 
-  return G_SOURCE_REMOVE;
+/* Segments are muxed in matroska with the video encoded in its final format,
+ * audio is kept lossless so that it gets encoded in one go, without gaps at
+ * the segment boundaries, when the segments are concatenated. */
+static GstEncodingProfile *
+make_segment_profile (GstTranscoder * self)
+{
+  const GList *tmp;
+  GstCaps *format;
+  GstEncodingContainerProfile *profile;
+
+  format = gst_caps_from_string ("video/x-matroska");
+  profile = gst_encoding_container_profile_new ("segment", NULL, format, NULL);
+  gst_caps_unref (format);
+
+  for (tmp =
+      gst_encoding_container_profile_get_profiles
+      (GST_ENCODING_CONTAINER_PROFILE (self->profile)); tmp; tmp = tmp->next) {
+    GstEncodingProfile *sprofile = tmp->data;
+
+    if (GST_IS_ENCODING_VIDEO_PROFILE (sprofile)) {
+      gst_encoding_container_profile_add_profile (profile,
+          gst_encoding_profile_copy (sprofile));
+    } else {
+      format = get_segment_audio_format ();
+      gst_encoding_container_profile_add_profile (profile,
+          (GstEncodingProfile *) gst_encoding_audio_profile_new (format, NULL,
+              NULL, gst_encoding_profile_get_presence (sprofile)));
+      gst_caps_unref (format);
+    }
+  }
+
+  return GST_ENCODING_PROFILE (profile);
+}
+
+/* Call from the transcoder thread */
+static gboolean
+segments_can_be_used (GstTranscoder * self, guint * n_segments,
+    GstClockTime start_time, GstClockTime stop_time)
+{
+  const GList *tmp;
+  GList *videos;
+  GstDiscoverer *discoverer;
+  GstDiscovererInfo *info = NULL;
+  gboolean has_video_profile = FALSE, res = FALSE;
+
+  if (!GST_IS_ENCODING_CONTAINER_PROFILE (self->profile))
+    return FALSE;
+
+  /* Segments are concatenated into the main output only */
+  if (self->n_renditions)
+    return FALSE;
+
+  for (tmp =
+      gst_encoding_container_profile_get_profiles
+      (GST_ENCODING_CONTAINER_PROFILE (self->profile)); tmp; tmp = tmp->next) {
+    if (GST_IS_ENCODING_VIDEO_PROFILE (tmp->data))
+      has_video_profile = TRUE;
+    else if (!GST_IS_ENCODING_AUDIO_PROFILE (tmp->data))
+      return FALSE;
+  }
+
+  if (!has_video_profile)
+    return FALSE;
+
+  discoverer = gst_discoverer_new (DISCOVERER_TIMEOUT, NULL);
+  if (discoverer)
+    info = gst_discoverer_discover_uri (discoverer, self->source_uri, NULL);
+
+  if (!info || !gst_discoverer_info_get_seekable (info))
+    goto done;
+
+  videos = gst_discoverer_info_get_video_streams (info);
+  if (!videos)
+    goto done;
+  gst_discoverer_stream_info_list_free (videos);
+
+  self->last_duration = gst_discoverer_info_get_duration (info);
+  if (!GST_CLOCK_TIME_IS_VALID (self->last_duration))
+    goto done;
+
+  /* Only the range to transcode gets split */
+  if (GST_CLOCK_TIME_IS_VALID (stop_time))
+    self->last_duration = MIN (self->last_duration, stop_time);
+  if (self->last_duration <= start_time)
+    goto done;
+  self->last_duration -= start_time;
+
+  *n_segments = MIN (*n_segments, self->last_duration / MIN_SEGMENT_DURATION);
+  /* A single segment is still worth it to checkpoint the job */
+  if (self->segments_checkpointed)
+    *n_segments = MAX (*n_segments, 1);
+  res = *n_segments > 1 || self->segments_checkpointed;
+
+done:
+  if (info)
+    g_object_unref (info);
+  if (discoverer)
+    g_object_unref (discoverer);
+
+  return res;
+}
+
+/* Call from the transcoder thread */
+static gboolean
+segment_start (GstTranscoder * self, GstTranscoderSegment * segment)
+{
+  GstBus *bus;
+  gchar *dest_uri;
+  gint seek_mode = GST_TRANSCODER_SEEK_MODE_ACCURATE;
+  guint64 stop_time = segment->stop, max_memory;
+  GstElement *pipeline = gst_element_factory_make ("uritranscodebin", NULL);
+
+  if (!pipeline) {
+    emit_error (self, g_error_new (GST_TRANSCODER_ERROR,
+            GST_TRANSCODER_ERROR_FAILED, "No uritranscodebin element, check "
+            "your installation"), NULL);
+    return FALSE;
+  }
+
+  segment->pipeline = gst_object_ref_sink (pipeline);
+
+  /* The last segment goes up to the real end of the range, only the first
+   * one can snap to a keyframe so that the others neither overlap nor leave
+   * holes */
+  if (segment->last)
+    g_object_get (self->transcodebin, "stop-time", &stop_time, NULL);
+  if (segment == g_ptr_array_index (self->segments, 0))
+    g_object_get (self->transcodebin, "seek-mode", &seek_mode, NULL);
+  /* The running segments share the memory of the job */
+  g_object_get (self->transcodebin, "max-memory", &max_memory, NULL);
+  max_memory /= self->max_running_segments;
+
+  dest_uri = gst_filename_to_uri (segment->part_location, NULL);
+  g_object_set (segment->pipeline, "hardware-policy",
+      gst_transcoder_get_hardware_policy (self), "seek-mode", seek_mode,
+      "max-memory", max_memory, NULL);
+  g_object_set (segment->pipeline, "source-uri", self->source_uri,
+      "dest-uri", dest_uri, "profile", self->segment_profile, "cpu-usage",
+      self->segment_cpu_usage, "start-time", segment->start, "stop-time",
+      stop_time, NULL);
+  g_free (dest_uri);
+
+  bus = gst_element_get_bus (segment->pipeline);
+  segment->bus_source = gst_bus_create_watch (bus);
+  g_source_set_callback (segment->bus_source, (GSourceFunc) segment_bus_cb,
+      segment, NULL);
+  g_source_attach (segment->bus_source, self->context);
+  gst_object_unref (bus);
+
+  if (gst_element_set_state (segment->pipeline,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    emit_error (self, g_error_new (GST_TRANSCODER_ERROR,
+            GST_TRANSCODER_ERROR_FAILED, "Could not start transcoding "
+            "segment %s", segment->location), NULL);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+segments_start_pending (GstTranscoder * self)
+{
+  while (self->segments && self->next_segment < self->segments->len
+      && self->n_segments_running < self->max_running_segments) {
+    GstTranscoderSegment *segment = g_ptr_array_index (self->segments,
+        self->next_segment++);
+
+    if (segment->done)
+      continue;
+
+    if (!segment_start (self, segment))
+      return;
+
+    self->n_segments_running++;
+  }
+}
+
+/* Checkpoints are only valid for the same source, video settings and
+ * split */
+static gchar *
+segments_get_checkpoint_key (GstTranscoder * self, guint n_segments)
+{
+  gchar *tmp, *key;
+  const GList *profiles;
+  guint64 start_time, stop_time;
+  gint seek_mode;
+  GChecksum *checksum = g_checksum_new (G_CHECKSUM_SHA1);
+
+  checksum_source (self, checksum);
+  for (profiles =
+      gst_encoding_container_profile_get_profiles
+      (GST_ENCODING_CONTAINER_PROFILE (self->profile)); profiles;
+      profiles = profiles->next) {
+    if (GST_IS_ENCODING_VIDEO_PROFILE (profiles->data))
+      checksum_profile (checksum, profiles->data);
+  }
+
+  /* Segments with another audio format can not be concatenated */
+  checksum_caps (checksum, get_segment_audio_format ());
+
+  g_object_get (self->transcodebin, "start-time", &start_time, "stop-time",
+      &stop_time, "seek-mode", &seek_mode, NULL);
+  tmp = g_strdup_printf ("%u:%" G_GUINT64_FORMAT ":%d:%" G_GUINT64_FORMAT ":%"
+      G_GUINT64_FORMAT ":%d", n_segments, self->last_duration,
+      gst_transcoder_get_hardware_policy (self), start_time, stop_time,
+      seek_mode);
+  g_checksum_update (checksum, (const guchar *) tmp, -1);
+  g_free (tmp);
+
+  key = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  return key;
+}
+
+/* Returns the directory to transcode the segments in, reusing the segments
+ * of a previous run of the same job when checkpointing */
+static gchar *
+segments_prepare_dir (GstTranscoder * self, guint n_segments, GError ** err)
+{
+  gchar *dir, *key, *old_key = NULL, *checkpoint_file;
+  GKeyFile *keyfile;
+
+  GST_OBJECT_LOCK (self);
+  dir = g_strdup (self->checkpoint_dir);
+  GST_OBJECT_UNLOCK (self);
+
+  if (!dir)
+    return g_dir_make_tmp ("gst-transcoder-XXXXXX", err);
+
+  if (g_mkdir_with_parents (dir, 0755) < 0) {
+    g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "Could not create checkpoint directory %s: %s", dir,
+        g_strerror (errno));
+    g_free (dir);
+
+    return NULL;
+  }
+
+  key = segments_get_checkpoint_key (self, n_segments);
+  checkpoint_file = g_build_filename (dir, CHECKPOINT_FILE, NULL);
+  keyfile = g_key_file_new ();
+  if (g_key_file_load_from_file (keyfile, checkpoint_file, G_KEY_FILE_NONE,
+          NULL))
+    old_key = g_key_file_get_string (keyfile, "checkpoint", "key", NULL);
+
+  if (g_strcmp0 (key, old_key)) {
+    GST_INFO_OBJECT (self, "Starting new checkpoint in %s", dir);
+    segments_remove_files (dir);
+
+    g_key_file_set_string (keyfile, "checkpoint", "key", key);
+    g_key_file_set_string (keyfile, "checkpoint", "source-uri",
+        self->source_uri);
+    g_key_file_set_uint64 (keyfile, "checkpoint", "duration",
+        self->last_duration);
+    g_key_file_set_integer (keyfile, "checkpoint", "n-segments", n_segments);
+    if (!g_key_file_save_to_file (keyfile, checkpoint_file, err))
+      g_clear_pointer (&dir, g_free);
+  } else {
+    GST_INFO_OBJECT (self, "Resuming checkpoint from %s", dir);
+  }
+
+  g_key_file_free (keyfile);
+  g_free (checkpoint_file);
+  g_free (old_key);
+  g_free (key);
+
+  return dir;
+}
+
+static gboolean
+segments_start (GstTranscoder * self)
+{
+  guint i, n_segments, max_running, cpu_usage;
+  guint64 start_time, stop_time;
+  GError *err = NULL;
+
+  GST_OBJECT_LOCK (self);
+  n_segments = self->n_segments ? self->n_segments : g_get_num_processors ();
+  cpu_usage = self->wanted_cpu_usage;
+  self->segments_checkpointed = self->checkpoint_dir != NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  g_object_get (self->transcodebin, "start-time", &start_time, "stop-time",
+      &stop_time, NULL);
+  if (!segments_can_be_used (self, &n_segments, start_time, stop_time)) {
+    GST_INFO_OBJECT (self, "Can not transcode %s in segments",
+        self->source_uri);
+    self->segments_checkpointed = FALSE;
+    start_transcoding (self);
+
+    return G_SOURCE_REMOVE;
+  }
+
+  /* Checkpoints are taken at least every CHECKPOINT_SEGMENT_DURATION while
+   * the same number of segments are transcoded in parallel */
+  max_running = n_segments;
+  if (self->segments_checkpointed)
+    n_segments = MAX (n_segments, (self->last_duration +
+            CHECKPOINT_SEGMENT_DURATION - 1) / CHECKPOINT_SEGMENT_DURATION);
+
+  self->segments_dir = segments_prepare_dir (self, n_segments, &err);
+  if (!self->segments_dir) {
+    self->segments_checkpointed = FALSE;
+    emit_error (self, err, NULL);
+
+    return G_SOURCE_REMOVE;
+  }
+
+  GST_INFO_OBJECT (self, "Transcoding %s in %d segments in %s",
+      self->source_uri, n_segments, self->segments_dir);
+
+  /* Share the CPU usage between the running segments */
+  if (cpu_usage > 0 && cpu_usage < 100)
+    cpu_usage = MAX (cpu_usage / max_running, 1);
+
+  self->segment_profile = make_segment_profile (self);
+  self->segment_cpu_usage = cpu_usage;
+  self->max_running_segments = max_running;
+  self->n_segments_running = 0;
+  self->next_segment = 0;
+  self->target_state = GST_STATE_PLAYING;
+  emit_duration_changed (self, self->last_duration);
+  self->segments = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      segment_free);
+  for (i = 0; i < n_segments; i++) {
+    gchar *name;
+    GstTranscoderSegment *segment = g_new0 (GstTranscoderSegment, 1);
+
+    segment->transcoder = self;
+    g_ptr_array_add (self->segments, segment);
+
+    segment->start = start_time + gst_util_uint64_scale (self->last_duration,
+        i, n_segments);
+    segment->stop = start_time + gst_util_uint64_scale (self->last_duration,
+        i + 1, n_segments);
+    segment->last = i == n_segments - 1;
+
+    name = g_strdup_printf ("segment-%05d.mkv", i);
+    segment->location = g_build_filename (self->segments_dir, name, NULL);
+    segment->part_location = g_strdup_printf ("%s.part", segment->location);
+    g_free (name);
+
+    /* Only fully written segments get renamed */
+    if (self->segments_checkpointed
+        && g_file_test (segment->location, G_FILE_TEST_EXISTS)) {
+      segment->done = TRUE;
+      self->n_segments_done++;
+    }
+  }
+
+  add_tick_source (self);
+  if (self->n_segments_done == self->segments->len)
+    segments_concat (self);
+  else
+    segments_start_pending (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Returns the first video stream profile asking for multipass encoding */
+static GstEncodingProfile *
+get_multipass_profile (GstTranscoder * self)
+{
+  const GList *tmp;
+
+  if (GST_IS_ENCODING_VIDEO_PROFILE (self->profile))
+    return gst_encoding_video_profile_get_pass (GST_ENCODING_VIDEO_PROFILE
+        (self->profile)) ? self->profile : NULL;
+
+  if (!GST_IS_ENCODING_CONTAINER_PROFILE (self->profile))
+    return NULL;
+
+  for (tmp =
+      gst_encoding_container_profile_get_profiles
+      (GST_ENCODING_CONTAINER_PROFILE (self->profile)); tmp; tmp = tmp->next) {
+    if (GST_IS_ENCODING_VIDEO_PROFILE (tmp->data)
+        && gst_encoding_video_profile_get_pass (tmp->data))
+      return tmp->data;
+  }
+
+  return NULL;
+}
+
+/* The first pass statistics only depend on the source and on how the video
+ * gets encoded, so that they are reused when only the container or the
+ * audio streams change */
+static gchar *
+get_multipass_cache_file (GstTranscoder * self, GstEncodingProfile * profile)
+{
+  GChecksum *checksum;
+  gchar *tmp, *dir, *ret = NULL;
+  guint64 start_time, stop_time;
+  gint seek_mode;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  checksum_source (self, checksum);
+  checksum_profile (checksum, profile);
+
+  g_object_get (self->transcodebin, "start-time", &start_time, "stop-time",
+      &stop_time, "seek-mode", &seek_mode, NULL);
+  tmp = g_strdup_printf ("%d:%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ":%d",
+      gst_transcoder_get_hardware_policy (self), start_time, stop_time,
+      seek_mode);
+  g_checksum_update (checksum, (const guchar *) tmp, -1);
+  g_free (tmp);
+
+  dir = g_build_filename (g_get_user_cache_dir (), "gst-transcoder",
+      "multipass", NULL);
+  if (g_mkdir_with_parents (dir, 0755) == 0)
+    ret = g_build_filename (dir, g_checksum_get_string (checksum), NULL);
+  else
+    GST_WARNING_OBJECT (self, "Could not create %s: %s", dir,
+        g_strerror (errno));
+
+  g_free (dir);
+  g_checksum_free (checksum);
+
+  return ret;
+}
+
+static void
+multipass_cleanup (GstTranscoder * self)
+{
+  if (self->analysis_bus_source) {
+    g_source_destroy (self->analysis_bus_source);
+    g_clear_pointer (&self->analysis_bus_source, g_source_unref);
+  }
+
+  if (self->analysis_pipeline) {
+    gst_element_set_state (self->analysis_pipeline, GST_STATE_NULL);
+    gst_clear_object (&self->analysis_pipeline);
+  }
+
+  g_clear_pointer (&self->multipass_cache_file, g_free);
+}
+
+static void
+multipass_analysis_done (GstTranscoder * self)
+{
+  gchar *done_file;
+  GError *err = NULL;
+
+  GST_INFO_OBJECT (self, "First pass done, stats in %s",
+      self->multipass_cache_file);
+
+  /* The encoders write their stats when stopping, only flag them as
+   * usable once the pipeline is down */
+  gst_element_set_state (self->analysis_pipeline, GST_STATE_NULL);
+  done_file = g_strdup_printf ("%s.done", self->multipass_cache_file);
+  if (!g_file_set_contents (done_file, "", 0, &err)) {
+    GST_WARNING_OBJECT (self, "Could not flag the first pass stats as"
+        " complete: %s", err->message);
+    g_clear_error (&err);
+  }
+  g_free (done_file);
+
+  g_source_destroy (self->analysis_bus_source);
+  g_clear_pointer (&self->analysis_bus_source, g_source_unref);
+  gst_clear_object (&self->analysis_pipeline);
+
+  start_transcoding (self);
+}
+
+static gboolean
+analysis_bus_cb (GstBus * bus, GstMessage * msg, GstTranscoder * self)
+{
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_ERROR:
+      error_cb (bus, msg, self);
+      return G_SOURCE_REMOVE;
+    case GST_MESSAGE_EOS:
+      multipass_analysis_done (self);
+      return G_SOURCE_REMOVE;
+    default:
+      /* Warnings are expected, the streams that are not analysed can not
+       * be encoded */
+      break;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Runs the analysis pass, the video stream only with its encoder in first
+ * pass mode and no muxing, unless its stats are already cached, then the
+ * final pass through the regular pipeline */
+static gboolean
+multipass_start (GstTranscoder * self)
+{
+  GstBus *bus;
+  gchar *done_file;
+  gboolean cached;
+  GstEncodingProfile *video_profile, *profile;
+  GstElement *sink;
+  guint64 start_time, stop_time, max_memory;
+  gint seek_mode;
+
+  video_profile = get_multipass_profile (self);
+  self->multipass_cache_file = get_multipass_cache_file (self, video_profile);
+  if (!self->multipass_cache_file) {
+    start_transcoding (self);
+
+    return G_SOURCE_REMOVE;
+  }
+
+  g_object_set (self->transcodebin, "pass", 2, "multipass-cache-file",
+      self->multipass_cache_file, NULL);
+
+  done_file = g_strdup_printf ("%s.done", self->multipass_cache_file);
+  cached = g_file_test (done_file, G_FILE_TEST_EXISTS);
+  g_free (done_file);
+
+  if (cached) {
+    GST_INFO_OBJECT (self, "Reusing first pass stats from %s",
+        self->multipass_cache_file);
+    start_transcoding (self);
+
+    return G_SOURCE_REMOVE;
+  }
+
+  self->analysis_pipeline = gst_element_factory_make ("uritranscodebin", NULL);
+  sink = gst_element_factory_make ("fakesink", NULL);
+  if (!self->analysis_pipeline || !sink) {
+    if (sink)
+      gst_object_unref (sink);
+    emit_error (self, g_error_new (GST_TRANSCODER_ERROR,
+            GST_TRANSCODER_ERROR_FAILED, "Missing uritranscodebin or fakesink "
+            "to run the first pass, check your installation"), NULL);
+
+    return G_SOURCE_REMOVE;
+  }
+  gst_object_ref_sink (self->analysis_pipeline);
+
+  /* Same range and memory limit as the final pass */
+  g_object_get (self->transcodebin, "start-time", &start_time, "stop-time",
+      &stop_time, "seek-mode", &seek_mode, "max-memory", &max_memory, NULL);
+
+  GST_INFO_OBJECT (self, "Running the first pass of %s, stats in %s",
+      self->source_uri, self->multipass_cache_file);
+
+  profile = gst_encoding_profile_copy (video_profile);
+  gst_encoding_profile_set_presence (profile, 1);
+  g_object_set (self->analysis_pipeline, "source-uri", self->source_uri,
+      "sink", sink, "profile", profile, "cpu-usage", self->wanted_cpu_usage,
+      "hardware-policy", gst_transcoder_get_hardware_policy (self),
+      "pass", 1, "multipass-cache-file", self->multipass_cache_file, NULL);
+  g_object_set (self->analysis_pipeline, "start-time", start_time,
+      "stop-time", stop_time, "seek-mode", seek_mode, "max-memory", max_memory,
+      NULL);
+  gst_object_unref (profile);
+
+  bus = gst_element_get_bus (self->analysis_pipeline);
+  self->analysis_bus_source = gst_bus_create_watch (bus);
+  g_source_set_callback (self->analysis_bus_source, (GSourceFunc)
+      analysis_bus_cb, self, NULL);
+  g_source_attach (self->analysis_bus_source, self->context);
+  gst_object_unref (bus);
+
+  self->target_state = GST_STATE_PLAYING;
+  add_tick_source (self);
+  if (gst_element_set_state (self->analysis_pipeline,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    emit_error (self, g_error_new (GST_TRANSCODER_ERROR,
+            GST_TRANSCODER_ERROR_FAILED, "Could not start the first pass"),
+        NULL);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Copies @src over @dest through a temporary file renamed in place, so that
+ * @dest is never seen partially written. The data is cloned rather than
+ * copied on the file systems supporting it. */
+static gboolean
+copy_file (const gchar * src, const gchar * dest, GError ** err)
+{
+  gint in, out, saved_errno;
+  gchar *tmp_dest, buf[64 * 1024];
+  gssize n = 0;
+  gboolean cloned = FALSE;
+
+  in = g_open (src, O_RDONLY | O_BINARY, 0);
+  if (in < 0) {
+    g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "Could not open %s: %s", src, g_strerror (errno));
+    return FALSE;
+  }
+
+  tmp_dest = g_strdup_printf ("%s.XXXXXX", dest);
+  out = g_mkstemp (tmp_dest);
+  if (out < 0) {
+    g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "Could not create %s: %s", tmp_dest, g_strerror (errno));
+    close (in);
+    g_free (tmp_dest);
+    return FALSE;
+  }
+
+#ifdef FICLONE
+  cloned = ioctl (out, FICLONE, in) == 0;
+#endif
+  while (!cloned && (n = read (in, buf, sizeof (buf))) > 0) {
+    if (write (out, buf, n) != n) {
+      n = -1;
+      break;
+    }
+  }
+  saved_errno = errno;
+  close (in);
+
+  if (close (out) < 0 && n >= 0) {
+    saved_errno = errno;
+    n = -1;
+  }
+
+  if (n >= 0 && (g_chmod (tmp_dest, 0644) < 0
+          || g_rename (tmp_dest, dest) < 0)) {
+    saved_errno = errno;
+    n = -1;
+  }
+
+  if (n < 0) {
+    g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+        "Could not copy %s to %s: %s", src, dest, g_strerror (saved_errno));
+    g_unlink (tmp_dest);
+  }
+  g_free (tmp_dest);
+
+  return n >= 0;
+}
+
+/* Identifies the content of a local file whatever its name, files bigger
+ * than OUTPUT_CACHE_FULL_HASH_SIZE only get evenly spaced samples hashed */
+static gboolean
+checksum_file_content (GChecksum * checksum, const gchar * filename,
+    GError ** err)
+{
+  guint i;
+  gsize size;
+  gchar *tmp;
+  const guchar *data;
+  GMappedFile *file = g_mapped_file_new (filename, FALSE, err);
+
+  if (!file)
+    return FALSE;
+
+  data = (const guchar *) g_mapped_file_get_contents (file);
+  size = g_mapped_file_get_length (file);
+  tmp = g_strdup_printf ("%" G_GSIZE_FORMAT, size);
+  g_checksum_update (checksum, (const guchar *) tmp, -1);
+  g_free (tmp);
+
+  if (size <= OUTPUT_CACHE_FULL_HASH_SIZE) {
+    if (size)
+      g_checksum_update (checksum, data, size);
+  } else {
+    for (i = 0; i < OUTPUT_CACHE_N_SAMPLES; i++) {
+      gsize offset = (size - OUTPUT_CACHE_SAMPLE_SIZE) /
+          (OUTPUT_CACHE_N_SAMPLES - 1) * i;
+
+      g_checksum_update (checksum, data + offset, OUTPUT_CACHE_SAMPLE_SIZE);
+    }
+  }
+  g_mapped_file_unref (file);
+
+  return TRUE;
+}
+
+/* Identifies everything of the profile and of its children that changes the
+ * encoded output */
+static void
+checksum_profile_tree (GChecksum * checksum, GstEncodingProfile * profile)
+{
+  const GList *tmp;
+  gchar *str;
+  guint pass = 0;
+  gboolean variable_framerate = FALSE;
+
+  if (GST_IS_ENCODING_VIDEO_PROFILE (profile)) {
+    pass = gst_encoding_video_profile_get_pass (GST_ENCODING_VIDEO_PROFILE
+        (profile));
+    variable_framerate =
+        gst_encoding_video_profile_get_variableframerate
+        (GST_ENCODING_VIDEO_PROFILE (profile));
+  }
+
+  checksum_profile (checksum, profile);
+  str = g_strdup_printf ("%s:%d:%u:%u:%d", G_OBJECT_TYPE_NAME (profile),
+      gst_encoding_profile_is_enabled (profile),
+      gst_encoding_profile_get_presence (profile), pass, variable_framerate);
+  g_checksum_update (checksum, (const guchar *) str, -1);
+  g_free (str);
+
+  if (!GST_IS_ENCODING_CONTAINER_PROFILE (profile))
+    return;
+
+  for (tmp =
+      gst_encoding_container_profile_get_profiles
+      (GST_ENCODING_CONTAINER_PROFILE (profile)); tmp; tmp = tmp->next)
+    checksum_profile_tree (checksum, tmp->data);
+}
+
+/* Returns where the output of the job is cached, named after the content of
+ * the source and everything the output depends on, or NULL when the job can
+ * not be cached */
+static gchar *
+output_cache_get_file (GstTranscoder * self)
+{
+  guint n_segments;
+  gint seek_mode, mp4_mode;
+  gboolean avoid_reencoding;
+  guint64 start_time, stop_time, deadline;
+  GstElement *source, *sink, *video_filter, *audio_filter;
+  gchar *dir, *filename = NULL, *video_desc, *audio_desc, *tmp, *ret = NULL;
+  GChecksum *checksum = NULL;
+  GError *err = NULL;
+
+  GST_OBJECT_LOCK (self);
+  dir = g_strdup (self->output_cache_dir);
+  n_segments = self->n_segments;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!dir)
+    return NULL;
+
+  g_object_get (self->transcodebin, "source", &source, "sink", &sink,
+      "video-filter", &video_filter, "audio-filter", &audio_filter,
+      "video-filter-description", &video_desc, "audio-filter-description",
+      &audio_desc, "avoid-reencoding", &avoid_reencoding, "mp4-mode",
+      &mp4_mode, "start-time", &start_time, "stop-time", &stop_time,
+      "seek-mode", &seek_mode, "deadline", &deadline, NULL);
+
+  /* Elements can not be identified, and degraded or live outputs are not
+   * reproducible */
+  if (source || sink || video_filter || audio_filter || self->n_renditions
+      || GST_CLOCK_TIME_IS_VALID (deadline) || gst_transcoder_get_live (self)
+      || !gst_uri_has_protocol (self->source_uri, "file")
+      || !gst_uri_has_protocol (self->dest_uri, "file")) {
+    GST_DEBUG_OBJECT (self, "Output of %s can not be cached",
+        self->source_uri);
+    goto done;
+  }
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  filename = gst_uri_get_location (self->source_uri);
+  if (!filename || !checksum_file_content (checksum, filename, &err)) {
+    GST_WARNING_OBJECT (self, "Could not hash %s: %s", self->source_uri,
+        err ? err->message : "invalid URI");
+    g_clear_error (&err);
+    goto done;
+  }
+
+  checksum_profile_tree (checksum, self->profile);
+  tmp = g_strdup_printf ("%s:%s:%d:%d:%d:%" G_GUINT64_FORMAT ":%"
+      G_GUINT64_FORMAT ":%d:%u", GST_STR_NULL (video_desc),
+      GST_STR_NULL (audio_desc), avoid_reencoding, mp4_mode,
+      gst_transcoder_get_hardware_policy (self), start_time, stop_time,
+      seek_mode, n_segments);
+  g_checksum_update (checksum, (const guchar *) tmp, -1);
+  g_free (tmp);
+
+  if (g_mkdir_with_parents (dir, 0755) == 0)
+    ret = g_build_filename (dir, g_checksum_get_string (checksum), NULL);
+  else
+    GST_WARNING_OBJECT (self, "Could not create %s: %s", dir,
+        g_strerror (errno));
+
+done:
+  gst_clear_object (&source);
+  gst_clear_object (&sink);
+  gst_clear_object (&video_filter);
+  gst_clear_object (&audio_filter);
+  if (checksum)
+    g_checksum_free (checksum);
+  g_free (video_desc);
+  g_free (audio_desc);
+  g_free (filename);
+  g_free (dir);
+
+  return ret;
+}
+
+/* Called on EOS, the output is only complete once the pipeline is done */
+static void
+output_cache_store (GstTranscoder * self)
+{
+  GError *err = NULL;
+  gchar *location = gst_uri_get_location (self->dest_uri);
+
+  if (location && copy_file (location, self->output_cache_file, &err)) {
+    GST_INFO_OBJECT (self, "Cached %s as %s", self->dest_uri,
+        self->output_cache_file);
+  } else {
+    GST_WARNING_OBJECT (self, "Could not cache %s: %s", self->dest_uri,
+        err ? err->message : "invalid URI");
+    g_clear_error (&err);
+  }
+
+  g_free (location);
+  g_clear_pointer (&self->output_cache_file, g_free);
+}
+
+static void run_pipeline (GstTranscoder * self);
+
+/* Call from the transcoder thread */
+static gboolean
+output_cache_lookup (GstTranscoder * self)
+{
+  gchar *location;
+  GError *err = NULL;
+
+  self->output_cache_file = output_cache_get_file (self);
+  if (!self->output_cache_file
+      || !g_file_test (self->output_cache_file, G_FILE_TEST_IS_REGULAR)) {
+    run_pipeline (self);
+
+    return G_SOURCE_REMOVE;
+  }
+
+  location = gst_uri_get_location (self->dest_uri);
+  if (!location || !copy_file (self->output_cache_file, location, &err)) {
+    GST_WARNING_OBJECT (self, "Could not reuse %s, transcoding again: %s",
+        self->output_cache_file, err ? err->message : "invalid URI");
+    g_clear_error (&err);
+    g_free (location);
+    run_pipeline (self);
+
+    return G_SOURCE_REMOVE;
+  }
+
+  GST_INFO_OBJECT (self, "Reused %s for %s", self->output_cache_file,
+      self->dest_uri);
+  g_clear_pointer (&self->output_cache_file, g_free);
+  g_free (location);
+  emit_done (self);
+  self->is_eos = TRUE;
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * gst_transcoder_run_async:
+ * @self: The GstTranscoder to run
+ *
+ * Run the transcoder task asynchonously. You should connect
+ * to the 'done' signal to be notified about when the
+ * transcoding is done, and to the 'error' signal to be
+ * notified about any error.
+ *
+ * When a video stream profile has a non zero
+ * gst_encoding_video_profile_get_pass(), the video is encoded in two passes
+ * as part of the same job: a first pass only decoding and analysing the
+ * video stream, then the final pass. The first pass statistics are cached
+ * in the user cache directory, keyed on the source and on the video stream
+ * profile, so that the first pass is skipped when the same source is
+ * transcoded again with only the container or the audio changed. The
+ * position goes through the stream once per pass.
+ *
+ * When #GstTranscoder:output-cache-dir is set and the same content was
+ * already transcoded the same way, the cached output is copied to the
+ * destination and 'done' is emitted without building any pipeline.
+ */
+void
+gst_transcoder_run_async (GstTranscoder * self)
+{
+  gboolean cached;
+  GstClockTime start_time, stop_time;
+
+  GST_DEBUG_OBJECT (self, "Play");
+
+  self->run_start = g_get_monotonic_time ();
+  self->last_position_update = GST_CLOCK_TIME_NONE;
+  if (!self->profile) {
+    emit_error (self, g_error_new (GST_TRANSCODER_ERROR,
+            GST_TRANSCODER_ERROR_FAILED, "No \"profile\" provided"), NULL);
+
+    return;
+  }
+
+  /* In case the pipeline got stopped after concatenating segments */
+  segments_restore_source (self);
+
+  GST_OBJECT_LOCK (self);
+  cached = self->output_cache_dir != NULL;
+  start_time = self->start_time;
+  stop_time = self->stop_time;
+  GST_OBJECT_UNLOCK (self);
+
+  /* The segments and the first pass get their range from there */
+  g_object_set (self->transcodebin, "pass", 0, "multipass-cache-file", NULL,
+      "start-time", start_time, "stop-time", stop_time, NULL);
+
+  g_clear_pointer (&self->output_cache_file, g_free);
+  if (cached) {
+    g_main_context_invoke_full (self->context, G_PRIORITY_DEFAULT,
+        (GSourceFunc) output_cache_lookup, g_object_ref (self),
+        g_object_unref);
+
+    return;
+  }
+
+  run_pipeline (self);
+}
+
+static void
+run_pipeline (GstTranscoder * self)
+{
+  guint n_segments;
+  gboolean checkpointed;
+
+  GST_OBJECT_LOCK (self);
+  n_segments = self->n_segments;
+  checkpointed = self->checkpoint_dir != NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  /* Live streams can neither be split nor read twice */
+  if (gst_transcoder_get_live (self)) {
+    start_transcoding (self);
+
+    return;
+  }
+
+  if (n_segments != 1 || checkpointed) {
+    g_main_context_invoke_full (self->context, G_PRIORITY_DEFAULT,
+        (GSourceFunc) segments_start, g_object_ref (self), g_object_unref);
+
+    return;
+  }
+
+  /* The renditions share the decoded streams with the main output, they
+   * are encoded in a single pass */
+  if (!self->n_renditions && get_multipass_profile (self)) {
+    g_main_context_invoke_full (self->context, G_PRIORITY_DEFAULT,
+        (GSourceFunc) multipass_start, g_object_ref (self), g_object_unref);
+
+    return;
+  }
+
+  start_transcoding (self);
+}
+
+static gboolean
+gst_transcoder_set_position_update_interval_internal (gpointer user_data)
+{
+  GstTranscoder *self = user_data;
+
+  GST_OBJECT_LOCK (self);
+
+  if (self->tick_source) {
+    remove_tick_source (self);
+    add_tick_source (self);
+  }
+
+  GST_OBJECT_UNLOCK (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * gst_transcoder_set_position_update_interval:
+ * @self: #GstTranscoder instance
+ * @interval: interval in ms
+ *
+ * Set interval in milliseconds between two position-updated signals.
+ * Pass 0 to stop updating the position.
+ */
+void
+gst_transcoder_set_position_update_interval (GstTranscoder * self,
+    guint interval)
+{
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+  g_return_if_fail (interval <= 10000);
+
+  GST_OBJECT_LOCK (self);
+  self->position_update_interval_ms = interval;
+  GST_OBJECT_UNLOCK (self);
+
+  gst_transcoder_set_position_update_interval_internal (self);
+}
+
+/**
+ * gst_transcoder_get_position_update_interval:
+ * @self: #GstTranscoder instance
+ *
+ * Returns: current position update interval in milliseconds
+ */
+guint
+gst_transcoder_get_position_update_interval (GstTranscoder * self)
+{
+  g_return_val_if_fail (GST_IS_TRANSCODER (self),
+      DEFAULT_POSITION_UPDATE_INTERVAL_MS);
+
+  return self->position_update_interval_ms;
+}
+
+/**
+ * gst_transcoder_set_position_update_delta:
+ * @self: #GstTranscoder instance
+ * @delta: minimum progress between two position updates, 0 to query the
+ *   position on each update
+ *
+ * See #GstTranscoder:position-update-delta.
+ */
+void
+gst_transcoder_set_position_update_delta (GstTranscoder * self,
+    GstClockTime delta)
+{
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+
+  g_object_set (self, "position-update-delta", delta, NULL);
+}
+
+/**
+ * gst_transcoder_get_position_update_delta:
+ * @self: #GstTranscoder instance
+ *
+ * Returns: the minimum progress between two position updates, see
+ * #GstTranscoder:position-update-delta.
+ */
+GstClockTime
+gst_transcoder_get_position_update_delta (GstTranscoder * self)
+{
+  GstClockTime val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self),
+      DEFAULT_POSITION_UPDATE_DELTA);
+
+  g_object_get (self, "position-update-delta", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_get_source_uri:
+ * @self: #GstTranscoder instance
+ *
+ * Gets the URI of the currently-transcoding stream.
+ *
+ * Returns: (transfer full): a string containing the URI of the
+ * source stream. g_free() after usage.
+ */
+gchar *
+gst_transcoder_get_source_uri (GstTranscoder * self)
+{
+  gchar *val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), DEFAULT_URI);
+
+  g_object_get (self, "src-uri", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_get_dest_uri:
+ * @self: #GstTranscoder instance
+ *
+ * Gets the URI of the destination of the transcoded stream.
+ *
+ * Returns: (transfer full): a string containing the URI of the
+ * destination of the transcoded stream. g_free() after usage.
+ */
+gchar *
+gst_transcoder_get_dest_uri (GstTranscoder * self)
+{
+  gchar *val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), DEFAULT_URI);
+
+  g_object_get (self, "dest-uri", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_get_position:
+ * @self: #GstTranscoder instance
+ *
+ * Returns: the absolute position time, in nanoseconds, of the
+ * transcoding stream.
+ */
+GstClockTime
+gst_transcoder_get_position (GstTranscoder * self)
+{
+  GstClockTime val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), DEFAULT_POSITION);
+
+  g_object_get (self, "position", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_get_duration:
+ * @self: #GstTranscoder instance
+ *
+ * Retrieves the duration of the media stream that self represents.
+ *
+ * Returns: the duration of the transcoding media stream, in
+ * nanoseconds.
+ */
+GstClockTime
+gst_transcoder_get_duration (GstTranscoder * self)
+{
+  GstClockTime val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), DEFAULT_DURATION);
+
+  g_object_get (self, "duration", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_get_pipeline:
+ * @self: #GstTranscoder instance
+ *
+ * Returns: (transfer full): The internal uritranscodebin instance
+ */
+GstElement *
+gst_transcoder_get_pipeline (GstTranscoder * self)
+{
+  GstElement *val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), NULL);
+
+  g_object_get (self, "pipeline", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_get_avoid_reencoding:
+ * @self: The #GstTranscoder to check whether reencoding is avoided or not.
+ *
+ * Returns: %TRUE if the transcoder tries to avoid reencoding streams where
+ * reencoding is not strictly needed, %FALSE otherwise.
+ */
+gboolean
+gst_transcoder_get_avoid_reencoding (GstTranscoder * self)
+{
+  gboolean val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), FALSE);
+
+  g_object_get (self->transcodebin, "avoid-reencoding", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_set_avoid_reencoding:
+ * @self: The #GstTranscoder to set whether reencoding should be avoided or not.
+ * @avoid_reencoding: %TRUE if the transcoder should try to avoid reencoding
+ * streams where * reencoding is not strictly needed, %FALSE otherwise.
+ */
+void
+gst_transcoder_set_avoid_reencoding (GstTranscoder * self,
+    gboolean avoid_reencoding)
+{
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+
+  g_object_set (self->transcodebin, "avoid-reencoding", avoid_reencoding, NULL);
+}
+
+/**
+ * gst_transcoder_get_n_segments:
+ * @self: The #GstTranscoder to get the number of segments from.
+ *
+ * Returns: The number of segments the source is split into to be transcoded
+ * in parallel, see #GstTranscoder:n-segments.
+ */
+guint
+gst_transcoder_get_n_segments (GstTranscoder * self)
+{
+  guint val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), DEFAULT_N_SEGMENTS);
+
+  g_object_get (self, "n-segments", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_set_n_segments:
+ * @self: The #GstTranscoder to set the number of segments on.
+ * @n_segments: The number of segments to transcode in parallel, 0 for one
+ * per CPU and 1 to disable segmented transcoding.
+ *
+ * Sets the number of time ranges the source is split into, each of them
+ * being transcoded in parallel before being concatenated. It has to be set
+ * before running the transcoder.
+ */
+void
+gst_transcoder_set_n_segments (GstTranscoder * self, guint n_segments)
+{
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+
+  g_object_set (self, "n-segments", n_segments, NULL);
+}
+
+/**
+ * gst_transcoder_get_checkpoint_dir:
+ * @self: The #GstTranscoder to get the checkpoint directory from.
+ *
+ * Returns: (transfer full) (nullable): The directory the transcoded segments
+ * are kept in to resume interrupted jobs, see #GstTranscoder:checkpoint-dir.
+ */
+gchar *
+gst_transcoder_get_checkpoint_dir (GstTranscoder * self)
+{
+  gchar *val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), NULL);
+
+  g_object_get (self, "checkpoint-dir", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_set_checkpoint_dir:
+ * @self: The #GstTranscoder to set the checkpoint directory on.
+ * @dir: (nullable): The directory to keep the transcoded segments in, %NULL
+ * to not checkpoint the job.
+ *
+ * Makes the job resumable: running the transcoder again with the same
+ * directory after an interruption only transcodes what had not been fully
+ * written yet. It has to be set before running the transcoder.
+ */
+void
+gst_transcoder_set_checkpoint_dir (GstTranscoder * self, const gchar * dir)
+{
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+
+  g_object_set (self, "checkpoint-dir", dir, NULL);
+}
+
+/**
+ * gst_transcoder_get_hardware_policy:
+ * @self: The #GstTranscoder to get the hardware policy from.
+ *
+ * Returns: How hardware video codecs are selected, see
+ * #GstTranscoder:hardware-policy.
+ */
+GstTranscoderHardwarePolicy
+gst_transcoder_get_hardware_policy (GstTranscoder * self)
+{
+  GstTranscoderHardwarePolicy val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self),
+      GST_TRANSCODER_HARDWARE_POLICY_AUTO);
+
+  g_object_get (self, "hardware-policy", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_set_hardware_policy:
+ * @self: The #GstTranscoder to set the hardware policy on.
+ * @policy: The #GstTranscoderHardwarePolicy to use.
+ *
+ * Sets whether hardware video decoders and encoders are preferred, required
+ * or forbidden. It has to be set before running the transcoder.
+ */
+void
+gst_transcoder_set_hardware_policy (GstTranscoder * self,
+    GstTranscoderHardwarePolicy policy)
+{
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+
+  g_object_set (self, "hardware-policy", policy, NULL);
+}
+
+/**
+ * gst_transcoder_get_mp4_mode:
+ * @self: The #GstTranscoder to get the MP4 mode from.
+ *
+ * Returns: How MP4 outputs are laid out, see #GstTranscoder:mp4-mode.
+ */
+GstTranscoderMp4Mode
+gst_transcoder_get_mp4_mode (GstTranscoder * self)
+{
+  GstTranscoderMp4Mode val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self),
+      GST_TRANSCODER_MP4_MODE_NORMAL);
+
+  g_object_get (self, "mp4-mode", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_set_mp4_mode:
+ * @self: The #GstTranscoder to set the MP4 mode on.
+ * @mode: The #GstTranscoderMp4Mode to use.
+ *
+ * Sets whether MP4 outputs get their moov atom reserved at the start of the
+ * file or are fragmented, so that they are playable while being written. It
+ * has to be set before running the transcoder.
+ */
+void
+gst_transcoder_set_mp4_mode (GstTranscoder * self, GstTranscoderMp4Mode mode)
+{
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+
+  g_object_set (self, "mp4-mode", mode, NULL);
+}
+
+/**
+ * gst_transcoder_get_start_time:
+ * @self: The #GstTranscoder to get the start time from.
+ *
+ * Returns: The position in the source where transcoding starts, see
+ * #GstTranscoder:start-time.
+ */
+GstClockTime
+gst_transcoder_get_start_time (GstTranscoder * self)
+{
+  guint64 val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), 0);
+
+  g_object_get (self, "start-time", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_set_start_time:
+ * @self: The #GstTranscoder to set the start time on.
+ * @start_time: The position in the source where to start transcoding.
+ *
+ * Only transcodes the source from @start_time, it has to be set before
+ * running the transcoder.
+ */
+void
+gst_transcoder_set_start_time (GstTranscoder * self, GstClockTime start_time)
+{
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+
+  g_object_set (self, "start-time", start_time, NULL);
+}
+
+/**
+ * gst_transcoder_get_stop_time:
+ * @self: The #GstTranscoder to get the stop time from.
+ *
+ * Returns: The position in the source where transcoding stops, see
+ * #GstTranscoder:stop-time.
+ */
+GstClockTime
+gst_transcoder_get_stop_time (GstTranscoder * self)
+{
+  guint64 val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), GST_CLOCK_TIME_NONE);
+
+  g_object_get (self, "stop-time", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_set_stop_time:
+ * @self: The #GstTranscoder to set the stop time on.
+ * @stop_time: The position in the source where to stop transcoding,
+ * #GST_CLOCK_TIME_NONE to transcode until the end.
+ *
+ * Only transcodes the source up to @stop_time, it has to be set before
+ * running the transcoder.
+ */
+void
+gst_transcoder_set_stop_time (GstTranscoder * self, GstClockTime stop_time)
+{
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+
+  g_object_set (self, "stop-time", stop_time, NULL);
+}
+
+/**
+ * gst_transcoder_get_seek_mode:
+ * @self: The #GstTranscoder to get the seek mode from.
+ *
+ * Returns: How the start of the range to transcode is found, see
+ * #GstTranscoder:seek-mode.
+ */
+GstTranscoderSeekMode
+gst_transcoder_get_seek_mode (GstTranscoder * self)
+{
+  GstTranscoderSeekMode val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self),
+      GST_TRANSCODER_SEEK_MODE_ACCURATE);
+
+  g_object_get (self, "seek-mode", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_set_seek_mode:
+ * @self: The #GstTranscoder to set the seek mode on.
+ * @mode: How to find the start of the range to transcode.
+ *
+ * Sets whether transcoding starts exactly at #GstTranscoder:start-time or on
+ * the keyframe preceding it.
+ */
+void
+gst_transcoder_set_seek_mode (GstTranscoder * self, GstTranscoderSeekMode mode)
+{
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+
+  g_object_set (self, "seek-mode", mode, NULL);
+}
+
+/**
+ * gst_transcoder_get_live:
+ * @self: The #GstTranscoder to check.
+ *
+ * Returns: %TRUE if the source is transcoded in #GstTranscoder:live mode.
+ */
+gboolean
+gst_transcoder_get_live (GstTranscoder * self)
+{
+  gboolean val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), FALSE);
+
+  g_object_get (self, "live", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_set_live:
+ * @self: The #GstTranscoder to set the live mode on.
+ * @live: Whether to transcode the source with a bounded latency.
+ *
+ * Sets whether the source is a live stream to transcode with a bounded
+ * latency, see #GstTranscoder:live. It has to be set before running the
+ * transcoder.
+ */
+void
+gst_transcoder_set_live (GstTranscoder * self, gboolean live)
+{
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+
+  g_object_set (self, "live", live, NULL);
+}
+
+/**
+ * gst_transcoder_get_latency_budget:
+ * @self: The #GstTranscoder to get the latency budget from.
+ *
+ * Returns: How late the frames can reach the encoders in live mode, see
+ * #GstTranscoder:latency-budget.
+ */
+GstClockTime
+gst_transcoder_get_latency_budget (GstTranscoder * self)
+{
+  guint64 val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), GST_CLOCK_TIME_NONE);
+
+  g_object_get (self, "latency-budget", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_set_latency_budget:
+ * @self: The #GstTranscoder to set the latency budget on.
+ * @budget: How long after their capture the frames can reach the encoders.
+ *
+ * In live mode, the frames later than @budget are dropped instead of
+ * delaying the output further.
+ */
+void
+gst_transcoder_set_latency_budget (GstTranscoder * self, GstClockTime budget)
+{
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+
+  g_object_set (self, "latency-budget", budget, NULL);
+}
+
+/**
+ * gst_transcoder_get_latency:
+ * @self: The #GstTranscoder to get the latency from.
+ *
+ * Returns: The latency of the live pipeline, or #GST_CLOCK_TIME_NONE when
+ * the source is not live, see #GstTranscoder:latency.
+ */
+GstClockTime
+gst_transcoder_get_latency (GstTranscoder * self)
+{
+  guint64 val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), GST_CLOCK_TIME_NONE);
+
+  g_object_get (self, "latency", &val, NULL);
+
+  return val;
 }
 
 /**
- * gst_transcoder_set_position_update_interval:
- * @self: #GstTranscoder instance
- * @interval: interval in ms
+ * gst_transcoder_get_deadline:
+ * @self: The #GstTranscoder to get the deadline from.
  *
- * Set interval in milliseconds between two position-updated signals.
- * Pass 0 to stop updating the position.
+ * Returns: How long the transcoding may take, see #GstTranscoder:deadline.
  */
-void
-gst_transcoder_set_position_update_interval (GstTranscoder * self,
-    guint interval)
+GstClockTime
+gst_transcoder_get_deadline (GstTranscoder * self)
 {
-  g_return_if_fail (GST_IS_TRANSCODER (self));
-  g_return_if_fail (interval <= 10000);
+  guint64 val;
 
-  GST_OBJECT_LOCK (self);
-  self->position_update_interval_ms = interval;
-  GST_OBJECT_UNLOCK (self);
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), GST_CLOCK_TIME_NONE);
 
-  gst_transcoder_set_position_update_interval_internal (self);
+  g_object_get (self, "deadline", &val, NULL);
+
+  return val;
 }
 
 /**
- * gst_transcoder_get_position_update_interval:
- * @self: #GstTranscoder instance
+ * gst_transcoder_set_deadline:
+ * @self: The #GstTranscoder to set the deadline on.
+ * @deadline: How long the transcoding may take, #GST_CLOCK_TIME_NONE for
+ * no deadline.
  *
- * Returns: current position update interval in milliseconds
+ * Lets the transcoder trade output quality for speed when it would not be
+ * done within @deadline otherwise, see #GstTranscoder:deadline.
  */
-guint
-gst_transcoder_get_position_update_interval (GstTranscoder * self)
+void
+gst_transcoder_set_deadline (GstTranscoder * self, GstClockTime deadline)
 {
-  g_return_val_if_fail (GST_IS_TRANSCODER (self),
-      DEFAULT_POSITION_UPDATE_INTERVAL_MS);
+  g_return_if_fail (GST_IS_TRANSCODER (self));
 
-  return self->position_update_interval_ms;
+  g_object_set (self, "deadline", deadline, NULL);
 }
 
 /**
- * gst_transcoder_get_source_uri:
- * @self: #GstTranscoder instance
- *
- * Gets the URI of the currently-transcoding stream.
+ * gst_transcoder_get_max_memory:
+ * @self: The #GstTranscoder to get the memory limit from.
  *
- * Returns: (transfer full): a string containing the URI of the
- * source stream. g_free() after usage.
+ * Returns: How many bytes the job can queue, see #GstTranscoder:max-memory.
  */
-gchar *
-gst_transcoder_get_source_uri (GstTranscoder * self)
+guint64
+gst_transcoder_get_max_memory (GstTranscoder * self)
 {
-  gchar *val;
+  guint64 val;
 
-  g_return_val_if_fail (GST_IS_TRANSCODER (self), DEFAULT_URI);
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), 0);
 
-  g_object_get (self, "src-uri", &val, NULL);
+  g_object_get (self, "max-memory", &val, NULL);
 
   return val;
 }
 
 /**
- * gst_transcoder_get_dest_uri:
- * @self: #GstTranscoder instance
+ * gst_transcoder_set_max_memory:
+ * @self: The #GstTranscoder to set the memory limit on.
+ * @max_memory: How many bytes the job can queue, 0 for unlimited.
  *
- * Gets the URI of the destination of the transcoded stream.
+ * Bounds the memory used by the job, see #GstTranscoder:max-memory.
+ */
+void
+gst_transcoder_set_max_memory (GstTranscoder * self, guint64 max_memory)
+{
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+
+  g_object_set (self, "max-memory", max_memory, NULL);
+}
+
+/**
+ * gst_transcoder_get_output_cache_dir:
+ * @self: The #GstTranscoder to get the output cache directory from.
  *
- * Returns: (transfer full): a string containing the URI of the
- * destination of the transcoded stream. g_free() after usage.
+ * Returns: (transfer full) (nullable): The directory the outputs of the
+ * jobs are cached in, see #GstTranscoder:output-cache-dir.
  */
 gchar *
-gst_transcoder_get_dest_uri (GstTranscoder * self)
+gst_transcoder_get_output_cache_dir (GstTranscoder * self)
 {
   gchar *val;
 
-  g_return_val_if_fail (GST_IS_TRANSCODER (self), DEFAULT_URI);
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), NULL);
 
-  g_object_get (self, "dest-uri", &val, NULL);
+  g_object_get (self, "output-cache-dir", &val, NULL);
 
   return val;
 }
 
 /**
- * gst_transcoder_get_position:
- * @self: #GstTranscoder instance
+ * gst_transcoder_set_output_cache_dir:
+ * @self: The #GstTranscoder to set the output cache directory on.
+ * @dir: (nullable): The directory to cache the outputs in, %NULL to not
+ * cache them.
  *
- * Returns: the absolute position time, in nanoseconds, of the
- * transcoding stream.
+ * Skips transcoding when the same content was already transcoded the same
+ * way, see #GstTranscoder:output-cache-dir. It has to be set before running
+ * the transcoder.
  */
-GstClockTime
-gst_transcoder_get_position (GstTranscoder * self)
+void
+gst_transcoder_set_output_cache_dir (GstTranscoder * self, const gchar * dir)
 {
-  GstClockTime val;
-
-  g_return_val_if_fail (GST_IS_TRANSCODER (self), DEFAULT_POSITION);
-
-  g_object_get (self, "position", &val, NULL);
+  g_return_if_fail (GST_IS_TRANSCODER (self));
 
-  return val;
+  g_object_set (self, "output-cache-dir", dir, NULL);
 }
 
 /**
- * gst_transcoder_get_duration:
- * @self: #GstTranscoder instance
- *
- * Retrieves the duration of the media stream that self represents.
+ * gst_transcoder_add_rendition:
+ * @self: The #GstTranscoder to add a rendition to.
+ * @dest_uri: The URI to write the rendition to.
+ * @profile: The #GstEncodingProfile to encode the rendition with.
  *
- * Returns: the duration of the transcoding media stream, in
- * nanoseconds.
+ * Adds an output which is encoded from the same decoded streams as the main
+ * one, so that several renditions of a source can be produced while
+ * demuxing and decoding it only once. It has to be called before running
+ * the transcoder. Segmented transcoding is not used when renditions are
+ * added.
  */
-GstClockTime
-gst_transcoder_get_duration (GstTranscoder * self)
+void
+gst_transcoder_add_rendition (GstTranscoder * self, const gchar * dest_uri,
+    GstEncodingProfile * profile)
 {
-  GstClockTime val;
-
-  g_return_val_if_fail (GST_IS_TRANSCODER (self), DEFAULT_DURATION);
+  GValue profiles = G_VALUE_INIT, val = G_VALUE_INIT;
+  gchar **dest_uris = NULL, **new_dest_uris;
+  guint n_dest_uris;
 
-  g_object_get (self, "duration", &val, NULL);
+  g_return_if_fail (GST_IS_TRANSCODER (self));
+  g_return_if_fail (dest_uri);
+  g_return_if_fail (GST_IS_ENCODING_PROFILE (profile));
+
+  g_value_init (&profiles, GST_TYPE_ARRAY);
+  g_object_get_property (G_OBJECT (self->transcodebin), "extra-profiles",
+      &profiles);
+  g_value_init (&val, GST_TYPE_ENCODING_PROFILE);
+  g_value_set_object (&val, profile);
+  gst_value_array_append_and_take_value (&profiles, &val);
+
+  g_object_get (self->transcodebin, "extra-dest-uris", &dest_uris, NULL);
+  n_dest_uris = dest_uris ? g_strv_length (dest_uris) : 0;
+  new_dest_uris = g_new0 (gchar *, n_dest_uris + 2);
+  if (dest_uris)
+    memcpy (new_dest_uris, dest_uris, n_dest_uris * sizeof (gchar *));
+  new_dest_uris[n_dest_uris] = g_strdup (dest_uri);
+  g_free (dest_uris);
+
+  g_object_set_property (G_OBJECT (self->transcodebin), "extra-profiles",
+      &profiles);
+  g_object_set (self->transcodebin, "extra-dest-uris", new_dest_uris, NULL);
+
+  g_value_unset (&profiles);
+  g_strfreev (new_dest_uris);
 
-  return val;
+  GST_OBJECT_LOCK (self);
+  self->n_renditions++;
+  GST_OBJECT_UNLOCK (self);
 }
 
 /**
- * gst_transcoder_get_pipeline:
- * @self: #GstTranscoder instance
+ * gst_transcoder_get_stats:
+ * @self: The #GstTranscoder to get the statistics from.
  *
- * Returns: (transfer full): The internal uritranscodebin instance
+ * Takes a snapshot of the statistics of the current run. The returned
+ * "transcoder-stats" structure holds the "position", the "elapsed" wall
+ * clock time since the transcoder was started and the "realtime-factor"
+ * (the position divided by the elapsed time), along with the
+ * #GstUriTranscodeBin:stats of the pipeline: the "streams", "elements" and
+ * "queues" arrays, the "pacing-time", the "late-buffers", the
+ * "degradation-level", the "throttling-time" and the queued "memory". The
+ * per stream statistics are only available when #GstTranscoder:collect-stats
+ * is set.
+ *
+ * Returns: (transfer full): The statistics of @self, free with
+ * gst_structure_free().
  */
-GstElement *
-gst_transcoder_get_pipeline (GstTranscoder * self)
+GstStructure *
+gst_transcoder_get_stats (GstTranscoder * self)
 {
-  GstElement *val;
+  gint64 run_start;
+  GstStructure *stats = NULL;
+  GstClockTime position, elapsed = 0;
 
   g_return_val_if_fail (GST_IS_TRANSCODER (self), NULL);
 
-  g_object_get (self, "pipeline", &val, NULL);
+  g_object_get (self->transcodebin, "stats", &stats, NULL);
+  if (!stats)
+    stats = gst_structure_new_empty ("transcoder-stats");
+  gst_structure_set_name (stats, "transcoder-stats");
 
-  return val;
+  position = gst_transcoder_get_position (self);
+  run_start = self->run_start;
+  if (run_start)
+    elapsed = (g_get_monotonic_time () - run_start) * GST_USECOND;
+
+  gst_structure_set (stats, "position", G_TYPE_UINT64, position,
+      "elapsed", G_TYPE_UINT64, elapsed,
+      "realtime-factor", G_TYPE_DOUBLE, elapsed
+      && GST_CLOCK_TIME_IS_VALID (position) ? (gdouble) position /
+      elapsed : 0.0, NULL);
+
+  return stats;
 }
 
 /**
- * gst_transcoder_get_avoid_reencoding:
- * @self: The #GstTranscoder to check whether reencoding is avoided or not.
+ * gst_transcoder_retarget:
+ * @self: The #GstTranscoder to retarget.
+ * @source_uri: The URI of the next media stream to transcode
+ * @dest_uri: The URI of the destination of the next transcoded stream
+ * @profile: (allow-none): The #GstEncodingProfile of the next job, or %NULL
+ *   to keep the current one
  *
- * Returns: %TRUE if the transcoder tries to avoid reencoding streams where
- * reencoding is not strictly needed, %FALSE otherwise.
+ * Prepares @self to transcode another stream once the current one is done,
+ * so that a transcoder can be reused for a queue of jobs. The pipeline is
+ * only brought back to %GST_STATE_READY: the source, the demuxer and the
+ * sink are recreated for the new URIs while encodebin, with its encoders
+ * and muxer, is kept alive when the profile stays the same. Call
+ * gst_transcoder_run() or gst_transcoder_run_async() to start the next job.
+ *
+ * Returns: %TRUE if @self could be retargeted, %FALSE otherwise.
  */
 gboolean
-gst_transcoder_get_avoid_reencoding (GstTranscoder * self)
+gst_transcoder_retarget (GstTranscoder * self, const gchar * source_uri,
+    const gchar * dest_uri, GstEncodingProfile * profile)
 {
-  gboolean val;
-
   g_return_val_if_fail (GST_IS_TRANSCODER (self), FALSE);
+  g_return_val_if_fail (source_uri, FALSE);
+  g_return_val_if_fail (dest_uri, FALSE);
+  g_return_val_if_fail (!profile || GST_IS_ENCODING_PROFILE (profile), FALSE);
 
-  g_object_get (self->transcodebin, "avoid-reencoding", &val, NULL);
+  GST_DEBUG_OBJECT (self, "Retargeting to %s -> %s", source_uri, dest_uri);
 
-  return val;
-}
+  g_object_set (self->transcodebin, "reuse-encoders", TRUE, NULL);
+  if (gst_element_set_state (self->transcodebin,
+          GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+    GST_ERROR_OBJECT (self, "Could not bring the pipeline back to READY");
 
-/**
- * gst_transcoder_set_avoid_reencoding:
- * @self: The #GstTranscoder to set whether reencoding should be avoided or not.
- * @avoid_reencoding: %TRUE if the transcoder should try to avoid reencoding
- * streams where * reencoding is not strictly needed, %FALSE otherwise.
- */
-void
-gst_transcoder_set_avoid_reencoding (GstTranscoder * self,
-    gboolean avoid_reencoding)
-{
-  g_return_if_fail (GST_IS_TRANSCODER (self));
+    return FALSE;
+  }
 
-  g_object_set (self->transcodebin, "avoid-reencoding", avoid_reencoding, NULL);
+  remove_tick_source (self);
+  segments_cleanup (self);
+  segments_restore_source (self);
+  multipass_cleanup (self);
+
+  GST_OBJECT_LOCK (self);
+  g_free (self->source_uri);
+  self->source_uri = g_strdup (source_uri);
+  g_free (self->dest_uri);
+  self->dest_uri = g_strdup (dest_uri);
+  if (profile)
+    gst_object_replace ((GstObject **) & self->profile, (GstObject *) profile);
+  self->target_state = GST_STATE_READY;
+  self->current_state = GST_STATE_READY;
+  self->is_eos = FALSE;
+  self->is_live = FALSE;
+  self->latency = GST_CLOCK_TIME_NONE;
+  self->last_duration = 0;
+  GST_OBJECT_UNLOCK (self);
+
+  g_object_set (self->transcodebin, "source", NULL, "source-uri", source_uri,
+      "dest-uri", dest_uri, "profile", self->profile, NULL);
+
+  return TRUE;
 }
 
 #define C_ENUM(v) ((gint) v)
@@ -1368,6 +4218,8 @@ gst_transcoder_error_get_type (void)
   static const GEnumValue values[] = {
     {C_ENUM (GST_TRANSCODER_ERROR_FAILED), "GST_TRANSCODER_ERROR_FAILED",
         "failed"},
+    {C_ENUM (GST_TRANSCODER_ERROR_MEMORY_LIMIT),
+        "GST_TRANSCODER_ERROR_MEMORY_LIMIT", "memory-limit"},
     {0, NULL, NULL}
   };
 
@@ -1379,6 +4231,72 @@ gst_transcoder_error_get_type (void)
   return (GType) id;
 }
 
+GType
+gst_transcoder_hardware_policy_get_type (void)
+{
+  static gsize id = 0;
+  static const GEnumValue values[] = {
+    {C_ENUM (GST_TRANSCODER_HARDWARE_POLICY_AUTO),
+        "GST_TRANSCODER_HARDWARE_POLICY_AUTO", "auto"},
+    {C_ENUM (GST_TRANSCODER_HARDWARE_POLICY_PREFER),
+        "GST_TRANSCODER_HARDWARE_POLICY_PREFER", "prefer"},
+    {C_ENUM (GST_TRANSCODER_HARDWARE_POLICY_REQUIRE),
+        "GST_TRANSCODER_HARDWARE_POLICY_REQUIRE", "require"},
+    {C_ENUM (GST_TRANSCODER_HARDWARE_POLICY_FORBID),
+        "GST_TRANSCODER_HARDWARE_POLICY_FORBID", "forbid"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&id)) {
+    GType tmp = g_enum_register_static ("GstTranscoderHardwarePolicy", values);
+    g_once_init_leave (&id, tmp);
+  }
+
+  return (GType) id;
+}
+
+GType
+gst_transcoder_mp4_mode_get_type (void)
+{
+  static gsize id = 0;
+  static const GEnumValue values[] = {
+    {C_ENUM (GST_TRANSCODER_MP4_MODE_NORMAL),
+        "GST_TRANSCODER_MP4_MODE_NORMAL", "normal"},
+    {C_ENUM (GST_TRANSCODER_MP4_MODE_FASTSTART),
+        "GST_TRANSCODER_MP4_MODE_FASTSTART", "faststart"},
+    {C_ENUM (GST_TRANSCODER_MP4_MODE_FRAGMENTED),
+        "GST_TRANSCODER_MP4_MODE_FRAGMENTED", "fragmented"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&id)) {
+    GType tmp = g_enum_register_static ("GstTranscoderMp4Mode", values);
+    g_once_init_leave (&id, tmp);
+  }
+
+  return (GType) id;
+}
+
+GType
+gst_transcoder_seek_mode_get_type (void)
+{
+  static gsize id = 0;
+  static const GEnumValue values[] = {
+    {C_ENUM (GST_TRANSCODER_SEEK_MODE_ACCURATE),
+        "GST_TRANSCODER_SEEK_MODE_ACCURATE", "accurate"},
+    {C_ENUM (GST_TRANSCODER_SEEK_MODE_KEYFRAME),
+        "GST_TRANSCODER_SEEK_MODE_KEYFRAME", "keyframe"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&id)) {
+    GType tmp = g_enum_register_static ("GstTranscoderSeekMode", values);
+    g_once_init_leave (&id, tmp);
+  }
+
+  return (GType) id;
+}
+
 /**
  * gst_transcoder_error_get_name:
  * @error: a #GstTranscoderError
@@ -1393,6 +4311,8 @@ gst_transcoder_error_get_name (GstTranscoderError error)
   switch (error) {
     case GST_TRANSCODER_ERROR_FAILED:
       return "failed";
+    case GST_TRANSCODER_ERROR_MEMORY_LIMIT:
+      return "memory-limit";
   }
 
   g_assert_not_reached ();
@@ -1608,3 +4528,319 @@ gst_transcoder_g_main_context_signal_dispatcher_new (GMainContext *
   return g_object_new (GST_TYPE_TRANSCODER_G_MAIN_CONTEXT_SIGNAL_DISPATCHER,
       "application-context", application_context, NULL);
 }
+
+static void
+preflight_add_missing (GValue * missing, gchar * description)
+{
+  guint i;
+  GValue value = G_VALUE_INIT;
+
+  for (i = 0; i < gst_value_array_get_size (missing); i++) {
+    if (!g_strcmp0 (g_value_get_string (gst_value_array_get_value (missing,
+                    i)), description)) {
+      g_free (description);
+      return;
+    }
+  }
+
+  g_value_init (&value, G_TYPE_STRING);
+  g_value_take_string (&value, description);
+  gst_value_array_append_and_take_value (missing, &value);
+}
+
+/* Whether an element handling @caps is installed, video codecs also have to
+ * follow the hardware @policy */
+static gboolean
+preflight_has_factory (GstElementFactoryListType type, GstCaps * caps,
+    GstPadDirection direction, GstTranscoderHardwarePolicy policy)
+{
+  GList *all, *factories, *tmp;
+  gboolean res = FALSE;
+
+  all = gst_element_factory_list_get_elements (type, GST_RANK_MARGINAL);
+  factories = gst_element_factory_list_filter (all, caps, direction, FALSE);
+  gst_plugin_feature_list_free (all);
+
+  for (tmp = factories; tmp && !res; tmp = tmp->next) {
+    const gchar *klass = gst_element_factory_get_metadata (tmp->data,
+        GST_ELEMENT_METADATA_KLASS);
+    gboolean hardware = klass && strstr (klass, "Hardware");
+
+    res = !(policy == GST_TRANSCODER_HARDWARE_POLICY_REQUIRE && !hardware)
+        && !(policy == GST_TRANSCODER_HARDWARE_POLICY_FORBID && hardware);
+  }
+  gst_plugin_feature_list_free (factories);
+
+  return res;
+}
+
+/* Same as transcodebin: with avoid-reencoding, streams already in the format
+ * of a profile without restriction are not decoded */
+static GstEncodingProfile *
+preflight_find_passthrough_profile (GList * profiles, GstCaps * caps)
+{
+  GList *tmp;
+
+  for (tmp = profiles; tmp; tmp = tmp->next) {
+    GstCaps *format = gst_encoding_profile_get_format (tmp->data);
+    gboolean compatible = gst_caps_can_intersect (caps, format);
+
+    gst_caps_unref (format);
+    if (compatible) {
+      GstCaps *restriction = gst_encoding_profile_get_restriction (tmp->data);
+      gboolean restricted = restriction && !gst_caps_is_any (restriction);
+
+      if (restriction)
+        gst_caps_unref (restriction);
+
+      return restricted ? NULL : tmp->data;
+    }
+  }
+
+  return NULL;
+}
+
+/* Same as encodebin: decoded streams go to the first profile of their kind
+ * which is not used up yet */
+static GstEncodingProfile *
+preflight_find_encoding_profile (GList * profiles, GHashTable * uses,
+    GType profile_type)
+{
+  GList *tmp;
+
+  for (tmp = profiles; tmp; tmp = tmp->next) {
+    guint presence = gst_encoding_profile_get_presence (tmp->data);
+    guint used = GPOINTER_TO_UINT (g_hash_table_lookup (uses, tmp->data));
+
+    if (G_TYPE_CHECK_INSTANCE_TYPE (tmp->data, profile_type)
+        && (!presence || used < presence)) {
+      g_hash_table_insert (uses, tmp->data, GUINT_TO_POINTER (used + 1));
+
+      return tmp->data;
+    }
+  }
+
+  return NULL;
+}
+
+static GstStructure *
+preflight_stream (GstTranscoder * self, GstDiscovererStreamInfo * sinfo,
+    GList * profiles, GHashTable * uses, GstCaps * input_container_caps,
+    GstCaps * output_container_caps, GValue * missing)
+{
+  GType profile_type = G_TYPE_INVALID;
+  const gchar *decision = "drop";
+  GstTranscoderHardwarePolicy policy = GST_TRANSCODER_HARDWARE_POLICY_AUTO;
+  GstEncodingProfile *profile = NULL;
+  GstCaps *caps, *output_caps = NULL;
+  GstStructure *res;
+
+  caps = gst_discoverer_stream_info_get_caps (sinfo);
+  if (!caps)
+    caps = gst_caps_new_any ();
+
+  if (GST_IS_DISCOVERER_VIDEO_INFO (sinfo)) {
+    profile_type = GST_TYPE_ENCODING_VIDEO_PROFILE;
+    policy = gst_transcoder_get_hardware_policy (self);
+  } else if (GST_IS_DISCOVERER_AUDIO_INFO (sinfo)) {
+    profile_type = GST_TYPE_ENCODING_AUDIO_PROFILE;
+  }
+
+  if (gst_transcoder_get_avoid_reencoding (self) && !self->n_renditions)
+    profile = preflight_find_passthrough_profile (profiles, caps);
+
+  if (profile) {
+    decision = input_container_caps && output_container_caps
+        && gst_caps_can_intersect (input_container_caps,
+        output_container_caps) ? "passthrough" : "remux";
+    output_caps = gst_caps_ref (caps);
+  } else if (profile_type != G_TYPE_INVALID) {
+    GstStructure *structure = gst_caps_get_size (caps) ?
+        gst_caps_get_structure (caps, 0) : NULL;
+    gboolean decodable = (structure
+        && g_str_has_suffix (gst_structure_get_name (structure), "/x-raw"))
+        || preflight_has_factory (GST_ELEMENT_FACTORY_TYPE_DECODER, caps,
+        GST_PAD_SINK, policy);
+
+    if (!decodable)
+      preflight_add_missing (missing,
+          gst_pb_utils_get_decoder_description (caps));
+
+    profile = preflight_find_encoding_profile (profiles, uses, profile_type);
+    if (profile) {
+      const gchar *preset_name = gst_encoding_profile_get_preset_name (profile);
+      GstCaps *format = gst_encoding_profile_get_format (profile);
+      gboolean encodable;
+
+      if (preset_name) {
+        GstElementFactory *factory = gst_element_factory_find (preset_name);
+
+        encodable = factory != NULL;
+        if (factory)
+          gst_object_unref (factory);
+      } else {
+        encodable = preflight_has_factory (GST_ELEMENT_FACTORY_TYPE_ENCODER,
+            format, GST_PAD_SRC, policy);
+      }
+
+      if (!encodable)
+        preflight_add_missing (missing, preset_name ? g_strdup (preset_name) :
+            gst_pb_utils_get_encoder_description (format));
+
+      if (decodable && encodable) {
+        decision = "reencode";
+        output_caps = gst_caps_ref (format);
+      }
+      gst_caps_unref (format);
+    }
+  }
+
+  res = gst_structure_new ("stream",
+      "stream-id", G_TYPE_STRING, gst_discoverer_stream_info_get_stream_id
+      (sinfo), "input-caps", GST_TYPE_CAPS, caps,
+      "decision", G_TYPE_STRING, decision, NULL);
+  if (output_caps) {
+    gst_structure_set (res, "output-caps", GST_TYPE_CAPS, output_caps,
+        "profile", G_TYPE_STRING, gst_encoding_profile_get_name (profile),
+        NULL);
+    gst_caps_unref (output_caps);
+  }
+  gst_caps_unref (caps);
+
+  return res;
+}
+
+/**
+ * gst_transcoder_preflight:
+ * @self: The #GstTranscoder to check
+ * @error: (allow-none): A #GError to report why the source could not be
+ * probed
+ *
+ * Checks what running @self would do without building its pipeline: the
+ * source is only probed, up to its parsers, and each of its streams is
+ * matched against the #GstTranscoder:profile the way transcodebin and
+ * encodebin do it, then the decoders, encoders, muxer and sink are looked
+ * up in the registry.
+ *
+ * The returned "transcoder-preflight" structure holds the "duration" and
+ * "seekable" state of the source, a "streams" array with the "stream-id",
+ * "input-caps" and "decision" ("passthrough", "remux", "reencode" or "drop")
+ * of each stream, along with the "output-caps" and "profile" of the streams
+ * not dropped, a "missing-elements" array of descriptions of what has to be
+ * installed and "can-transcode", %TRUE when nothing is missing and at least
+ * one stream is kept.
+ *
+ * This function blocks until the source has been probed.
+ *
+ * Returns: (transfer full) (nullable): The preflight report of @self, free
+ * with gst_structure_free(), or %NULL if the source could not be probed.
+ */
+GstStructure *
+gst_transcoder_preflight (GstTranscoder * self, GError ** error)
+{
+  GList *tmp, *streams, *profiles = NULL;
+  GHashTable *uses;
+  GstDiscoverer *discoverer;
+  GstDiscovererInfo *info;
+  GstDiscovererStreamInfo *top;
+  GstCaps *input_container_caps = NULL, *output_container_caps = NULL;
+  GValue stream_array = G_VALUE_INIT, missing = G_VALUE_INIT;
+  gboolean kept_stream = FALSE;
+  gchar *protocol;
+  GstStructure *res;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER (self), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  if (!self->profile) {
+    g_set_error (error, GST_TRANSCODER_ERROR, GST_TRANSCODER_ERROR_FAILED,
+        "No \"profile\" provided");
+    return NULL;
+  }
+
+  discoverer = gst_discoverer_new (DISCOVERER_TIMEOUT, error);
+  if (!discoverer)
+    return NULL;
+
+  info = gst_discoverer_discover_uri (discoverer, self->source_uri, error);
+  g_object_unref (discoverer);
+  if (!info)
+    return NULL;
+
+  if (gst_discoverer_info_get_result (info) != GST_DISCOVERER_OK
+      && gst_discoverer_info_get_result (info) !=
+      GST_DISCOVERER_MISSING_PLUGINS) {
+    g_set_error (error, GST_TRANSCODER_ERROR, GST_TRANSCODER_ERROR_FAILED,
+        "Could not probe %s", self->source_uri);
+    g_object_unref (info);
+    return NULL;
+  }
+
+  g_value_init (&stream_array, GST_TYPE_ARRAY);
+  g_value_init (&missing, GST_TYPE_ARRAY);
+
+  top = gst_discoverer_info_get_stream_info (info);
+  if (top && GST_IS_DISCOVERER_CONTAINER_INFO (top))
+    input_container_caps = gst_discoverer_stream_info_get_caps (top);
+  if (top)
+    gst_discoverer_stream_info_unref (top);
+
+  if (GST_IS_ENCODING_CONTAINER_PROFILE (self->profile)) {
+    output_container_caps = gst_encoding_profile_get_format (self->profile);
+    profiles = g_list_copy ((GList *)
+        gst_encoding_container_profile_get_profiles
+        (GST_ENCODING_CONTAINER_PROFILE (self->profile)));
+    if (!preflight_has_factory (GST_ELEMENT_FACTORY_TYPE_MUXER,
+            output_container_caps, GST_PAD_SRC,
+            GST_TRANSCODER_HARDWARE_POLICY_AUTO))
+      preflight_add_missing (&missing,
+          gst_pb_utils_get_encoder_description (output_container_caps));
+  } else {
+    profiles = g_list_prepend (profiles, self->profile);
+  }
+
+  protocol = gst_uri_get_protocol (self->dest_uri);
+  if (protocol && !gst_uri_protocol_is_supported (GST_URI_SINK, protocol))
+    preflight_add_missing (&missing, gst_pb_utils_get_sink_description
+        (protocol));
+  g_free (protocol);
+
+  uses = g_hash_table_new (NULL, NULL);
+  streams = gst_discoverer_info_get_stream_list (info);
+  for (tmp = streams; tmp; tmp = tmp->next) {
+    GstStructure *stream;
+    GValue value = G_VALUE_INIT;
+
+    if (GST_IS_DISCOVERER_CONTAINER_INFO (tmp->data))
+      continue;
+
+    stream = preflight_stream (self, tmp->data, profiles, uses,
+        input_container_caps, output_container_caps, &missing);
+    kept_stream |= g_strcmp0 (gst_structure_get_string (stream, "decision"),
+        "drop") != 0;
+
+    g_value_init (&value, GST_TYPE_STRUCTURE);
+    g_value_take_boxed (&value, stream);
+    gst_value_array_append_and_take_value (&stream_array, &value);
+  }
+  gst_discoverer_stream_info_list_free (streams);
+  g_hash_table_unref (uses);
+  g_list_free (profiles);
+
+  res = gst_structure_new ("transcoder-preflight",
+      "source-uri", G_TYPE_STRING, self->source_uri,
+      "duration", G_TYPE_UINT64, gst_discoverer_info_get_duration (info),
+      "seekable", G_TYPE_BOOLEAN, gst_discoverer_info_get_seekable (info),
+      "can-transcode", G_TYPE_BOOLEAN, kept_stream
+      && !gst_value_array_get_size (&missing), NULL);
+  gst_structure_take_value (res, "streams", &stream_array);
+  gst_structure_take_value (res, "missing-elements", &missing);
+
+  gst_clear_caps (&input_container_caps);
+  gst_clear_caps (&output_container_caps);
+  g_object_unref (info);
+
+  GST_INFO_OBJECT (self, "Preflight: %" GST_PTR_FORMAT, res);
+
+  return res;
+}
@@ -16,15 +16,65 @@ typedef struct _GstTranscoderSignalDispatcherInterface GstTranscoderSignalDispat
 /**
  * GstTranscoderError:
  * @GST_TRANSCODER_ERROR_FAILED: generic error.
+ * @GST_TRANSCODER_ERROR_MEMORY_LIMIT: the job needed more memory than
+ * #GstTranscoder:max-memory.
  */
 typedef enum {
-  GST_TRANSCODER_ERROR_FAILED = 0
+  GST_TRANSCODER_ERROR_FAILED = 0,
+  GST_TRANSCODER_ERROR_MEMORY_LIMIT
 } GstTranscoderError;
 
 GQuark        gst_transcoder_error_quark    (void);
 GType         gst_transcoder_error_get_type (void);
 const gchar * gst_transcoder_error_get_name (GstTranscoderError error);
 
+/**
+ * GstTranscoderHardwarePolicy:
+ * @GST_TRANSCODER_HARDWARE_POLICY_AUTO: pick codecs by rank.
+ * @GST_TRANSCODER_HARDWARE_POLICY_PREFER: prefer hardware video codecs.
+ * @GST_TRANSCODER_HARDWARE_POLICY_REQUIRE: only use hardware video codecs.
+ * @GST_TRANSCODER_HARDWARE_POLICY_FORBID: never use hardware video codecs.
+ */
+typedef enum {
+  GST_TRANSCODER_HARDWARE_POLICY_AUTO,
+  GST_TRANSCODER_HARDWARE_POLICY_PREFER,
+  GST_TRANSCODER_HARDWARE_POLICY_REQUIRE,
+  GST_TRANSCODER_HARDWARE_POLICY_FORBID,
+} GstTranscoderHardwarePolicy;
+
+#define      GST_TYPE_TRANSCODER_HARDWARE_POLICY          (gst_transcoder_hardware_policy_get_type ())
+GType         gst_transcoder_hardware_policy_get_type (void);
+
+/**
+ * GstTranscoderMp4Mode:
+ * @GST_TRANSCODER_MP4_MODE_NORMAL: write the moov atom at the end of the file.
+ * @GST_TRANSCODER_MP4_MODE_FASTSTART: reserve space for the moov atom at the
+ *   start of the file.
+ * @GST_TRANSCODER_MP4_MODE_FRAGMENTED: write moof/mdat fragments.
+ */
+typedef enum {
+  GST_TRANSCODER_MP4_MODE_NORMAL,
+  GST_TRANSCODER_MP4_MODE_FASTSTART,
+  GST_TRANSCODER_MP4_MODE_FRAGMENTED,
+} GstTranscoderMp4Mode;
+
+#define      GST_TYPE_TRANSCODER_MP4_MODE                 (gst_transcoder_mp4_mode_get_type ())
+GType         gst_transcoder_mp4_mode_get_type        (void);
+
+/**
+ * GstTranscoderSeekMode:
+ * @GST_TRANSCODER_SEEK_MODE_ACCURATE: start exactly at the start position.
+ * @GST_TRANSCODER_SEEK_MODE_KEYFRAME: start on the keyframe preceding the
+ *   start position.
+ */
+typedef enum {
+  GST_TRANSCODER_SEEK_MODE_ACCURATE,
+  GST_TRANSCODER_SEEK_MODE_KEYFRAME,
+} GstTranscoderSeekMode;
+
+#define      GST_TYPE_TRANSCODER_SEEK_MODE                (gst_transcoder_seek_mode_get_type ())
+GType         gst_transcoder_seek_mode_get_type       (void);
+
 /*********** GstTranscoder definition  ************/
 #define GST_TYPE_TRANSCODER (gst_transcoder_get_type ())
 #define GST_TRANSCODER(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_TRANSCODER, GstTranscoder))
@@ -53,6 +103,7 @@ gboolean gst_transcoder_run                               (GstTranscoder *self,
 
 void gst_transcoder_set_cpu_usage                         (GstTranscoder *self,
                                                            gint cpu_usage);
+gint gst_transcoder_get_cpu_usage                         (GstTranscoder *self);
 
 void gst_transcoder_run_async                             (GstTranscoder *self);
 
@@ -64,6 +115,9 @@ gchar * gst_transcoder_get_source_uri                     (GstTranscoder * self)
 gchar * gst_transcoder_get_dest_uri                       (GstTranscoder * self);
 
 guint gst_transcoder_get_position_update_interval         (GstTranscoder *self);
+void gst_transcoder_set_position_update_delta             (GstTranscoder *self,
+                                                           GstClockTime delta);
+GstClockTime gst_transcoder_get_position_update_delta     (GstTranscoder *self);
 
 GstClockTime gst_transcoder_get_position                  (GstTranscoder * self);
 
@@ -74,6 +128,54 @@ GstElement * gst_transcoder_get_pipeline                  (GstTranscoder * self)
 gboolean gst_transcoder_get_avoid_reencoding              (GstTranscoder * self);
 void gst_transcoder_set_avoid_reencoding                  (GstTranscoder * self,
                                                            gboolean avoid_reencoding);
+guint gst_transcoder_get_n_segments                       (GstTranscoder * self);
+void gst_transcoder_set_n_segments                        (GstTranscoder * self,
+                                                           guint n_segments);
+gchar * gst_transcoder_get_checkpoint_dir                 (GstTranscoder * self);
+void gst_transcoder_set_checkpoint_dir                    (GstTranscoder * self,
+                                                           const gchar * dir);
+GstTranscoderHardwarePolicy gst_transcoder_get_hardware_policy (GstTranscoder * self);
+void gst_transcoder_set_hardware_policy                   (GstTranscoder * self,
+                                                           GstTranscoderHardwarePolicy policy);
+GstTranscoderMp4Mode gst_transcoder_get_mp4_mode          (GstTranscoder * self);
+void gst_transcoder_set_mp4_mode                          (GstTranscoder * self,
+                                                           GstTranscoderMp4Mode mode);
+GstClockTime gst_transcoder_get_start_time                (GstTranscoder * self);
+void gst_transcoder_set_start_time                        (GstTranscoder * self,
+                                                           GstClockTime start_time);
+GstClockTime gst_transcoder_get_stop_time                 (GstTranscoder * self);
+void gst_transcoder_set_stop_time                         (GstTranscoder * self,
+                                                           GstClockTime stop_time);
+GstTranscoderSeekMode gst_transcoder_get_seek_mode        (GstTranscoder * self);
+void gst_transcoder_set_seek_mode                         (GstTranscoder * self,
+                                                           GstTranscoderSeekMode mode);
+gboolean gst_transcoder_get_live                          (GstTranscoder * self);
+void gst_transcoder_set_live                              (GstTranscoder * self,
+                                                           gboolean live);
+GstClockTime gst_transcoder_get_latency_budget            (GstTranscoder * self);
+void gst_transcoder_set_latency_budget                    (GstTranscoder * self,
+                                                           GstClockTime budget);
+GstClockTime gst_transcoder_get_latency                   (GstTranscoder * self);
+GstClockTime gst_transcoder_get_deadline                  (GstTranscoder * self);
+void gst_transcoder_set_deadline                          (GstTranscoder * self,
+                                                           GstClockTime deadline);
+guint64 gst_transcoder_get_max_memory                     (GstTranscoder * self);
+void gst_transcoder_set_max_memory                        (GstTranscoder * self,
+                                                           guint64 max_memory);
+gchar * gst_transcoder_get_output_cache_dir               (GstTranscoder * self);
+void gst_transcoder_set_output_cache_dir                  (GstTranscoder * self,
+                                                           const gchar * dir);
+void gst_transcoder_add_rendition                         (GstTranscoder * self,
+                                                           const gchar * dest_uri,
+                                                           GstEncodingProfile * profile);
+GstStructure * gst_transcoder_get_stats                   (GstTranscoder * self);
+GstStructure * gst_transcoder_preflight                   (GstTranscoder * self,
+                                                           GError ** error);
+GstEncodingProfile * gst_transcoder_create_encoding_profile (const gchar * profile_string);
+gboolean gst_transcoder_retarget                          (GstTranscoder * self,
+                                                           const gchar * source_uri,
+                                                           const gchar * dest_uri,
+                                                           GstEncodingProfile * profile);
 
 
 /****************** Signal dispatcher *******************************/
@@ -0,0 +1,676 @@
+/* GStreamer
+ *
+ * Copyright (C) 2015 Thibault Saunier <tsaunier@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * SECTION:gsttranscoderpool
+ * @short_description: Run many #GstTranscoder jobs on a few threads
+ *
+ * A #GstTranscoderPool runs the jobs queued with
+ * gst_transcoder_pool_queue_job(), never more than
+ * #GstTranscoderPool:max-jobs at a time. The buses of all the jobs are
+ * watched from a fixed set of worker threads instead of one thread per
+ * #GstTranscoder. The signals of each job are emitted through the
+ * #GstTranscoderSignalDispatcher of the pool.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "gsttranscoderpool.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_transcoder_pool_debug);
+#define GST_CAT_DEFAULT gst_transcoder_pool_debug
+
+#define DEFAULT_N_WORKERS 2
+#define DEFAULT_MAX_JOBS 0
+#define DEFAULT_CPU_USAGE 100
+/* Share of the pool CPU usage given to a running job */
+#define CPU_SHARE_QUARK (g_quark_from_static_string ("pool-cpu-share"))
+/* CPU usage the job was given before being queued */
+#define OWN_CPU_USAGE_QUARK (g_quark_from_static_string ("pool-own-cpu-usage"))
+
+enum
+{
+  PROP_0,
+  PROP_SIGNAL_DISPATCHER,
+  PROP_N_WORKERS,
+  PROP_MAX_JOBS,
+  PROP_CPU_USAGE,
+  PROP_LAST
+};
+
+typedef struct
+{
+  GThread *thread;
+  GMainContext *context;
+  GMainLoop *loop;
+} GstTranscoderPoolWorker;
+
+struct _GstTranscoderPool
+{
+  GstObject parent;
+
+  GstTranscoderSignalDispatcher *signal_dispatcher;
+
+  guint n_workers;
+  GPtrArray *workers;
+  guint next_worker;
+
+  /* Protected by the object lock */
+  guint max_jobs;
+  guint cpu_usage;
+  GQueue pending;
+  GList *running;
+  guint n_failed;
+  GCond cond;
+};
+
+struct _GstTranscoderPoolClass
+{
+  GstObjectClass parent_class;
+};
+
+#define parent_class gst_transcoder_pool_parent_class
+G_DEFINE_TYPE (GstTranscoderPool, gst_transcoder_pool, GST_TYPE_OBJECT);
+
+static GParamSpec *param_specs[PROP_LAST] = { NULL, };
+
+static gpointer
+worker_main (GstTranscoderPoolWorker * worker)
+{
+  g_main_context_push_thread_default (worker->context);
+  g_main_loop_run (worker->loop);
+  g_main_context_pop_thread_default (worker->context);
+
+  return NULL;
+}
+
+static gboolean
+worker_quit_cb (GMainLoop * loop)
+{
+  g_main_loop_quit (loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+worker_free (GstTranscoderPoolWorker * worker)
+{
+  /* Through the context so that it works even if the loop is not running
+   * yet, after the bus messages already posted to the jobs */
+  g_main_context_invoke_full (worker->context, G_PRIORITY_LOW,
+      (GSourceFunc) worker_quit_cb, worker->loop, NULL);
+  g_thread_join (worker->thread);
+
+  g_main_loop_unref (worker->loop);
+  g_main_context_unref (worker->context);
+  g_free (worker);
+}
+
+static GstTranscoderPoolWorker *
+worker_new (guint i)
+{
+  gchar *name = g_strdup_printf ("GstTranscoderPool-%d", i);
+  GstTranscoderPoolWorker *worker = g_new0 (GstTranscoderPoolWorker, 1);
+
+  worker->context = g_main_context_new ();
+  worker->loop = g_main_loop_new (worker->context, FALSE);
+  worker->thread = g_thread_new (name, (GThreadFunc) worker_main, worker);
+  g_free (name);
+
+  return worker;
+}
+
+/* Call with the object lock held */
+static guint
+get_max_jobs (GstTranscoderPool * self)
+{
+  return self->max_jobs ? self->max_jobs : g_get_num_processors ();
+}
+
+static guint
+get_own_cpu_usage (GstTranscoder * job)
+{
+  return GPOINTER_TO_UINT (g_object_get_qdata (G_OBJECT (job),
+          OWN_CPU_USAGE_QUARK));
+}
+
+/* Call with the object lock held. The running jobs which have their own
+ * CPU usage take it out of the budget, the others share what is left */
+static guint
+get_reserved_cpu_usage (GstTranscoderPool * self, guint * n_shared)
+{
+  GList *tmp;
+  guint reserved = 0;
+
+  *n_shared = 0;
+  for (tmp = self->running; tmp; tmp = tmp->next) {
+    guint own = get_own_cpu_usage (tmp->data);
+
+    if (own)
+      reserved += own;
+    else
+      (*n_shared)++;
+  }
+
+  return reserved;
+}
+
+/* Call with the object lock held. When throttling, each job sharing the
+ * budget needs at least one CPU, and at least one percent of the CPU usage
+ * as that is the granularity of gst_transcoder_set_cpu_usage(), so the
+ * budget also bounds how many jobs run at the same time */
+static gboolean
+can_start_job (GstTranscoderPool * self, GstTranscoder * job)
+{
+  guint reserved, n_shared, min_share, own = get_own_cpu_usage (job);
+  guint n_running = g_list_length (self->running);
+
+  if (n_running >= get_max_jobs (self))
+    return FALSE;
+
+  /* A job with more than the whole budget runs alone */
+  if (self->cpu_usage >= 100 || !n_running)
+    return TRUE;
+
+  min_share = MAX (100 / g_get_num_processors (), 1);
+  reserved = get_reserved_cpu_usage (self, &n_shared);
+  if (own)
+    reserved += own;
+  else
+    n_shared++;
+
+  return reserved + n_shared * min_share <= self->cpu_usage;
+}
+
+/* Call with the object lock held. The running jobs without their own CPU
+ * usage get an equal share of what is left of the budget, rounded down so
+ * that they never go over it */
+static void
+update_cpu_shares (GstTranscoderPool * self)
+{
+  GList *tmp;
+  guint n_shared, reserved, share;
+
+  reserved = get_reserved_cpu_usage (self, &n_shared);
+  if (!n_shared)
+    return;
+
+  share = self->cpu_usage;
+  if (share < 100)
+    share = MAX ((share - MIN (reserved, share)) / n_shared, 1);
+
+  for (tmp = self->running; tmp; tmp = tmp->next) {
+    guint old_share = GPOINTER_TO_UINT (g_object_get_qdata (tmp->data,
+            CPU_SHARE_QUARK));
+
+    /* Jobs of a pool which does not throttle are left alone */
+    if (get_own_cpu_usage (tmp->data) || share == old_share
+        || (share >= 100 && !old_share))
+      continue;
+
+    GST_DEBUG_OBJECT (self, "%" GST_PTR_FORMAT " gets %u%% of the CPU",
+        tmp->data, share);
+    gst_transcoder_set_cpu_usage (tmp->data, share);
+    g_object_set_qdata (tmp->data, CPU_SHARE_QUARK,
+        GUINT_TO_POINTER (share < 100 ? share : 0));
+  }
+}
+
+static void
+start_pending_jobs (GstTranscoderPool * self)
+{
+  while (TRUE) {
+    GstTranscoder *job;
+
+    GST_OBJECT_LOCK (self);
+    if (g_queue_is_empty (&self->pending)
+        || !can_start_job (self, g_queue_peek_head (&self->pending))) {
+      GST_OBJECT_UNLOCK (self);
+      break;
+    }
+
+    job = g_queue_pop_head (&self->pending);
+    self->running = g_list_prepend (self->running, job);
+    update_cpu_shares (self);
+    GST_OBJECT_UNLOCK (self);
+
+    GST_DEBUG_OBJECT (self, "Starting %" GST_PTR_FORMAT, job);
+    gst_transcoder_run_async (job);
+  }
+}
+
+static void
+job_finished (GstTranscoderPool * self, GstTranscoder * job, gboolean failed)
+{
+  GList *link;
+
+  GST_OBJECT_LOCK (self);
+  link = g_list_find (self->running, job);
+  if (!link) {
+    GST_OBJECT_UNLOCK (self);
+    return;
+  }
+
+  self->running = g_list_delete_link (self->running, link);
+  if (failed)
+    self->n_failed++;
+  /* The remaining jobs get the share of the finished one until another one
+   * is started */
+  update_cpu_shares (self);
+  g_cond_broadcast (&self->cond);
+  GST_OBJECT_UNLOCK (self);
+
+  GST_DEBUG_OBJECT (self, "%" GST_PTR_FORMAT " %s", job,
+      failed ? "failed" : "done");
+
+  g_signal_handlers_disconnect_by_data (job, self);
+  gst_object_unref (job);
+
+  start_pending_jobs (self);
+}
+
+static void
+job_done_cb (GstTranscoder * job, GstTranscoderPool * self)
+{
+  job_finished (self, job, FALSE);
+}
+
+static void
+job_error_cb (GstTranscoder * job, GError * error, GstStructure * details,
+    GstTranscoderPool * self)
+{
+  job_finished (self, job, TRUE);
+}
+
+static void
+gst_transcoder_pool_constructed (GObject * object)
+{
+  guint i;
+  GstTranscoderPool *self = GST_TRANSCODER_POOL (object);
+
+  self->workers =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) worker_free);
+  for (i = 0; i < self->n_workers; i++)
+    g_ptr_array_add (self->workers, worker_new (i));
+
+  G_OBJECT_CLASS (parent_class)->constructed (object);
+}
+
+/* The job handles the error from the thread watching its bus, which stops
+ * it and reports it like any other error */
+static void
+stop_job (GstTranscoder * job)
+{
+  GstElement *pipeline = gst_transcoder_get_pipeline (job);
+  GError *err = g_error_new_literal (GST_CORE_ERROR, GST_CORE_ERROR_STATE,
+      "The transcoder pool was disposed");
+
+  gst_element_post_message (pipeline,
+      gst_message_new_error (GST_OBJECT (pipeline), err, NULL));
+  g_error_free (err);
+  gst_object_unref (pipeline);
+}
+
+static void
+gst_transcoder_pool_dispose (GObject * object)
+{
+  GList *tmp, *running;
+  GstTranscoder *job;
+  GstTranscoderPool *self = GST_TRANSCODER_POOL (object);
+
+  GST_OBJECT_LOCK (self);
+  running = self->running;
+  self->running = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  /* The callers may keep the jobs alive */
+  while ((job = g_queue_pop_head (&self->pending))) {
+    g_signal_handlers_disconnect_by_data (job, self);
+    gst_object_unref (job);
+  }
+
+  for (tmp = running; tmp; tmp = tmp->next) {
+    g_signal_handlers_disconnect_by_data (tmp->data, self);
+    stop_job (tmp->data);
+  }
+
+  /* Stop dispatching before tearing the jobs down */
+  g_clear_pointer (&self->workers, g_ptr_array_unref);
+  g_list_free_full (running, gst_object_unref);
+
+  g_clear_object (&self->signal_dispatcher);
+
+  G_OBJECT_CLASS (parent_class)->dispose (object);
+}
+
+static void
+gst_transcoder_pool_finalize (GObject * object)
+{
+  GstTranscoderPool *self = GST_TRANSCODER_POOL (object);
+
+  g_cond_clear (&self->cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_transcoder_pool_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstTranscoderPool *self = GST_TRANSCODER_POOL (object);
+
+  switch (prop_id) {
+    case PROP_SIGNAL_DISPATCHER:
+      self->signal_dispatcher = g_value_dup_object (value);
+      break;
+    case PROP_N_WORKERS:
+      self->n_workers = g_value_get_uint (value);
+      break;
+    case PROP_MAX_JOBS:
+      GST_OBJECT_LOCK (self);
+      self->max_jobs = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+
+      start_pending_jobs (self);
+      break;
+    case PROP_CPU_USAGE:
+      GST_OBJECT_LOCK (self);
+      self->cpu_usage = g_value_get_uint (value);
+      update_cpu_shares (self);
+      GST_OBJECT_UNLOCK (self);
+
+      start_pending_jobs (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_transcoder_pool_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstTranscoderPool *self = GST_TRANSCODER_POOL (object);
+
+  switch (prop_id) {
+    case PROP_N_WORKERS:
+      g_value_set_uint (value, self->n_workers);
+      break;
+    case PROP_MAX_JOBS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->max_jobs);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_CPU_USAGE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->cpu_usage);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_transcoder_pool_class_init (GstTranscoderPoolClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+
+  gobject_class->set_property = gst_transcoder_pool_set_property;
+  gobject_class->get_property = gst_transcoder_pool_get_property;
+  gobject_class->constructed = gst_transcoder_pool_constructed;
+  gobject_class->dispose = gst_transcoder_pool_dispose;
+  gobject_class->finalize = gst_transcoder_pool_finalize;
+
+  param_specs[PROP_SIGNAL_DISPATCHER] =
+      g_param_spec_object ("signal-dispatcher",
+      "Signal Dispatcher", "Dispatcher for the signals of the jobs",
+      GST_TYPE_TRANSCODER_SIGNAL_DISPATCHER,
+      G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  param_specs[PROP_N_WORKERS] =
+      g_param_spec_uint ("n-workers", "Number of workers",
+      "Number of threads watching the buses of the jobs", 1, 64,
+      DEFAULT_N_WORKERS,
+      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  param_specs[PROP_MAX_JOBS] =
+      g_param_spec_uint ("max-jobs", "Maximum jobs",
+      "Maximum number of jobs running at the same time, 0 means one per CPU",
+      0, G_MAXUINT, DEFAULT_MAX_JOBS,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstTranscoderPool:cpu-usage:
+   *
+   * The percentage of the CPU all the running jobs together should try to
+   * use, see gst_transcoder_set_cpu_usage(). 100 disables throttling.
+   *
+   * When throttling, the running jobs get equal shares of it, recomputed
+   * as jobs start and finish, and no more jobs run than there are CPUs in
+   * the budget, whatever #GstTranscoderPool:max-jobs is. Jobs queued with
+   * their own gst_transcoder_set_cpu_usage() keep it, and it is taken out
+   * of the budget shared by the other jobs.
+   */
+  param_specs[PROP_CPU_USAGE] =
+      g_param_spec_uint ("cpu-usage", "CPU usage",
+      "The percentage of the CPU the running jobs should try to use",
+      1, 100, DEFAULT_CPU_USAGE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (gobject_class, PROP_LAST, param_specs);
+}
+
+static void
+gst_transcoder_pool_init (GstTranscoderPool * self)
+{
+  g_cond_init (&self->cond);
+  g_queue_init (&self->pending);
+
+  self->n_workers = DEFAULT_N_WORKERS;
+  self->max_jobs = DEFAULT_MAX_JOBS;
+  self->cpu_usage = DEFAULT_CPU_USAGE;
+}
+
+static gpointer
+gst_transcoder_pool_init_once (G_GNUC_UNUSED gpointer user_data)
+{
+  gst_init (NULL, NULL);
+
+  GST_DEBUG_CATEGORY_INIT (gst_transcoder_pool_debug, "gst-transcoder-pool",
+      0, "GstTranscoderPool");
+
+  return NULL;
+}
+
+/**
+ * gst_transcoder_pool_new:
+ * @signal_dispatcher: (allow-none): The #GstTranscoderSignalDispatcher to be
+ * used to dispatch the signals of the jobs.
+ *
+ * Returns: a new #GstTranscoderPool instance
+ */
+GstTranscoderPool *
+gst_transcoder_pool_new (GstTranscoderSignalDispatcher * signal_dispatcher)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, gst_transcoder_pool_init_once, NULL);
+
+  return g_object_new (GST_TYPE_TRANSCODER_POOL, "signal-dispatcher",
+      signal_dispatcher, NULL);
+}
+
+/**
+ * gst_transcoder_pool_create_job:
+ * @self: The #GstTranscoderPool to create the job for
+ * @source_uri: The URI of the media stream to transcode
+ * @dest_uri: The URI of the destination of the transcoded stream
+ * @profile: The #GstEncodingProfile defining the output format
+ *
+ * Creates a #GstTranscoder whose bus is watched from one of the worker
+ * threads of the pool, and whose signals are dispatched through the
+ * #GstTranscoderSignalDispatcher of the pool. Connect to its signals and
+ * configure it before queueing it with gst_transcoder_pool_queue_job().
+ *
+ * Returns: a new #GstTranscoder instance
+ */
+GstTranscoder *
+gst_transcoder_pool_create_job (GstTranscoderPool * self,
+    const gchar * source_uri, const gchar * dest_uri,
+    GstEncodingProfile * profile)
+{
+  GstTranscoderPoolWorker *worker;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER_POOL (self), NULL);
+  g_return_val_if_fail (source_uri, NULL);
+  g_return_val_if_fail (dest_uri, NULL);
+
+  GST_OBJECT_LOCK (self);
+  worker = g_ptr_array_index (self->workers,
+      self->next_worker++ % self->workers->len);
+  GST_OBJECT_UNLOCK (self);
+
+  return g_object_new (GST_TYPE_TRANSCODER, "src-uri", source_uri,
+      "dest-uri", dest_uri, "profile", profile,
+      "signal-dispatcher", self->signal_dispatcher,
+      "main-context", worker->context, NULL);
+}
+
+/**
+ * gst_transcoder_pool_queue_job:
+ * @self: The #GstTranscoderPool to run @job in
+ * @job: A #GstTranscoder created with gst_transcoder_pool_create_job()
+ *
+ * Queues @job, it is started as soon as less than
+ * #GstTranscoderPool:max-jobs jobs are running and the
+ * #GstTranscoderPool:cpu-usage budget allows for one more job.
+ *
+ * If @job was given a CPU usage below 100 with
+ * gst_transcoder_set_cpu_usage(), it keeps it instead of getting a share
+ * of the pool budget, and that usage is deducted from the budget. A job
+ * whose own CPU usage is above the whole budget only runs alone.
+ *
+ * When the pool is disposed, its running jobs are stopped with a
+ * #GstTranscoder::error and its pending jobs are never started.
+ */
+void
+gst_transcoder_pool_queue_job (GstTranscoderPool * self, GstTranscoder * job)
+{
+  gint own_cpu_usage;
+
+  g_return_if_fail (GST_IS_TRANSCODER_POOL (self));
+  g_return_if_fail (GST_IS_TRANSCODER (job));
+
+  g_signal_connect (job, "done", G_CALLBACK (job_done_cb), self);
+  g_signal_connect (job, "error", G_CALLBACK (job_error_cb), self);
+
+  /* Jobs throttled on their own keep their CPU usage */
+  own_cpu_usage = gst_transcoder_get_cpu_usage (job);
+  if (own_cpu_usage > 0 && own_cpu_usage < 100)
+    g_object_set_qdata (G_OBJECT (job), OWN_CPU_USAGE_QUARK,
+        GUINT_TO_POINTER (own_cpu_usage));
+
+  GST_OBJECT_LOCK (self);
+  g_queue_push_tail (&self->pending, gst_object_ref (job));
+  GST_OBJECT_UNLOCK (self);
+
+  start_pending_jobs (self);
+}
+
+/**
+ * gst_transcoder_pool_wait:
+ * @self: The #GstTranscoderPool to wait for
+ *
+ * Blocks until all the queued jobs are done. When the signal dispatcher of
+ * the pool dispatches to a #GMainContext, that context has to be running in
+ * another thread.
+ *
+ * Returns: The number of jobs that failed since the last call.
+ */
+guint
+gst_transcoder_pool_wait (GstTranscoderPool * self)
+{
+  guint n_failed;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER_POOL (self), 0);
+
+  GST_OBJECT_LOCK (self);
+  while (!g_queue_is_empty (&self->pending) || self->running)
+    g_cond_wait (&self->cond, GST_OBJECT_GET_LOCK (self));
+  n_failed = self->n_failed;
+  self->n_failed = 0;
+  GST_OBJECT_UNLOCK (self);
+
+  return n_failed;
+}
+
+/**
+ * gst_transcoder_pool_set_max_jobs:
+ * @self: The #GstTranscoderPool to set the maximum number of jobs on
+ * @max_jobs: The maximum number of jobs to run at the same time, 0 for one
+ * per CPU
+ */
+void
+gst_transcoder_pool_set_max_jobs (GstTranscoderPool * self, guint max_jobs)
+{
+  g_return_if_fail (GST_IS_TRANSCODER_POOL (self));
+
+  g_object_set (self, "max-jobs", max_jobs, NULL);
+}
+
+/**
+ * gst_transcoder_pool_get_max_jobs:
+ * @self: The #GstTranscoderPool to get the maximum number of jobs from
+ *
+ * Returns: The maximum number of jobs run at the same time, 0 meaning one
+ * per CPU
+ */
+guint
+gst_transcoder_pool_get_max_jobs (GstTranscoderPool * self)
+{
+  guint val;
+
+  g_return_val_if_fail (GST_IS_TRANSCODER_POOL (self), DEFAULT_MAX_JOBS);
+
+  g_object_get (self, "max-jobs", &val, NULL);
+
+  return val;
+}
+
+/**
+ * gst_transcoder_pool_set_cpu_usage:
+ * @self: The #GstTranscoderPool to limit CPU usage on
+ * @cpu_usage: The percentage of the CPU the running jobs should try to use
+ *
+ * Sets the CPU budget shared by the running jobs, see
+ * #GstTranscoderPool:cpu-usage. The running jobs get their new share right
+ * away.
+ */
+void
+gst_transcoder_pool_set_cpu_usage (GstTranscoderPool * self, guint cpu_usage)
+{
+  g_return_if_fail (GST_IS_TRANSCODER_POOL (self));
+
+  g_object_set (self, "cpu-usage", cpu_usage, NULL);
+}
@@ -0,0 +1,65 @@
+/* GStreamer
+ *
+ * Copyright (C) 2015 Thibault Saunier <tsaunier@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_TRANSCODER_POOL_H
+#define __GST_TRANSCODER_POOL_H
+
+#include <gst/gst.h>
+#include <gst/pbutils/pbutils.h>
+
+#include "gsttranscoder.h"
+
+G_BEGIN_DECLS
+
+/*********** GstTranscoderPool definition  ************/
+#define GST_TYPE_TRANSCODER_POOL (gst_transcoder_pool_get_type ())
+#define GST_TRANSCODER_POOL(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_TRANSCODER_POOL, GstTranscoderPool))
+#define GST_TRANSCODER_POOL_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), GST_TYPE_TRANSCODER_POOL, GstTranscoderPoolClass))
+#define GST_IS_TRANSCODER_POOL(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_TRANSCODER_POOL))
+#define GST_IS_TRANSCODER_POOL_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_TRANSCODER_POOL))
+#define GST_TRANSCODER_POOL_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_TYPE_TRANSCODER_POOL, GstTranscoderPoolClass))
+
+typedef struct _GstTranscoderPool  GstTranscoderPool;
+typedef struct _GstTranscoderPoolClass  GstTranscoderPoolClass;
+
+GType               gst_transcoder_pool_get_type         (void);
+
+GstTranscoderPool * gst_transcoder_pool_new              (GstTranscoderSignalDispatcher *signal_dispatcher);
+
+GstTranscoder *     gst_transcoder_pool_create_job       (GstTranscoderPool * self,
+                                                          const gchar * source_uri,
+                                                          const gchar * dest_uri,
+                                                          GstEncodingProfile * profile);
+
+void                gst_transcoder_pool_queue_job        (GstTranscoderPool * self,
+                                                          GstTranscoder * job);
+
+guint               gst_transcoder_pool_wait             (GstTranscoderPool * self);
+
+void                gst_transcoder_pool_set_max_jobs     (GstTranscoderPool * self,
+                                                          guint max_jobs);
+guint               gst_transcoder_pool_get_max_jobs     (GstTranscoderPool * self);
+
+void                gst_transcoder_pool_set_cpu_usage    (GstTranscoderPool * self,
+                                                          guint cpu_usage);
+
+G_END_DECLS
+
+#endif
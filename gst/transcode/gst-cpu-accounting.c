@@ -0,0 +1,474 @@
+/*
+ * gst-cpu-accounting.c
+ *
+ * Copyright (C) 2015 Thibault Saunier <tsaunier@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <time.h>
+#ifdef HAVE_GETRUSAGE
+#include <sys/resource.h>
+#endif
+#ifdef HAVE_PTHREAD_GETCPUCLOCKID
+#include <pthread.h>
+#endif
+
+#include "gst-cpu-accounting.h"
+
+/**
+ * SECTION: gst-cpu-accounting
+ * @title: GstCpuAccounting
+ * @short_description: CPU time accounting of the threads of a pipeline
+ *
+ * Accounts the CPU time used by the streaming threads of a pipeline. Those
+ * are registered from the GST_STREAM_STATUS_TYPE_ENTER and
+ * GST_STREAM_STATUS_TYPE_LEAVE messages, which are posted from the streaming
+ * threads themselves, see gst_cpu_accounting_handle_message().
+ *
+ * Threads which are not #GstTask threads (for example encoder library worker
+ * threads) can not be attributed to a pipeline, their CPU time is shared
+ * between all the accountings of the process, in proportion to the CPU time
+ * of the threads they track.
+ *
+ * When per thread CPU clocks are not available, the CPU time of the whole
+ * process is used.
+ */
+
+GST_DEBUG_CATEGORY_STATIC (gst_cpu_accounting_debug);
+#define GST_CAT_DEFAULT gst_cpu_accounting_debug
+
+/* Minimum time between two evaluations of the ratio between the process CPU
+ * time and the CPU time of all tracked threads */
+#define GLOBAL_RATIO_PERIOD (100 * GST_MSECOND)
+
+typedef struct
+{
+  guint count;
+  GstClockTime base;
+#ifdef HAVE_PTHREAD_GETCPUCLOCKID
+  clockid_t clock_id;
+#endif
+} ThreadEntry;
+
+struct _GstCpuAccounting
+{
+  gint refcount;
+
+  GMutex lock;
+  GHashTable *threads;          /* GThread -> ThreadEntry */
+  GstClockTime retired;         /* CPU time of the threads which left */
+
+  GstClockTime last_tracked;
+  gdouble attributed;
+};
+
+static GMutex global_lock;
+static GList *accountings = NULL;
+static GstClockTime global_last_eval = GST_CLOCK_TIME_NONE;
+static GstClockTime global_last_process = 0;
+static GstClockTime global_last_tracked = 0;
+static gdouble global_ratio = 1.0;
+
+static GstClockTime
+get_process_cpu_time (void)
+{
+#ifdef HAVE_GETRUSAGE
+  struct rusage ru;
+
+  if (getrusage (RUSAGE_SELF, &ru) == 0)
+    return GST_TIMEVAL_TO_TIME (ru.ru_utime) +
+        GST_TIMEVAL_TO_TIME (ru.ru_stime);
+#endif
+
+  return GST_CLOCK_TIME_NONE;
+}
+
+#ifdef HAVE_PTHREAD_GETCPUCLOCKID
+static GstClockTime
+get_thread_cpu_time (ThreadEntry * entry)
+{
+  struct timespec ts;
+
+  if (clock_gettime (entry->clock_id, &ts) != 0)
+    return GST_CLOCK_TIME_NONE;
+
+  return GST_TIMESPEC_TO_TIME (ts);
+}
+
+/* Call with self->lock */
+static GstClockTime
+get_tracked_time_unlocked (GstCpuAccounting * self)
+{
+  GHashTableIter iter;
+  gpointer value;
+  GstClockTime res = self->retired;
+
+  g_hash_table_iter_init (&iter, self->threads);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    ThreadEntry *entry = value;
+    GstClockTime time = get_thread_cpu_time (entry);
+
+    if (GST_CLOCK_TIME_IS_VALID (time) && time > entry->base)
+      res += time - entry->base;
+  }
+
+  return res;
+}
+
+static gdouble
+get_global_ratio (void)
+{
+  gdouble ratio;
+  GstClockTime now = gst_util_get_timestamp ();
+
+  g_mutex_lock (&global_lock);
+  if (!GST_CLOCK_TIME_IS_VALID (global_last_eval)
+      || now - global_last_eval >= GLOBAL_RATIO_PERIOD) {
+    GList *tmp;
+    GstClockTime tracked = 0, process = get_process_cpu_time ();
+
+    for (tmp = accountings; tmp; tmp = tmp->next) {
+      GstCpuAccounting *accounting = tmp->data;
+
+      g_mutex_lock (&accounting->lock);
+      tracked += get_tracked_time_unlocked (accounting);
+      g_mutex_unlock (&accounting->lock);
+    }
+
+    if (GST_CLOCK_TIME_IS_VALID (process)
+        && GST_CLOCK_TIME_IS_VALID (global_last_eval)
+        && process > global_last_process && tracked > global_last_tracked) {
+      global_ratio = MAX (1.0, (gdouble) (process - global_last_process) /
+          (tracked - global_last_tracked));
+    }
+
+    global_last_eval = now;
+    global_last_process = process;
+    global_last_tracked = tracked;
+  }
+  ratio = global_ratio;
+  g_mutex_unlock (&global_lock);
+
+  return ratio;
+}
+#endif
+
+static gpointer
+init_debug (G_GNUC_UNUSED gpointer data)
+{
+  GST_DEBUG_CATEGORY_INIT (gst_cpu_accounting_debug, "cpuaccounting", 0,
+      "CPU accounting");
+
+  return NULL;
+}
+
+GstCpuAccounting *
+gst_cpu_accounting_new (void)
+{
+  static GOnce once = G_ONCE_INIT;
+  GstCpuAccounting *self;
+
+  g_once (&once, init_debug, NULL);
+
+  self = g_new0 (GstCpuAccounting, 1);
+  self->refcount = 1;
+  g_mutex_init (&self->lock);
+  self->threads = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+  g_mutex_lock (&global_lock);
+  accountings = g_list_prepend (accountings, self);
+  g_mutex_unlock (&global_lock);
+
+  return self;
+}
+
+GstCpuAccounting *
+gst_cpu_accounting_ref (GstCpuAccounting * self)
+{
+  g_return_val_if_fail (self, NULL);
+
+  g_atomic_int_inc (&self->refcount);
+
+  return self;
+}
+
+void
+gst_cpu_accounting_unref (GstCpuAccounting * self)
+{
+  g_return_if_fail (self);
+
+  if (!g_atomic_int_dec_and_test (&self->refcount))
+    return;
+
+  g_mutex_lock (&global_lock);
+  accountings = g_list_remove (accountings, self);
+  g_mutex_unlock (&global_lock);
+
+  g_hash_table_unref (self->threads);
+  g_mutex_clear (&self->lock);
+  g_free (self);
+}
+
+/**
+ * gst_cpu_accounting_thread_enter:
+ * @self: A #GstCpuAccounting
+ *
+ * Starts accounting the CPU time of the calling thread.
+ */
+void
+gst_cpu_accounting_thread_enter (GstCpuAccounting * self)
+{
+#ifdef HAVE_PTHREAD_GETCPUCLOCKID
+  ThreadEntry *entry;
+  GThread *thread = g_thread_self ();
+
+  g_mutex_lock (&self->lock);
+  entry = g_hash_table_lookup (self->threads, thread);
+  if (!entry) {
+    entry = g_new0 (ThreadEntry, 1);
+
+    if (pthread_getcpuclockid (pthread_self (), &entry->clock_id) != 0)
+      goto failed;
+
+    /* Threads come from a pool shared by all pipelines, only account
+     * what is used from now on */
+    entry->base = get_thread_cpu_time (entry);
+    if (!GST_CLOCK_TIME_IS_VALID (entry->base))
+      goto failed;
+
+    GST_LOG ("Accounting thread %p in %p", thread, self);
+    g_hash_table_insert (self->threads, thread, entry);
+  }
+  entry->count++;
+  g_mutex_unlock (&self->lock);
+
+  return;
+
+failed:
+  GST_WARNING ("Could not get CPU clock of thread %p", thread);
+  g_free (entry);
+  g_mutex_unlock (&self->lock);
+#endif
+}
+
+/**
+ * gst_cpu_accounting_thread_leave:
+ * @self: A #GstCpuAccounting
+ *
+ * Stops accounting the CPU time of the calling thread.
+ */
+void
+gst_cpu_accounting_thread_leave (GstCpuAccounting * self)
+{
+#ifdef HAVE_PTHREAD_GETCPUCLOCKID
+  ThreadEntry *entry;
+  GThread *thread = g_thread_self ();
+
+  g_mutex_lock (&self->lock);
+  entry = g_hash_table_lookup (self->threads, thread);
+  if (entry && --entry->count == 0) {
+    GstClockTime time = get_thread_cpu_time (entry);
+
+    if (GST_CLOCK_TIME_IS_VALID (time) && time > entry->base)
+      self->retired += time - entry->base;
+
+    GST_LOG ("Stop accounting thread %p in %p", thread, self);
+    g_hash_table_remove (self->threads, thread);
+  }
+  g_mutex_unlock (&self->lock);
+#endif
+}
+
+/**
+ * gst_cpu_accounting_handle_message:
+ * @self: A #GstCpuAccounting
+ * @message: A #GstMessage
+ *
+ * Starts or stops accounting the calling thread if @message is a
+ * %GST_MESSAGE_STREAM_STATUS of the %GST_STREAM_STATUS_TYPE_ENTER or
+ * %GST_STREAM_STATUS_TYPE_LEAVE type. Must be called synchronously from the
+ * thread posting the message, for example from #GstBin.handle_message.
+ */
+void
+gst_cpu_accounting_handle_message (GstCpuAccounting * self,
+    GstMessage * message)
+{
+  GstStreamStatusType type;
+  GstElement *owner;
+
+  if (GST_MESSAGE_TYPE (message) != GST_MESSAGE_STREAM_STATUS)
+    return;
+
+  gst_message_parse_stream_status (message, &type, &owner);
+  if (type == GST_STREAM_STATUS_TYPE_ENTER)
+    gst_cpu_accounting_thread_enter (self);
+  else if (type == GST_STREAM_STATUS_TYPE_LEAVE)
+    gst_cpu_accounting_thread_leave (self);
+}
+
+/**
+ * gst_cpu_accounting_get_cpu_time:
+ * @self: A #GstCpuAccounting
+ *
+ * Returns: The CPU time attributed to @self so far, or %GST_CLOCK_TIME_NONE
+ * if CPU time can not be measured on the platform.
+ */
+GstClockTime
+gst_cpu_accounting_get_cpu_time (GstCpuAccounting * self)
+{
+#ifdef HAVE_PTHREAD_GETCPUCLOCKID
+  GstClockTime tracked, res;
+  gdouble ratio = get_global_ratio ();
+
+  g_mutex_lock (&self->lock);
+  tracked = get_tracked_time_unlocked (self);
+  if (tracked > self->last_tracked)
+    self->attributed += (tracked - self->last_tracked) * ratio;
+  self->last_tracked = tracked;
+  res = (GstClockTime) self->attributed;
+  g_mutex_unlock (&self->lock);
+
+  return res;
+#else
+  return get_process_cpu_time ();
+#endif
+}
+
+#ifdef __linux__
+static gboolean
+read_cgroup_value (const gchar * path, gdouble * value)
+{
+  gchar *contents;
+  gboolean res = FALSE;
+
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    return FALSE;
+
+  g_strstrip (contents);
+  if (g_strcmp0 (contents, "max")) {
+    *value = g_ascii_strtod (contents, NULL);
+    res = TRUE;
+  }
+  g_free (contents);
+
+  return res;
+}
+
+static gdouble
+read_cgroup2_quota (const gchar * path)
+{
+  gchar *contents;
+  gchar **fields;
+  gdouble res = -1;
+
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    return -1;
+
+  fields = g_strsplit (g_strstrip (contents), " ", 2);
+  if (fields[0] && fields[1] && g_strcmp0 (fields[0], "max")) {
+    gdouble quota = g_ascii_strtod (fields[0], NULL);
+    gdouble period = g_ascii_strtod (fields[1], NULL);
+
+    if (quota > 0 && period > 0)
+      res = quota / period;
+  }
+  g_strfreev (fields);
+  g_free (contents);
+
+  return res;
+}
+
+/* Returns the number of CPUs allowed by the CPU bandwidth controller of the
+ * cgroup we are running in, or -1 if unlimited */
+static gdouble
+get_cgroup_cpu_quota (void)
+{
+  gchar *contents;
+  gdouble quota, period;
+  gdouble res = -1;
+  const gchar *v1_dirs[] =
+      { "/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct", NULL };
+  const gchar **dir;
+
+  /* cgroup v2, the path of our cgroup is in the "0::" line */
+  if (g_file_get_contents ("/proc/self/cgroup", &contents, NULL, NULL)) {
+    gchar **lines = g_strsplit (contents, "\n", -1);
+    gchar **line;
+
+    for (line = lines; *line && res < 0; line++) {
+      if (g_str_has_prefix (*line, "0::")) {
+        gchar *path = g_build_filename ("/sys/fs/cgroup", *line + 3,
+            "cpu.max", NULL);
+
+        res = read_cgroup2_quota (path);
+        g_free (path);
+      }
+    }
+    g_strfreev (lines);
+    g_free (contents);
+  }
+
+  /* Inside a cgroup namespace our cgroup is the root */
+  if (res < 0)
+    res = read_cgroup2_quota ("/sys/fs/cgroup/cpu.max");
+
+  for (dir = v1_dirs; *dir && res < 0; dir++) {
+    gchar *quota_path = g_build_filename (*dir, "cpu.cfs_quota_us", NULL);
+    gchar *period_path = g_build_filename (*dir, "cpu.cfs_period_us", NULL);
+
+    if (read_cgroup_value (quota_path, &quota)
+        && read_cgroup_value (period_path, &period) && quota > 0
+        && period > 0)
+      res = quota / period;
+
+    g_free (quota_path);
+    g_free (period_path);
+  }
+
+  return res;
+}
+#endif
+
+/**
+ * gst_cpu_accounting_get_allowed_cpus:
+ *
+ * Returns: The number of CPUs the process is allowed to use, taking into
+ * account the cgroup CPU quota. It might not be an integer.
+ */
+gdouble
+gst_cpu_accounting_get_allowed_cpus (void)
+{
+  static gsize initialized = 0;
+  static gdouble allowed_cpus = 1.0;
+
+  if (g_once_init_enter (&initialized)) {
+    gdouble quota = -1;
+
+    allowed_cpus = g_get_num_processors ();
+#ifdef __linux__
+    quota = get_cgroup_cpu_quota ();
+#endif
+    if (quota > 0 && quota < allowed_cpus)
+      allowed_cpus = quota;
+
+    g_once_init_leave (&initialized, 1);
+  }
+
+  return allowed_cpus;
+}
@@ -0,0 +1,43 @@
+/*
+ * gst-cpu-accounting.h
+ *
+ * Copyright (C) 2015 Thibault Saunier <tsaunier@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GST_CPU_ACCOUNTING_H__
+#define __GST_CPU_ACCOUNTING_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstCpuAccounting GstCpuAccounting;
+
+GstCpuAccounting * gst_cpu_accounting_new             (void);
+GstCpuAccounting * gst_cpu_accounting_ref             (GstCpuAccounting * self);
+void               gst_cpu_accounting_unref           (GstCpuAccounting * self);
+
+void               gst_cpu_accounting_thread_enter    (GstCpuAccounting * self);
+void               gst_cpu_accounting_thread_leave    (GstCpuAccounting * self);
+void               gst_cpu_accounting_handle_message  (GstCpuAccounting * self,
+                                                       GstMessage * message);
+
+GstClockTime       gst_cpu_accounting_get_cpu_time    (GstCpuAccounting * self);
+gdouble            gst_cpu_accounting_get_allowed_cpus (void);
+
+G_END_DECLS
+
+#endif /* #ifndef __GST_CPU_ACCOUNTING_H__*/
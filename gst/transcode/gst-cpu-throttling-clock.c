@@ -37,17 +37,34 @@ struct _GstCpuThrottlingClockPrivate
   GstClock *sclock;
   GstClockTime current_wait_time;
   GstPoll *timer;
-  struct rusage last_usage;
+  GstCpuAccounting *accounting;
+  GstClockTime last_cpu_time;
 
   GstClockID evaluate_wait_time;
   GstClockTime time_between_evals;
+  GstClockTime last_eval_time;
+
+  /* Time spent throttling, protected by the object lock */
+  GstClockTime waited_time;
+
+  /* Proportional/integral controller state, protected by the object lock */
+  gdouble proportional_gain;
+  gdouble integral_gain;
+  gdouble integral;
 };
 
+#define DEFAULT_PROPORTIONAL_GAIN 20000.0
+#define DEFAULT_INTEGRAL_GAIN 100000.0
+#define DEFAULT_EVALUATION_PERIOD (GST_SECOND / 4)
 
 enum
 {
   PROP_FIRST,
   PROP_CPU_USAGE,
+  PROP_PROPORTIONAL_GAIN,
+  PROP_INTEGRAL_GAIN,
+  PROP_EVALUATION_PERIOD,
+  PROP_WAITED_TIME,
   PROP_LAST
 };
 
@@ -64,6 +81,26 @@ gst_cpu_throttling_clock_get_property (GObject * object,
     case PROP_CPU_USAGE:
       g_value_set_uint (value, self->priv->wanted_cpu_usage);
       break;
+    case PROP_PROPORTIONAL_GAIN:
+      GST_OBJECT_LOCK (self);
+      g_value_set_double (value, self->priv->proportional_gain);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_INTEGRAL_GAIN:
+      GST_OBJECT_LOCK (self);
+      g_value_set_double (value, self->priv->integral_gain);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_EVALUATION_PERIOD:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->priv->time_between_evals);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_WAITED_TIME:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->priv->waited_time);
+      GST_OBJECT_UNLOCK (self);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -82,41 +119,117 @@ gst_cpu_throttling_clock_set_property (GObject * object,
       if (self->priv->wanted_cpu_usage == 0)
         self->priv->wanted_cpu_usage = 100;
       break;
+    case PROP_PROPORTIONAL_GAIN:
+      GST_OBJECT_LOCK (self);
+      self->priv->proportional_gain = g_value_get_double (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_INTEGRAL_GAIN:
+      GST_OBJECT_LOCK (self);
+      self->priv->integral_gain = g_value_get_double (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_EVALUATION_PERIOD:
+    {
+      GstClockID evaluate_wait_time;
+
+      GST_OBJECT_LOCK (self);
+      self->priv->time_between_evals = g_value_get_uint64 (value);
+      /* Restarted with the new period on next wait */
+      evaluate_wait_time = self->priv->evaluate_wait_time;
+      self->priv->evaluate_wait_time = NULL;
+      GST_OBJECT_UNLOCK (self);
+
+      if (evaluate_wait_time) {
+        gst_clock_id_unschedule (evaluate_wait_time);
+        gst_clock_id_unref (evaluate_wait_time);
+      }
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
   }
 }
 
+/* Call with the object lock */
+static GstClockTime
+get_cpu_time_unlocked (GstCpuThrottlingClock * self)
+{
+  struct rusage ru;
+
+  if (self->priv->accounting)
+    return gst_cpu_accounting_get_cpu_time (self->priv->accounting);
+
+  getrusage (RUSAGE_SELF, &ru);
+
+  return GST_TIMEVAL_TO_TIME (ru.ru_utime) + GST_TIMEVAL_TO_TIME (ru.ru_stime);
+}
+
+/* Proportional/integral controller: the error is the difference between the
+ * measured and the wanted CPU usage (in percent), and the output is the time
+ * to wait on each clock wait. The integral term is what makes it settle on
+ * the wanted usage, it is only accumulated while the output is not saturated
+ * so that it does not wind up while we can not wait more (or less). */
 static gboolean
 gst_transcoder_adjust_wait_time (GstClock * sync_clock, GstClockTime time,
     GstClockID id, GstCpuThrottlingClock * self)
 {
-  struct rusage ru;
-  float delta_usage, usage, coef;
+  GstClockTime now, cpu_time;
+  gdouble delta_usage, elapsed, usage, error, output, integral;
 
   GstCpuThrottlingClockPrivate *priv = self->priv;
 
-  getrusage (RUSAGE_SELF, &ru);
-  delta_usage = GST_TIMEVAL_TO_TIME (ru.ru_utime) -
-      GST_TIMEVAL_TO_TIME (self->priv->last_usage.ru_utime);
-  usage =
-      ((float) delta_usage / self->priv->time_between_evals * 100) /
-      g_get_num_processors ();
+  if (priv->wanted_cpu_usage >= 100)
+    return TRUE;
+
+  now = gst_clock_get_time (priv->sclock);
 
-  self->priv->last_usage = ru;
+  GST_OBJECT_LOCK (self);
+  cpu_time = get_cpu_time_unlocked (self);
+  if (!GST_CLOCK_TIME_IS_VALID (priv->last_eval_time)
+      || !GST_CLOCK_TIME_IS_VALID (cpu_time)
+      || !GST_CLOCK_TIME_IS_VALID (priv->last_cpu_time)
+      || now <= priv->last_eval_time) {
+    priv->last_eval_time = now;
+    priv->last_cpu_time = cpu_time;
+    GST_OBJECT_UNLOCK (self);
+
+    return TRUE;
+  }
 
-  coef = GST_MSECOND / 10;
-  if (usage < (gfloat) priv->wanted_cpu_usage) {
-    coef = -coef;
+  /* CPU usage in percent of the CPUs we are allowed to use */
+  delta_usage = cpu_time > priv->last_cpu_time ?
+      cpu_time - priv->last_cpu_time : 0;
+  elapsed = now - priv->last_eval_time;
+  usage = (delta_usage / elapsed * 100) /
+      gst_cpu_accounting_get_allowed_cpus ();
+
+  priv->last_cpu_time = cpu_time;
+  priv->last_eval_time = now;
+
+  error = usage - (gdouble) priv->wanted_cpu_usage;
+  integral = priv->integral + error * (elapsed / GST_SECOND);
+
+  output = priv->proportional_gain * error + priv->integral_gain * integral;
+  if (output <= 0) {
+    output = 0;
+    if (error > 0)
+      priv->integral = integral;
+  } else if (output >= GST_SECOND) {
+    output = GST_SECOND;
+    if (error < 0)
+      priv->integral = integral;
+  } else {
+    priv->integral = integral;
   }
 
-  priv->current_wait_time = CLAMP (0,
-      (GstClockTime) priv->current_wait_time + coef, GST_SECOND);
+  priv->current_wait_time = (GstClockTime) output;
+  GST_OBJECT_UNLOCK (self);
 
   GST_DEBUG_OBJECT (self,
       "Avg is %f (wanted %d) => %" GST_TIME_FORMAT, usage,
-      self->priv->wanted_cpu_usage, GST_TIME_ARGS (priv->current_wait_time));
+      priv->wanted_cpu_usage, GST_TIME_ARGS (priv->current_wait_time));
 
   return TRUE;
 }
@@ -124,8 +237,18 @@ gst_transcoder_adjust_wait_time (GstClock * sync_clock, GstClockTime time,
 static GstClockReturn
 _wait (GstClock * clock, GstClockEntry * entry, GstClockTimeDiff * jitter)
 {
+  GstClockTime start;
   GstCpuThrottlingClock *self = GST_CPU_THROTTLING_CLOCK (clock);
 
+  /* Not throttling, never block */
+  if (self->priv->wanted_cpu_usage >= 100) {
+    if (G_UNLIKELY (GST_CLOCK_ENTRY_STATUS (entry) == GST_CLOCK_UNSCHEDULED))
+      return GST_CLOCK_UNSCHEDULED;
+
+    return GST_CLOCK_OK;
+  }
+
+  GST_OBJECT_LOCK (self);
   if (!self->priv->evaluate_wait_time) {
     if (!(self->priv->sclock)) {
       GST_ERROR_OBJECT (clock, "Could not find any system clock"
@@ -141,14 +264,20 @@ _wait (GstClock * clock, GstClockEntry * entry, GstClockTimeDiff * jitter)
           (gpointer) self, NULL);
     }
   }
+  GST_OBJECT_UNLOCK (self);
 
   if (G_UNLIKELY (GST_CLOCK_ENTRY_STATUS (entry) == GST_CLOCK_UNSCHEDULED))
     return GST_CLOCK_UNSCHEDULED;
 
+  start = gst_util_get_timestamp ();
   if (gst_poll_wait (self->priv->timer, self->priv->current_wait_time)) {
     GST_INFO_OBJECT (self, "Something happened on the poll");
   }
 
+  GST_OBJECT_LOCK (self);
+  self->priv->waited_time += gst_util_get_timestamp () - start;
+  GST_OBJECT_UNLOCK (self);
+
   return GST_CLOCK_ENTRY_STATUS (entry);
 }
 
@@ -170,6 +299,15 @@ gst_cpu_throttling_clock_dispose (GObject * object)
     gst_clock_id_unref (self->priv->evaluate_wait_time);
     self->priv->evaluate_wait_time = 0;
   }
+
+  GST_OBJECT_LOCK (self);
+  if (self->priv->accounting) {
+    gst_cpu_accounting_unref (self->priv->accounting);
+    self->priv->accounting = NULL;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  G_OBJECT_CLASS (parent_class)->dispose (object);
 }
 
 static void
@@ -190,13 +328,69 @@ gst_cpu_throttling_clock_class_init (GstCpuThrottlingClockClass * klass)
   /**
    * GstCpuThrottlingClock:cpu-usage:
    *
+   * The CPU usage to target. When set to 100, the clock does not throttle
+   * and never blocks.
+   *
    * Since: UNRELEASED
    */
   param_specs[PROP_CPU_USAGE] = g_param_spec_uint ("cpu-usage", "cpu-usage",
-      "The percentage of CPU to try to use with the processus running the "
-      "pipeline driven by the clock", 0, 100,
+      "The percentage of the allowed CPUs to try to use with the threads "
+      "of the pipeline driven by the clock", 0, 100,
       100, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+  /**
+   * GstCpuThrottlingClock:proportional-gain:
+   *
+   * Nanoseconds of wait time added per percent of difference between the
+   * measured and the wanted CPU usage.
+   *
+   * Since: UNRELEASED
+   */
+  param_specs[PROP_PROPORTIONAL_GAIN] =
+      g_param_spec_double ("proportional-gain", "Proportional gain",
+      "Proportional gain of the CPU usage controller (in nanoseconds of wait"
+      " per percent of CPU usage error)", 0, G_MAXDOUBLE,
+      DEFAULT_PROPORTIONAL_GAIN, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstCpuThrottlingClock:integral-gain:
+   *
+   * Nanoseconds of wait time added per percent of CPU usage error
+   * accumulated over one second.
+   *
+   * Since: UNRELEASED
+   */
+  param_specs[PROP_INTEGRAL_GAIN] =
+      g_param_spec_double ("integral-gain", "Integral gain",
+      "Integral gain of the CPU usage controller (in nanoseconds of wait"
+      " per percent of CPU usage error and per second)", 0, G_MAXDOUBLE,
+      DEFAULT_INTEGRAL_GAIN, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstCpuThrottlingClock:evaluation-period:
+   *
+   * Time between two evaluations of the CPU usage.
+   *
+   * Since: UNRELEASED
+   */
+  param_specs[PROP_EVALUATION_PERIOD] =
+      g_param_spec_uint64 ("evaluation-period", "Evaluation period",
+      "Time between two evaluations of the CPU usage", GST_MSECOND,
+      G_MAXUINT64, DEFAULT_EVALUATION_PERIOD,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstCpuThrottlingClock:waited-time:
+   *
+   * Total time spent blocking in clock waits to throttle the pipeline.
+   *
+   * Since: UNRELEASED
+   */
+  param_specs[PROP_WAITED_TIME] =
+      g_param_spec_uint64 ("waited-time", "Waited time",
+      "Total time spent throttling in clock waits", 0, G_MAXUINT64, 0,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (oclass, PROP_LAST, param_specs);
 
   clock_klass->wait = GST_DEBUG_FUNCPTR (_wait);
@@ -209,14 +403,15 @@ gst_cpu_throttling_clock_init (GstCpuThrottlingClock * self)
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
       GST_TYPE_CPU_THROTTLING_CLOCK, GstCpuThrottlingClockPrivate);
 
-  self->priv->current_wait_time = GST_MSECOND;
+  self->priv->current_wait_time = 0;
   self->priv->wanted_cpu_usage = 100;
   self->priv->timer = gst_poll_new_timer ();
-  self->priv->time_between_evals = GST_SECOND / 4;
+  self->priv->time_between_evals = DEFAULT_EVALUATION_PERIOD;
+  self->priv->last_eval_time = GST_CLOCK_TIME_NONE;
+  self->priv->proportional_gain = DEFAULT_PROPORTIONAL_GAIN;
+  self->priv->integral_gain = DEFAULT_INTEGRAL_GAIN;
   self->priv->sclock = GST_CLOCK (gst_system_clock_obtain ());
-
-
-  getrusage (RUSAGE_SELF, &self->priv->last_usage);
+  self->priv->last_cpu_time = GST_CLOCK_TIME_NONE;
 }
 
 GstCpuThrottlingClock *
@@ -225,3 +420,25 @@ gst_cpu_throttling_clock_new (guint cpu_usage)
   return g_object_new (GST_TYPE_CPU_THROTTLING_CLOCK, "cpu-usage",
       cpu_usage, NULL);
 }
+
+/**
+ * gst_cpu_throttling_clock_set_accounting:
+ * @self: A #GstCpuThrottlingClock
+ * @accounting: (allow-none): the #GstCpuAccounting of the pipeline
+ *
+ * Sets the #GstCpuAccounting used to measure the CPU usage of the pipeline
+ * driven by the clock. If not set, the CPU usage of the whole process is
+ * used.
+ */
+void
+gst_cpu_throttling_clock_set_accounting (GstCpuThrottlingClock * self,
+    GstCpuAccounting * accounting)
+{
+  GST_OBJECT_LOCK (self);
+  if (self->priv->accounting)
+    gst_cpu_accounting_unref (self->priv->accounting);
+  self->priv->accounting =
+      accounting ? gst_cpu_accounting_ref (accounting) : NULL;
+  self->priv->last_cpu_time = GST_CLOCK_TIME_NONE;
+  GST_OBJECT_UNLOCK (self);
+}
@@ -25,6 +25,8 @@
 #include <glib-object.h>
 #include <gst/gst.h>
 
+#include "gst-cpu-accounting.h"
+
 G_BEGIN_DECLS
 
 typedef struct _GstCpuThrottlingClock GstCpuThrottlingClock;
@@ -54,6 +56,8 @@ struct _GstCpuThrottlingClock
 };
 
 GstCpuThrottlingClock * gst_cpu_throttling_clock_new (guint cpu_usage);
+void gst_cpu_throttling_clock_set_accounting (GstCpuThrottlingClock * self,
+                                              GstCpuAccounting * accounting);
 
 G_END_DECLS
 
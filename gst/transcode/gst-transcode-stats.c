@@ -0,0 +1,445 @@
+/*
+ * gst-transcode-stats.c
+ *
+ * Copyright (C) 2015 Thibault Saunier <tsaunier@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gst-transcode-stats.h"
+
+/**
+ * SECTION: gst-transcode-stats
+ * @title: GstTranscodeStats
+ * @short_description: Throughput and latency of the stages of a transcoding
+ *
+ * Counts the buffers and bytes going in and out of the decoders, the
+ * encoders and of each decoded stream (from the decoder output to the
+ * encoder input, that is through the filters and queues), and measures the
+ * time each buffer spends in between. Everything is done from pad probes
+ * which are only installed on the tracked pads, nothing is paid when no
+ * stats are collected.
+ */
+
+GST_DEBUG_CATEGORY_STATIC (gst_transcode_stats_debug);
+#define GST_CAT_DEFAULT gst_transcode_stats_debug
+
+/* Latencies are histogrammed in power of two microseconds buckets */
+#define LATENCY_BUCKETS 32
+/* Buffers the output is never matched with, for example the ones dropped
+ * by a decoder, are forgotten after that many newer ones */
+#define MAX_PENDING_BUFFERS 64
+
+typedef struct
+{
+  guint64 count;
+  GstClockTime total;
+  guint64 buckets[LATENCY_BUCKETS];
+} Latency;
+
+typedef struct
+{
+  GstClockTime pts;
+  GstClockTime entered;
+} PendingBuffer;
+
+/* Buffers going through one stage, from @in_pad to @out_pad, all the
+ * counters are protected by the stats lock */
+typedef struct
+{
+  GstTranscodeStats *stats;
+  const gchar *stage;
+  gchar *name;
+  gchar *stream_id;
+
+  GstPad *in_pad;
+  GstPad *out_pad;
+  gulong in_probe;
+  gulong out_probe;
+
+  guint64 frames_in;
+  guint64 bytes_in;
+  guint64 frames_out;
+  guint64 bytes_out;
+  GQueue pending;
+  Latency latency;
+} Stage;
+
+struct _GstTranscodeStats
+{
+  GMutex lock;
+  GList *stages;
+};
+
+static void
+stage_reset (Stage * stage)
+{
+  stage->frames_in = stage->bytes_in = 0;
+  stage->frames_out = stage->bytes_out = 0;
+  g_queue_foreach (&stage->pending, (GFunc) g_free, NULL);
+  g_queue_clear (&stage->pending);
+  memset (&stage->latency, 0, sizeof (Latency));
+}
+
+static void
+stage_free (Stage * stage)
+{
+  gst_pad_remove_probe (stage->in_pad, stage->in_probe);
+  gst_object_unref (stage->in_pad);
+  if (stage->out_pad) {
+    gst_pad_remove_probe (stage->out_pad, stage->out_probe);
+    gst_object_unref (stage->out_pad);
+  }
+
+  stage_reset (stage);
+  g_free (stage->name);
+  g_free (stage->stream_id);
+  g_free (stage);
+}
+
+static void
+get_buffers_info (GstPadProbeInfo * info, guint * frames, gsize * bytes,
+    GstClockTime * pts)
+{
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+    *frames = 1;
+    *bytes = gst_buffer_get_size (buffer);
+    *pts = GST_BUFFER_PTS (buffer);
+  } else {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+
+    *frames = gst_buffer_list_length (list);
+    *bytes = gst_buffer_list_calculate_size (list);
+    *pts = GST_CLOCK_TIME_NONE;
+  }
+}
+
+static GstPadProbeReturn
+stage_in_probe (GstPad * pad, GstPadProbeInfo * info, Stage * stage)
+{
+  guint frames;
+  gsize bytes;
+  GstClockTime pts;
+
+  get_buffers_info (info, &frames, &bytes, &pts);
+
+  g_mutex_lock (&stage->stats->lock);
+  stage->frames_in += frames;
+  stage->bytes_in += bytes;
+
+  if (stage->out_pad && GST_CLOCK_TIME_IS_VALID (pts)) {
+    PendingBuffer *pending = g_new (PendingBuffer, 1);
+
+    if (g_queue_get_length (&stage->pending) >= MAX_PENDING_BUFFERS)
+      g_free (g_queue_pop_head (&stage->pending));
+
+    pending->pts = pts;
+    pending->entered = gst_util_get_timestamp ();
+    g_queue_push_tail (&stage->pending, pending);
+  }
+  g_mutex_unlock (&stage->stats->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gint
+compare_pending_pts (PendingBuffer * pending, GstClockTime * pts)
+{
+  return pending->pts == *pts ? 0 : 1;
+}
+
+static void
+latency_add (Latency * latency, GstClockTime time)
+{
+  guint64 usecs = time / GST_USECOND;
+  guint bucket = usecs ? g_bit_storage (usecs) - 1 : 0;
+
+  latency->count++;
+  latency->total += time;
+  latency->buckets[MIN (bucket, LATENCY_BUCKETS - 1)]++;
+}
+
+/* Upper bound of the bucket containing the @percent th percentile */
+static GstClockTime
+latency_get_percentile (Latency * latency, guint percent)
+{
+  guint i;
+  guint64 wanted, seen = 0;
+
+  if (!latency->count)
+    return GST_CLOCK_TIME_NONE;
+
+  wanted = (latency->count * percent + 99) / 100;
+  for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+    seen += latency->buckets[i];
+    if (seen >= wanted)
+      break;
+  }
+
+  return GST_USECOND << (i + 1);
+}
+
+/* Output buffers are matched with the input ones by PTS, decoders and
+ * encoders reorder frames. When nothing matches, the oldest pending buffer
+ * is used as long as it is not in the future. */
+static GstPadProbeReturn
+stage_out_probe (GstPad * pad, GstPadProbeInfo * info, Stage * stage)
+{
+  guint frames;
+  gsize bytes;
+  GList *link;
+  GstClockTime pts, now = gst_util_get_timestamp ();
+
+  get_buffers_info (info, &frames, &bytes, &pts);
+
+  g_mutex_lock (&stage->stats->lock);
+  stage->frames_out += frames;
+  stage->bytes_out += bytes;
+
+  if (GST_CLOCK_TIME_IS_VALID (pts)) {
+    link = g_queue_find_custom (&stage->pending, &pts,
+        (GCompareFunc) compare_pending_pts);
+    if (!link && stage->pending.head
+        && ((PendingBuffer *) stage->pending.head->data)->pts <= pts)
+      link = stage->pending.head;
+
+    if (link) {
+      PendingBuffer *pending = link->data;
+
+      if (now > pending->entered)
+        latency_add (&stage->latency, now - pending->entered);
+      g_queue_delete_link (&stage->pending, link);
+      g_free (pending);
+    }
+  }
+  g_mutex_unlock (&stage->stats->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+stage_add (GstTranscodeStats * self, const gchar * stage_name,
+    const gchar * name, const gchar * stream_id, GstPad * in_pad,
+    GstPad * out_pad)
+{
+  Stage *stage = g_new0 (Stage, 1);
+
+  stage->stats = self;
+  stage->stage = stage_name;
+  stage->name = g_strdup (name);
+  stage->stream_id = g_strdup (stream_id);
+  g_queue_init (&stage->pending);
+
+  stage->in_pad = gst_object_ref (in_pad);
+  stage->in_probe = gst_pad_add_probe (in_pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      (GstPadProbeCallback) stage_in_probe, stage, NULL);
+
+  if (out_pad) {
+    stage->out_pad = gst_object_ref (out_pad);
+    stage->out_probe = gst_pad_add_probe (out_pad,
+        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+        (GstPadProbeCallback) stage_out_probe, stage, NULL);
+  }
+
+  GST_DEBUG ("Tracking %s %s", stage_name, name);
+
+  g_mutex_lock (&self->lock);
+  self->stages = g_list_append (self->stages, stage);
+  g_mutex_unlock (&self->lock);
+}
+
+static gpointer
+init_debug (G_GNUC_UNUSED gpointer data)
+{
+  GST_DEBUG_CATEGORY_INIT (gst_transcode_stats_debug, "transcodestats", 0,
+      "Transcoding statistics");
+
+  return NULL;
+}
+
+GstTranscodeStats *
+gst_transcode_stats_new (void)
+{
+  static GOnce once = G_ONCE_INIT;
+  GstTranscodeStats *self;
+
+  g_once (&once, init_debug, NULL);
+
+  self = g_new0 (GstTranscodeStats, 1);
+  g_mutex_init (&self->lock);
+
+  return self;
+}
+
+void
+gst_transcode_stats_free (GstTranscodeStats * self)
+{
+  g_list_free_full (self->stages, (GDestroyNotify) stage_free);
+  g_mutex_clear (&self->lock);
+  g_free (self);
+}
+
+/**
+ * gst_transcode_stats_track_element:
+ * @self: A #GstTranscodeStats
+ * @element: The decoder or encoder to track
+ * @stage: A static string describing what @element does, "decoder" or
+ *   "encoder" for example
+ *
+ * Tracks the buffers going from the first sink pad of @element to its first
+ * src pad.
+ */
+void
+gst_transcode_stats_track_element (GstTranscodeStats * self,
+    GstElement * element, const gchar * stage)
+{
+  gchar *name;
+  GstPad *sinkpad = NULL, *srcpad = NULL;
+
+  GST_OBJECT_LOCK (element);
+  if (element->sinkpads)
+    sinkpad = gst_object_ref (element->sinkpads->data);
+  if (element->srcpads)
+    srcpad = gst_object_ref (element->srcpads->data);
+  GST_OBJECT_UNLOCK (element);
+
+  if (sinkpad && srcpad) {
+    name = gst_object_get_name (GST_OBJECT (element));
+    stage_add (self, stage, name, NULL, sinkpad, srcpad);
+    g_free (name);
+  }
+
+  gst_clear_object (&sinkpad);
+  gst_clear_object (&srcpad);
+}
+
+/**
+ * gst_transcode_stats_track_stream:
+ * @self: A #GstTranscodeStats
+ * @stream_id: The id of the stream
+ * @decoded_pad: The pad the stream comes out of the decoders from
+ * @encoder_pad: (allow-none): The pad the stream goes into the encoders
+ *   through
+ *
+ * Tracks the buffers of a decoded stream, from @decoded_pad to @encoder_pad.
+ * Only the buffers coming out of the decoders are counted when
+ * @encoder_pad is %NULL.
+ */
+void
+gst_transcode_stats_track_stream (GstTranscodeStats * self,
+    const gchar * stream_id, GstPad * decoded_pad, GstPad * encoder_pad)
+{
+  gchar *name = gst_object_get_name (GST_OBJECT (decoded_pad));
+
+  stage_add (self, "stream", name, stream_id, decoded_pad, encoder_pad);
+  g_free (name);
+}
+
+/**
+ * gst_transcode_stats_prune:
+ * @self: A #GstTranscodeStats
+ * @ancestor: The bin the stages are run in
+ *
+ * Stops tracking the stages living outside of @ancestor, the ones which are
+ * kept get their counters reset. It must be called while no data is flowing.
+ */
+void
+gst_transcode_stats_prune (GstTranscodeStats * self, GstObject * ancestor)
+{
+  GList *tmp, *next;
+
+  g_mutex_lock (&self->lock);
+  for (tmp = self->stages; tmp; tmp = next) {
+    Stage *stage = tmp->data;
+
+    next = tmp->next;
+    if (gst_object_has_as_ancestor (GST_OBJECT (stage->in_pad), ancestor)) {
+      stage_reset (stage);
+    } else {
+      stage_free (stage);
+      self->stages = g_list_delete_link (self->stages, tmp);
+    }
+  }
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+append_structure (GValue * array, GstStructure * structure)
+{
+  GValue value = G_VALUE_INIT;
+
+  g_value_init (&value, GST_TYPE_STRUCTURE);
+  g_value_take_boxed (&value, structure);
+  gst_value_array_append_and_take_value (array, &value);
+}
+
+/**
+ * gst_transcode_stats_get_structure:
+ * @self: A #GstTranscodeStats
+ *
+ * Returns: (transfer full): A "transcode-stats" #GstStructure with a
+ * "streams" and an "elements" array of structures holding the frames-in,
+ * bytes-in, frames-out, bytes-out, latency-average and latency-p99 of each
+ * stage.
+ */
+GstStructure *
+gst_transcode_stats_get_structure (GstTranscodeStats * self)
+{
+  GList *tmp;
+  GstStructure *res;
+  GValue streams = G_VALUE_INIT, elements = G_VALUE_INIT;
+
+  g_value_init (&streams, GST_TYPE_ARRAY);
+  g_value_init (&elements, GST_TYPE_ARRAY);
+
+  g_mutex_lock (&self->lock);
+  for (tmp = self->stages; tmp; tmp = tmp->next) {
+    Stage *stage = tmp->data;
+    GstStructure *s = gst_structure_new (stage->stage,
+        "name", G_TYPE_STRING, stage->name,
+        "frames-in", G_TYPE_UINT64, stage->frames_in,
+        "bytes-in", G_TYPE_UINT64, stage->bytes_in,
+        "frames-out", G_TYPE_UINT64, stage->frames_out,
+        "bytes-out", G_TYPE_UINT64, stage->bytes_out,
+        "latency-average", G_TYPE_UINT64, stage->latency.count ?
+        stage->latency.total / stage->latency.count : GST_CLOCK_TIME_NONE,
+        "latency-p99", G_TYPE_UINT64,
+        latency_get_percentile (&stage->latency, 99), NULL);
+
+    if (stage->stream_id)
+      gst_structure_set (s, "stream-id", G_TYPE_STRING, stage->stream_id,
+          NULL);
+
+    if (g_str_equal (stage->stage, "stream"))
+      append_structure (&streams, s);
+    else
+      append_structure (&elements, s);
+  }
+  g_mutex_unlock (&self->lock);
+
+  res = gst_structure_new_empty ("transcode-stats");
+  gst_structure_take_value (res, "streams", &streams);
+  gst_structure_take_value (res, "elements", &elements);
+
+  return res;
+}
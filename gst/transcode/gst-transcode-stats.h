@@ -0,0 +1,46 @@
+/*
+ * gst-transcode-stats.h
+ *
+ * Copyright (C) 2015 Thibault Saunier <tsaunier@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GST_TRANSCODE_STATS_H__
+#define __GST_TRANSCODE_STATS_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstTranscodeStats GstTranscodeStats;
+
+GstTranscodeStats * gst_transcode_stats_new            (void);
+void                gst_transcode_stats_free           (GstTranscodeStats * self);
+
+void                gst_transcode_stats_track_element  (GstTranscodeStats * self,
+                                                        GstElement * element,
+                                                        const gchar * stage);
+void                gst_transcode_stats_track_stream   (GstTranscodeStats * self,
+                                                        const gchar * stream_id,
+                                                        GstPad * decoded_pad,
+                                                        GstPad * encoder_pad);
+void                gst_transcode_stats_prune          (GstTranscodeStats * self,
+                                                        GstObject * ancestor);
+
+GstStructure *      gst_transcode_stats_get_structure  (GstTranscodeStats * self);
+
+G_END_DECLS
+
+#endif /* #ifndef __GST_TRANSCODE_STATS_H__*/
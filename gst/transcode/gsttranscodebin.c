@@ -23,9 +23,13 @@
 #endif
 
 #include "gsttranscoding.h"
+#include "gst-cpu-accounting.h"
+#include "gst-transcode-stats.h"
 #include <gst/pbutils/pbutils.h>
+#include <gst/video/video.h>
 
 #include <gst/pbutils/missing-plugins.h>
+#include <string.h>
 
 GST_DEBUG_CATEGORY_STATIC (gst_transcodebin_debug);
 #define GST_CAT_DEFAULT gst_transcodebin_debug
@@ -42,20 +46,118 @@ GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS_ANY);
 
+static GstStaticPadTemplate transcode_bin_extra_src_template =
+GST_STATIC_PAD_TEMPLATE ("src_%u",
+    GST_PAD_SRC,
+    GST_PAD_SOMETIMES,
+    GST_STATIC_CAPS_ANY);
+
 typedef struct
 {
   GstBin parent;
 
   GstElement *decodebin;
   GstElement *encodebin;
+  GList *extra_encodebins;
+  /* tees and queues, protected by the object lock */
+  GList *stream_elements;
 
   GstEncodingProfile *profile;
+  /* Encoders kept alive across runs, the pads are protected by the object
+   * lock */
+  gboolean reuse_encoders;
+  GstEncodingProfile *encodebin_profile;
+  GList *encodebin_sinkpads;
+  GList *free_encodebin_sinkpads;
+  GPtrArray *extra_profiles;
+  GList *extra_srcpads;
   gboolean avoid_reencoding;
   GstPad *sinkpad;
   GstPad *srcpad;
 
   GstElement *audio_filter;
   GstElement *video_filter;
+  gchar *audio_filter_description;
+  gchar *video_filter_description;
+
+  GstTranscodeBinHardwarePolicy hardware_policy;
+  gboolean zero_copy;
+
+  /* ISO MP4 muxers configured following mp4_mode, all protected by the
+   * object lock */
+  GstTranscodeBinMp4Mode mp4_mode;
+  GList *mp4_muxers;
+  gboolean mp4_moov_reserved;
+
+  /* Multipass encoding of the video encoders, protected by the object
+   * lock */
+  guint pass;
+  gchar *multipass_cache_file;
+  /* Set when hardware frames go straight from decoders to encoders,
+   * protected by the object lock */
+  gboolean no_video_conversion;
+
+  /* Pools proposed to the decoders, protected by the object lock */
+  gboolean allocation_pool;
+  guint allocation_pool_min_buffers;
+  guint allocation_pool_max_buffers;
+  guint allocation_pool_alignment;
+
+  /* Thread boundaries, protected by the object lock */
+  gboolean insert_queues;
+  guint queue_max_size_buffers;
+  guint queue_max_size_bytes;
+  guint64 queue_max_size_time;
+
+  /* Range to transcode, decodebin srcpads are blocked until the initial
+   * seek is done, protected by the object lock */
+  GstClockTime start_time;
+  GstClockTime stop_time;
+  GstTranscodeBinSeekMode seek_mode;
+  gboolean initial_seek_done;
+  GList *blocked_pads;
+
+  /* Live transcoding, the raw frames reaching the encoders later than the
+   * latency budget are dropped, protected by the object lock */
+  gboolean live;
+  GstClockTime latency_budget;
+  /* Only accessed atomically */
+  volatile gint late_buffers;
+
+  /* Work dropped to meet the deadline, protected by the object lock but the
+   * level which is only accessed atomically */
+  GstClockTime deadline;
+  volatile gint degradation_level;
+  GList *video_encoders;
+  guint n_video_streams;
+  guint n_audio_streams;
+  GstClockTime degradation_start;
+  GstClockTime degradation_last_check;
+  GstClockTime degradation_last_change;
+  GstClockTime degradation_last_cpu_time;
+
+  /* Stream classification, protected by the object lock */
+  GstCaps *input_caps;
+  GHashTable *classified_streams;
+
+  /* Only tracked while collect_stats is set, protected by the object lock */
+  gboolean collect_stats;
+  GstTranscodeStats *stats;
+
+  /* Furthest stream time reached by the buffers going into the encoders,
+   * in milliseconds, only accessed atomically */
+  volatile gint progress_ms;
+
+  /* Token bucket pacing the encoders, all protected by bucket_lock */
+  GMutex bucket_lock;
+  GCond bucket_cond;
+  gboolean bucket_flushing;
+  GstClockTime cpu_budget;
+  gdouble tokens;
+  GstClockTime last_refill;
+  GstClockTime last_cpu_time;
+  GstClockTime pacing_time;
+  GstCpuAccounting *encoder_accounting;
 } GstTranscodeBin;
 
 typedef struct
@@ -73,6 +175,37 @@ typedef struct
 #define GST_TRANSCODE_BIN_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_TRANSCODE_BIN_TYPE, GstTranscodeBinClass))
 
 #define DEFAULT_AVOID_REENCODING   FALSE
+#define DEFAULT_CPU_BUDGET   0
+#define DEFAULT_START_TIME   0
+#define DEFAULT_STOP_TIME   GST_CLOCK_TIME_NONE
+#define DEFAULT_SEEK_MODE   GST_TRANSCODE_BIN_SEEK_MODE_ACCURATE
+#define DEFAULT_LIVE   FALSE
+#define DEFAULT_LATENCY_BUDGET   (2 * GST_SECOND)
+#define DEFAULT_DEADLINE   GST_CLOCK_TIME_NONE
+/* How often the progress is compared to the deadline, and how long an
+ * adjustment is given to show its effect before degrading further */
+#define DEGRADATION_CHECK_INTERVAL   GST_SECOND
+#define DEGRADATION_SETTLE_TIME   (5 * GST_SECOND)
+/* Share of the allowed CPUs the encoders have to use for the job to be
+ * considered CPU bound, degrading would not make it faster otherwise */
+#define DEGRADATION_CPU_BOUND_RATIO   0.5
+#define DEFAULT_HARDWARE_POLICY   GST_TRANSCODE_BIN_HARDWARE_POLICY_AUTO
+#define DEFAULT_MP4_MODE   GST_TRANSCODE_BIN_MP4_MODE_NORMAL
+/* In milliseconds, as the qtmux fragment-duration property */
+#define MP4_FRAGMENT_DURATION   1000
+#define MP4_MOOV_UPDATE_PERIOD   GST_SECOND
+#define DEFAULT_PASS   0
+#define DEFAULT_REUSE_ENCODERS   FALSE
+#define DEFAULT_COLLECT_STATS   FALSE
+#define DEFAULT_ZERO_COPY   TRUE
+#define DEFAULT_ALLOCATION_POOL   FALSE
+#define DEFAULT_ALLOCATION_POOL_MIN_BUFFERS   4
+#define DEFAULT_ALLOCATION_POOL_MAX_BUFFERS   8
+#define DEFAULT_ALLOCATION_POOL_ALIGNMENT   64
+#define DEFAULT_INSERT_QUEUES   TRUE
+#define DEFAULT_QUEUE_MAX_SIZE_BUFFERS   5
+#define DEFAULT_QUEUE_MAX_SIZE_BYTES   0
+#define DEFAULT_QUEUE_MAX_SIZE_TIME   0
 
 G_DEFINE_TYPE (GstTranscodeBin, gst_transcode_bin, GST_TYPE_BIN)
 enum
@@ -82,9 +215,104 @@ enum
  PROP_AVOID_REENCODING,
  PROP_VIDEO_FILTER,
  PROP_AUDIO_FILTER,
+ PROP_CPU_BUDGET,
+ PROP_START_TIME,
+ PROP_STOP_TIME,
+ PROP_EXTRA_PROFILES,
+ PROP_VIDEO_FILTER_DESCRIPTION,
+ PROP_AUDIO_FILTER_DESCRIPTION,
+ PROP_INSERT_QUEUES,
+ PROP_QUEUE_MAX_SIZE_BUFFERS,
+ PROP_QUEUE_MAX_SIZE_BYTES,
+ PROP_QUEUE_MAX_SIZE_TIME,
+ PROP_HARDWARE_POLICY,
+ PROP_ZERO_COPY,
+ PROP_ALLOCATION_POOL,
+ PROP_ALLOCATION_POOL_MIN_BUFFERS,
+ PROP_ALLOCATION_POOL_MAX_BUFFERS,
+ PROP_ALLOCATION_POOL_ALIGNMENT,
+ PROP_REUSE_ENCODERS,
+ PROP_COLLECT_STATS,
+ PROP_STATS,
+ PROP_PROGRESS,
+ PROP_MP4_MODE,
+ PROP_PASS,
+ PROP_MULTIPASS_CACHE_FILE,
+ PROP_SEEK_MODE,
+ PROP_LIVE,
+ PROP_LATENCY_BUDGET,
+ PROP_DEADLINE,
  LAST_PROP
 };
 
+GType
+gst_transcode_bin_hardware_policy_get_type (void)
+{
+  static gsize id = 0;
+  static const GEnumValue values[] = {
+    {GST_TRANSCODE_BIN_HARDWARE_POLICY_AUTO,
+        "Pick codecs by rank", "auto"},
+    {GST_TRANSCODE_BIN_HARDWARE_POLICY_PREFER,
+        "Prefer hardware video codecs", "prefer"},
+    {GST_TRANSCODE_BIN_HARDWARE_POLICY_REQUIRE,
+        "Only use hardware video codecs", "require"},
+    {GST_TRANSCODE_BIN_HARDWARE_POLICY_FORBID,
+        "Never use hardware video codecs", "forbid"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&id)) {
+    GType tmp = g_enum_register_static ("GstTranscodeBinHardwarePolicy",
+        values);
+    g_once_init_leave (&id, tmp);
+  }
+
+  return (GType) id;
+}
+
+GType
+gst_transcode_bin_mp4_mode_get_type (void)
+{
+  static gsize id = 0;
+  static const GEnumValue values[] = {
+    {GST_TRANSCODE_BIN_MP4_MODE_NORMAL,
+        "Write the moov atom at the end of the file", "normal"},
+    {GST_TRANSCODE_BIN_MP4_MODE_FASTSTART,
+        "Reserve space for the moov atom at the start of the file",
+        "faststart"},
+    {GST_TRANSCODE_BIN_MP4_MODE_FRAGMENTED,
+        "Write moof/mdat fragments", "fragmented"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&id)) {
+    GType tmp = g_enum_register_static ("GstTranscodeBinMp4Mode", values);
+    g_once_init_leave (&id, tmp);
+  }
+
+  return (GType) id;
+}
+
+GType
+gst_transcode_bin_seek_mode_get_type (void)
+{
+  static gsize id = 0;
+  static const GEnumValue values[] = {
+    {GST_TRANSCODE_BIN_SEEK_MODE_ACCURATE,
+        "Start and stop exactly at the requested positions", "accurate"},
+    {GST_TRANSCODE_BIN_SEEK_MODE_KEYFRAME,
+        "Start on the keyframe preceding the start position", "keyframe"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&id)) {
+    GType tmp = g_enum_register_static ("GstTranscodeBinSeekMode", values);
+    g_once_init_leave (&id, tmp);
+  }
+
+  return (GType) id;
+}
+
 static void
 post_missing_plugin_error (GstElement * dec, const gchar * element_name)
 {
@@ -99,13 +327,83 @@ post_missing_plugin_error (GstElement * dec, const gchar * element_name)
 }
 /* *INDENT-ON* */
 
+static void
+_track_stream_element (GstTranscodeBin * self, GstElement * element)
+{
+  GST_OBJECT_LOCK (self);
+  self->stream_elements = g_list_prepend (self->stream_elements,
+      gst_object_ref (element));
+  GST_OBJECT_UNLOCK (self);
+}
+
+/* Each stream gets its own filter instance */
 static GstPad *
-_insert_filter (GstTranscodeBin * self, GstPad * sinkpad, GstPad * pad,
-    GstCaps * caps)
+_insert_filter_from_description (GstTranscodeBin * self, GstPad * pad,
+    const gchar * description)
+{
+  GError *err = NULL;
+  GstElement *filter;
+  GstPad *filter_sink, *filter_src;
+
+  filter = gst_parse_bin_from_description (description, TRUE, &err);
+  if (!filter) {
+    GST_ELEMENT_ERROR (self, CORE, FAILED,
+        ("Could not create filter from \"%s\"", description),
+        ("%s", err ? err->message : "unknown error"));
+    g_clear_error (&err);
+
+    return pad;
+  }
+
+  if (err) {
+    GST_WARNING_OBJECT (self, "Filter \"%s\" created with warning: %s",
+        description, err->message);
+    g_clear_error (&err);
+  }
+
+  gst_bin_add (GST_BIN (self), filter);
+  _track_stream_element (self, filter);
+
+  filter_sink = gst_element_get_static_pad (filter, "sink");
+  if (G_UNLIKELY (gst_pad_link (pad, filter_sink) != GST_PAD_LINK_OK)) {
+    GST_ELEMENT_ERROR (self, CORE, PAD, (NULL),
+        ("Couldn't link %" GST_PTR_FORMAT " to filter \"%s\"", pad,
+            description));
+  }
+  gst_object_unref (filter_sink);
+
+  gst_element_sync_state_with_parent (filter);
+
+  /* The pad stays alive as long as the filter is inside ourself */
+  filter_src = gst_element_get_static_pad (filter, "src");
+  gst_object_unref (filter_src);
+
+  return filter_src;
+}
+
+static GstPad *
+_insert_filter (GstTranscodeBin * self, GstPad * pad, GstCaps * caps)
 {
   GstPad *filter_src = NULL, *filter_sink = NULL;
   GstElement* filter = NULL;
   GstObject *filter_parent;
+  gchar *description = NULL;
+
+  GST_OBJECT_LOCK (self);
+  if (!g_strcmp0 (gst_structure_get_name (gst_caps_get_structure (caps, 0)),
+          "video/x-raw"))
+    description = g_strdup (self->video_filter_description);
+  else if (!g_strcmp0 (gst_structure_get_name (gst_caps_get_structure (caps,
+                  0)), "audio/x-raw"))
+    description = g_strdup (self->audio_filter_description);
+  GST_OBJECT_UNLOCK (self);
+
+  if (description) {
+    pad = _insert_filter_from_description (self, pad, description);
+    g_free (description);
+
+    return pad;
+  }
 
   if (self->video_filter &&
       !g_strcmp0 (gst_structure_get_name (gst_caps_get_structure (caps, 0)),
@@ -123,7 +421,8 @@ _insert_filter (GstTranscodeBin * self, GstPad * sinkpad, GstPad * pad,
   if ((filter_parent = gst_object_get_parent (GST_OBJECT (filter)))) {
       GST_WARNING_OBJECT (self, "Filter already in use (inside %" GST_PTR_FORMAT ").",
         filter_parent);
-      GST_FIXME_OBJECT(self, "Handle transcoding several streams of a same kind.");
+      GST_FIXME_OBJECT(self, "Use a filter description to filter several"
+          " streams of a same kind.");
       gst_object_unref(filter_parent);
 
       return pad;
@@ -137,7 +436,7 @@ _insert_filter (GstTranscodeBin * self, GstPad * sinkpad, GstPad * pad,
 
   gst_bin_add (GST_BIN (self), gst_object_ref (filter));
   if (G_UNLIKELY (gst_pad_link (pad, filter_sink) != GST_PAD_LINK_OK)) {
-    GstCaps *othercaps = gst_pad_get_current_caps (sinkpad);
+    GstCaps *othercaps = gst_pad_query_caps (filter_sink, NULL);
     caps = gst_pad_get_current_caps (pad);
 
     GST_ELEMENT_ERROR (self, CORE, PAD,
@@ -145,7 +444,8 @@ _insert_filter (GstTranscodeBin * self, GstPad * sinkpad, GstPad * pad,
         ("Couldn't link pads \n\n%" GST_PTR_FORMAT "\n\n  and \n\n %"
             GST_PTR_FORMAT "\n\n", caps, othercaps));
 
-    gst_caps_unref (caps);
+    if (caps)
+      gst_caps_unref (caps);
     gst_caps_unref (othercaps);
   }
 
@@ -155,250 +455,1957 @@ _insert_filter (GstTranscodeBin * self, GstPad * sinkpad, GstPad * pad,
 }
 
 static void
-pad_added_cb (GstElement * decodebin, GstPad * pad, GstTranscodeBin * self)
+bucket_set_flushing (GstTranscodeBin * self, gboolean flushing)
 {
-  GstCaps *caps;
-  GstPad *sinkpad = NULL;
-  GstPadLinkReturn lret;
-
-  caps = gst_pad_query_caps (pad, NULL);
-
-  GST_DEBUG_OBJECT (decodebin, "Pad added, caps: %" GST_PTR_FORMAT, caps);
-
-  g_signal_emit_by_name (self->encodebin, "request-pad", caps, &sinkpad);
+  g_mutex_lock (&self->bucket_lock);
+  self->bucket_flushing = flushing;
+  self->tokens = 0;
+  self->last_refill = GST_CLOCK_TIME_NONE;
+  self->last_cpu_time = GST_CLOCK_TIME_NONE;
+  g_cond_broadcast (&self->bucket_cond);
+  g_mutex_unlock (&self->bucket_lock);
+}
 
-  if (sinkpad == NULL) {
-    gchar *stream_id = gst_pad_get_stream_id (pad);
+/* The bucket is refilled with cpu-budget nanoseconds per second, up to one
+ * second worth of budget, and drained by the CPU time used by the encoding
+ * threads. Raw buffers are held back here, before entering encodebin, as
+ * long as the bucket is empty. This blocks the streaming thread feeding the
+ * encoder, so _add_filter_stage() always puts a queue in front of it when
+ * pacing: demuxing and decoding then keep going until that queue and the
+ * decodebin ones are full. */
+static GstPadProbeReturn
+encoders_pacing_probe (GstPad * pad, GstPadProbeInfo * info,
+    GstTranscodeBin * self)
+{
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_FLUSH) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
 
-    GST_ELEMENT_WARNING_WITH_DETAILS (self, STREAM, FORMAT,
-        (NULL), ("Stream with caps: %" GST_PTR_FORMAT " can not be"
-            " encoded in the defined encoding formats",
-            caps),
-        ("can-t-encode-stream", G_TYPE_BOOLEAN, TRUE,
-            "stream-caps", GST_TYPE_CAPS, caps,
-            "stream-id", G_TYPE_STRING, stream_id, NULL));
+    if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_START)
+      bucket_set_flushing (self, TRUE);
+    else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+      bucket_set_flushing (self, FALSE);
 
-    g_free (stream_id);
-    return;
+    return GST_PAD_PROBE_OK;
   }
 
-  if (caps)
-    gst_caps_unref (caps);
-
-  pad = _insert_filter (self, sinkpad, pad, caps);
-  lret = gst_pad_link (pad, sinkpad);
-  switch (lret) {
-    case GST_PAD_LINK_OK:
-        break;
-    case GST_PAD_LINK_WAS_LINKED:
-        GST_FIXME_OBJECT(self, "Pad %" GST_PTR_FORMAT " was already linked",
-          sinkpad);
-        break;
-    default:
-    {
-        GstCaps* othercaps = gst_pad_query_caps(sinkpad, NULL);
-        caps = gst_pad_get_current_caps(pad);
-
-        GST_ELEMENT_ERROR_WITH_DETAILS(self, CORE, PAD,
-            (NULL),
-            ("Couldn't link pads:\n    %" GST_PTR_FORMAT ": %" GST_PTR_FORMAT
-             "\nand:\n"
-             "    %" GST_PTR_FORMAT ": %" GST_PTR_FORMAT "\n\n",
-                pad, caps, sinkpad, othercaps),
-            ("linking-error", GST_TYPE_PAD_LINK_RETURN, lret,
-                "source-pad", GST_TYPE_PAD, pad,
-                "source-caps", GST_TYPE_CAPS, caps,
-                "sink-pad", GST_TYPE_PAD, sinkpad,
-                "sink-caps", GST_TYPE_CAPS, othercaps, NULL));
+  g_mutex_lock (&self->bucket_lock);
+  while (self->cpu_budget && !self->bucket_flushing) {
+    gint64 wait_us;
+    GstClockTime now = gst_util_get_timestamp ();
+    GstClockTime cpu_time =
+        gst_cpu_accounting_get_cpu_time (self->encoder_accounting);
+
+    if (GST_CLOCK_TIME_IS_VALID (self->last_refill))
+      self->tokens += gst_util_uint64_scale (now - self->last_refill,
+          self->cpu_budget, GST_SECOND);
+    self->last_refill = now;
+
+    if (GST_CLOCK_TIME_IS_VALID (cpu_time)
+        && GST_CLOCK_TIME_IS_VALID (self->last_cpu_time)
+        && cpu_time > self->last_cpu_time)
+      self->tokens -= cpu_time - self->last_cpu_time;
+    self->last_cpu_time = cpu_time;
+
+    self->tokens = CLAMP (self->tokens, -(gdouble) self->cpu_budget,
+        (gdouble) self->cpu_budget);
+    if (self->tokens >= 0)
+      break;
 
-        gst_caps_unref(caps);
-        if (othercaps)
-            gst_caps_unref(othercaps);
-    }
+    wait_us = (-self->tokens / self->cpu_budget) * G_USEC_PER_SEC;
+    GST_LOG_OBJECT (self, "Out of CPU budget, pacing for %" G_GINT64_FORMAT
+        "us", wait_us);
+    g_cond_wait_until (&self->bucket_cond, &self->bucket_lock,
+        g_get_monotonic_time () + MAX (wait_us, 1));
+    self->pacing_time += gst_util_get_timestamp () - now;
   }
+  g_mutex_unlock (&self->bucket_lock);
 
-  gst_object_unref (sinkpad);
+  return GST_PAD_PROBE_OK;
 }
 
-static gboolean
-make_encodebin (GstTranscodeBin * self)
+typedef struct
 {
   GstPad *pad;
-  GST_INFO_OBJECT (self, "making new encodebin");
-
-  if (!self->profile)
-    goto no_profile;
+  gulong probe_id;
+} BlockedPad;
 
-  self->encodebin = gst_element_factory_make ("encodebin", NULL);
-  if (!self->encodebin)
-    goto no_encodebin;
+static void
+blocked_pad_free (BlockedPad * blocked)
+{
+  gst_pad_remove_probe (blocked->pad, blocked->probe_id);
+  gst_object_unref (blocked->pad);
+  g_free (blocked);
+}
 
-  gst_bin_add (GST_BIN (self), self->encodebin);
-  g_object_set (self->encodebin, "profile", self->profile, NULL);
+/* Call with the object lock held */
+static gboolean
+needs_initial_seek (GstTranscodeBin * self)
+{
+  return !self->initial_seek_done && (self->start_time > 0
+      || GST_CLOCK_TIME_IS_VALID (self->stop_time));
+}
 
-  pad = gst_element_get_static_pad (self->encodebin, "src");
-  if (!gst_ghost_pad_set_target (GST_GHOST_PAD_CAST (self->srcpad), pad)) {
+static GstPadProbeReturn
+block_until_seeked_probe (GstPad * pad, GstPadProbeInfo * info,
+    GstTranscodeBin * self)
+{
+  GST_DEBUG_OBJECT (self, "%" GST_PTR_FORMAT " blocked until the initial"
+      " seek is done", pad);
 
-    gst_object_unref (pad);
-    GST_ERROR_OBJECT (self, "Could not ghost %" GST_PTR_FORMAT " srcpad",
-        self->encodebin);
+  return GST_PAD_PROBE_OK;
+}
 
-    return FALSE;
-  }
-  gst_object_unref (pad);
+static void
+do_initial_seek (GstElement * element, gpointer unused)
+{
+  GList *blocked_pads;
+  GstEvent *seek;
+  GstSeekFlags flags = GST_SEEK_FLAG_FLUSH;
+  GstClockTime start, stop;
+  GstTranscodeBinSeekMode seek_mode;
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (element);
 
-  return gst_element_sync_state_with_parent (self->encodebin);
+  GST_OBJECT_LOCK (self);
+  blocked_pads = self->blocked_pads;
+  self->blocked_pads = NULL;
+  start = self->start_time;
+  stop = self->stop_time;
+  seek_mode = self->seek_mode;
+  GST_OBJECT_UNLOCK (self);
 
-  /* ERRORS */
-no_encodebin:
-  {
-    post_missing_plugin_error (GST_ELEMENT_CAST (self), "encodebin");
+  if (!blocked_pads)
+    return;
 
-    GST_ELEMENT_ERROR (self, CORE, MISSING_PLUGIN, (NULL),
-        ("No encodebin element, check your installation"));
+  GST_INFO_OBJECT (self, "Seeking to %" GST_TIME_FORMAT " -- %"
+      GST_TIME_FORMAT, GST_TIME_ARGS (start), GST_TIME_ARGS (stop));
+
+  /* Accurate seeking by default so that consecutive ranges neither overlap
+   * nor leave holes, decoding starts from the previous keyframe anyway.
+   * Snapping to that keyframe lets passed through streams start on a
+   * decodable frame and saves decoding the frames before the start. */
+  if (seek_mode == GST_TRANSCODE_BIN_SEEK_MODE_KEYFRAME)
+    flags |= GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE;
+  else
+    flags |= GST_SEEK_FLAG_ACCURATE;
+
+  seek = gst_event_new_seek (1.0, GST_FORMAT_TIME, flags, GST_SEEK_TYPE_SET,
+      start,
+      GST_CLOCK_TIME_IS_VALID (stop) ? GST_SEEK_TYPE_SET : GST_SEEK_TYPE_NONE,
+      GST_CLOCK_TIME_IS_VALID (stop) ? stop : GST_CLOCK_TIME_NONE);
+
+  if (!gst_pad_send_event (((BlockedPad *) blocked_pads->data)->pad, seek))
+    GST_ELEMENT_ERROR (self, CORE, SEEK, (NULL),
+        ("Could not seek to %" GST_TIME_FORMAT " -- %" GST_TIME_FORMAT,
+            GST_TIME_ARGS (start), GST_TIME_ARGS (stop)));
+
+  g_list_free_full (blocked_pads, (GDestroyNotify) blocked_pad_free);
+}
 
-    return FALSE;
-  }
-  /* ERRORS */
-no_profile:
-  {
-    GST_ELEMENT_ERROR (self, CORE, MISSING_PLUGIN, (NULL),
-        ("No GstEncodingProfile set, can not run."));
+static gboolean
+_is_hardware_factory (GstElementFactory * factory)
+{
+  const gchar *klass = gst_element_factory_get_metadata (factory,
+      GST_ELEMENT_METADATA_KLASS);
 
-    return FALSE;
-  }
+  return klass && strstr (klass, "Hardware");
 }
 
 static gboolean
-make_decodebin (GstTranscodeBin * self)
+_is_video_codec_factory (GstElementFactory * factory)
 {
-  GstPad *pad;
-  GST_INFO_OBJECT (self, "making new decodebin");
+  const gchar *klass = gst_element_factory_get_metadata (factory,
+      GST_ELEMENT_METADATA_KLASS);
 
-  self->decodebin = gst_element_factory_make ("decodebin", NULL);
+  return klass && strstr (klass, "Video") && (strstr (klass, "Decoder")
+      || strstr (klass, "Encoder"));
+}
 
-  if (!self->decodebin)
-    goto no_decodebin;
+static gint
+_compare_hardware_first (GstElementFactory * a, GstElementFactory * b)
+{
+  return (gint) _is_hardware_factory (b) - (gint) _is_hardware_factory (a);
+}
 
-  if (self->avoid_reencoding) {
-    GstCaps *decodecaps;
+/* Reorders or drops the video codec factories following the hardware
+ * policy, keeping the rank order otherwise */
+static GList *
+_apply_hardware_policy (GstTranscodeBinHardwarePolicy policy,
+    GList * factories)
+{
+  GList *tmp, *next;
 
-    g_object_get (self->decodebin, "caps", &decodecaps, NULL);
-    if (GST_IS_ENCODING_CONTAINER_PROFILE (self->profile)) {
-      GList *tmp;
+  if (policy == GST_TRANSCODE_BIN_HARDWARE_POLICY_AUTO)
+    return factories;
 
-      decodecaps = gst_caps_make_writable (decodecaps);
-      for (tmp = (GList *)
-          gst_encoding_container_profile_get_profiles
-          (GST_ENCODING_CONTAINER_PROFILE (self->profile)); tmp;
-          tmp = tmp->next) {
-        GstCaps *encodecaps = gst_encoding_profile_get_format (tmp->data);
-        GstCaps *restrictions =
-            gst_encoding_profile_get_restriction (tmp->data);
+  for (tmp = factories; tmp; tmp = next) {
+    GstElementFactory *factory = tmp->data;
+    gboolean hardware = _is_hardware_factory (factory);
 
-        if (!restrictions)
-          gst_caps_append (decodecaps, encodecaps);
-        else
-          gst_caps_unref (restrictions);
-      }
+    next = tmp->next;
+    if (!_is_video_codec_factory (factory))
+      continue;
+
+    if ((policy == GST_TRANSCODE_BIN_HARDWARE_POLICY_FORBID && hardware) ||
+        (policy == GST_TRANSCODE_BIN_HARDWARE_POLICY_REQUIRE && !hardware)) {
+      gst_object_unref (factory);
+      factories = g_list_delete_link (factories, tmp);
     }
-    g_object_set (self->decodebin, "caps", decodecaps, NULL);
-    gst_caps_unref (decodecaps);
   }
 
-  g_signal_connect (self->decodebin, "pad-added", G_CALLBACK (pad_added_cb),
-      self);
+  if (policy == GST_TRANSCODE_BIN_HARDWARE_POLICY_PREFER)
+    factories = g_list_sort (factories, (GCompareFunc) _compare_hardware_first);
 
-  gst_bin_add (GST_BIN (self), self->decodebin);
-  pad = gst_element_get_static_pad (self->decodebin, "sink");
-  if (!gst_ghost_pad_set_target (GST_GHOST_PAD_CAST (self->sinkpad), pad)) {
+  return factories;
+}
 
-    gst_object_unref (pad);
-    GST_ERROR_OBJECT (self, "Could not ghost %" GST_PTR_FORMAT " sinkpad",
-        self->decodebin);
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
+static GValueArray *
+autoplug_sort_cb (GstElement * decodebin, GstPad * pad, GstCaps * caps,
+    GValueArray * factories, GstTranscodeBin * self)
+{
+  guint i;
+  GList *tmp, *list = NULL;
+  GValueArray *result;
+  GstTranscodeBinHardwarePolicy policy;
 
-    return FALSE;
-  }
+  GST_OBJECT_LOCK (self);
+  policy = self->hardware_policy;
+  GST_OBJECT_UNLOCK (self);
 
-  gst_object_unref (pad);
-  return TRUE;
+  if (policy == GST_TRANSCODE_BIN_HARDWARE_POLICY_AUTO)
+    return NULL;
 
-  /* ERRORS */
-no_decodebin:
-  {
-    post_missing_plugin_error (GST_ELEMENT_CAST (self), "decodebin");
-    GST_ELEMENT_ERROR (self, CORE, MISSING_PLUGIN, (NULL),
-        ("No decodebin element, check your installation"));
+  for (i = 0; i < factories->n_values; i++)
+    list = g_list_append (list,
+        g_value_dup_object (g_value_array_get_nth (factories, i)));
+  list = _apply_hardware_policy (policy, list);
 
-    return FALSE;
+  result = g_value_array_new (g_list_length (list));
+  for (tmp = list; tmp; tmp = tmp->next) {
+    GValue val = G_VALUE_INIT;
+
+    g_value_init (&val, GST_TYPE_ELEMENT_FACTORY);
+    g_value_set_object (&val, tmp->data);
+    g_value_array_append (result, &val);
+    g_value_unset (&val);
   }
+  gst_plugin_feature_list_free (list);
+
+  return result;
+}
+G_GNUC_END_IGNORE_DEPRECATIONS;
+
+/* Returns the encoders able to produce the format of @profile, by rank */
+static GList *
+_list_video_encoders (GstEncodingProfile * profile)
+{
+  GList *encoders, *all_encoders;
+  GstCaps *format;
+
+  all_encoders =
+      gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_ENCODER |
+      GST_ELEMENT_FACTORY_TYPE_MEDIA_VIDEO, GST_RANK_MARGINAL);
+  format = gst_encoding_profile_get_format (profile);
+  encoders = gst_element_factory_list_filter (all_encoders, format,
+      GST_PAD_SRC, FALSE);
+  gst_caps_unref (format);
+  gst_plugin_feature_list_free (all_encoders);
+
+  return g_list_sort (encoders, gst_plugin_feature_rank_compare_func);
 }
 
 static void
-remove_all_children (GstTranscodeBin * self)
+_set_encodebin_flag (GstElement * encodebin, const gchar * nick,
+    gboolean set)
 {
-  if (self->encodebin) {
-    gst_element_set_state (self->encodebin, GST_STATE_NULL);
-    gst_bin_remove (GST_BIN (self), self->encodebin);
-    self->encodebin = NULL;
-  }
+  guint flags;
+  GFlagsValue *value;
+  GParamSpec *pspec =
+      g_object_class_find_property (G_OBJECT_GET_CLASS (encodebin), "flags");
 
-  if (self->video_filter && GST_OBJECT_PARENT (self->video_filter)) {
-    gst_element_set_state (self->video_filter, GST_STATE_NULL);
-    gst_bin_remove (GST_BIN (self), self->video_filter);
-  }
+  if (!pspec || !G_IS_PARAM_SPEC_FLAGS (pspec))
+    return;
 
-  if (self->audio_filter && GST_OBJECT_PARENT (self->audio_filter)) {
-    gst_element_set_state (self->audio_filter, GST_STATE_NULL);
-    gst_bin_remove (GST_BIN (self), self->audio_filter);
-  }
+  value = g_flags_get_value_by_nick (G_PARAM_SPEC_FLAGS (pspec)->flags_class,
+      nick);
+  if (!value)
+    return;
 
-  if (self->decodebin) {
-    gst_element_set_state (self->decodebin, GST_STATE_NULL);
-    gst_bin_remove (GST_BIN (self), self->decodebin);
-    self->decodebin = NULL;
-  }
+  g_object_get (encodebin, "flags", &flags, NULL);
+  g_object_set (encodebin, "flags",
+      set ? flags | value->value : flags & ~value->value, NULL);
 }
 
-static GstStateChangeReturn
-gst_transcode_bin_change_state (GstElement * element, GstStateChange transition)
+/* Returns the memory features, other than system memory, that decoded
+ * frames with @caps can keep up to the video encoder of @encodebin, if no
+ * conversion is needed in between */
+static gchar *
+_find_shared_memory_features (GstTranscodeBin * self, GstElement * encodebin,
+    GstCaps * caps)
 {
-  GstStateChangeReturn ret;
-  GstTranscodeBin *self = GST_TRANSCODE_BIN (element);
+  guint i;
+  const GList *tmp;
+  GList *profiles, *encoders = NULL;
+  GstElementFactory *encoder = NULL;
+  GstEncodingProfile *profile = NULL, *video_profile = NULL;
+  GstCaps *restriction, *sinkcaps = NULL;
+  gchar *features = NULL;
+
+  g_object_get (encodebin, "profile", &profile, NULL);
+  if (!profile)
+    return NULL;
+
+  profiles = GST_IS_ENCODING_CONTAINER_PROFILE (profile) ?
+      (GList *) gst_encoding_container_profile_get_profiles
+      (GST_ENCODING_CONTAINER_PROFILE (profile)) : NULL;
+  if (!profiles && GST_IS_ENCODING_VIDEO_PROFILE (profile))
+    video_profile = profile;
+  for (tmp = profiles; tmp && !video_profile; tmp = tmp->next)
+    if (GST_IS_ENCODING_VIDEO_PROFILE (tmp->data))
+      video_profile = tmp->data;
+
+  if (!video_profile)
+    goto done;
+
+  /* Scaling or converting requires system memory */
+  restriction = gst_encoding_profile_get_restriction (video_profile);
+  if (restriction) {
+    gboolean any = gst_caps_is_any (restriction);
+
+    gst_caps_unref (restriction);
+    if (!any)
+      goto done;
+  }
 
-  switch (transition) {
-    case GST_STATE_CHANGE_READY_TO_PAUSED:
+  if (gst_encoding_profile_get_preset_name (video_profile)) {
+    encoder =
+        gst_element_factory_find (gst_encoding_profile_get_preset_name
+        (video_profile));
+  } else {
+    encoders = _list_video_encoders (video_profile);
+    if (encoders)
+      encoder = gst_object_ref (encoders->data);
+    gst_plugin_feature_list_free (encoders);
+  }
 
-      if (!make_encodebin (self))
-        goto setup_failed;
+  if (!encoder)
+    goto done;
 
-      if (!make_decodebin (self))
-        goto setup_failed;
+  for (tmp = gst_element_factory_get_static_pad_templates (encoder); tmp;
+      tmp = tmp->next) {
+    GstStaticPadTemplate *templ = tmp->data;
 
+    if (templ->direction == GST_PAD_SINK) {
+      sinkcaps = gst_static_caps_get (&templ->static_caps);
       break;
-    default:
-      break;
+    }
   }
 
-  ret =
-      GST_ELEMENT_CLASS (gst_transcode_bin_parent_class)->change_state (element,
-      transition);
-  if (ret == GST_STATE_CHANGE_FAILURE)
-    goto beach;
+  for (i = 0; sinkcaps && i < gst_caps_get_size (caps) && !features; i++) {
+    GstCapsFeatures *f = gst_caps_get_features (caps, i);
+    GstCaps *featured;
 
-  switch (transition) {
-    case GST_STATE_CHANGE_PAUSED_TO_READY:
-      remove_all_children (self);
-      break;
-    default:
-      break;
+    if (!f || gst_caps_features_is_any (f) ||
+        gst_caps_features_is_equal (f, GST_CAPS_FEATURES_MEMORY_SYSTEM_MEMORY))
+      continue;
+
+    featured = gst_caps_copy_nth (caps, i);
+    if (gst_caps_can_intersect (featured, sinkcaps))
+      features = gst_caps_features_to_string (f);
+    gst_caps_unref (featured);
   }
 
-beach:
-  return ret;
+  gst_clear_caps (&sinkcaps);
+  gst_object_unref (encoder);
+
+done:
+  gst_object_unref (profile);
+
+  return features;
+}
+
+/* Pins the encoder of the video profiles that do not name one, returns
+ * FALSE if the policy can not be fulfilled */
+static gboolean
+_select_video_encoder (GstTranscodeBin * self,
+    GstTranscodeBinHardwarePolicy policy, GstEncodingProfile * profile)
+{
+  GList *encoders;
+  GstCaps *restriction;
+
+  if (!GST_IS_ENCODING_VIDEO_PROFILE (profile)
+      || gst_encoding_profile_get_preset_name (profile))
+    return TRUE;
+
+  encoders = _apply_hardware_policy (policy, _list_video_encoders (profile));
+
+  if (!encoders)
+    return policy != GST_TRANSCODE_BIN_HARDWARE_POLICY_REQUIRE;
+
+  GST_INFO_OBJECT (self, "Using %s to encode %" GST_PTR_FORMAT,
+      GST_OBJECT_NAME (encoders->data), profile);
+  gst_encoding_profile_set_preset_name (profile,
+      GST_OBJECT_NAME (encoders->data));
+
+  /* Let hardware frames flow from a hardware decoder */
+  restriction = gst_encoding_profile_get_restriction (profile);
+  if (policy == GST_TRANSCODE_BIN_HARDWARE_POLICY_REQUIRE && !restriction) {
+    GST_OBJECT_LOCK (self);
+    self->no_video_conversion = TRUE;
+    GST_OBJECT_UNLOCK (self);
+  }
+  if (restriction)
+    gst_caps_unref (restriction);
+  gst_plugin_feature_list_free (encoders);
+
+  return TRUE;
+}
+
+/* Returns a copy of @profile with the video encoders picked following the
+ * hardware policy or %NULL if it can not be fulfilled */
+static GstEncodingProfile *
+_make_encoding_profile (GstTranscodeBin * self, GstEncodingProfile * profile)
+{
+  GstTranscodeBinHardwarePolicy policy;
+  gboolean res = TRUE;
+
+  GST_OBJECT_LOCK (self);
+  policy = self->hardware_policy;
+  GST_OBJECT_UNLOCK (self);
+
+  if (policy == GST_TRANSCODE_BIN_HARDWARE_POLICY_AUTO)
+    return gst_object_ref (profile);
+
+  profile = gst_encoding_profile_copy (profile);
+  if (GST_IS_ENCODING_CONTAINER_PROFILE (profile)) {
+    const GList *tmp;
+
+    for (tmp =
+        gst_encoding_container_profile_get_profiles
+        (GST_ENCODING_CONTAINER_PROFILE (profile)); tmp && res;
+        tmp = tmp->next)
+      res = _select_video_encoder (self, policy, tmp->data);
+  } else {
+    res = _select_video_encoder (self, policy, profile);
+  }
+
+  if (!res) {
+    GST_ELEMENT_ERROR (self, CORE, MISSING_PLUGIN, (NULL),
+        ("No hardware encoder for the video of %" GST_PTR_FORMAT, profile));
+    gst_object_unref (profile);
+
+    return NULL;
+  }
+
+  return profile;
+}
+
+static gchar *
+_list_codecs (GstBin * bin, const gchar * kind, gboolean * hardware)
+{
+  GValue item = G_VALUE_INIT;
+  GString *codecs = g_string_new (NULL);
+  GstIterator *it = gst_bin_iterate_recurse (bin);
+
+  while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    GstElement *element = g_value_get_object (&item);
+    GstElementFactory *factory = gst_element_get_factory (element);
+    const gchar *klass = factory ? gst_element_factory_get_metadata (factory,
+        GST_ELEMENT_METADATA_KLASS) : NULL;
+
+    if (klass && strstr (klass, kind)) {
+      if (codecs->len)
+        g_string_append (codecs, ", ");
+      g_string_append (codecs, GST_OBJECT_NAME (factory));
+      if (_is_hardware_factory (factory) && strstr (klass, "Video"))
+        *hardware = TRUE;
+    }
+    g_value_reset (&item);
+  }
+  g_value_unset (&item);
+  gst_iterator_free (it);
+
+  return g_string_free (codecs, FALSE);
+}
+
+/* Reports which decoders and encoders actually got plugged */
+static void
+post_codec_path (GstTranscodeBin * self)
+{
+  gchar *decoders, *encoders;
+  GstTranscodeBinHardwarePolicy policy;
+  gboolean hardware_decoding = FALSE, hardware_encoding = FALSE;
+  gboolean hardware_memory;
+
+  GST_OBJECT_LOCK (self);
+  policy = self->hardware_policy;
+  hardware_memory = self->no_video_conversion;
+  GST_OBJECT_UNLOCK (self);
+
+  decoders = _list_codecs (GST_BIN (self->decodebin), "Decoder",
+      &hardware_decoding);
+  encoders = _list_codecs (GST_BIN (self), "Encoder", &hardware_encoding);
+
+  GST_INFO_OBJECT (self, "Decoders: [%s] Encoders: [%s]", decoders, encoders);
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_element (GST_OBJECT (self),
+          gst_structure_new ("transcodebin-codec-path",
+              "hardware-policy", GST_TYPE_TRANSCODE_BIN_HARDWARE_POLICY,
+              policy, "decoders", G_TYPE_STRING, decoders,
+              "encoders", G_TYPE_STRING, encoders,
+              "hardware-decoding", G_TYPE_BOOLEAN, hardware_decoding,
+              "hardware-encoding", G_TYPE_BOOLEAN, hardware_encoding,
+              "hardware-memory", G_TYPE_BOOLEAN, hardware_memory,
+              NULL)));
+
+  g_free (decoders);
+  g_free (encoders);
+}
+
+static void
+no_more_pads_cb (GstElement * decodebin, GstTranscodeBin * self)
+{
+  gboolean seek;
+
+  GST_OBJECT_LOCK (self);
+  seek = self->blocked_pads && needs_initial_seek (self);
+  self->initial_seek_done = TRUE;
+  GST_OBJECT_UNLOCK (self);
+
+  post_codec_path (self);
+
+  if (seek)
+    gst_element_call_async (GST_ELEMENT (self), do_initial_seek, NULL, NULL);
+}
+
+static void
+_add_pacing_probe (GstTranscodeBin * self, GstPad * pad)
+{
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER |
+      GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+      (GstPadProbeCallback) encoders_pacing_probe, self, NULL);
+}
+
+typedef struct
+{
+  GstTranscodeBin *self;
+  GstSegment segment;
+} ProgressProbe;
+
+/* Records how far the encoders got without taking any lock, so that the
+ * progress can be polled cheaply instead of querying the pipeline */
+static GstPadProbeReturn
+progress_probe (GstPad * pad, GstPadProbeInfo * info, ProgressProbe * probe)
+{
+  gint old_ms, progress_ms;
+  GstClockTime end;
+  GstBuffer *buffer;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_BOTH) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+      gst_event_copy_segment (event, &probe->segment);
+    else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+      g_atomic_int_set (&probe->self->progress_ms, 0);
+
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  end = GST_BUFFER_PTS (buffer);
+  if (!GST_CLOCK_TIME_IS_VALID (end) || probe->segment.format != GST_FORMAT_TIME)
+    return GST_PAD_PROBE_OK;
+
+  if (GST_BUFFER_DURATION_IS_VALID (buffer))
+    end += GST_BUFFER_DURATION (buffer);
+  end = gst_segment_to_stream_time (&probe->segment, GST_FORMAT_TIME, end);
+  if (!GST_CLOCK_TIME_IS_VALID (end))
+    return GST_PAD_PROBE_OK;
+
+  progress_ms = MIN (end / GST_MSECOND, G_MAXINT);
+  do {
+    old_ms = g_atomic_int_get (&probe->self->progress_ms);
+    if (progress_ms <= old_ms)
+      break;
+  } while (!g_atomic_int_compare_and_exchange (&probe->self->progress_ms,
+          old_ms, progress_ms));
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+_add_progress_probe (GstTranscodeBin * self, GstPad * pad)
+{
+  ProgressProbe *probe = g_new0 (ProgressProbe, 1);
+
+  probe->self = self;
+  gst_segment_init (&probe->segment, GST_FORMAT_UNDEFINED);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER |
+      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+      (GstPadProbeCallback) progress_probe, probe, g_free);
+}
+
+static gboolean
+_is_raw (GstCaps * caps)
+{
+  const gchar *name;
+
+  if (!caps || gst_caps_is_empty (caps) || gst_caps_is_any (caps))
+    return FALSE;
+
+  name = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+
+  return !g_strcmp0 (name, "video/x-raw") || !g_strcmp0 (name, "audio/x-raw");
+}
+
+typedef struct
+{
+  GstTranscodeBin *self;
+  GstSegment segment;
+  GstClockTime budget;
+} LatencyProbe;
+
+/* The running time of live buffers is the time they were captured at, the
+ * frames which waited longer than the budget on their way to the encoders
+ * are dropped so that slow encoding does not add up into more and more
+ * delay */
+static GstPadProbeReturn
+latency_probe (GstPad * pad, GstPadProbeInfo * info, LatencyProbe * probe)
+{
+  GstClock *clock;
+  GstBuffer *buffer;
+  GstClockTime running_time, now, base_time;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_BOTH) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+      gst_event_copy_segment (event, &probe->segment);
+
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  if (probe->segment.format != GST_FORMAT_TIME)
+    return GST_PAD_PROBE_OK;
+
+  running_time = gst_segment_to_running_time (&probe->segment,
+      GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+  if (!GST_CLOCK_TIME_IS_VALID (running_time))
+    return GST_PAD_PROBE_OK;
+
+  clock = gst_element_get_clock (GST_ELEMENT (probe->self));
+  if (!clock)
+    return GST_PAD_PROBE_OK;
+
+  now = gst_clock_get_time (clock);
+  gst_object_unref (clock);
+  base_time = gst_element_get_base_time (GST_ELEMENT (probe->self));
+  if (now < base_time || now - base_time <= running_time + probe->budget)
+    return GST_PAD_PROBE_OK;
+
+  GST_LOG_OBJECT (pad, "Dropping %" GST_PTR_FORMAT ", %" GST_TIME_FORMAT
+      " late", buffer, GST_TIME_ARGS (now - base_time - running_time));
+  g_atomic_int_inc (&probe->self->late_buffers);
+
+  return GST_PAD_PROBE_DROP;
+}
+
+static void
+_add_latency_probe (GstTranscodeBin * self, GstPad * pad, GstCaps * caps)
+{
+  LatencyProbe *probe;
+
+  GST_OBJECT_LOCK (self);
+  if (!self->live || !_is_raw (caps)) {
+    GST_OBJECT_UNLOCK (self);
+    return;
+  }
+
+  probe = g_new0 (LatencyProbe, 1);
+  probe->self = self;
+  probe->budget = self->latency_budget;
+  GST_OBJECT_UNLOCK (self);
+
+  gst_segment_init (&probe->segment, GST_FORMAT_UNDEFINED);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER |
+      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      (GstPadProbeCallback) latency_probe, probe, g_free);
+}
+
+/* Each level keeps the adjustments of the previous ones */
+typedef enum
+{
+  DEGRADATION_NONE,
+  DEGRADATION_ENCODER_SPEED,
+  DEGRADATION_FRAMERATE,
+  DEGRADATION_SKIP_STREAMS,
+} DegradationLevel;
+
+static const gchar *degradation_adjustments[] = {
+  "none", "encoder-speed", "framerate", "skip-streams"
+};
+
+/* Faster settings for the video encoders, only the properties they accept
+ * while encoding are changed. The presets of x264enc and x265enc can only
+ * be changed in the NULL or READY state, so they are left alone */
+static const struct
+{
+  const gchar *property;
+  const gchar *value;
+} fast_encoding_settings[] = {
+  {"cpu-used", "8"},            /* vp8enc, vp9enc */
+  {"deadline", "1"},            /* vp8enc, vp9enc */
+  {"complexity", "low"},        /* openh264enc */
+};
+
+/* Returns whether any encoder got faster settings */
+static gboolean
+_speed_up_encoders (GstTranscodeBin * self)
+{
+  guint i;
+  GList *tmp, *encoders;
+  gboolean changed = FALSE;
+
+  GST_OBJECT_LOCK (self);
+  encoders = g_list_copy_deep (self->video_encoders, (GCopyFunc)
+      gst_object_ref, NULL);
+  GST_OBJECT_UNLOCK (self);
+
+  for (tmp = encoders; tmp; tmp = tmp->next) {
+    GObjectClass *klass = G_OBJECT_GET_CLASS (tmp->data);
+
+    for (i = 0; i < G_N_ELEMENTS (fast_encoding_settings); i++) {
+      GParamSpec *pspec = g_object_class_find_property (klass,
+          fast_encoding_settings[i].property);
+
+      if (!pspec || !(pspec->flags & GST_PARAM_MUTABLE_PLAYING))
+        continue;
+
+      GST_INFO_OBJECT (self, "Setting %s=%s on %" GST_PTR_FORMAT,
+          fast_encoding_settings[i].property, fast_encoding_settings[i].value,
+          tmp->data);
+      gst_util_set_object_arg (G_OBJECT (tmp->data),
+          fast_encoding_settings[i].property,
+          fast_encoding_settings[i].value);
+      changed = TRUE;
+    }
+  }
+  g_list_free_full (encoders, gst_object_unref);
+
+  return changed;
+}
+
+/* Goes one level further when the job, at its current speed, would end
+ * after the deadline while the encoders use most of the allowed CPUs */
+static void
+_update_degradation (GstTranscodeBin * self, GstPad * pad)
+{
+  gint level;
+  gint64 upstream_duration;
+  gboolean settled;
+  gdouble cpu_usage;
+  GstClockTime now, last_check, cpu_time, cpu_used, interval, elapsed;
+  GstClockTime deadline, start_time, duration, done, projected;
+
+  level = g_atomic_int_get (&self->degradation_level);
+  if (level >= DEGRADATION_SKIP_STREAMS)
+    return;
+
+  now = gst_util_get_timestamp ();
+
+  GST_OBJECT_LOCK (self);
+  deadline = self->deadline;
+  last_check = self->degradation_last_check;
+  if (!GST_CLOCK_TIME_IS_VALID (deadline) || (GST_CLOCK_TIME_IS_VALID
+          (last_check) && now - last_check < DEGRADATION_CHECK_INTERVAL)) {
+    GST_OBJECT_UNLOCK (self);
+    return;
+  }
+
+  cpu_time = gst_cpu_accounting_get_cpu_time (self->encoder_accounting);
+  if (!GST_CLOCK_TIME_IS_VALID (self->degradation_start)) {
+    self->degradation_start = now;
+    self->degradation_last_change = now;
+    self->degradation_last_check = now;
+    self->degradation_last_cpu_time = cpu_time;
+    GST_OBJECT_UNLOCK (self);
+    return;
+  }
+
+  interval = now - last_check;
+  cpu_used = 0;
+  if (GST_CLOCK_TIME_IS_VALID (cpu_time)
+      && GST_CLOCK_TIME_IS_VALID (self->degradation_last_cpu_time)
+      && cpu_time > self->degradation_last_cpu_time)
+    cpu_used = cpu_time - self->degradation_last_cpu_time;
+  self->degradation_last_check = now;
+  self->degradation_last_cpu_time = cpu_time;
+  elapsed = now - self->degradation_start;
+  settled = now - self->degradation_last_change >= DEGRADATION_SETTLE_TIME;
+  start_time = self->start_time;
+  duration = self->stop_time;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!settled)
+    return;
+
+  if (gst_pad_query_duration (pad, GST_FORMAT_TIME, &upstream_duration)
+      && upstream_duration > 0)
+    duration = MIN (duration, upstream_duration);
+
+  done = g_atomic_int_get (&self->progress_ms) * GST_MSECOND;
+  if (!GST_CLOCK_TIME_IS_VALID (duration) || duration <= start_time
+      || done <= start_time)
+    return;
+
+  projected = gst_util_uint64_scale (elapsed, duration - start_time,
+      done - start_time);
+  cpu_usage = (gdouble) cpu_used / interval /
+      gst_cpu_accounting_get_allowed_cpus ();
+  if (projected <= deadline || cpu_usage < DEGRADATION_CPU_BOUND_RATIO)
+    return;
+
+  /* Concurrent streams could reach the decision at the same time */
+  if (!g_atomic_int_compare_and_exchange (&self->degradation_level, level,
+          level + 1))
+    return;
+  level++;
+
+  /* Waiting for a step that changed nothing to settle would only lose time */
+  if (level == DEGRADATION_ENCODER_SPEED && !_speed_up_encoders (self)) {
+    GST_INFO_OBJECT (self, "No encoder can be sped up while encoding");
+    if (!g_atomic_int_compare_and_exchange (&self->degradation_level, level,
+            DEGRADATION_FRAMERATE))
+      return;
+    level = DEGRADATION_FRAMERATE;
+  }
+
+  GST_OBJECT_LOCK (self);
+  self->degradation_last_change = now;
+  GST_OBJECT_UNLOCK (self);
+
+  GST_INFO_OBJECT (self, "Projected to take %" GST_TIME_FORMAT " for a %"
+      GST_TIME_FORMAT " deadline with the encoders using %.0f%% of the CPUs,"
+      " degrading: %s", GST_TIME_ARGS (projected), GST_TIME_ARGS (deadline),
+      cpu_usage * 100, degradation_adjustments[level]);
+
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_element (GST_OBJECT (self),
+          gst_structure_new ("transcodebin-degradation",
+              "level", G_TYPE_UINT, level,
+              "adjustment", G_TYPE_STRING, degradation_adjustments[level],
+              "projected-duration", G_TYPE_UINT64, projected,
+              "deadline", G_TYPE_UINT64, deadline,
+              "encoders-cpu-usage", G_TYPE_DOUBLE, cpu_usage, NULL)));
+}
+
+typedef struct
+{
+  GstTranscodeBin *self;
+  gboolean video;
+  gboolean optional;
+  guint64 n_frames;
+  gboolean skipped;
+} DegradationProbe;
+
+/* Video streams are decimated to half their framerate and the optional
+ * streams are ended early, the frames kept are not retimestamped so that
+ * neither the encoders nor the muxers need to renegotiate */
+static GstPadProbeReturn
+degradation_probe (GstPad * pad, GstPadProbeInfo * info,
+    DegradationProbe * probe)
+{
+  gint level;
+
+  _update_degradation (probe->self, pad);
+  level = g_atomic_int_get (&probe->self->degradation_level);
+
+  if (probe->optional && level >= DEGRADATION_SKIP_STREAMS) {
+    if (!probe->skipped) {
+      GST_INFO_OBJECT (pad, "Skipping optional stream");
+      probe->skipped = TRUE;
+      gst_pad_push_event (pad, gst_event_new_eos ());
+    }
+
+    return GST_PAD_PROBE_DROP;
+  }
+
+  if (probe->video && level >= DEGRADATION_FRAMERATE && probe->n_frames++ % 2)
+    return GST_PAD_PROBE_DROP;
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* The first audio and video streams are required, the other ones can be
+ * skipped when the deadline can not be met otherwise */
+static void
+_add_degradation_probe (GstTranscodeBin * self, GstPad * pad, GstCaps * caps)
+{
+  gboolean video, optional;
+  DegradationProbe *probe;
+  const gchar *name = caps && !gst_caps_is_empty (caps) &&
+      !gst_caps_is_any (caps) ?
+      gst_structure_get_name (gst_caps_get_structure (caps, 0)) : "";
+
+  GST_OBJECT_LOCK (self);
+  video = g_str_has_prefix (name, "video/");
+  if (video)
+    optional = self->n_video_streams++ > 0;
+  else if (g_str_has_prefix (name, "audio/"))
+    optional = self->n_audio_streams++ > 0;
+  else
+    optional = TRUE;
+
+  if (!GST_CLOCK_TIME_IS_VALID (self->deadline) || !_is_raw (caps)) {
+    GST_OBJECT_UNLOCK (self);
+    return;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  probe = g_new0 (DegradationProbe, 1);
+  probe->self = self;
+  probe->video = video;
+  probe->optional = optional;
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) degradation_probe, probe, g_free);
+}
+
+static GstPad *
+_request_encodebin_pad (GstTranscodeBin * self, GstElement * encodebin,
+    GstPad * pad, GstCaps * caps)
+{
+  GstPad *sinkpad = NULL;
+
+  g_signal_emit_by_name (encodebin, "request-pad", caps, &sinkpad);
+
+  if (sinkpad == NULL) {
+    gchar *stream_id = gst_pad_get_stream_id (pad);
+
+    GST_ELEMENT_WARNING_WITH_DETAILS (self, STREAM, FORMAT,
+        (NULL), ("Stream with caps: %" GST_PTR_FORMAT " can not be"
+            " encoded in the defined encoding formats",
+            caps),
+        ("can-t-encode-stream", G_TYPE_BOOLEAN, TRUE,
+            "stream-caps", GST_TYPE_CAPS, caps,
+            "stream-id", G_TYPE_STRING, stream_id, NULL));
+
+    g_free (stream_id);
+  }
+
+  return sinkpad;
+}
+
+static gboolean
+_link_to_encodebin (GstTranscodeBin * self, GstPad * pad, GstPad * sinkpad)
+{
+  GstCaps *caps;
+  GstPadLinkReturn lret;
+
+  lret = gst_pad_link (pad, sinkpad);
+  switch (lret) {
+    case GST_PAD_LINK_OK:
+        return TRUE;
+    case GST_PAD_LINK_WAS_LINKED:
+        GST_FIXME_OBJECT(self, "Pad %" GST_PTR_FORMAT " was already linked",
+          sinkpad);
+        break;
+    default:
+    {
+        GstCaps* othercaps = gst_pad_query_caps(sinkpad, NULL);
+        caps = gst_pad_get_current_caps(pad);
+
+        GST_ELEMENT_ERROR_WITH_DETAILS(self, CORE, PAD,
+            (NULL),
+            ("Couldn't link pads:\n    %" GST_PTR_FORMAT ": %" GST_PTR_FORMAT
+             "\nand:\n"
+             "    %" GST_PTR_FORMAT ": %" GST_PTR_FORMAT "\n\n",
+                pad, caps, sinkpad, othercaps),
+            ("linking-error", GST_TYPE_PAD_LINK_RETURN, lret,
+                "source-pad", GST_TYPE_PAD, pad,
+                "source-caps", GST_TYPE_CAPS, caps,
+                "sink-pad", GST_TYPE_PAD, sinkpad,
+                "sink-caps", GST_TYPE_CAPS, othercaps, NULL));
+
+        if (caps)
+            gst_caps_unref(caps);
+        if (othercaps)
+            gst_caps_unref(othercaps);
+    }
+  }
+
+  return FALSE;
+}
+
+/* Links elements inside ourself, unlike _link_to_encodebin() a failure does
+ * not mean that the stream can not be encoded */
+static gboolean
+_link_pads (GstTranscodeBin * self, GstPad * pad, GstPad * sinkpad)
+{
+  if (G_LIKELY (gst_pad_link (pad, sinkpad) == GST_PAD_LINK_OK))
+    return TRUE;
+
+  GST_ELEMENT_ERROR (self, CORE, PAD, (NULL),
+      ("Couldn't link %" GST_PTR_FORMAT " to %" GST_PTR_FORMAT, pad,
+          sinkpad));
+
+  return FALSE;
+}
+
+static GstElement *
+_add_stream_element (GstTranscodeBin * self, const gchar * factory_name)
+{
+  GstElement *element = gst_element_factory_make (factory_name, NULL);
+
+  if (!element) {
+    post_missing_plugin_error (GST_ELEMENT_CAST (self), factory_name);
+
+    return NULL;
+  }
+
+  gst_bin_add (GST_BIN (self), element);
+  _track_stream_element (self, element);
+
+  return element;
+}
+
+static GstElement *
+_make_queue (GstTranscodeBin * self, GstCaps * caps)
+{
+  GstClockTime max_size_time;
+  GstElement *queue = _add_stream_element (self, "queue");
+
+  if (!queue)
+    return NULL;
+
+  GST_OBJECT_LOCK (self);
+  max_size_time = self->queue_max_size_time;
+  /* In live mode the oldest decoded frames are dropped instead of making the
+   * decoders wait, the streams passed through are never dropped as they
+   * would not be decodable until the next keyframe */
+  if (self->live && _is_raw (caps)) {
+    if (!max_size_time || max_size_time > self->latency_budget)
+      max_size_time = self->latency_budget;
+    gst_util_set_object_arg (G_OBJECT (queue), "leaky", "downstream");
+  }
+  g_object_set (queue, "max-size-buffers", self->queue_max_size_buffers,
+      "max-size-bytes", self->queue_max_size_bytes,
+      "max-size-time", max_size_time, NULL);
+  GST_OBJECT_UNLOCK (self);
+
+  return queue;
+}
+
+/* Adds a thread boundary after @pad when insert-queues is set or @force is
+ * TRUE, returning the pad to link downstream elements to */
+static GstPad *
+_add_queue (GstTranscodeBin * self, GstPad * pad, GstCaps * caps,
+    GString * layout, gboolean force)
+{
+  GstElement *queue;
+  GstPad *queuesink, *queuesrc;
+  gboolean insert_queues;
+
+  GST_OBJECT_LOCK (self);
+  insert_queues = self->insert_queues || force;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!insert_queues || !(queue = _make_queue (self, caps)))
+    return pad;
+
+  queuesink = gst_element_get_static_pad (queue, "sink");
+  if (!_link_pads (self, pad, queuesink)) {
+    gst_object_unref (queuesink);
+
+    return pad;
+  }
+  gst_object_unref (queuesink);
+  gst_element_sync_state_with_parent (queue);
+  g_string_append (layout, " ! queue");
+
+  /* The pad stays alive as long as the queue is inside ourself */
+  queuesrc = gst_element_get_static_pad (queue, "src");
+  gst_object_unref (queuesrc);
+
+  return queuesrc;
+}
+
+/* Decoded streams are encoded once per encodebin, each branch having its own
+ * queue so that the encoders run in parallel */
+static void
+_tee_to_encodebins (GstTranscodeBin * self, GstPad * pad, GstCaps * caps,
+    GString * layout)
+{
+  GList *tmp, *encodebins;
+  GstElement *tee;
+  GstPad *teesink;
+
+  if (!(tee = _add_stream_element (self, "tee")))
+    return;
+
+  teesink = gst_element_get_static_pad (tee, "sink");
+  if (!_link_pads (self, pad, teesink)) {
+    gst_object_unref (teesink);
+    return;
+  }
+  gst_object_unref (teesink);
+  _add_pacing_probe (self, pad);
+  _add_progress_probe (self, pad);
+  _add_latency_probe (self, pad, caps);
+  _add_degradation_probe (self, pad, caps);
+  g_string_append (layout, " ! tee");
+
+  encodebins = g_list_prepend (g_list_copy (self->extra_encodebins),
+      self->encodebin);
+  for (tmp = encodebins; tmp; tmp = tmp->next) {
+    GstElement *queue;
+    GstPad *teesrc, *queuesink, *queuesrc;
+    GstPad *sinkpad = _request_encodebin_pad (self, tmp->data, pad, caps);
+
+    if (!sinkpad)
+      continue;
+
+    if (!(queue = _make_queue (self, caps))) {
+      gst_object_unref (sinkpad);
+      break;
+    }
+
+    teesrc = gst_element_get_request_pad (tee, "src_%u");
+    queuesink = gst_element_get_static_pad (queue, "sink");
+    queuesrc = gst_element_get_static_pad (queue, "src");
+
+    gst_pad_link (teesrc, queuesink);
+    _link_to_encodebin (self, queuesrc, sinkpad);
+    gst_element_sync_state_with_parent (queue);
+    g_string_append_printf (layout, " t. ! queue ! %s",
+        GST_OBJECT_NAME (tmp->data));
+
+    gst_object_unref (teesrc);
+    gst_object_unref (queuesink);
+    gst_object_unref (queuesrc);
+    gst_object_unref (sinkpad);
+  }
+  g_list_free (encodebins);
+
+  gst_element_sync_state_with_parent (tee);
+}
+
+/* Returns a pad requested on encodebin during a previous run that can take
+ * @caps, if any */
+static GstPad *
+_get_reusable_encodebin_pad (GstTranscodeBin * self, GstCaps * caps)
+{
+  GList *tmp, *candidates;
+  GstPad *sinkpad = NULL;
+
+  GST_OBJECT_LOCK (self);
+  candidates = g_list_copy_deep (self->free_encodebin_sinkpads,
+      (GCopyFunc) gst_object_ref, NULL);
+  GST_OBJECT_UNLOCK (self);
+
+  for (tmp = candidates; tmp && !sinkpad; tmp = tmp->next) {
+    GstCaps *sinkcaps = gst_pad_query_caps (tmp->data, NULL);
+
+    if (gst_caps_can_intersect (caps, sinkcaps)) {
+      GList *free_link;
+
+      /* Another stream might have taken it in the meantime */
+      GST_OBJECT_LOCK (self);
+      free_link = g_list_find (self->free_encodebin_sinkpads, tmp->data);
+      if (free_link) {
+        sinkpad = gst_object_ref (tmp->data);
+        self->free_encodebin_sinkpads =
+            g_list_delete_link (self->free_encodebin_sinkpads, free_link);
+      }
+      GST_OBJECT_UNLOCK (self);
+    }
+    gst_caps_unref (sinkcaps);
+  }
+  g_list_free_full (candidates, gst_object_unref);
+
+  if (sinkpad)
+    GST_INFO_OBJECT (self, "Reusing %" GST_PTR_FORMAT " for %" GST_PTR_FORMAT,
+        sinkpad, caps);
+
+  return sinkpad;
+}
+
+#define ALLOCATION_POOL_QUARK (g_quark_from_static_string ("transcodebin-pool"))
+
+/* Called once encodebin answered the ALLOCATION query, the decoder then gets
+ * a pool of our own for each stream, with bounded, pre-allocated and aligned
+ * buffers reused for the whole transcoding */
+static GstPadProbeReturn
+allocation_query_probe (GstPad * pad, GstPadProbeInfo * info,
+    GstTranscodeBin * self)
+{
+  guint i, size = 0, min = 0, max = 0, alignment;
+  GstQuery *query = GST_PAD_PROBE_INFO_QUERY (info);
+  GstStructure *config;
+  GstBufferPool *pool;
+  GstAllocationParams params;
+  GstVideoInfo vinfo;
+  GstCaps *caps;
+  gboolean need_pool, video_meta;
+
+  if (GST_QUERY_TYPE (query) != GST_QUERY_ALLOCATION ||
+      !(GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_PULL))
+    return GST_PAD_PROBE_OK;
+
+  gst_query_parse_allocation (query, &caps, &need_pool);
+  if (!caps || !need_pool || !gst_video_info_from_caps (&vinfo, caps) ||
+      !gst_caps_features_is_equal (gst_caps_get_features (caps, 0),
+          GST_CAPS_FEATURES_MEMORY_SYSTEM_MEMORY))
+    return GST_PAD_PROBE_OK;
+
+  if (gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_parse_nth_allocation_pool (query, 0, NULL, &size, &min, &max);
+
+  GST_OBJECT_LOCK (self);
+  size = MAX (size, vinfo.size);
+  min = MAX (min, self->allocation_pool_min_buffers);
+  if (self->allocation_pool_max_buffers)
+    max = max ? MIN (max, self->allocation_pool_max_buffers) :
+        self->allocation_pool_max_buffers;
+  if (max)
+    max = MAX (min, max);
+  alignment = self->allocation_pool_alignment;
+  GST_OBJECT_UNLOCK (self);
+
+  /* Reuse the pool when it is already running with those caps */
+  pool = g_object_get_qdata (G_OBJECT (pad), ALLOCATION_POOL_QUARK);
+  if (pool && gst_buffer_pool_is_active (pool)) {
+    GstCaps *pool_caps;
+
+    config = gst_buffer_pool_get_config (pool);
+    gst_buffer_pool_config_get_params (config, &pool_caps, &size, &min, &max);
+    if (pool_caps && gst_caps_is_equal (pool_caps, caps)) {
+      gst_structure_free (config);
+      goto propose;
+    }
+    gst_structure_free (config);
+    pool = NULL;
+  }
+
+  if (!pool) {
+    pool = gst_video_buffer_pool_new ();
+    g_object_set_qdata_full (G_OBJECT (pad), ALLOCATION_POOL_QUARK, pool,
+        gst_object_unref);
+  }
+
+  video_meta = gst_query_find_allocation_meta (query, GST_VIDEO_META_API_TYPE,
+      NULL);
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, size, min, max);
+  gst_allocation_params_init (&params);
+  params.align = alignment ? alignment - 1 : 0;
+  gst_buffer_pool_config_set_allocator (config, NULL, &params);
+
+  /* Padding the planes changes their strides, which only works if
+   * downstream reads them from the video meta */
+  if (video_meta && alignment) {
+    GstVideoAlignment align;
+
+    gst_video_alignment_reset (&align);
+    for (i = 0; i < GST_VIDEO_MAX_PLANES; i++)
+      align.stride_align[i] = alignment - 1;
+    gst_buffer_pool_config_add_option (config,
+        GST_BUFFER_POOL_OPTION_VIDEO_META);
+    gst_buffer_pool_config_add_option (config,
+        GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT);
+    gst_buffer_pool_config_set_video_alignment (config, &align);
+  }
+
+  if (!gst_buffer_pool_set_config (pool, config)) {
+    GST_WARNING_OBJECT (self, "Could not configure %" GST_PTR_FORMAT
+        " for %" GST_PTR_FORMAT, pool, caps);
+    g_object_set_qdata (G_OBJECT (pad), ALLOCATION_POOL_QUARK, NULL);
+
+    return GST_PAD_PROBE_OK;
+  }
+
+  /* The video pool grows the size with the alignment padding */
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_get_params (config, NULL, &size, NULL, NULL);
+  gst_structure_free (config);
+
+  GST_INFO_OBJECT (self, "Proposing %" GST_PTR_FORMAT " with %u-%u buffers "
+      "of %u bytes on %" GST_PTR_FORMAT, pool, min, max, size, pad);
+
+propose:
+  if (gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+  else
+    gst_query_add_allocation_pool (query, pool, size, min, max);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+_is_raw_video (GstCaps * caps)
+{
+  return !gst_caps_is_empty (caps) && !gst_caps_is_any (caps) &&
+      !g_strcmp0 (gst_structure_get_name (gst_caps_get_structure (caps, 0)),
+      "video/x-raw");
+}
+
+static gboolean
+_is_paced (GstTranscodeBin * self)
+{
+  gboolean ret;
+
+  g_mutex_lock (&self->bucket_lock);
+  ret = self->cpu_budget != 0;
+  g_mutex_unlock (&self->bucket_lock);
+
+  return ret;
+}
+
+static gboolean
+_has_filter_description (GstTranscodeBin * self, GstCaps * caps)
+{
+  const gchar *name = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+  gboolean ret;
+
+  GST_OBJECT_LOCK (self);
+  ret = (!g_strcmp0 (name, "video/x-raw") && self->video_filter_description)
+      || (!g_strcmp0 (name, "audio/x-raw") && self->audio_filter_description);
+  GST_OBJECT_UNLOCK (self);
+
+  return ret;
+}
+
+/* Adds the filter of the stream of @pad with the queues around it. Filters
+ * given as descriptions are created for each stream and always run in their
+ * own thread, as they are usually the expensive part. When the encoders are
+ * paced, the pacing probe never blocks the decoder thread */
+static GstPad *
+_add_filter_stage (GstTranscodeBin * self, GstPad * pad, GstCaps * caps,
+    GString * layout, gboolean add_queue)
+{
+  GstPad *filter_src;
+  gboolean paced = _is_paced (self);
+
+  pad = _add_queue (self, pad, caps, layout, paced
+      || _has_filter_description (self, caps));
+  filter_src = _insert_filter (self, pad, caps);
+  if (filter_src == pad)
+    return pad;
+
+  g_string_append_printf (layout, " ! %s",
+      GST_OBJECT_NAME (GST_OBJECT_PARENT (filter_src)));
+
+  if (add_queue)
+    filter_src = _add_queue (self, filter_src, caps, layout, paced);
+
+  return filter_src;
+}
+
+/* The space reserved for the moov atom depends on the duration of the
+ * stream, which is only known once decodebin exposes its pads */
+static void
+_reserve_mp4_moov (GstTranscodeBin * self, GstPad * pad)
+{
+  GList *tmp, *muxers;
+  GstClockTime duration = GST_CLOCK_TIME_NONE;
+  gint64 upstream_duration;
+
+  GST_OBJECT_LOCK (self);
+  if (self->mp4_moov_reserved || !self->mp4_muxers) {
+    GST_OBJECT_UNLOCK (self);
+    return;
+  }
+  self->mp4_moov_reserved = TRUE;
+  muxers = g_list_copy_deep (self->mp4_muxers, (GCopyFunc) gst_object_ref,
+      NULL);
+  if (GST_CLOCK_TIME_IS_VALID (self->stop_time)
+      && self->stop_time > self->start_time)
+    duration = self->stop_time - self->start_time;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!GST_CLOCK_TIME_IS_VALID (duration)
+      && gst_pad_query_duration (pad, GST_FORMAT_TIME, &upstream_duration)
+      && upstream_duration > 0)
+    duration = upstream_duration;
+
+  for (tmp = muxers; tmp; tmp = tmp->next) {
+    if (GST_CLOCK_TIME_IS_VALID (duration)) {
+      /* Some margin as the moov can not grow past the reserved space */
+      g_object_set (tmp->data, "reserved-max-duration",
+          duration + duration / 10 + GST_SECOND, NULL);
+    } else {
+      GST_INFO_OBJECT (self, "Unknown duration, %" GST_PTR_FORMAT
+          " rewrites the file to move the moov atom at the start", tmp->data);
+      g_object_set (tmp->data, "faststart", TRUE, NULL);
+    }
+  }
+  g_list_free_full (muxers, gst_object_unref);
+}
+
+static void
+pad_added_cb (GstElement * decodebin, GstPad * pad, GstTranscodeBin * self)
+{
+  GstCaps *caps;
+  gboolean collect_stats;
+  GstPad *sinkpad = NULL, *decoded_pad = pad;
+  gchar *stream_id, *memory_features = NULL;
+  GString *layout;
+
+  GST_OBJECT_LOCK (self);
+  collect_stats = self->collect_stats;
+  if (needs_initial_seek (self)) {
+    BlockedPad *blocked = g_new0 (BlockedPad, 1);
+
+    blocked->pad = gst_object_ref (pad);
+    blocked->probe_id = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BLOCK |
+        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+        (GstPadProbeCallback) block_until_seeked_probe, self, NULL);
+    self->blocked_pads = g_list_prepend (self->blocked_pads, blocked);
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  _reserve_mp4_moov (self, pad);
+
+  caps = gst_pad_query_caps (pad, NULL);
+
+  GST_DEBUG_OBJECT (decodebin, "Pad added, caps: %" GST_PTR_FORMAT, caps);
+
+  stream_id = gst_pad_get_stream_id (pad);
+  layout = g_string_new (GST_OBJECT_NAME (decodebin));
+
+  if (!self->extra_encodebins) {
+    GstElement *video_filter;
+    gboolean zero_copy;
+
+    GST_OBJECT_LOCK (self);
+    video_filter = self->video_filter;
+    zero_copy = self->zero_copy && !self->video_filter_description
+        && !self->no_video_conversion;
+    GST_OBJECT_UNLOCK (self);
+
+    /* Decoded frames can stay in their memory (DMABuf, GL, ...) when the
+     * encoder handles it and nothing needs to touch them in between */
+    if (zero_copy && !video_filter && caps && _is_raw_video (caps))
+      memory_features = _find_shared_memory_features (self, self->encodebin,
+          caps);
+
+    if (caps)
+      sinkpad = _get_reusable_encodebin_pad (self, caps);
+
+    if (!sinkpad) {
+      if (memory_features)
+        _set_encodebin_flag (self->encodebin, "no-video-conversion", TRUE);
+      sinkpad = _request_encodebin_pad (self, self->encodebin, pad, caps);
+      if (memory_features)
+        _set_encodebin_flag (self->encodebin, "no-video-conversion", FALSE);
+
+      GST_OBJECT_LOCK (self);
+      if (sinkpad && self->reuse_encoders)
+        self->encodebin_sinkpads = g_list_prepend (self->encodebin_sinkpads,
+            gst_object_ref (sinkpad));
+      GST_OBJECT_UNLOCK (self);
+    }
+
+    if (sinkpad) {
+      pad = _add_filter_stage (self, pad, caps, layout, TRUE);
+      if (_link_to_encodebin (self, pad, sinkpad)) {
+        gboolean allocation_pool;
+
+        _add_pacing_probe (self, pad);
+        _add_progress_probe (self, pad);
+        _add_latency_probe (self, pad, caps);
+        _add_degradation_probe (self, pad, caps);
+
+        GST_OBJECT_LOCK (self);
+        allocation_pool = self->allocation_pool;
+        GST_OBJECT_UNLOCK (self);
+        if (allocation_pool && !memory_features && caps && _is_raw_video (caps))
+          gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM,
+              (GstPadProbeCallback) allocation_query_probe, self, NULL);
+        if (collect_stats)
+          gst_transcode_stats_track_stream (self->stats, stream_id,
+              decoded_pad, sinkpad);
+        g_string_append_printf (layout, " ! %s",
+            GST_OBJECT_NAME (self->encodebin));
+      }
+      gst_object_unref (sinkpad);
+    }
+  } else {
+    /* Each tee branch already has its own queue */
+    pad = _add_filter_stage (self, pad, caps, layout, FALSE);
+    _tee_to_encodebins (self, pad, caps, layout);
+    if (collect_stats)
+      gst_transcode_stats_track_stream (self->stats, stream_id, decoded_pad,
+          NULL);
+  }
+
+  GST_INFO_OBJECT (self, "Stream %s layout: %s (memory: %s)", stream_id,
+      layout->str, GST_STR_NULL (memory_features));
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_element (GST_OBJECT (self),
+          gst_structure_new ("transcodebin-stream-layout",
+              "stream-id", G_TYPE_STRING, stream_id,
+              "stream-caps", GST_TYPE_CAPS, caps,
+              "layout", G_TYPE_STRING, layout->str,
+              "memory-features", G_TYPE_STRING, memory_features ?
+              memory_features : GST_CAPS_FEATURE_MEMORY_SYSTEM_MEMORY,
+              NULL)));
+
+  g_string_free (layout, TRUE);
+  g_free (memory_features);
+  g_free (stream_id);
+  if (caps)
+    gst_caps_unref (caps);
+}
+
+/* Call with the object lock held */
+static GstEncodingProfile *
+_find_stream_profile (GstTranscodeBin * self, GstCaps * caps)
+{
+  const GList *tmp;
+
+  if (!GST_IS_ENCODING_CONTAINER_PROFILE (self->profile))
+    return self->profile;
+
+  for (tmp =
+      gst_encoding_container_profile_get_profiles
+      (GST_ENCODING_CONTAINER_PROFILE (self->profile)); tmp; tmp = tmp->next) {
+    GstCaps *format = gst_encoding_profile_get_format (tmp->data);
+    gboolean compatible = gst_caps_can_intersect (caps, format);
+
+    gst_caps_unref (format);
+    if (compatible)
+      return tmp->data;
+  }
+
+  return NULL;
+}
+
+static gboolean
+_is_elementary_stream (GstCaps * caps)
+{
+  const gchar *name;
+
+  if (gst_caps_is_empty (caps) || gst_caps_is_any (caps))
+    return FALSE;
+
+  name = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+
+  return g_str_has_prefix (name, "audio/") || g_str_has_prefix (name,
+      "video/") || g_str_has_prefix (name, "image/")
+      || g_str_has_prefix (name, "text/")
+      || g_str_has_prefix (name, "subpicture/")
+      || g_str_has_prefix (name, "closedcaption/");
+}
+
+/* Decide, the first time decodebin finds the caps of a stream, whether it is
+ * passed through as is (same format in the same container), remuxed into
+ * another container or decoded and re-encoded. Each stream is classified on
+ * its own so that a change to the audio never makes us decode the video. */
+static gboolean
+autoplug_continue_cb (GstElement * decodebin, GstPad * pad, GstCaps * caps,
+    GstTranscodeBin * self)
+{
+  gchar *stream_id;
+  const gchar *decision;
+  GstEncodingProfile *profile;
+  GstCaps *restriction = NULL, *container_format = NULL;
+  gboolean autoplug = TRUE;
+
+  if (!_is_elementary_stream (caps)) {
+    GST_OBJECT_LOCK (self);
+    if (!self->input_caps)
+      self->input_caps = gst_caps_ref (caps);
+    GST_OBJECT_UNLOCK (self);
+
+    return TRUE;
+  }
+
+  stream_id = gst_pad_get_stream_id (pad);
+
+  GST_OBJECT_LOCK (self);
+  if (stream_id && g_hash_table_contains (self->classified_streams,
+          stream_id)) {
+    GST_OBJECT_UNLOCK (self);
+    g_free (stream_id);
+
+    return TRUE;
+  }
+
+  if (stream_id)
+    g_hash_table_add (self->classified_streams, g_strdup (stream_id));
+
+  /* Renditions get the decoded streams, nothing can be passed through */
+  profile = NULL;
+  if (self->avoid_reencoding && (!self->extra_profiles
+          || !self->extra_profiles->len))
+    profile = _find_stream_profile (self, caps);
+  if (profile)
+    restriction = gst_encoding_profile_get_restriction (profile);
+  if (GST_IS_ENCODING_CONTAINER_PROFILE (self->profile))
+    container_format = gst_encoding_profile_get_format (self->profile);
+
+  if (!profile || (restriction && !gst_caps_is_any (restriction))) {
+    decision = "reencode";
+  } else {
+    autoplug = FALSE;
+    if (self->input_caps && container_format &&
+        gst_caps_can_intersect (self->input_caps, container_format))
+      decision = "passthrough";
+    else
+      decision = "remux";
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  GST_INFO_OBJECT (self, "Stream %s with caps %" GST_PTR_FORMAT ": %s",
+      stream_id, caps, decision);
+
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_element (GST_OBJECT (self),
+          gst_structure_new ("transcodebin-stream-classification",
+              "stream-id", G_TYPE_STRING, stream_id,
+              "stream-caps", GST_TYPE_CAPS, caps,
+              "decision", G_TYPE_STRING, decision, NULL)));
+
+  if (restriction)
+    gst_caps_unref (restriction);
+  if (container_format)
+    gst_caps_unref (container_format);
+  g_free (stream_id);
+
+  return autoplug;
+}
+
+static GstElement *
+_make_encodebin (GstTranscodeBin * self, GstEncodingProfile * profile,
+    GstPad * srcpad)
+{
+  GstPad *pad;
+  GstElement *encodebin;
+  gboolean no_video_conversion;
+
+  profile = _make_encoding_profile (self, profile);
+  if (!profile)
+    return NULL;
+
+  encodebin = gst_element_factory_make ("encodebin", NULL);
+  if (!encodebin) {
+    gst_object_unref (profile);
+    goto no_encodebin;
+  }
+
+  gst_bin_add (GST_BIN (self), encodebin);
+  g_object_set (encodebin, "profile", profile, NULL);
+  gst_object_unref (profile);
+  GST_OBJECT_LOCK (self);
+  no_video_conversion = self->no_video_conversion;
+  GST_OBJECT_UNLOCK (self);
+  if (no_video_conversion)
+    _set_encodebin_flag (encodebin, "no-video-conversion", TRUE);
+
+  pad = gst_element_get_static_pad (encodebin, "src");
+  if (!gst_ghost_pad_set_target (GST_GHOST_PAD_CAST (srcpad), pad)) {
+
+    gst_object_unref (pad);
+    GST_ERROR_OBJECT (self, "Could not ghost %" GST_PTR_FORMAT " srcpad",
+        encodebin);
+
+    return NULL;
+  }
+  gst_object_unref (pad);
+
+  if (!gst_element_sync_state_with_parent (encodebin))
+    return NULL;
+
+  return encodebin;
+
+  /* ERRORS */
+no_encodebin:
+  {
+    post_missing_plugin_error (GST_ELEMENT_CAST (self), "encodebin");
+
+    GST_ELEMENT_ERROR (self, CORE, MISSING_PLUGIN, (NULL),
+        ("No encodebin element, check your installation"));
+
+    return NULL;
+  }
+}
+
+static void
+remove_encodebin (GstTranscodeBin * self)
+{
+  if (!self->encodebin)
+    return;
+
+  gst_element_set_state (self->encodebin, GST_STATE_NULL);
+  gst_bin_remove (GST_BIN (self), self->encodebin);
+  self->encodebin = NULL;
+  gst_clear_object (&self->encodebin_profile);
+
+  GST_OBJECT_LOCK (self);
+  g_list_free_full (self->encodebin_sinkpads, gst_object_unref);
+  self->encodebin_sinkpads = NULL;
+  g_list_free (self->free_encodebin_sinkpads);
+  self->free_encodebin_sinkpads = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  gst_transcode_stats_prune (self->stats, GST_OBJECT (self));
+}
+
+static gboolean
+make_encodebin (GstTranscodeBin * self)
+{
+  guint i;
+  GList *srcpad;
+
+  if (!self->profile)
+    goto no_profile;
+
+  /* The profile may have been changed while going through READY */
+  if (self->encodebin && (self->extra_profiles->len
+          || self->encodebin_profile != self->profile))
+    remove_encodebin (self);
+
+  if (self->encodebin) {
+    GST_OBJECT_LOCK (self);
+    g_list_free (self->free_encodebin_sinkpads);
+    self->free_encodebin_sinkpads = g_list_copy (self->encodebin_sinkpads);
+    GST_OBJECT_UNLOCK (self);
+
+    GST_INFO_OBJECT (self, "reusing encodebin");
+
+    return TRUE;
+  }
+
+  GST_INFO_OBJECT (self, "making new encodebin");
+
+  gst_object_replace ((GstObject **) & self->encodebin_profile,
+      (GstObject *) self->profile);
+  GST_OBJECT_LOCK (self);
+  self->no_video_conversion = FALSE;
+  GST_OBJECT_UNLOCK (self);
+  self->encodebin = _make_encodebin (self, self->profile, self->srcpad);
+  if (!self->encodebin)
+    return FALSE;
+
+  for (i = 0, srcpad = self->extra_srcpads; srcpad; i++, srcpad = srcpad->next) {
+    GstElement *encodebin = _make_encodebin (self,
+        g_ptr_array_index (self->extra_profiles, i), srcpad->data);
+
+    if (!encodebin)
+      return FALSE;
+
+    self->extra_encodebins = g_list_append (self->extra_encodebins, encodebin);
+  }
+
+  return TRUE;
+
+  /* ERRORS */
+no_profile:
+  {
+    GST_ELEMENT_ERROR (self, CORE, MISSING_PLUGIN, (NULL),
+        ("No GstEncodingProfile set, can not run."));
+
+    return FALSE;
+  }
+}
+
+static gboolean
+make_decodebin (GstTranscodeBin * self)
+{
+  GstPad *pad;
+  GST_INFO_OBJECT (self, "making new decodebin");
+
+  self->decodebin = gst_element_factory_make ("decodebin", NULL);
+
+  if (!self->decodebin)
+    goto no_decodebin;
+
+  if (self->avoid_reencoding) {
+    GstCaps *decodecaps;
+
+    g_object_get (self->decodebin, "caps", &decodecaps, NULL);
+    if (GST_IS_ENCODING_CONTAINER_PROFILE (self->profile)) {
+      GList *tmp;
+
+      decodecaps = gst_caps_make_writable (decodecaps);
+      for (tmp = (GList *)
+          gst_encoding_container_profile_get_profiles
+          (GST_ENCODING_CONTAINER_PROFILE (self->profile)); tmp;
+          tmp = tmp->next) {
+        GstCaps *encodecaps = gst_encoding_profile_get_format (tmp->data);
+        GstCaps *restrictions =
+            gst_encoding_profile_get_restriction (tmp->data);
+
+        if (!restrictions)
+          gst_caps_append (decodecaps, encodecaps);
+        else
+          gst_caps_unref (restrictions);
+      }
+    }
+    g_object_set (self->decodebin, "caps", decodecaps, NULL);
+    gst_caps_unref (decodecaps);
+  }
+
+  g_signal_connect (self->decodebin, "autoplug-continue",
+      G_CALLBACK (autoplug_continue_cb), self);
+  g_signal_connect (self->decodebin, "autoplug-sort",
+      G_CALLBACK (autoplug_sort_cb), self);
+  g_signal_connect (self->decodebin, "pad-added", G_CALLBACK (pad_added_cb),
+      self);
+  g_signal_connect (self->decodebin, "no-more-pads",
+      G_CALLBACK (no_more_pads_cb), self);
+
+  gst_bin_add (GST_BIN (self), self->decodebin);
+  pad = gst_element_get_static_pad (self->decodebin, "sink");
+  if (!gst_ghost_pad_set_target (GST_GHOST_PAD_CAST (self->sinkpad), pad)) {
+
+    gst_object_unref (pad);
+    GST_ERROR_OBJECT (self, "Could not ghost %" GST_PTR_FORMAT " sinkpad",
+        self->decodebin);
+
+    return FALSE;
+  }
+
+  gst_object_unref (pad);
+  return TRUE;
+
+  /* ERRORS */
+no_decodebin:
+  {
+    post_missing_plugin_error (GST_ELEMENT_CAST (self), "decodebin");
+    GST_ELEMENT_ERROR (self, CORE, MISSING_PLUGIN, (NULL),
+        ("No decodebin element, check your installation"));
+
+    return FALSE;
+  }
+}
+
+/* The main encodebin is kept, with its encoders, when @keep_encodebin is
+ * %TRUE and the profile did not change */
+static void
+remove_all_children (GstTranscodeBin * self, gboolean keep_encodebin)
+{
+  GList *tmp, *stream_elements;
+
+  /* Renditions are always set up from scratch */
+  if (self->extra_encodebins)
+    keep_encodebin = FALSE;
+
+  GST_OBJECT_LOCK (self);
+  stream_elements = self->stream_elements;
+  self->stream_elements = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  for (tmp = stream_elements; tmp; tmp = tmp->next) {
+    gst_element_set_state (tmp->data, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self), tmp->data);
+  }
+  g_list_free_full (stream_elements, gst_object_unref);
+
+  for (tmp = self->extra_encodebins; tmp; tmp = tmp->next) {
+    gst_element_set_state (tmp->data, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self), tmp->data);
+  }
+  g_list_free (self->extra_encodebins);
+  self->extra_encodebins = NULL;
+
+  if (!keep_encodebin || self->encodebin_profile != self->profile)
+    remove_encodebin (self);
+
+  if (self->video_filter && GST_OBJECT_PARENT (self->video_filter)) {
+    gst_element_set_state (self->video_filter, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self), self->video_filter);
+  }
+
+  if (self->audio_filter && GST_OBJECT_PARENT (self->audio_filter)) {
+    gst_element_set_state (self->audio_filter, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self), self->audio_filter);
+  }
+
+  if (self->decodebin) {
+    gst_element_set_state (self->decodebin, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self), self->decodebin);
+    self->decodebin = NULL;
+  }
+
+  GST_OBJECT_LOCK (self);
+  gst_clear_caps (&self->input_caps);
+  g_hash_table_remove_all (self->classified_streams);
+  GST_OBJECT_UNLOCK (self);
+
+  gst_transcode_stats_prune (self->stats, GST_OBJECT (self));
+}
+
+static GstStateChangeReturn
+gst_transcode_bin_change_state (GstElement * element, GstStateChange transition)
+{
+  gboolean keep_encodebin;
+  GstStateChangeReturn ret;
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (element);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      bucket_set_flushing (self, FALSE);
+      g_mutex_lock (&self->bucket_lock);
+      self->pacing_time = 0;
+      g_mutex_unlock (&self->bucket_lock);
+      g_atomic_int_set (&self->progress_ms, 0);
+      g_atomic_int_set (&self->late_buffers, 0);
+      g_atomic_int_set (&self->degradation_level, DEGRADATION_NONE);
+      GST_OBJECT_LOCK (self);
+      self->n_video_streams = 0;
+      self->n_audio_streams = 0;
+      self->degradation_start = GST_CLOCK_TIME_NONE;
+      self->degradation_last_check = GST_CLOCK_TIME_NONE;
+      self->initial_seek_done = FALSE;
+      self->mp4_moov_reserved = FALSE;
+      GST_OBJECT_UNLOCK (self);
+
+      if (!make_encodebin (self))
+        goto setup_failed;
+
+      if (!make_decodebin (self))
+        goto setup_failed;
+
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      bucket_set_flushing (self, TRUE);
+      break;
+    default:
+      break;
+  }
+
+  ret =
+      GST_ELEMENT_CLASS (gst_transcode_bin_parent_class)->change_state (element,
+      transition);
+  if (ret == GST_STATE_CHANGE_FAILURE)
+    goto beach;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      GST_OBJECT_LOCK (self);
+      g_list_free_full (self->blocked_pads, (GDestroyNotify) blocked_pad_free);
+      self->blocked_pads = NULL;
+      keep_encodebin = self->reuse_encoders;
+      GST_OBJECT_UNLOCK (self);
+
+      remove_all_children (self, keep_encodebin);
+      break;
+    case GST_STATE_CHANGE_READY_TO_NULL:
+      remove_encodebin (self);
+      break;
+    default:
+      break;
+  }
+
+beach:
+  return ret;
 
 setup_failed:
-  remove_all_children (self);
+  remove_all_children (self, FALSE);
   return GST_STATE_CHANGE_FAILURE;
 }
 
@@ -410,9 +2417,292 @@ gst_transcode_bin_dispose (GObject * object)
   g_clear_object (&self->video_filter);
   g_clear_object (&self->audio_filter);
 
+  if (self->encoder_accounting) {
+    gst_cpu_accounting_unref (self->encoder_accounting);
+    self->encoder_accounting = NULL;
+  }
+
+  g_clear_pointer (&self->extra_profiles, g_ptr_array_unref);
+  gst_clear_object (&self->encodebin_profile);
+  g_list_free_full (self->encodebin_sinkpads, gst_object_unref);
+  self->encodebin_sinkpads = NULL;
+  g_list_free (self->free_encodebin_sinkpads);
+  self->free_encodebin_sinkpads = NULL;
+  g_list_free (self->extra_srcpads);
+  self->extra_srcpads = NULL;
+  g_list_free_full (self->mp4_muxers, gst_object_unref);
+  self->mp4_muxers = NULL;
+  g_list_free_full (self->video_encoders, gst_object_unref);
+  self->video_encoders = NULL;
+
   G_OBJECT_CLASS (gst_transcode_bin_parent_class)->dispose (object);
 }
 
+static void
+gst_transcode_bin_finalize (GObject * object)
+{
+  GstTranscodeBin *self = (GstTranscodeBin *) object;
+
+  g_mutex_clear (&self->bucket_lock);
+  g_cond_clear (&self->bucket_cond);
+  g_hash_table_unref (self->classified_streams);
+  gst_transcode_stats_free (self->stats);
+  g_free (self->video_filter_description);
+  g_free (self->audio_filter_description);
+  g_free (self->multipass_cache_file);
+
+  G_OBJECT_CLASS (gst_transcode_bin_parent_class)->finalize (object);
+}
+
+/* How the video encoders supporting multipass encoding name their passes */
+static const struct
+{
+  const gchar *property;
+  const gchar *first_pass;
+  const gchar *final_pass;
+} multipass_modes[] = {
+  {"pass", "pass1", "pass2"},   /* x264enc */
+  {"multipass-mode", "first-pass", "last-pass"},        /* vp8enc, vp9enc */
+  {"multipass-mode", "first-pass", "second-pass"},      /* theoraenc */
+};
+
+static void
+_configure_multipass_encoder (GstTranscodeBin * self, GstElement * encoder,
+    guint pass, const gchar * cache_file)
+{
+  guint i;
+  GObjectClass *klass = G_OBJECT_GET_CLASS (encoder);
+
+  for (i = 0; i < G_N_ELEMENTS (multipass_modes); i++) {
+    GEnumValue *value;
+    GParamSpec *pspec =
+        g_object_class_find_property (klass, multipass_modes[i].property);
+
+    if (!pspec || !G_IS_PARAM_SPEC_ENUM (pspec))
+      continue;
+
+    value = g_enum_get_value_by_nick (G_PARAM_SPEC_ENUM (pspec)->enum_class,
+        pass == 1 ? multipass_modes[i].first_pass :
+        multipass_modes[i].final_pass);
+    if (!value)
+      continue;
+
+    GST_INFO_OBJECT (self, "%s pass of %" GST_PTR_FORMAT " using %s",
+        pass == 1 ? "First" : "Final", encoder, cache_file);
+    g_object_set (encoder, multipass_modes[i].property, value->value, NULL);
+    if (g_object_class_find_property (klass, "multipass-cache-file"))
+      g_object_set (encoder, "multipass-cache-file", cache_file, NULL);
+
+    return;
+  }
+
+  GST_WARNING_OBJECT (self, "%" GST_PTR_FORMAT " does not support multipass"
+      " encoding, doing a single pass", encoder);
+}
+
+/* How the video encoders are told not to hold frames back, in live mode
+ * they override what the presets of the profile set */
+static const struct
+{
+  const gchar *property;
+  const gchar *value;
+} low_latency_settings[] = {
+  {"tune", "zerolatency"},      /* x264enc, x265enc */
+  {"deadline", "1"},            /* vp8enc, vp9enc */
+  {"lag-in-frames", "0"},       /* vp8enc, vp9enc */
+  {"zerolatency", "true"},      /* nvh264enc, nvh265enc */
+};
+
+static void
+_configure_low_latency_encoder (GstTranscodeBin * self, GstElement * encoder)
+{
+  guint i;
+  GObjectClass *klass = G_OBJECT_GET_CLASS (encoder);
+
+  for (i = 0; i < G_N_ELEMENTS (low_latency_settings); i++) {
+    if (!g_object_class_find_property (klass,
+            low_latency_settings[i].property))
+      continue;
+
+    GST_INFO_OBJECT (self, "Setting %s=%s on %" GST_PTR_FORMAT,
+        low_latency_settings[i].property, low_latency_settings[i].value,
+        encoder);
+    gst_util_set_object_arg (G_OBJECT (encoder),
+        low_latency_settings[i].property, low_latency_settings[i].value);
+  }
+}
+
+static void
+gst_transcode_bin_deep_element_added (GstBin * bin, GstBin * sub_bin,
+    GstElement * child)
+{
+  const gchar *klass;
+  gboolean collect_stats, live, degrade;
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (bin);
+  GstTranscodeBinMp4Mode mp4_mode;
+  guint pass;
+  gchar *multipass_cache_file;
+
+  GST_OBJECT_LOCK (self);
+  collect_stats = self->collect_stats;
+  live = self->live;
+  degrade = GST_CLOCK_TIME_IS_VALID (self->deadline);
+  mp4_mode = self->mp4_mode;
+  pass = self->pass;
+  multipass_cache_file = g_strdup (self->multipass_cache_file);
+  GST_OBJECT_UNLOCK (self);
+
+  klass = gst_element_get_metadata (child, GST_ELEMENT_METADATA_KLASS);
+  if (collect_stats && klass && !GST_IS_BIN (child)) {
+    if (strstr (klass, "Decoder"))
+      gst_transcode_stats_track_element (self->stats, child, "decoder");
+    else if (strstr (klass, "Encoder"))
+      gst_transcode_stats_track_element (self->stats, child, "encoder");
+  }
+
+  if (pass && multipass_cache_file && klass && strstr (klass, "Encoder")
+      && strstr (klass, "Video"))
+    _configure_multipass_encoder (self, child, pass, multipass_cache_file);
+  g_free (multipass_cache_file);
+
+  if (live && klass && strstr (klass, "Encoder") && strstr (klass, "Video"))
+    _configure_low_latency_encoder (self, child);
+
+  if (degrade && klass && strstr (klass, "Encoder") && strstr (klass, "Video")
+      && !GST_IS_BIN (child)) {
+    GST_OBJECT_LOCK (self);
+    self->video_encoders = g_list_prepend (self->video_encoders,
+        gst_object_ref (child));
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  /* The qtmux family is the one with reserved moov support */
+  if (mp4_mode != GST_TRANSCODE_BIN_MP4_MODE_NORMAL &&
+      g_object_class_find_property (G_OBJECT_GET_CLASS (child),
+          "reserved-max-duration")) {
+    if (mp4_mode == GST_TRANSCODE_BIN_MP4_MODE_FRAGMENTED) {
+      g_object_set (child, "fragment-duration", MP4_FRAGMENT_DURATION, NULL);
+    } else {
+      g_object_set (child, "reserved-moov-update-period",
+          (guint64) MP4_MOOV_UPDATE_PERIOD, NULL);
+
+      GST_OBJECT_LOCK (self);
+      self->mp4_muxers = g_list_prepend (self->mp4_muxers,
+          gst_object_ref (child));
+      GST_OBJECT_UNLOCK (self);
+    }
+  }
+
+  GST_BIN_CLASS (gst_transcode_bin_parent_class)->deep_element_added (bin,
+      sub_bin, child);
+}
+
+static void
+gst_transcode_bin_deep_element_removed (GstBin * bin, GstBin * sub_bin,
+    GstElement * child)
+{
+  GList *link;
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (bin);
+
+  GST_OBJECT_LOCK (self);
+  link = g_list_find (self->mp4_muxers, child);
+  if (link) {
+    gst_object_unref (link->data);
+    self->mp4_muxers = g_list_delete_link (self->mp4_muxers, link);
+  }
+  link = g_list_find (self->video_encoders, child);
+  if (link) {
+    gst_object_unref (link->data);
+    self->video_encoders = g_list_delete_link (self->video_encoders, link);
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  GST_BIN_CLASS (gst_transcode_bin_parent_class)->deep_element_removed (bin,
+      sub_bin, child);
+}
+
+static GstStructure *
+_get_stats (GstTranscodeBin * self)
+{
+  GList *tmp, *elements;
+  GstStructure *stats;
+  GstClockTime pacing_time;
+  GValue queues = G_VALUE_INIT;
+
+  stats = gst_transcode_stats_get_structure (self->stats);
+
+  GST_OBJECT_LOCK (self);
+  elements = g_list_copy_deep (self->stream_elements, (GCopyFunc)
+      gst_object_ref, NULL);
+  GST_OBJECT_UNLOCK (self);
+
+  g_value_init (&queues, GST_TYPE_ARRAY);
+  for (tmp = elements; tmp; tmp = tmp->next) {
+    guint buffers, bytes, max_buffers;
+    guint64 time;
+    GValue value = G_VALUE_INIT;
+
+    if (!g_object_class_find_property (G_OBJECT_GET_CLASS (tmp->data),
+            "current-level-buffers"))
+      continue;
+
+    g_object_get (tmp->data, "current-level-buffers", &buffers,
+        "current-level-bytes", &bytes, "current-level-time", &time,
+        "max-size-buffers", &max_buffers, NULL);
+    g_value_init (&value, GST_TYPE_STRUCTURE);
+    g_value_take_boxed (&value, gst_structure_new ("queue",
+            "name", G_TYPE_STRING, GST_OBJECT_NAME (tmp->data),
+            "current-level-buffers", G_TYPE_UINT, buffers,
+            "current-level-bytes", G_TYPE_UINT, bytes,
+            "current-level-time", G_TYPE_UINT64, time,
+            "max-size-buffers", G_TYPE_UINT, max_buffers, NULL));
+    gst_value_array_append_and_take_value (&queues, &value);
+  }
+  g_list_free_full (elements, gst_object_unref);
+  gst_structure_take_value (stats, "queues", &queues);
+
+  g_mutex_lock (&self->bucket_lock);
+  pacing_time = self->pacing_time;
+  g_mutex_unlock (&self->bucket_lock);
+  gst_structure_set (stats, "pacing-time", G_TYPE_UINT64, pacing_time,
+      "late-buffers", G_TYPE_UINT, g_atomic_int_get (&self->late_buffers),
+      "degradation-level", G_TYPE_UINT,
+      g_atomic_int_get (&self->degradation_level), NULL);
+
+  return stats;
+}
+
+static void
+gst_transcode_bin_handle_message (GstBin * bin, GstMessage * message)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (bin);
+
+  /* Only account the threads running inside the encodebins */
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_STREAM_STATUS) {
+    GList *tmp, *encodebins = NULL;
+
+    GST_OBJECT_LOCK (self);
+    if (self->encodebin)
+      encodebins = g_list_prepend (encodebins,
+          gst_object_ref (self->encodebin));
+    for (tmp = self->extra_encodebins; tmp; tmp = tmp->next)
+      encodebins = g_list_prepend (encodebins, gst_object_ref (tmp->data));
+    GST_OBJECT_UNLOCK (self);
+
+    for (tmp = encodebins; tmp; tmp = tmp->next) {
+      if (gst_object_has_as_ancestor (GST_MESSAGE_SRC (message),
+              GST_OBJECT (tmp->data))) {
+        gst_cpu_accounting_handle_message (self->encoder_accounting, message);
+        break;
+      }
+    }
+    g_list_free_full (encodebins, gst_object_unref);
+  }
+
+  GST_BIN_CLASS (gst_transcode_bin_parent_class)->handle_message (bin,
+      message);
+}
+
 static void
 gst_transcode_bin_get_property (GObject * object,
     guint prop_id, GValue * value, GParamSpec * pspec)
@@ -422,24 +2712,166 @@ gst_transcode_bin_get_property (GObject * object,
   switch (prop_id) {
     case PROP_PROFILE:
       GST_OBJECT_LOCK (self);
-      g_value_set_object (value, self->profile);
+      g_value_set_object (value, self->profile);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_AVOID_REENCODING:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (value, self->avoid_reencoding);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_AUDIO_FILTER:
+      GST_OBJECT_LOCK (self);
+      g_value_set_object (value, self->audio_filter);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_VIDEO_FILTER:
+      GST_OBJECT_LOCK (self);
+      g_value_set_object (value, self->video_filter);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_CPU_BUDGET:
+      g_mutex_lock (&self->bucket_lock);
+      g_value_set_uint64 (value, self->cpu_budget);
+      g_mutex_unlock (&self->bucket_lock);
+      break;
+    case PROP_START_TIME:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->start_time);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SEEK_MODE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_enum (value, self->seek_mode);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LIVE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (value, self->live);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LATENCY_BUDGET:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->latency_budget);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_DEADLINE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->deadline);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STOP_TIME:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->stop_time);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_VIDEO_FILTER_DESCRIPTION:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->video_filter_description);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_HARDWARE_POLICY:
+      GST_OBJECT_LOCK (self);
+      g_value_set_enum (value, self->hardware_policy);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MP4_MODE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_enum (value, self->mp4_mode);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PASS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->pass);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MULTIPASS_CACHE_FILE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->multipass_cache_file);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ZERO_COPY:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (value, self->zero_copy);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_REUSE_ENCODERS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (value, self->reuse_encoders);
       GST_OBJECT_UNLOCK (self);
       break;
-    case PROP_AVOID_REENCODING:
+    case PROP_COLLECT_STATS:
       GST_OBJECT_LOCK (self);
-      g_value_set_boolean (value, self->avoid_reencoding);
+      g_value_set_boolean (value, self->collect_stats);
       GST_OBJECT_UNLOCK (self);
       break;
-    case PROP_AUDIO_FILTER:
+    case PROP_STATS:
+      g_value_take_boxed (value, _get_stats (self));
+      break;
+    case PROP_PROGRESS:
+      g_value_set_uint64 (value,
+          (guint64) g_atomic_int_get (&self->progress_ms) * GST_MSECOND);
+      break;
+    case PROP_ALLOCATION_POOL:
       GST_OBJECT_LOCK (self);
-      g_value_set_object (value, self->audio_filter);
+      g_value_set_boolean (value, self->allocation_pool);
       GST_OBJECT_UNLOCK (self);
       break;
-    case PROP_VIDEO_FILTER:
+    case PROP_ALLOCATION_POOL_MIN_BUFFERS:
       GST_OBJECT_LOCK (self);
-      g_value_set_object (value, self->video_filter);
+      g_value_set_uint (value, self->allocation_pool_min_buffers);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ALLOCATION_POOL_MAX_BUFFERS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->allocation_pool_max_buffers);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ALLOCATION_POOL_ALIGNMENT:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->allocation_pool_alignment);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_INSERT_QUEUES:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (value, self->insert_queues);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_QUEUE_MAX_SIZE_BUFFERS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->queue_max_size_buffers);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_QUEUE_MAX_SIZE_BYTES:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->queue_max_size_bytes);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_QUEUE_MAX_SIZE_TIME:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->queue_max_size_time);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_AUDIO_FILTER_DESCRIPTION:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->audio_filter_description);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_EXTRA_PROFILES:
+    {
+      guint i;
+
+      GST_OBJECT_LOCK (self);
+      for (i = 0; self->extra_profiles && i < self->extra_profiles->len; i++) {
+        GValue val = G_VALUE_INIT;
+
+        g_value_init (&val, GST_TYPE_ENCODING_PROFILE);
+        g_value_set_object (&val, g_ptr_array_index (self->extra_profiles, i));
+        gst_value_array_append_and_take_value (value, &val);
+      }
       GST_OBJECT_UNLOCK (self);
       break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -473,6 +2905,42 @@ bail_out:
   GST_OBJECT_UNLOCK (filter);
 }
 
+static void
+_set_extra_profiles (GstTranscodeBin * self, const GValue * profiles)
+{
+  guint i;
+  GList *tmp;
+  GstPadTemplate *pad_tmpl;
+
+  for (tmp = self->extra_srcpads; tmp; tmp = tmp->next)
+    gst_element_remove_pad (GST_ELEMENT (self), tmp->data);
+  g_list_free (self->extra_srcpads);
+  self->extra_srcpads = NULL;
+
+  GST_OBJECT_LOCK (self);
+  g_clear_pointer (&self->extra_profiles, g_ptr_array_unref);
+  self->extra_profiles = g_ptr_array_new_with_free_func (gst_object_unref);
+  for (i = 0; i < gst_value_array_get_size (profiles); i++) {
+    const GValue *profile = gst_value_array_get_value (profiles, i);
+
+    g_ptr_array_add (self->extra_profiles, g_value_dup_object (profile));
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  pad_tmpl = gst_static_pad_template_get (&transcode_bin_extra_src_template);
+  for (i = 0; i < self->extra_profiles->len; i++) {
+    gchar *name = g_strdup_printf ("src_%u", i);
+    GstPad *srcpad = gst_ghost_pad_new_no_target_from_template (name,
+        pad_tmpl);
+
+    gst_pad_set_active (srcpad, TRUE);
+    gst_element_add_pad (GST_ELEMENT (self), srcpad);
+    self->extra_srcpads = g_list_append (self->extra_srcpads, srcpad);
+    g_free (name);
+  }
+  gst_object_unref (pad_tmpl);
+}
+
 static void
 gst_transcode_bin_set_property (GObject * object,
     guint prop_id, const GValue * value, GParamSpec * pspec)
@@ -482,7 +2950,18 @@ gst_transcode_bin_set_property (GObject * object,
   switch (prop_id) {
     case PROP_PROFILE:
       GST_OBJECT_LOCK (self);
-      self->profile = g_value_dup_object (value);
+      gst_object_replace ((GstObject **) & self->profile,
+          g_value_get_object (value));
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_REUSE_ENCODERS:
+      GST_OBJECT_LOCK (self);
+      self->reuse_encoders = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_COLLECT_STATS:
+      GST_OBJECT_LOCK (self);
+      self->collect_stats = g_value_get_boolean (value);
       GST_OBJECT_UNLOCK (self);
       break;
     case PROP_AVOID_REENCODING:
@@ -496,6 +2975,123 @@ gst_transcode_bin_set_property (GObject * object,
     case PROP_VIDEO_FILTER:
       _set_filter (self, g_value_dup_object (value), &self->video_filter);
       break;
+    case PROP_CPU_BUDGET:
+      g_mutex_lock (&self->bucket_lock);
+      self->cpu_budget = g_value_get_uint64 (value);
+      g_cond_broadcast (&self->bucket_cond);
+      g_mutex_unlock (&self->bucket_lock);
+      break;
+    case PROP_START_TIME:
+      GST_OBJECT_LOCK (self);
+      self->start_time = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SEEK_MODE:
+      GST_OBJECT_LOCK (self);
+      self->seek_mode = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LIVE:
+      GST_OBJECT_LOCK (self);
+      self->live = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LATENCY_BUDGET:
+      GST_OBJECT_LOCK (self);
+      self->latency_budget = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_DEADLINE:
+      GST_OBJECT_LOCK (self);
+      self->deadline = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STOP_TIME:
+      GST_OBJECT_LOCK (self);
+      self->stop_time = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_EXTRA_PROFILES:
+      _set_extra_profiles (self, value);
+      break;
+    case PROP_HARDWARE_POLICY:
+      GST_OBJECT_LOCK (self);
+      self->hardware_policy = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MP4_MODE:
+      GST_OBJECT_LOCK (self);
+      self->mp4_mode = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PASS:
+      GST_OBJECT_LOCK (self);
+      self->pass = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MULTIPASS_CACHE_FILE:
+      GST_OBJECT_LOCK (self);
+      g_free (self->multipass_cache_file);
+      self->multipass_cache_file = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ZERO_COPY:
+      GST_OBJECT_LOCK (self);
+      self->zero_copy = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ALLOCATION_POOL:
+      GST_OBJECT_LOCK (self);
+      self->allocation_pool = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ALLOCATION_POOL_MIN_BUFFERS:
+      GST_OBJECT_LOCK (self);
+      self->allocation_pool_min_buffers = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ALLOCATION_POOL_MAX_BUFFERS:
+      GST_OBJECT_LOCK (self);
+      self->allocation_pool_max_buffers = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ALLOCATION_POOL_ALIGNMENT:
+      GST_OBJECT_LOCK (self);
+      self->allocation_pool_alignment = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_INSERT_QUEUES:
+      GST_OBJECT_LOCK (self);
+      self->insert_queues = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_QUEUE_MAX_SIZE_BUFFERS:
+      GST_OBJECT_LOCK (self);
+      self->queue_max_size_buffers = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_QUEUE_MAX_SIZE_BYTES:
+      GST_OBJECT_LOCK (self);
+      self->queue_max_size_bytes = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_QUEUE_MAX_SIZE_TIME:
+      GST_OBJECT_LOCK (self);
+      self->queue_max_size_time = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_VIDEO_FILTER_DESCRIPTION:
+      GST_OBJECT_LOCK (self);
+      g_free (self->video_filter_description);
+      self->video_filter_description = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_AUDIO_FILTER_DESCRIPTION:
+      GST_OBJECT_LOCK (self);
+      g_free (self->audio_filter_description);
+      self->audio_filter_description = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -506,8 +3102,10 @@ gst_transcode_bin_class_init (GstTranscodeBinClass * klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
   GstElementClass *gstelement_klass;
+  GstBinClass *gstbin_klass;
 
   object_class->dispose = gst_transcode_bin_dispose;
+  object_class->finalize = gst_transcode_bin_finalize;
   object_class->get_property = gst_transcode_bin_get_property;
   object_class->set_property = gst_transcode_bin_set_property;
 
@@ -515,10 +3113,20 @@ gst_transcode_bin_class_init (GstTranscodeBinClass * klass)
   gstelement_klass->change_state =
       GST_DEBUG_FUNCPTR (gst_transcode_bin_change_state);
 
+  gstbin_klass = (GstBinClass *) klass;
+  gstbin_klass->handle_message =
+      GST_DEBUG_FUNCPTR (gst_transcode_bin_handle_message);
+  gstbin_klass->deep_element_added =
+      GST_DEBUG_FUNCPTR (gst_transcode_bin_deep_element_added);
+  gstbin_klass->deep_element_removed =
+      GST_DEBUG_FUNCPTR (gst_transcode_bin_deep_element_removed);
+
   gst_element_class_add_pad_template (gstelement_klass,
       gst_static_pad_template_get (&transcode_bin_sink_template));
   gst_element_class_add_pad_template (gstelement_klass,
       gst_static_pad_template_get (&transcode_bin_src_template));
+  gst_element_class_add_pad_template (gstelement_klass,
+      gst_static_pad_template_get (&transcode_bin_extra_src_template));
 
   /**
    * GstEncodeBin:profile:
@@ -531,6 +3139,15 @@ gst_transcode_bin_class_init (GstTranscodeBinClass * klass)
           "The GstEncodingProfile to use", GST_TYPE_ENCODING_PROFILE,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * GstTranscodeBin:avoid-reencoding:
+   *
+   * Whether to avoid decoding and re-encoding streams that are already in a
+   * format of the profile without restrictions. Each stream is classified
+   * as "passthrough", "remux" or "reencode" when it is found, and a
+   * "transcodebin-stream-classification" element message with "stream-id",
+   * "stream-caps" and "decision" fields is posted for it.
+   */
   g_object_class_install_property (object_class, PROP_AVOID_REENCODING,
       g_param_spec_boolean ("avoid-reencoding", "Avoid re-encoding",
           "Whether to re-encode portions of compatible video streams that lay on segment boundaries",
@@ -555,6 +3172,410 @@ gst_transcode_bin_class_init (GstTranscodeBinClass * klass)
       g_param_spec_object ("audio-filter", "Audio filter",
           "the audio filter(s) to apply, if possible",
           GST_TYPE_ELEMENT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:video-filter-description:
+   *
+   * A bin description, in the gst-launch syntax, of the filter to apply to
+   * the raw video streams. Unlike #GstTranscodeBin:video-filter, one
+   * instance is created for each stream, running in its own thread when
+   * #GstTranscodeBin:insert-queues is set. Takes precedence over
+   * #GstTranscodeBin:video-filter.
+   */
+  g_object_class_install_property (object_class, PROP_VIDEO_FILTER_DESCRIPTION,
+      g_param_spec_string ("video-filter-description",
+          "Video filter description",
+          "Bin description of the filter to apply to each video stream",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:audio-filter-description:
+   *
+   * A bin description, in the gst-launch syntax, of the filter to apply to
+   * the raw audio streams, one instance being created for each stream. Takes
+   * precedence over #GstTranscodeBin:audio-filter.
+   */
+  g_object_class_install_property (object_class, PROP_AUDIO_FILTER_DESCRIPTION,
+      g_param_spec_string ("audio-filter-description",
+          "Audio filter description",
+          "Bin description of the filter to apply to each audio stream",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:hardware-policy:
+   *
+   * Whether hardware video decoders and encoders, identified by the
+   * "Hardware" element class, are preferred, required or forbidden. Video
+   * profiles without a preset name get their encoder picked following the
+   * policy. When hardware codecs are required and the video is not
+   * restricted, encodebin does not convert the video so that frames stay in
+   * GPU memory. The plugged codecs are posted in a
+   * "transcodebin-codec-path" element message. This property must be set
+   * before going to %GST_STATE_PAUSED or higher.
+   */
+  g_object_class_install_property (object_class, PROP_HARDWARE_POLICY,
+      g_param_spec_enum ("hardware-policy", "Hardware policy",
+          "How hardware video codecs are selected",
+          GST_TYPE_TRANSCODE_BIN_HARDWARE_POLICY, DEFAULT_HARDWARE_POLICY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:mp4-mode:
+   *
+   * How MP4 and QuickTime muxers lay out their output so that it can be
+   * played while it is still being written, without a post processing pass.
+   * In "faststart" mode space for the moov atom is reserved at the start of
+   * the file, sized after the duration of the input, and periodically
+   * updated; the file is rewritten by the muxer when that duration is
+   * unknown. In "fragmented" mode moof/mdat fragments are written one after
+   * the other. This property must be set before going to %GST_STATE_PAUSED
+   * or higher.
+   */
+  g_object_class_install_property (object_class, PROP_MP4_MODE,
+      g_param_spec_enum ("mp4-mode", "MP4 mode",
+          "How MP4 muxers lay out their output",
+          GST_TYPE_TRANSCODE_BIN_MP4_MODE, DEFAULT_MP4_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:pass:
+   *
+   * The multipass encoding pass the video encoders are set up for: 0 for a
+   * regular single pass, 1 for the first, analysis, pass and 2 for the
+   * final pass. Only encoders exposing a multipass mode (x264enc, vp8enc,
+   * vp9enc, theoraenc) are affected, the others do a single pass. It is
+   * only used when #GstTranscodeBin:multipass-cache-file is set and must
+   * be set before going to %GST_STATE_PAUSED or higher.
+   */
+  g_object_class_install_property (object_class, PROP_PASS,
+      g_param_spec_uint ("pass", "Pass",
+          "The multipass encoding pass, 0 for single pass encoding", 0, 2,
+          DEFAULT_PASS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:multipass-cache-file:
+   *
+   * The file the first pass statistics of the video encoders are written
+   * to during the first pass and read from during the final pass.
+   */
+  g_object_class_install_property (object_class, PROP_MULTIPASS_CACHE_FILE,
+      g_param_spec_string ("multipass-cache-file", "Multipass cache file",
+          "The file holding the first pass statistics", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:reuse-encoders:
+   *
+   * Whether to keep encodebin, with its encoders and muxer, when going back
+   * to %GST_STATE_READY, so that the next run only creates a new decodebin
+   * and links the new streams to the already existing encoders. encodebin
+   * is rebuilt when #GstTranscodeBin:profile is set to another profile or
+   * when #GstTranscodeBin:extra-profiles are used.
+   */
+  g_object_class_install_property (object_class, PROP_REUSE_ENCODERS,
+      g_param_spec_boolean ("reuse-encoders", "Reuse encoders",
+          "Whether to keep the encoders alive across runs",
+          DEFAULT_REUSE_ENCODERS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:collect-stats:
+   *
+   * Whether to track the decoders, the encoders and the decoded streams set
+   * up from now on so that #GstTranscodeBin:stats reports their throughput
+   * and latency. Nothing is tracked, and nothing is paid per buffer, when
+   * disabled.
+   */
+  g_object_class_install_property (object_class, PROP_COLLECT_STATS,
+      g_param_spec_boolean ("collect-stats", "Collect stats",
+          "Whether to collect per stream statistics",
+          DEFAULT_COLLECT_STATS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:stats:
+   *
+   * A "transcode-stats" #GstStructure snapshot of the current run:
+   *
+   * - "streams": array of "stream" structures, one per decoded stream, with
+   *   the frames-in/bytes-in coming out of the decoders, the
+   *   frames-out/bytes-out going into the encoders and the
+   *   latency-average/latency-p99 of the filters and queues in between, in
+   *   nanoseconds and with the stream-id.
+   * - "elements": array of "decoder" and "encoder" structures with the same
+   *   fields for each decoder and encoder.
+   * - "queues": array of "queue" structures with the current level of each
+   *   queue inserted between the decoders and the encoders.
+   * - "pacing-time": the time (in nanoseconds) buffers were held back to
+   *   respect #GstTranscodeBin:cpu-budget.
+   * - "late-buffers": the number of decoded frames dropped for being later
+   *   than #GstTranscodeBin:latency-budget in #GstTranscodeBin:live mode.
+   * - "degradation-level": how many steps of the output degradation done to
+   *   meet #GstTranscodeBin:deadline are in effect.
+   *
+   * Streams, decoders and encoders are only reported when
+   * #GstTranscodeBin:collect-stats was set when they got created.
+   */
+  g_object_class_install_property (object_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Stats", "Statistics of the current run",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:progress:
+   *
+   * The furthest stream time reached by the buffers going into the
+   * encoders, with a millisecond precision. It is recorded from pad probes
+   * and reading it does not query the pipeline.
+   */
+  g_object_class_install_property (object_class, PROP_PROGRESS,
+      g_param_spec_uint64 ("progress", "Progress",
+          "Furthest stream time reached by the encoders", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:zero-copy:
+   *
+   * Whether decoded video frames may stay in the memory they were decoded
+   * to (DMABuf, GL memory, ...) when the video encoder accepts it and no
+   * filter, scaling or conversion is needed. encodebin then does not
+   * insert its video conversion elements for that stream and frames are
+   * only copied to system memory when needed. The memory used for each
+   * stream is reported in the "memory-features" field of the
+   * "transcodebin-stream-layout" message.
+   */
+  g_object_class_install_property (object_class, PROP_ZERO_COPY,
+      g_param_spec_boolean ("zero-copy", "Zero copy",
+          "Whether to keep decoded frames in their memory when possible",
+          DEFAULT_ZERO_COPY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:allocation-pool:
+   *
+   * Whether transcodebin answers the ALLOCATION queries of the video
+   * decoders itself, with one buffer pool per stream. The pools are
+   * bounded by #GstTranscodeBin:allocation-pool-max-buffers, so that memory
+   * does not grow over long transcodings. They pre-allocate
+   * #GstTranscodeBin:allocation-pool-min-buffers buffers and are reused as
+   * long as the caps do not change. Only system memory video is handled.
+   */
+  g_object_class_install_property (object_class, PROP_ALLOCATION_POOL,
+      g_param_spec_boolean ("allocation-pool", "Allocation pool",
+          "Whether to provide our own buffer pools to the video decoders",
+          DEFAULT_ALLOCATION_POOL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:allocation-pool-min-buffers:
+   *
+   * Number of buffers pre-allocated in each pool, raised to what the
+   * encoder requires if needed.
+   */
+  g_object_class_install_property (object_class,
+      PROP_ALLOCATION_POOL_MIN_BUFFERS,
+      g_param_spec_uint ("allocation-pool-min-buffers",
+          "Allocation pool min buffers",
+          "Number of buffers pre-allocated in each pool", 0, G_MAXUINT,
+          DEFAULT_ALLOCATION_POOL_MIN_BUFFERS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:allocation-pool-max-buffers:
+   *
+   * Maximum number of buffers in each pool, 0 meaning unlimited.
+   */
+  g_object_class_install_property (object_class,
+      PROP_ALLOCATION_POOL_MAX_BUFFERS,
+      g_param_spec_uint ("allocation-pool-max-buffers",
+          "Allocation pool max buffers",
+          "Maximum number of buffers in each pool (0=unlimited)", 0,
+          G_MAXUINT, DEFAULT_ALLOCATION_POOL_MAX_BUFFERS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:allocation-pool-alignment:
+   *
+   * Alignment, in bytes, of the memory and, when downstream handles the
+   * video meta, of the plane strides of the pooled buffers. Must be a power
+   * of two, 0 keeps the default alignment.
+   */
+  g_object_class_install_property (object_class,
+      PROP_ALLOCATION_POOL_ALIGNMENT,
+      g_param_spec_uint ("allocation-pool-alignment",
+          "Allocation pool alignment",
+          "Alignment of the pooled buffers, in bytes", 0, 4096,
+          DEFAULT_ALLOCATION_POOL_ALIGNMENT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:insert-queues:
+   *
+   * Whether to insert a queue after the decoder and after the filter of each
+   * stream, so that decoding, filtering and encoding run in their own
+   * streaming threads. The filters set with
+   * #GstTranscodeBin:video-filter-description and
+   * #GstTranscodeBin:audio-filter-description always get a queue in front of
+   * them. The layout used for each stream is posted as a
+   * "transcodebin-stream-layout" element message with "stream-id",
+   * "stream-caps" and "layout" fields. This property must be set before
+   * going to %GST_STATE_PAUSED or higher.
+   */
+  g_object_class_install_property (object_class, PROP_INSERT_QUEUES,
+      g_param_spec_boolean ("insert-queues", "Insert queues",
+          "Whether to run decoders, filters and encoders in their own threads",
+          DEFAULT_INSERT_QUEUES, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:queue-max-size-buffers:
+   *
+   * The max-size-buffers of the inserted queues, 0 meaning unlimited.
+   */
+  g_object_class_install_property (object_class, PROP_QUEUE_MAX_SIZE_BUFFERS,
+      g_param_spec_uint ("queue-max-size-buffers", "Queue max size buffers",
+          "Max number of buffers in the inserted queues (0=disable)",
+          0, G_MAXUINT, DEFAULT_QUEUE_MAX_SIZE_BUFFERS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:queue-max-size-bytes:
+   *
+   * The max-size-bytes of the inserted queues, 0 meaning unlimited.
+   */
+  g_object_class_install_property (object_class, PROP_QUEUE_MAX_SIZE_BYTES,
+      g_param_spec_uint ("queue-max-size-bytes", "Queue max size bytes",
+          "Max amount of data in the inserted queues (bytes, 0=disable)",
+          0, G_MAXUINT, DEFAULT_QUEUE_MAX_SIZE_BYTES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:queue-max-size-time:
+   *
+   * The max-size-time of the inserted queues, 0 meaning unlimited.
+   */
+  g_object_class_install_property (object_class, PROP_QUEUE_MAX_SIZE_TIME,
+      g_param_spec_uint64 ("queue-max-size-time", "Queue max size time",
+          "Max amount of data in the inserted queues (in ns, 0=disable)",
+          0, G_MAXUINT64, DEFAULT_QUEUE_MAX_SIZE_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:cpu-budget:
+   *
+   * CPU time, in nanoseconds, the encoding threads are allowed to use per
+   * second. Raw buffers are held back before entering the encoders when the
+   * budget is exhausted, behind a queue even if
+   * #GstTranscodeBin:insert-queues is not set, so that demuxing and decoding
+   * are not paced. 0 disables pacing. This property must be set before
+   * going to %GST_STATE_PAUSED or higher for the queue to be inserted.
+   */
+  g_object_class_install_property (object_class, PROP_CPU_BUDGET,
+      g_param_spec_uint64 ("cpu-budget", "CPU budget",
+          "CPU time (in nanoseconds) the encoders can use per second, "
+          "0 means unlimited", 0, G_MAXUINT64, DEFAULT_CPU_BUDGET,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:start-time:
+   *
+   * Position in the input stream where transcoding starts. Decoded streams
+   * are held back until a seek to that position has been done, so nothing
+   * before it gets encoded. This property must be set before going to
+   * %GST_STATE_PAUSED or higher.
+   */
+  g_object_class_install_property (object_class, PROP_START_TIME,
+      g_param_spec_uint64 ("start-time", "Start time",
+          "Position of the input stream where to start transcoding",
+          0, G_MAXUINT64, DEFAULT_START_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:stop-time:
+   *
+   * Position in the input stream where transcoding stops, or
+   * #GST_CLOCK_TIME_NONE to transcode until the end of the stream. This
+   * property must be set before going to %GST_STATE_PAUSED or higher.
+   */
+  g_object_class_install_property (object_class, PROP_STOP_TIME,
+      g_param_spec_uint64 ("stop-time", "Stop time",
+          "Position of the input stream where to stop transcoding",
+          0, G_MAXUINT64, DEFAULT_STOP_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:seek-mode:
+   *
+   * How the initial seek to #GstTranscodeBin:start-time is done. In
+   * "keyframe" mode transcoding starts on the keyframe preceding the start
+   * position, so that streams passed through with
+   * #GstTranscodeBin:avoid-reencoding start on a decodable frame and only
+   * the GOPs of the range get demuxed. This property must be set before
+   * going to %GST_STATE_PAUSED or higher.
+   */
+  g_object_class_install_property (object_class, PROP_SEEK_MODE,
+      g_param_spec_enum ("seek-mode", "Seek mode",
+          "How the start of the range to transcode is found",
+          GST_TYPE_TRANSCODE_BIN_SEEK_MODE, DEFAULT_SEEK_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:live:
+   *
+   * Transcode a live stream with a bounded latency: the queues in front of
+   * the encoders drop their oldest decoded frames instead of blocking, the
+   * video encoders are tuned not to hold frames back and the decoded
+   * frames reaching the encoders more than #GstTranscodeBin:latency-budget
+   * after they were captured are dropped. This property must be set before
+   * going to %GST_STATE_PAUSED or higher.
+   */
+  g_object_class_install_property (object_class, PROP_LIVE,
+      g_param_spec_boolean ("live", "Live",
+          "Bound the latency of live streams by dropping late frames",
+          DEFAULT_LIVE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:latency-budget:
+   *
+   * In #GstTranscodeBin:live mode, how long after their capture the decoded
+   * frames can reach the encoders, later ones are dropped. This property
+   * must be set before going to %GST_STATE_PAUSED or higher.
+   */
+  g_object_class_install_property (object_class, PROP_LATENCY_BUDGET,
+      g_param_spec_uint64 ("latency-budget", "Latency budget",
+          "How late frames can reach the encoders in live mode (in ns)",
+          0, G_MAXUINT64, DEFAULT_LATENCY_BUDGET,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:deadline:
+   *
+   * How long the transcoding may take, or #GST_CLOCK_TIME_NONE to never
+   * trade quality for speed. When the run, at its current pace, would end
+   * after the deadline while the encoders use most of the allowed CPUs,
+   * the work is reduced in steps, each of them reported with a
+   * "transcodebin-degradation" element message: the video encoders are
+   * switched to their fastest settings where they allow it while encoding
+   * (this step is skipped when none of them does), then the video streams
+   * are encoded at half their framerate, then the streams other than the
+   * first audio and video ones are ended. This property must be set before
+   * going to %GST_STATE_PAUSED or higher.
+   */
+  g_object_class_install_property (object_class, PROP_DEADLINE,
+      g_param_spec_uint64 ("deadline", "Deadline",
+          "How long transcoding may take before degrading the output (in ns)",
+          0, G_MAXUINT64, DEFAULT_DEADLINE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstTranscodeBin:extra-profiles:
+   *
+   * Additional #GstEncodingProfile-s to encode the decoded streams with.
+   * Each stream is decoded once and teed to one encodebin per profile, the
+   * output of the Nth extra profile is exposed on the "src_N" pad. This
+   * property must be set before going to %GST_STATE_PAUSED or higher.
+   */
+  g_object_class_install_property (object_class, PROP_EXTRA_PROFILES,
+      gst_param_spec_array ("extra-profiles", "Extra profiles",
+          "Additional GstEncodingProfile-s to encode the streams with",
+          g_param_spec_object ("profile", "Profile",
+              "An extra GstEncodingProfile", GST_TYPE_ENCODING_PROFILE,
+              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS),
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -562,6 +3583,38 @@ gst_transcode_bin_init (GstTranscodeBin * self)
 {
   GstPadTemplate *pad_tmpl;
 
+  g_mutex_init (&self->bucket_lock);
+  g_cond_init (&self->bucket_cond);
+  self->cpu_budget = DEFAULT_CPU_BUDGET;
+  self->last_refill = GST_CLOCK_TIME_NONE;
+  self->last_cpu_time = GST_CLOCK_TIME_NONE;
+  self->encoder_accounting = gst_cpu_accounting_new ();
+  self->start_time = DEFAULT_START_TIME;
+  self->stop_time = DEFAULT_STOP_TIME;
+  self->seek_mode = DEFAULT_SEEK_MODE;
+  self->live = DEFAULT_LIVE;
+  self->latency_budget = DEFAULT_LATENCY_BUDGET;
+  self->deadline = DEFAULT_DEADLINE;
+  self->degradation_start = GST_CLOCK_TIME_NONE;
+  self->degradation_last_check = GST_CLOCK_TIME_NONE;
+  self->hardware_policy = DEFAULT_HARDWARE_POLICY;
+  self->mp4_mode = DEFAULT_MP4_MODE;
+  self->pass = DEFAULT_PASS;
+  self->zero_copy = DEFAULT_ZERO_COPY;
+  self->reuse_encoders = DEFAULT_REUSE_ENCODERS;
+  self->collect_stats = DEFAULT_COLLECT_STATS;
+  self->stats = gst_transcode_stats_new ();
+  self->allocation_pool = DEFAULT_ALLOCATION_POOL;
+  self->allocation_pool_min_buffers = DEFAULT_ALLOCATION_POOL_MIN_BUFFERS;
+  self->allocation_pool_max_buffers = DEFAULT_ALLOCATION_POOL_MAX_BUFFERS;
+  self->allocation_pool_alignment = DEFAULT_ALLOCATION_POOL_ALIGNMENT;
+  self->insert_queues = DEFAULT_INSERT_QUEUES;
+  self->queue_max_size_buffers = DEFAULT_QUEUE_MAX_SIZE_BUFFERS;
+  self->queue_max_size_bytes = DEFAULT_QUEUE_MAX_SIZE_BYTES;
+  self->queue_max_size_time = DEFAULT_QUEUE_MAX_SIZE_TIME;
+  self->classified_streams = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+
   pad_tmpl = gst_static_pad_template_get (&transcode_bin_sink_template);
   self->sinkpad = gst_ghost_pad_new_no_target_from_template ("sink", pad_tmpl);
   gst_pad_set_active (self->sinkpad, TRUE);
@@ -25,6 +25,36 @@
 
 #include <gst/gst.h>
 
+typedef enum
+{
+  GST_TRANSCODE_BIN_HARDWARE_POLICY_AUTO,
+  GST_TRANSCODE_BIN_HARDWARE_POLICY_PREFER,
+  GST_TRANSCODE_BIN_HARDWARE_POLICY_REQUIRE,
+  GST_TRANSCODE_BIN_HARDWARE_POLICY_FORBID,
+} GstTranscodeBinHardwarePolicy;
+
+#define GST_TYPE_TRANSCODE_BIN_HARDWARE_POLICY (gst_transcode_bin_hardware_policy_get_type ())
+GType gst_transcode_bin_hardware_policy_get_type (void);
+
+typedef enum
+{
+  GST_TRANSCODE_BIN_MP4_MODE_NORMAL,
+  GST_TRANSCODE_BIN_MP4_MODE_FASTSTART,
+  GST_TRANSCODE_BIN_MP4_MODE_FRAGMENTED,
+} GstTranscodeBinMp4Mode;
+
+#define GST_TYPE_TRANSCODE_BIN_MP4_MODE (gst_transcode_bin_mp4_mode_get_type ())
+GType gst_transcode_bin_mp4_mode_get_type (void);
+
+typedef enum
+{
+  GST_TRANSCODE_BIN_SEEK_MODE_ACCURATE,
+  GST_TRANSCODE_BIN_SEEK_MODE_KEYFRAME,
+} GstTranscodeBinSeekMode;
+
+#define GST_TYPE_TRANSCODE_BIN_SEEK_MODE (gst_transcode_bin_seek_mode_get_type ())
+GType gst_transcode_bin_seek_mode_get_type (void);
+
 GType gst_transcode_bin_get_type (void);
 GType gst_uri_transcode_bin_get_type (void);
 
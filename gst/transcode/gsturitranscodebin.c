@@ -31,26 +31,71 @@
 GST_DEBUG_CATEGORY_STATIC (gst_uri_transcodebin_debug);
 #define GST_CAT_DEFAULT gst_uri_transcodebin_debug
 
+typedef enum
+{
+  GST_URI_TRANSCODE_BIN_THROTTLING_CLOCK,
+  GST_URI_TRANSCODE_BIN_THROTTLING_ENCODERS,
+  GST_URI_TRANSCODE_BIN_THROTTLING_DEGRADE,
+} GstUriTranscodeBinThrottlingMode;
+
 typedef struct
 {
   GstPipeline parent;
 
   GstElement *src;
+  GstElement *user_src;
   gchar *source_uri;
+  /* queue2 reading ahead of the demuxer for network sources */
+  GstElement *read_ahead;
+  guint read_ahead_size;
+  guint64 read_ahead_duration;
 
   GstElement *transcodebin;
 
   GstElement *audio_filter;
   GstElement *video_filter;
+  gchar *audio_filter_description;
+  gchar *video_filter_description;
 
   GstEncodingProfile *profile;
   gboolean avoid_reencoding;
   guint wanted_cpu_usage;
+  GstUriTranscodeBinThrottlingMode throttling_mode;
+  GstClockTime deadline;
+  GstTranscodeBinHardwarePolicy hardware_policy;
+  GstTranscodeBinMp4Mode mp4_mode;
+  guint pass;
+  gchar *multipass_cache_file;
+  GstClockTime start_time;
+  GstClockTime stop_time;
+  GstTranscodeBinSeekMode seek_mode;
+  /* Live sources are transcoded as they come, never throttled */
+  gboolean live;
+  GstClockTime latency_budget;
+  /* Bytes the queues of the job can hold, 0 for unlimited */
+  guint64 max_memory;
+  gboolean memory_restricted;
+  gboolean memory_exceeded;
+  GstClockID memory_check;
+  gboolean reuse_encoders;
+  gboolean collect_stats;
 
   GstElement *sink;
+  GstElement *user_sink;
   gchar *dest_uri;
+  /* queues decoupling the sinks created from URIs from the muxers */
+  GList *write_behinds;
+  guint write_behind_size;
+  guint write_block_size;
+
+  /* Renditions encoded from the same decoded streams, the Nth extra
+   * profile is written to the Nth extra destination */
+  GValue extra_profiles;
+  gchar **extra_dest_uris;
+  GList *extra_sinks;
 
   GstClock *cpu_clock;
+  GstCpuAccounting *accounting;
 
 } GstUriTranscodeBin;
 
@@ -70,6 +115,37 @@ typedef struct
 #define GST_URI_TRANSCODE_BIN_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_URI_TRANSCODE_BIN_TYPE, GstUriTranscodeBinClass))
 
 #define DEFAULT_AVOID_REENCODING   FALSE
+#define DEFAULT_THROTTLING_MODE   GST_URI_TRANSCODE_BIN_THROTTLING_CLOCK
+#define DEFAULT_DEADLINE   GST_CLOCK_TIME_NONE
+#define DEFAULT_HARDWARE_POLICY   GST_TRANSCODE_BIN_HARDWARE_POLICY_AUTO
+#define DEFAULT_MP4_MODE   GST_TRANSCODE_BIN_MP4_MODE_NORMAL
+#define DEFAULT_START_TIME   0
+#define DEFAULT_STOP_TIME   GST_CLOCK_TIME_NONE
+#define DEFAULT_SEEK_MODE   GST_TRANSCODE_BIN_SEEK_MODE_ACCURATE
+#define DEFAULT_LIVE   FALSE
+#define DEFAULT_LATENCY_BUDGET   (2 * GST_SECOND)
+#define DEFAULT_MAX_MEMORY   0
+#define DEFAULT_REUSE_ENCODERS   FALSE
+#define DEFAULT_COLLECT_STATS   FALSE
+#define DEFAULT_READ_AHEAD_SIZE   (8 * 1024 * 1024)
+#define DEFAULT_READ_AHEAD_DURATION   0
+/* How much of the stream around the read position is kept so that demuxer
+ * seeks close to it do not trigger new range requests */
+#define READ_AHEAD_RING_BUFFER_FACTOR 4
+#define DEFAULT_WRITE_BEHIND_SIZE   (32 * 1024 * 1024)
+#define DEFAULT_WRITE_BLOCK_SIZE   (1024 * 1024)
+/* Writes are coalesced in multiples of the usual page and block size */
+#define WRITE_BLOCK_ALIGNMENT 4096
+/* The queues stop growing once more than MEMORY_HIGH_WATERMARK percent of
+ * #GstUriTranscodeBin:max-memory is used and get their limits back under
+ * MEMORY_LOW_WATERMARK percent */
+#define MEMORY_CHECK_INTERVAL (100 * GST_MSECOND)
+#define MEMORY_HIGH_WATERMARK 75
+#define MEMORY_LOW_WATERMARK 50
+/* Restricted queues can still take that much so that they do not stall on
+ * buffers bigger than their current level */
+#define MEMORY_MIN_QUEUE_BYTES (256 * 1024)
+#define MEMORY_LIMIT_QUARK (g_quark_from_static_string ("memory-limit"))
 
 G_DEFINE_TYPE (GstUriTranscodeBin, gst_uri_transcode_bin, GST_TYPE_PIPELINE)
 enum
@@ -84,9 +160,58 @@ enum
  PROP_CPU_USAGE,
  PROP_VIDEO_FILTER,
  PROP_AUDIO_FILTER,
+ PROP_THROTTLING_MODE,
+ PROP_START_TIME,
+ PROP_STOP_TIME,
+ PROP_EXTRA_PROFILES,
+ PROP_EXTRA_DEST_URIS,
+ PROP_VIDEO_FILTER_DESCRIPTION,
+ PROP_AUDIO_FILTER_DESCRIPTION,
+ PROP_HARDWARE_POLICY,
+ PROP_REUSE_ENCODERS,
+ PROP_COLLECT_STATS,
+ PROP_STATS,
+ PROP_PROGRESS,
+ PROP_MP4_MODE,
+ PROP_PASS,
+ PROP_MULTIPASS_CACHE_FILE,
+ PROP_READ_AHEAD_SIZE,
+ PROP_READ_AHEAD_DURATION,
+ PROP_WRITE_BEHIND_SIZE,
+ PROP_WRITE_BLOCK_SIZE,
+ PROP_SEEK_MODE,
+ PROP_LIVE,
+ PROP_LATENCY_BUDGET,
+ PROP_DEADLINE,
+ PROP_MAX_MEMORY,
+ PROP_MEMORY,
  LAST_PROP
 };
 
+#define GST_TYPE_URI_TRANSCODE_BIN_THROTTLING_MODE (gst_uri_transcode_bin_throttling_mode_get_type ())
+static GType
+gst_uri_transcode_bin_throttling_mode_get_type (void)
+{
+  static gsize id = 0;
+  static const GEnumValue values[] = {
+    {GST_URI_TRANSCODE_BIN_THROTTLING_CLOCK,
+        "Throttle the whole pipeline through its clock", "clock"},
+    {GST_URI_TRANSCODE_BIN_THROTTLING_ENCODERS,
+        "Only pace the encoders", "encoders"},
+    {GST_URI_TRANSCODE_BIN_THROTTLING_DEGRADE,
+        "Degrade the output to meet the deadline", "degrade"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&id)) {
+    GType tmp = g_enum_register_static ("GstUriTranscodeBinThrottlingMode",
+        values);
+    g_once_init_leave (&id, tmp);
+  }
+
+  return (GType) id;
+}
+
 static void
 post_missing_plugin_error (GstElement * dec, const gchar * element_name)
 {
@@ -101,24 +226,216 @@ post_missing_plugin_error (GstElement * dec, const gchar * element_name)
 }
 /* *INDENT-ON* */
 
+/* Call with the object lock held */
+static gboolean
+is_throttling (GstUriTranscodeBin * self)
+{
+  return !self->live
+      && self->throttling_mode == GST_URI_TRANSCODE_BIN_THROTTLING_CLOCK
+      && self->cpu_clock && self->wanted_cpu_usage > 0
+      && self->wanted_cpu_usage < 100;
+}
+
+/* Call with the object lock held */
+static guint64
+get_encoders_cpu_budget (GstUriTranscodeBin * self)
+{
+  if (self->live
+      || self->throttling_mode != GST_URI_TRANSCODE_BIN_THROTTLING_ENCODERS
+      || self->wanted_cpu_usage == 0 || self->wanted_cpu_usage >= 100)
+    return 0;
+
+  return self->wanted_cpu_usage * gst_cpu_accounting_get_allowed_cpus () *
+      GST_SECOND / 100;
+}
+
+/* Call with the object lock held */
+static GstClockTime
+get_degradation_deadline (GstUriTranscodeBin * self)
+{
+  if (self->live
+      || self->throttling_mode != GST_URI_TRANSCODE_BIN_THROTTLING_DEGRADE)
+    return GST_CLOCK_TIME_NONE;
+
+  return self->deadline;
+}
+
+/* In "as fast as possible" mode (cpu-usage == 100) sinks do not sync and
+ * the pipeline uses its default clock, otherwise the throttling clock drives
+ * the pipeline and the sink has to sync on it. In "encoders" throttling mode
+ * the pipeline runs unthrottled and transcodebin paces the encoders, in
+ * "degrade" mode it runs unthrottled and transcodebin reduces the work of
+ * the encoders when the deadline can not be met otherwise. Live
+ * sources are already paced, so in live mode there is no throttling at all
+ * and the output is written as soon as it is encoded. */
+static void
+update_throttling (GstUriTranscodeBin * self)
+{
+  gboolean throttling;
+  guint64 cpu_budget;
+  GstClockTime deadline;
+  GList *tmp, *sinks = NULL;
+  GstElement *transcodebin = NULL;
+  GstClock *clock, *lost_clock = NULL;
+
+  GST_OBJECT_LOCK (self);
+  throttling = is_throttling (self);
+  cpu_budget = get_encoders_cpu_budget (self);
+  deadline = get_degradation_deadline (self);
+  if (self->sink)
+    sinks = g_list_prepend (sinks, gst_object_ref (self->sink));
+  for (tmp = self->extra_sinks; tmp; tmp = tmp->next)
+    sinks = g_list_prepend (sinks, gst_object_ref (tmp->data));
+  if (self->transcodebin)
+    transcodebin = gst_object_ref (self->transcodebin);
+  GST_OBJECT_UNLOCK (self);
+
+  for (tmp = sinks; tmp; tmp = tmp->next)
+    g_object_set (tmp->data, "sync", throttling, NULL);
+  g_list_free_full (sinks, gst_object_unref);
+
+  if (transcodebin) {
+    g_object_set (transcodebin, "cpu-budget", cpu_budget, "deadline",
+        deadline, NULL);
+    gst_object_unref (transcodebin);
+  }
+
+  if (!self->cpu_clock)
+    return;
+
+  if (throttling)
+    gst_pipeline_use_clock (GST_PIPELINE (self), self->cpu_clock);
+  else
+    gst_pipeline_auto_clock (GST_PIPELINE (self));
+
+  /* Make the new clock selected if we are already running */
+  clock = gst_element_get_clock (GST_ELEMENT (self));
+  if (clock) {
+    if (GST_STATE (self) == GST_STATE_PLAYING &&
+        (clock == self->cpu_clock) != throttling)
+      lost_clock = gst_object_ref (clock);
+
+    gst_object_unref (clock);
+  }
+
+  if (lost_clock) {
+    GST_INFO_OBJECT (self, "Switching throttling %s",
+        throttling ? "on" : "off");
+
+    gst_element_post_message (GST_ELEMENT (self),
+        gst_message_new_clock_lost (GST_OBJECT (self), lost_clock));
+    gst_object_unref (lost_clock);
+  }
+}
+
+/* The muxer output is queued and written from the queue thread, in large
+ * aligned blocks when the sink buffers its writes (filesink), so that a
+ * slow disk only back-pressures the encoders once the queue is full */
+static void
+make_write_behind (GstUriTranscodeBin * self, GstElement * sink)
+{
+  guint size, block_size;
+  gchar *name;
+  GstElement *queue;
+
+  GST_OBJECT_LOCK (self);
+  size = self->write_behind_size;
+  block_size = self->write_block_size;
+  GST_OBJECT_UNLOCK (self);
+
+  if (block_size && g_object_class_find_property (G_OBJECT_GET_CLASS (sink),
+          "buffer-mode")) {
+    block_size = GST_ROUND_UP_N (block_size, WRITE_BLOCK_ALIGNMENT);
+    gst_util_set_object_arg (G_OBJECT (sink), "buffer-mode", "full");
+    g_object_set (sink, "buffer-size", block_size, NULL);
+  }
+
+  if (!size)
+    return;
+
+  name = g_strdup_printf ("%s-write-behind", GST_OBJECT_NAME (sink));
+  queue = gst_element_factory_make ("queue", name);
+  g_free (name);
+  if (!queue) {
+    GST_WARNING_OBJECT (self, "No queue element, writing synchronously");
+    return;
+  }
+
+  g_object_set (queue, "max-size-buffers", 0, "max-size-time",
+      (guint64) 0, "max-size-bytes", size, "silent", TRUE, NULL);
+  gst_bin_add (GST_BIN (self), queue);
+  if (!gst_element_link (queue, sink)) {
+    GST_WARNING_OBJECT (self, "Could not link %" GST_PTR_FORMAT
+        " to %" GST_PTR_FORMAT, queue, sink);
+    gst_bin_remove (GST_BIN (self), queue);
+    return;
+  }
+
+  self->write_behinds = g_list_append (self->write_behinds, queue);
+  g_object_set_data (G_OBJECT (sink), "write-behind", queue);
+}
+
+/* Where the transcodebin output has to be linked to reach @sink */
+static GstElement *
+get_sink_input (GstElement * sink)
+{
+  GstElement *write_behind = g_object_get_data (G_OBJECT (sink),
+      "write-behind");
+
+  return write_behind ? write_behind : sink;
+}
+
 static gboolean
 make_transcodebin (GstUriTranscodeBin * self)
 {
-  GST_INFO_OBJECT (self, "making new transcodebin");
+  guint i;
+  GList *sink;
 
-  self->transcodebin = gst_element_factory_make ("transcodebin", NULL);
-  if (!self->transcodebin)
-    goto no_decodebin;
+  if (self->transcodebin) {
+    GST_INFO_OBJECT (self, "reusing transcodebin");
+  } else {
+    GST_INFO_OBJECT (self, "making new transcodebin");
+
+    self->transcodebin = gst_element_factory_make ("transcodebin", NULL);
+    if (!self->transcodebin)
+      goto no_decodebin;
+
+    gst_bin_add (GST_BIN (self), self->transcodebin);
+  }
 
   g_object_set (self->transcodebin, "profile", self->profile,
+      "reuse-encoders", self->reuse_encoders,
+      "collect-stats", self->collect_stats,
       "video-filter", self->video_filter,
       "audio-filter", self->audio_filter,
-      "avoid-reencoding", self->avoid_reencoding, NULL);
-
-  gst_bin_add (GST_BIN (self), self->transcodebin);
-  if (!gst_element_link (self->transcodebin, self->sink))
+      "video-filter-description", self->video_filter_description,
+      "audio-filter-description", self->audio_filter_description,
+      "avoid-reencoding", self->avoid_reencoding,
+      "hardware-policy", self->hardware_policy,
+      "mp4-mode", self->mp4_mode,
+      "pass", self->pass, "multipass-cache-file", self->multipass_cache_file,
+      "cpu-budget", get_encoders_cpu_budget (self),
+      "deadline", get_degradation_deadline (self),
+      "start-time", self->start_time, "stop-time", self->stop_time,
+      "seek-mode", self->seek_mode, "live", self->live,
+      "latency-budget", self->latency_budget, NULL);
+  g_object_set_property (G_OBJECT (self->transcodebin), "extra-profiles",
+      &self->extra_profiles);
+
+  if (!gst_element_link_pads (self->transcodebin, "src",
+          get_sink_input (self->sink), NULL))
     return FALSE;
 
+  for (i = 0, sink = self->extra_sinks; sink; i++, sink = sink->next) {
+    gchar *padname = g_strdup_printf ("src_%u", i);
+    gboolean linked = gst_element_link_pads (self->transcodebin, padname,
+        get_sink_input (sink->data), NULL);
+
+    g_free (padname);
+    if (!linked)
+      return FALSE;
+  }
+
   return TRUE;
 
   /* ERRORS */
@@ -133,30 +450,35 @@ no_decodebin:
   }
 }
 
-static gboolean
-make_dest (GstUriTranscodeBin * self)
+static GstElement *
+make_sink (GstUriTranscodeBin * self, const gchar * uri, const gchar * name)
 {
   GError *err = NULL;
+  GstElement *sink;
+  gboolean throttling;
 
-  if (!gst_uri_is_valid (self->dest_uri))
+  if (!gst_uri_is_valid (uri))
     goto invalid_uri;
 
-  self->sink = gst_element_make_from_uri (GST_URI_SINK, self->dest_uri,
-      "sink", &err);
-  if (!self->sink)
+  sink = gst_element_make_from_uri (GST_URI_SINK, uri, name, &err);
+  if (!sink)
     goto no_sink;
 
-  gst_bin_add (GST_BIN (self), self->sink);
-  g_object_set (self->sink, "sync", TRUE, "max-lateness", GST_CLOCK_TIME_NONE,
-      NULL);
-  return TRUE;
+  gst_bin_add (GST_BIN (self), sink);
+  GST_OBJECT_LOCK (self);
+  throttling = is_throttling (self);
+  GST_OBJECT_UNLOCK (self);
+  g_object_set (sink, "sync", throttling,
+      "max-lateness", GST_CLOCK_TIME_NONE, NULL);
+  make_write_behind (self, sink);
+  return sink;
 
 invalid_uri:
   {
     GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND,
-        ("Invalid URI \"%s\".", self->dest_uri), (NULL));
+        ("Invalid URI \"%s\".", uri), (NULL));
     g_clear_error (&err);
-    return FALSE;
+    return NULL;
   }
 
 no_sink:
@@ -166,7 +488,7 @@ no_sink:
     if (err != NULL && err->code == GST_URI_ERROR_UNSUPPORTED_PROTOCOL) {
       gchar *prot;
 
-      prot = gst_uri_get_protocol (self->dest_uri);
+      prot = gst_uri_get_protocol (uri);
       if (prot == NULL)
         goto invalid_uri;
 
@@ -180,31 +502,151 @@ no_sink:
     } else {
       GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND,
           ("%s", (err) ? err->message : "URI was not accepted by any element"),
-          ("No element accepted URI '%s'", self->dest_uri));
+          ("No element accepted URI '%s'", uri));
     }
 
     g_clear_error (&err);
 
+    return NULL;
+  }
+}
+
+static gboolean
+make_dest (GstUriTranscodeBin * self)
+{
+  guint i, n_extra_uris;
+
+  n_extra_uris = self->extra_dest_uris ?
+      g_strv_length (self->extra_dest_uris) : 0;
+  if (n_extra_uris != gst_value_array_get_size (&self->extra_profiles)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, SETTINGS,
+        ("Got %u extra destination URIs for %u extra profiles", n_extra_uris,
+            gst_value_array_get_size (&self->extra_profiles)), (NULL));
+
     return FALSE;
   }
+
+  if (self->user_sink) {
+    self->sink = self->user_sink;
+    gst_bin_add (GST_BIN (self), self->sink);
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (self->sink),
+            "sync")) {
+      gboolean throttling;
+
+      GST_OBJECT_LOCK (self);
+      throttling = is_throttling (self);
+      GST_OBJECT_UNLOCK (self);
+      g_object_set (self->sink, "sync", throttling, NULL);
+    }
+  } else {
+    self->sink = make_sink (self, self->dest_uri, "sink");
+  }
+
+  if (!self->sink)
+    return FALSE;
+
+  for (i = 0; i < n_extra_uris; i++) {
+    gchar *name = g_strdup_printf ("sink_%u", i);
+    GstElement *sink = make_sink (self, self->extra_dest_uris[i], name);
+
+    g_free (name);
+    if (!sink)
+      return FALSE;
+
+    self->extra_sinks = g_list_append (self->extra_sinks, sink);
+  }
+
+  return TRUE;
 }
 
+/* Sources going through the network, where each demuxer read can wait for a
+ * round-trip */
 static gboolean
-make_source (GstUriTranscodeBin * self)
+is_network_uri (const gchar * uri)
 {
-  GError *err = NULL;
+  static const gchar *protocols[] = {
+    "http", "https", "s3", "gs", "ftp", "sftp", "smb", "webdav", "webdavs",
+    "mms", "mmsh", "rtmp", "rtmps", NULL
+  };
+  gint i;
+
+  for (i = 0; protocols[i]; i++) {
+    if (gst_uri_has_protocol (uri, protocols[i]))
+      return TRUE;
+  }
 
-  if (!gst_uri_is_valid (self->source_uri))
-    goto invalid_uri;
+  return FALSE;
+}
 
-  self->src = gst_element_make_from_uri (GST_URI_SRC, self->source_uri,
-      "src", &err);
-  if (!self->src)
-    goto no_sink;
+/* The ring buffer makes queue2 operate in pull mode: it keeps prefetching
+ * ahead of the demuxer and turns the seeks outside of what it holds into
+ * range requests on the source */
+static GstElement *
+make_read_ahead (GstUriTranscodeBin * self)
+{
+  guint size;
+  guint64 duration;
+  GstElement *queue;
+
+  GST_OBJECT_LOCK (self);
+  size = self->read_ahead_size;
+  duration = self->read_ahead_duration;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!size && !duration)
+    return NULL;
+
+  queue = gst_element_factory_make ("queue2", "read-ahead");
+  if (!queue) {
+    GST_WARNING_OBJECT (self, "No queue2 element, reading %s directly",
+        self->source_uri);
+    return NULL;
+  }
+
+  GST_INFO_OBJECT (self, "Reading up to %u bytes, %" GST_TIME_FORMAT
+      " ahead of %s", size, GST_TIME_ARGS (duration), self->source_uri);
+  g_object_set (queue, "max-size-buffers", 0, "max-size-bytes", size,
+      "max-size-time", duration, "use-buffering", FALSE,
+      "ring-buffer-max-size", (guint64) (size ? size : DEFAULT_READ_AHEAD_SIZE)
+      * READ_AHEAD_RING_BUFFER_FACTOR, NULL);
+
+  return queue;
+}
+
+static gboolean
+make_source (GstUriTranscodeBin * self)
+{
+  GError *err = NULL;
+  GstElement *upstream;
+
+  if (self->user_src) {
+    self->src = self->user_src;
+  } else {
+    if (!gst_uri_is_valid (self->source_uri))
+      goto invalid_uri;
+
+    self->src = gst_element_make_from_uri (GST_URI_SRC, self->source_uri,
+        "src", &err);
+    if (!self->src)
+      goto no_sink;
+  }
 
   gst_bin_add (GST_BIN (self), self->src);
+  upstream = self->src;
+
+  /* Local files are read directly, the demuxer reads are cheap there, and
+   * reading ahead of a live source would only add latency */
+  if (!self->user_src && !self->live && is_network_uri (self->source_uri))
+    self->read_ahead = make_read_ahead (self);
+
+  if (self->read_ahead) {
+    gst_bin_add (GST_BIN (self), self->read_ahead);
+    if (!gst_element_link (self->src, self->read_ahead))
+      return FALSE;
+    upstream = self->read_ahead;
+  }
 
-  if (!gst_element_link (self->src, self->transcodebin))
+  if (!gst_element_link (upstream, self->transcodebin))
     return FALSE;
 
   return TRUE;
@@ -247,21 +689,50 @@ no_sink:
   }
 }
 
+/* transcodebin, and the encoders it keeps, survives when @keep_transcodebin
+ * is %TRUE so that the next run can reuse them */
 static void
-remove_all_children (GstUriTranscodeBin * self)
+remove_all_children (GstUriTranscodeBin * self, gboolean keep_transcodebin)
 {
+  GList *tmp, *extra_sinks;
+
+  GST_OBJECT_LOCK (self);
+  extra_sinks = self->extra_sinks;
+  self->extra_sinks = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  for (tmp = self->write_behinds; tmp; tmp = tmp->next) {
+    gst_element_set_state (tmp->data, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self), tmp->data);
+  }
+  g_clear_pointer (&self->write_behinds, g_list_free);
+
+  for (tmp = extra_sinks; tmp; tmp = tmp->next) {
+    g_object_set_data (G_OBJECT (tmp->data), "write-behind", NULL);
+    gst_element_set_state (tmp->data, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self), tmp->data);
+  }
+  g_list_free (extra_sinks);
+
   if (self->sink) {
+    g_object_set_data (G_OBJECT (self->sink), "write-behind", NULL);
     gst_element_set_state (self->sink, GST_STATE_NULL);
     gst_bin_remove (GST_BIN (self), self->sink);
     self->sink = NULL;
   }
 
-  if (self->transcodebin) {
+  if (self->transcodebin && !keep_transcodebin) {
     gst_element_set_state (self->transcodebin, GST_STATE_NULL);
     gst_bin_remove (GST_BIN (self), self->transcodebin);
     self->transcodebin = NULL;
   }
 
+  if (self->read_ahead) {
+    gst_element_set_state (self->read_ahead, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self), self->read_ahead);
+    self->read_ahead = NULL;
+  }
+
   if (self->src) {
     gst_element_set_state (self->src, GST_STATE_NULL);
     gst_bin_remove (GST_BIN (self), self->src);
@@ -269,15 +740,193 @@ remove_all_children (GstUriTranscodeBin * self)
   }
 }
 
+/* Bytes held by a queue, multiqueue exposes its levels on its source pads */
+static guint64
+get_element_memory (GstElement * element)
+{
+  guint bytes = 0;
+  guint64 memory = 0;
+  GValue item = G_VALUE_INIT;
+  GstIterator *it;
+
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (element),
+          "current-level-bytes")) {
+    g_object_get (element, "current-level-bytes", &bytes, NULL);
+    return bytes;
+  }
+
+  it = gst_element_iterate_src_pads (element);
+  while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    GstPad *pad = g_value_get_object (&item);
+
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (pad),
+            "current-level-bytes")) {
+      g_object_get (pad, "current-level-bytes", &bytes, NULL);
+      memory += bytes;
+    }
+    g_value_reset (&item);
+  }
+  g_value_unset (&item);
+  gst_iterator_free (it);
+
+  return memory;
+}
+
+/* What the queues of the job currently hold, that is the memory which grows
+ * when a part of the pipeline is slower than the others */
+static guint64
+get_memory (GstUriTranscodeBin * self)
+{
+  guint64 memory = 0;
+  GValue item = G_VALUE_INIT;
+  GstIterator *it = gst_bin_iterate_recurse (GST_BIN (self));
+
+  while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    memory += get_element_memory (g_value_get_object (&item));
+    g_value_reset (&item);
+  }
+  g_value_unset (&item);
+  gst_iterator_free (it);
+
+  return memory;
+}
+
+/* Lowers the byte limit of all the queues to what they hold so that they
+ * block upstream instead of growing, or puts back their original limit */
+static void
+restrict_queues (GstUriTranscodeBin * self, gboolean shrink)
+{
+  GValue item = G_VALUE_INIT;
+  GstIterator *it = gst_bin_iterate_recurse (GST_BIN (self));
+
+  while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    GstElement *element = g_value_get_object (&item);
+    guint max_size_bytes, level;
+    gpointer saved;
+
+    if (!g_object_class_find_property (G_OBJECT_GET_CLASS (element),
+            "max-size-bytes")) {
+      g_value_reset (&item);
+      continue;
+    }
+
+    saved = g_object_get_qdata (G_OBJECT (element), MEMORY_LIMIT_QUARK);
+    if (shrink && !saved) {
+      g_object_get (element, "max-size-bytes", &max_size_bytes, NULL);
+      level = MAX (get_element_memory (element), MEMORY_MIN_QUEUE_BYTES);
+      /* Limits are offset by one, 0 means unlimited */
+      g_object_set_qdata (G_OBJECT (element), MEMORY_LIMIT_QUARK,
+          GUINT_TO_POINTER (max_size_bytes + 1));
+      if (!max_size_bytes || level < max_size_bytes) {
+        GST_INFO_OBJECT (self, "Restricting %" GST_PTR_FORMAT " to %u bytes",
+            element, level);
+        g_object_set (element, "max-size-bytes", level, NULL);
+      }
+    } else if (!shrink && saved) {
+      max_size_bytes = GPOINTER_TO_UINT (saved) - 1;
+      GST_INFO_OBJECT (self, "Restoring %" GST_PTR_FORMAT " limit to %u bytes",
+          element, max_size_bytes);
+      g_object_set (element, "max-size-bytes", max_size_bytes, NULL);
+      g_object_set_qdata (G_OBJECT (element), MEMORY_LIMIT_QUARK, NULL);
+    }
+    g_value_reset (&item);
+  }
+  g_value_unset (&item);
+  gst_iterator_free (it);
+}
+
+static gboolean
+check_memory (GstClock * clock, GstClockTime time, GstClockID id,
+    GstUriTranscodeBin * self)
+{
+  guint64 memory = get_memory (self), max_memory;
+  gboolean exceeded = FALSE, shrink = FALSE, relax = FALSE;
+
+  GST_OBJECT_LOCK (self);
+  max_memory = self->max_memory;
+  if (max_memory && memory > max_memory && !self->memory_exceeded) {
+    self->memory_exceeded = exceeded = TRUE;
+  } else if (max_memory && !self->memory_restricted
+      && memory >= max_memory / 100 * MEMORY_HIGH_WATERMARK) {
+    self->memory_restricted = shrink = TRUE;
+  } else if (self->memory_restricted && (!max_memory
+          || memory < max_memory / 100 * MEMORY_LOW_WATERMARK)) {
+    self->memory_restricted = FALSE;
+    relax = TRUE;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  if (exceeded) {
+    GST_ELEMENT_ERROR_WITH_DETAILS (self, RESOURCE, NO_SPACE_LEFT,
+        ("The transcoding job needs more than %" G_GUINT64_FORMAT
+            " bytes of memory.", max_memory),
+        ("%" G_GUINT64_FORMAT " bytes queued", memory),
+        ("uritranscodebin-memory-limit", "memory", G_TYPE_UINT64, memory,
+            "max-memory", G_TYPE_UINT64, max_memory, NULL));
+  } else if (shrink || relax) {
+    GST_INFO_OBJECT (self, "%" G_GUINT64_FORMAT " bytes queued out of %"
+        G_GUINT64_FORMAT, memory, max_memory);
+    restrict_queues (self, shrink);
+  }
+
+  return TRUE;
+}
+
+static void
+start_memory_check (GstUriTranscodeBin * self)
+{
+  GstClock *clock;
+
+  GST_OBJECT_LOCK (self);
+  self->memory_restricted = FALSE;
+  self->memory_exceeded = FALSE;
+  if (self->max_memory && !self->memory_check) {
+    clock = gst_system_clock_obtain ();
+    self->memory_check = gst_clock_new_periodic_id (clock,
+        gst_clock_get_time (clock), MEMORY_CHECK_INTERVAL);
+    gst_clock_id_wait_async (self->memory_check,
+        (GstClockCallback) check_memory, gst_object_ref (self),
+        gst_object_unref);
+    gst_object_unref (clock);
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+stop_memory_check (GstUriTranscodeBin * self)
+{
+  GstClockID memory_check;
+  gboolean restricted;
+
+  GST_OBJECT_LOCK (self);
+  memory_check = self->memory_check;
+  self->memory_check = NULL;
+  restricted = self->memory_restricted;
+  self->memory_restricted = FALSE;
+  GST_OBJECT_UNLOCK (self);
+
+  if (memory_check) {
+    gst_clock_id_unschedule (memory_check);
+    gst_clock_id_unref (memory_check);
+  }
+
+  /* A reused transcodebin gets its original queue limits back */
+  if (restricted)
+    restrict_queues (self, FALSE);
+}
+
 static GstStateChangeReturn
 gst_uri_transcode_bin_change_state (GstElement * element,
     GstStateChange transition)
 {
+  GList *tmp;
+  gboolean keep_transcodebin;
   GstStateChangeReturn ret;
   GstUriTranscodeBin *self = GST_URI_TRANSCODE_BIN (element);
 
   switch (transition) {
     case GST_STATE_CHANGE_READY_TO_PAUSED:
+      update_throttling (self);
 
       if (!make_dest (self))
         goto setup_failed;
@@ -295,6 +944,24 @@ gst_uri_transcode_bin_change_state (GstElement * element,
         goto setup_failed;
       }
 
+      for (tmp = self->extra_sinks; tmp; tmp = tmp->next) {
+        if (gst_element_set_state (tmp->data,
+                GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE) {
+          GST_ERROR_OBJECT (self,
+              "Could not set %" GST_PTR_FORMAT " state to PAUSED", tmp->data);
+          goto setup_failed;
+        }
+      }
+
+      for (tmp = self->write_behinds; tmp; tmp = tmp->next) {
+        if (gst_element_set_state (tmp->data,
+                GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE) {
+          GST_ERROR_OBJECT (self,
+              "Could not set %" GST_PTR_FORMAT " state to PAUSED", tmp->data);
+          goto setup_failed;
+        }
+      }
+
       if (gst_element_set_state (self->transcodebin,
               GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE) {
         GST_ERROR_OBJECT (self,
@@ -303,6 +970,14 @@ gst_uri_transcode_bin_change_state (GstElement * element,
         goto setup_failed;
       }
 
+      if (self->read_ahead && gst_element_set_state (self->read_ahead,
+              GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE) {
+        GST_ERROR_OBJECT (self,
+            "Could not set %" GST_PTR_FORMAT " state to PAUSED",
+            self->read_ahead);
+        goto setup_failed;
+      }
+
       if (gst_element_set_state (self->src,
               GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE) {
         GST_ERROR_OBJECT (self,
@@ -310,6 +985,7 @@ gst_uri_transcode_bin_change_state (GstElement * element,
         goto setup_failed;
       }
 
+      start_memory_check (self);
       break;
     default:
       break;
@@ -322,17 +998,29 @@ gst_uri_transcode_bin_change_state (GstElement * element,
 
   switch (transition) {
     case GST_STATE_CHANGE_PAUSED_TO_READY:
-      remove_all_children (self);
+      stop_memory_check (self);
+
+      GST_OBJECT_LOCK (self);
+      keep_transcodebin = self->reuse_encoders;
+      GST_OBJECT_UNLOCK (self);
+
+      remove_all_children (self, keep_transcodebin);
+      break;
+    case GST_STATE_CHANGE_READY_TO_NULL:
+      remove_all_children (self, FALSE);
       break;
     default:
       break;
   }
 
 beach:
+  if (ret == GST_STATE_CHANGE_FAILURE)
+    stop_memory_check (self);
+
   return ret;
 
 setup_failed:
-  remove_all_children (self);
+  remove_all_children (self, FALSE);
   return GST_STATE_CHANGE_FAILURE;
 }
 
@@ -344,7 +1032,9 @@ gst_uri_transcode_bin_constructed (GObject * object)
 
   self->cpu_clock =
       GST_CLOCK (gst_cpu_throttling_clock_new (self->wanted_cpu_usage));
-  gst_pipeline_use_clock (GST_PIPELINE (self), self->cpu_clock);
+  gst_cpu_throttling_clock_set_accounting (GST_CPU_THROTTLING_CLOCK
+      (self->cpu_clock), self->accounting);
+  update_throttling (self);
 #endif
 
   ((GObjectClass *) parent_class)->constructed (object);
@@ -357,11 +1047,63 @@ gst_uri_transcode_bin_dispose (GObject * object)
 
   g_clear_object (&self->video_filter);
   g_clear_object (&self->audio_filter);
+  g_clear_object (&self->user_src);
+  g_clear_object (&self->user_sink);
   g_clear_object (&self->cpu_clock);
+  if (G_IS_VALUE (&self->extra_profiles))
+    g_value_unset (&self->extra_profiles);
+  g_clear_pointer (&self->extra_dest_uris, g_strfreev);
+  g_clear_pointer (&self->video_filter_description, g_free);
+  g_clear_pointer (&self->audio_filter_description, g_free);
+  g_clear_pointer (&self->multipass_cache_file, g_free);
+  if (self->accounting) {
+    gst_cpu_accounting_unref (self->accounting);
+    self->accounting = NULL;
+  }
 
   G_OBJECT_CLASS (gst_uri_transcode_bin_parent_class)->dispose (object);
 }
 
+static void
+gst_uri_transcode_bin_handle_message (GstBin * bin, GstMessage * message)
+{
+  GstUriTranscodeBin *self = GST_URI_TRANSCODE_BIN (bin);
+
+  /* Stream status messages are posted synchronously from our streaming
+   * threads, that is how they are accounted */
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_STREAM_STATUS)
+    gst_cpu_accounting_handle_message (self->accounting, message);
+
+  GST_BIN_CLASS (parent_class)->handle_message (bin, message);
+}
+
+static GstStructure *
+get_stats (GstUriTranscodeBin * self)
+{
+  GstStructure *stats = NULL;
+  GstElement *transcodebin = NULL;
+  GstClockTime throttling_time = 0;
+
+  GST_OBJECT_LOCK (self);
+  if (self->transcodebin)
+    transcodebin = gst_object_ref (self->transcodebin);
+  GST_OBJECT_UNLOCK (self);
+
+  if (transcodebin) {
+    g_object_get (transcodebin, "stats", &stats, NULL);
+    gst_object_unref (transcodebin);
+  }
+  if (!stats)
+    stats = gst_structure_new_empty ("transcode-stats");
+
+  if (self->cpu_clock)
+    g_object_get (self->cpu_clock, "waited-time", &throttling_time, NULL);
+  gst_structure_set (stats, "throttling-time", G_TYPE_UINT64,
+      throttling_time, "memory", G_TYPE_UINT64, get_memory (self), NULL);
+
+  return stats;
+}
+
 static void
 gst_uri_transcode_bin_get_property (GObject * object,
     guint prop_id, GValue * value, GParamSpec * pspec)
@@ -391,12 +1133,12 @@ gst_uri_transcode_bin_get_property (GObject * object,
       break;
     case PROP_SINK:
       GST_OBJECT_LOCK (self);
-      g_value_set_object (value, self->sink);
+      g_value_set_object (value, self->sink ? self->sink : self->user_sink);
       GST_OBJECT_UNLOCK (self);
       break;
     case PROP_SRC:
       GST_OBJECT_LOCK (self);
-      g_value_set_object (value, self->src);
+      g_value_set_object (value, self->src ? self->src : self->user_src);
       GST_OBJECT_UNLOCK (self);
       break;
     case PROP_CPU_USAGE:
@@ -414,6 +1156,139 @@ gst_uri_transcode_bin_get_property (GObject * object,
       g_value_set_object (value, self->audio_filter);
       GST_OBJECT_UNLOCK (self);
       break;
+    case PROP_THROTTLING_MODE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_enum (value, self->throttling_mode);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_DEADLINE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->deadline);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_REUSE_ENCODERS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (value, self->reuse_encoders);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_COLLECT_STATS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (value, self->collect_stats);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, get_stats (self));
+      break;
+    case PROP_PROGRESS:
+    {
+      GstElement *transcodebin = NULL;
+      guint64 progress = 0;
+
+      GST_OBJECT_LOCK (self);
+      if (self->transcodebin)
+        transcodebin = gst_object_ref (self->transcodebin);
+      GST_OBJECT_UNLOCK (self);
+
+      if (transcodebin) {
+        g_object_get (transcodebin, "progress", &progress, NULL);
+        gst_object_unref (transcodebin);
+      }
+      g_value_set_uint64 (value, progress);
+      break;
+    }
+    case PROP_HARDWARE_POLICY:
+      GST_OBJECT_LOCK (self);
+      g_value_set_enum (value, self->hardware_policy);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MP4_MODE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_enum (value, self->mp4_mode);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PASS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->pass);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MULTIPASS_CACHE_FILE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->multipass_cache_file);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_WRITE_BEHIND_SIZE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->write_behind_size);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_WRITE_BLOCK_SIZE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->write_block_size);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_READ_AHEAD_SIZE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->read_ahead_size);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_READ_AHEAD_DURATION:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->read_ahead_duration);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_START_TIME:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->start_time);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SEEK_MODE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_enum (value, self->seek_mode);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LIVE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (value, self->live);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LATENCY_BUDGET:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->latency_budget);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MAX_MEMORY:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->max_memory);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MEMORY:
+      g_value_set_uint64 (value, get_memory (self));
+      break;
+    case PROP_STOP_TIME:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->stop_time);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_EXTRA_PROFILES:
+      GST_OBJECT_LOCK (self);
+      g_value_copy (&self->extra_profiles, value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_EXTRA_DEST_URIS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boxed (value, self->extra_dest_uris);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_VIDEO_FILTER_DESCRIPTION:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->video_filter_description);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_AUDIO_FILTER_DESCRIPTION:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->audio_filter_description);
+      GST_OBJECT_UNLOCK (self);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -428,7 +1303,18 @@ gst_uri_transcode_bin_set_property (GObject * object,
   switch (prop_id) {
     case PROP_PROFILE:
       GST_OBJECT_LOCK (self);
-      self->profile = g_value_dup_object (value);
+      gst_object_replace ((GstObject **) & self->profile,
+          g_value_get_object (value));
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_REUSE_ENCODERS:
+      GST_OBJECT_LOCK (self);
+      self->reuse_encoders = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_COLLECT_STATS:
+      GST_OBJECT_LOCK (self);
+      self->collect_stats = g_value_get_boolean (value);
       GST_OBJECT_UNLOCK (self);
       break;
     case PROP_DEST_URI:
@@ -453,29 +1339,40 @@ gst_uri_transcode_bin_set_property (GObject * object,
       if (self->sink)
         GST_ERROR_OBJECT (self, "Sink already set, can not be changed"
             " at runtime");
-      else
-        self->sink = g_value_dup_object (value);
+      else {
+        g_clear_object (&self->user_sink);
+        if (g_value_get_object (value))
+          self->user_sink = gst_object_ref_sink (g_value_get_object (value));
+      }
       GST_OBJECT_UNLOCK (self);
       break;
     case PROP_SRC:
       GST_OBJECT_LOCK (self);
       if (self->src)
-        GST_ERROR_OBJECT (self, "Sink already set, can not be changed"
+        GST_ERROR_OBJECT (self, "Source already set, can not be changed"
             " at runtime");
-      else
-        self->src = g_value_dup_object (value);
+      else {
+        g_clear_object (&self->user_src);
+        if (g_value_get_object (value))
+          self->user_src = gst_object_ref_sink (g_value_get_object (value));
+      }
       GST_OBJECT_UNLOCK (self);
       break;
     case PROP_CPU_USAGE:
-#if HAVE_GETRUSAGE
       GST_OBJECT_LOCK (self);
       self->wanted_cpu_usage = g_value_get_uint (value);
-      g_object_set (self->cpu_clock, "cpu-usage", self->wanted_cpu_usage, NULL);
-      GST_OBJECT_UNLOCK (self);
+#if HAVE_GETRUSAGE
+      if (self->cpu_clock)
+        g_object_set (self->cpu_clock, "cpu-usage", self->wanted_cpu_usage,
+            NULL);
 #else
-      GST_ERROR_OBJECT (self,
-          "No CPU usage throttling support for that platform");
+      if (self->wanted_cpu_usage > 0 && self->wanted_cpu_usage < 100)
+        GST_ERROR_OBJECT (self,
+            "No CPU usage throttling support for that platform");
 #endif
+      GST_OBJECT_UNLOCK (self);
+
+      update_throttling (self);
       break;
     case PROP_AUDIO_FILTER:
       GST_OBJECT_LOCK (self);
@@ -487,6 +1384,118 @@ gst_uri_transcode_bin_set_property (GObject * object,
       self->video_filter = g_value_dup_object (value);
       GST_OBJECT_UNLOCK (self);
       break;
+    case PROP_THROTTLING_MODE:
+      GST_OBJECT_LOCK (self);
+      self->throttling_mode = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (self);
+
+      update_throttling (self);
+      break;
+    case PROP_DEADLINE:
+      GST_OBJECT_LOCK (self);
+      self->deadline = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+
+      update_throttling (self);
+      break;
+    case PROP_HARDWARE_POLICY:
+      GST_OBJECT_LOCK (self);
+      self->hardware_policy = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MP4_MODE:
+      GST_OBJECT_LOCK (self);
+      self->mp4_mode = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PASS:
+      GST_OBJECT_LOCK (self);
+      self->pass = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MULTIPASS_CACHE_FILE:
+      GST_OBJECT_LOCK (self);
+      g_free (self->multipass_cache_file);
+      self->multipass_cache_file = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_WRITE_BEHIND_SIZE:
+      GST_OBJECT_LOCK (self);
+      self->write_behind_size = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_WRITE_BLOCK_SIZE:
+      GST_OBJECT_LOCK (self);
+      self->write_block_size = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_READ_AHEAD_SIZE:
+      GST_OBJECT_LOCK (self);
+      self->read_ahead_size = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_READ_AHEAD_DURATION:
+      GST_OBJECT_LOCK (self);
+      self->read_ahead_duration = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_START_TIME:
+      GST_OBJECT_LOCK (self);
+      self->start_time = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SEEK_MODE:
+      GST_OBJECT_LOCK (self);
+      self->seek_mode = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LIVE:
+      GST_OBJECT_LOCK (self);
+      self->live = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+
+      update_throttling (self);
+      break;
+    case PROP_LATENCY_BUDGET:
+      GST_OBJECT_LOCK (self);
+      self->latency_budget = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MAX_MEMORY:
+      GST_OBJECT_LOCK (self);
+      self->max_memory = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STOP_TIME:
+      GST_OBJECT_LOCK (self);
+      self->stop_time = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_EXTRA_PROFILES:
+      GST_OBJECT_LOCK (self);
+      g_value_unset (&self->extra_profiles);
+      g_value_init (&self->extra_profiles, GST_TYPE_ARRAY);
+      g_value_copy (value, &self->extra_profiles);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_EXTRA_DEST_URIS:
+      GST_OBJECT_LOCK (self);
+      g_strfreev (self->extra_dest_uris);
+      self->extra_dest_uris = g_value_dup_boxed (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_VIDEO_FILTER_DESCRIPTION:
+      GST_OBJECT_LOCK (self);
+      g_free (self->video_filter_description);
+      self->video_filter_description = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_AUDIO_FILTER_DESCRIPTION:
+      GST_OBJECT_LOCK (self);
+      g_free (self->audio_filter_description);
+      self->audio_filter_description = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -497,6 +1506,7 @@ gst_uri_transcode_bin_class_init (GstUriTranscodeBinClass * klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
   GstElementClass *gstelement_klass;
+  GstBinClass *gstbin_klass;
 
   object_class->get_property = gst_uri_transcode_bin_get_property;
   object_class->set_property = gst_uri_transcode_bin_set_property;
@@ -507,6 +1517,10 @@ gst_uri_transcode_bin_class_init (GstUriTranscodeBinClass * klass)
   gstelement_klass->change_state =
       GST_DEBUG_FUNCPTR (gst_uri_transcode_bin_change_state);
 
+  gstbin_klass = (GstBinClass *) klass;
+  gstbin_klass->handle_message =
+      GST_DEBUG_FUNCPTR (gst_uri_transcode_bin_handle_message);
+
   GST_DEBUG_CATEGORY_INIT (gst_uri_transcodebin_debug, "uritranscodebin", 0,
       "UriTranscodebin element");
 
@@ -535,20 +1549,44 @@ gst_uri_transcode_bin_class_init (GstUriTranscodeBinClass * klass)
           DEFAULT_AVOID_REENCODING,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * GstUriTranscodeBin:sink:
+   *
+   * The output element to use instead of one created from
+   * #GstUriTranscodeBin:dest-uri. It must expose an always sink pad. This
+   * property must be set before going to %GST_STATE_PAUSED or higher.
+   */
   g_object_class_install_property (object_class, PROP_SINK,
       g_param_spec_object ("sink", "Sink",
           "the output element to use",
           GST_TYPE_ELEMENT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * GstUriTranscodeBin:source:
+   *
+   * The input element to use instead of one created from
+   * #GstUriTranscodeBin:source-uri. It must expose an always src pad. This
+   * property must be set before going to %GST_STATE_PAUSED or higher.
+   */
   g_object_class_install_property (object_class, PROP_SRC,
       g_param_spec_object ("source", "Source",
           "the input element to use",
           GST_TYPE_ELEMENT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * GstUriTranscodeBin:cpu-usage:
+   *
+   * The percentage of CPU to try to use, relative to the CPUs the process is
+   * allowed to use (taking the cgroup CPU quota into account) and counting
+   * only the CPU time of the threads of this pipeline (with a share of the
+   * threads that can not be attributed to any pipeline). Setting it to 100
+   * (or 0) runs the pipeline as fast as possible: the sink does not sync and
+   * no throttling clock is used.
+   */
   g_object_class_install_property (object_class, PROP_CPU_USAGE,
       g_param_spec_uint ("cpu-usage", "cpu-usage",
-          "The percentage of CPU to try to use with the processus running the "
-          "pipeline driven by the clock", 0, 100,
+          "The percentage of the allowed CPUs to try to use with the threads "
+          "of the pipeline", 0, 100,
           100, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   /**
@@ -569,10 +1607,344 @@ gst_uri_transcode_bin_class_init (GstUriTranscodeBinClass * klass)
       g_param_spec_object ("audio-filter", "Audio filter",
           "the audio filter(s) to apply, if possible",
           GST_TYPE_ELEMENT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:video-filter-description:
+   *
+   * Bin description of the filter to instantiate for each video stream, see
+   * #GstTranscodeBin:video-filter-description.
+   */
+  g_object_class_install_property (object_class, PROP_VIDEO_FILTER_DESCRIPTION,
+      g_param_spec_string ("video-filter-description",
+          "Video filter description",
+          "Bin description of the filter to apply to each video stream",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:audio-filter-description:
+   *
+   * Bin description of the filter to instantiate for each audio stream, see
+   * #GstTranscodeBin:audio-filter-description.
+   */
+  g_object_class_install_property (object_class, PROP_AUDIO_FILTER_DESCRIPTION,
+      g_param_spec_string ("audio-filter-description",
+          "Audio filter description",
+          "Bin description of the filter to apply to each audio stream",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:throttling-mode:
+   *
+   * How #GstUriTranscodeBin:cpu-usage is enforced. In "clock" mode the whole
+   * pipeline is slowed down through a throttling clock, in "encoders" mode
+   * only the encoders are paced, with a CPU time budget, so that demuxing,
+   * decoding and I/O run freely and keep the encoders fed. In "degrade" mode
+   * nothing is slowed down and #GstUriTranscodeBin:cpu-usage is ignored, the
+   * output gets degraded instead when #GstUriTranscodeBin:deadline would
+   * not be met, see #GstTranscodeBin:deadline.
+   */
+  g_object_class_install_property (object_class, PROP_THROTTLING_MODE,
+      g_param_spec_enum ("throttling-mode", "Throttling mode",
+          "How the CPU usage is limited",
+          GST_TYPE_URI_TRANSCODE_BIN_THROTTLING_MODE, DEFAULT_THROTTLING_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:deadline:
+   *
+   * How long the transcoding may take in "degrade"
+   * #GstUriTranscodeBin:throttling-mode, see #GstTranscodeBin:deadline.
+   */
+  g_object_class_install_property (object_class, PROP_DEADLINE,
+      g_param_spec_uint64 ("deadline", "Deadline",
+          "How long transcoding may take before degrading the output (in ns)",
+          0, G_MAXUINT64, DEFAULT_DEADLINE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:hardware-policy:
+   *
+   * How hardware video codecs are selected, see
+   * #GstTranscodeBin:hardware-policy.
+   */
+  g_object_class_install_property (object_class, PROP_HARDWARE_POLICY,
+      g_param_spec_enum ("hardware-policy", "Hardware policy",
+          "How hardware video codecs are selected",
+          GST_TYPE_TRANSCODE_BIN_HARDWARE_POLICY, DEFAULT_HARDWARE_POLICY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:mp4-mode:
+   *
+   * How MP4 muxers lay out their output, see #GstTranscodeBin:mp4-mode.
+   */
+  g_object_class_install_property (object_class, PROP_MP4_MODE,
+      g_param_spec_enum ("mp4-mode", "MP4 mode",
+          "How MP4 muxers lay out their output",
+          GST_TYPE_TRANSCODE_BIN_MP4_MODE, DEFAULT_MP4_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:pass:
+   *
+   * The multipass encoding pass of the video encoders, see
+   * #GstTranscodeBin:pass.
+   */
+  g_object_class_install_property (object_class, PROP_PASS,
+      g_param_spec_uint ("pass", "Pass",
+          "The multipass encoding pass, 0 for single pass encoding", 0, 2, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:multipass-cache-file:
+   *
+   * The file holding the first pass statistics, see
+   * #GstTranscodeBin:multipass-cache-file.
+   */
+  g_object_class_install_property (object_class, PROP_MULTIPASS_CACHE_FILE,
+      g_param_spec_string ("multipass-cache-file", "Multipass cache file",
+          "The file holding the first pass statistics", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:read-ahead-size:
+   *
+   * Maximum number of bytes prefetched ahead of the demuxer for network
+   * sources (http, https, s3...), 0 to only limit the read-ahead by
+   * #GstUriTranscodeBin:read-ahead-duration. Demuxer seeks close to the
+   * read position are served from memory while the others become range
+   * requests. Local files and #GstUriTranscodeBin:source elements are
+   * always read directly.
+   */
+  g_object_class_install_property (object_class, PROP_READ_AHEAD_SIZE,
+      g_param_spec_uint ("read-ahead-size", "Read ahead size",
+          "Maximum bytes to prefetch from network sources"
+          " (0 and a 0 read-ahead-duration disables the read-ahead)",
+          0, G_MAXUINT, DEFAULT_READ_AHEAD_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:read-ahead-duration:
+   *
+   * Maximum duration of the stream prefetched ahead of the demuxer for
+   * network sources, estimated from the stream bitrate, 0 to only limit
+   * the read-ahead by #GstUriTranscodeBin:read-ahead-size.
+   */
+  g_object_class_install_property (object_class, PROP_READ_AHEAD_DURATION,
+      g_param_spec_uint64 ("read-ahead-duration", "Read ahead duration",
+          "Maximum duration to prefetch from network sources (0 = no limit)",
+          0, G_MAXUINT64, DEFAULT_READ_AHEAD_DURATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:write-behind-size:
+   *
+   * Maximum number of bytes of muxed data queued in front of the sinks
+   * created from #GstUriTranscodeBin:dest-uri and
+   * #GstUriTranscodeBin:extra-dest-uris, written from a dedicated thread so
+   * that the encoders only wait on the disk once that much is pending. 0
+   * writes from the muxer thread directly.
+   */
+  g_object_class_install_property (object_class, PROP_WRITE_BEHIND_SIZE,
+      g_param_spec_uint ("write-behind-size", "Write behind size",
+          "Maximum bytes queued in front of the sinks (0 = disabled)",
+          0, G_MAXUINT, DEFAULT_WRITE_BEHIND_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:write-block-size:
+   *
+   * Size of the writes the muxed data is coalesced into by sinks buffering
+   * their output, like filesink, rounded up to a multiple of 4096 bytes. 0
+   * keeps the sink default.
+   */
+  g_object_class_install_property (object_class, PROP_WRITE_BLOCK_SIZE,
+      g_param_spec_uint ("write-block-size", "Write block size",
+          "Size of the writes to the destination files (0 = sink default)",
+          0, G_MAXUINT - WRITE_BLOCK_ALIGNMENT, DEFAULT_WRITE_BLOCK_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:reuse-encoders:
+   *
+   * Whether to keep transcodebin, and its encoders, when going back to
+   * %GST_STATE_READY so that the next run with a new
+   * #GstUriTranscodeBin:source-uri and #GstUriTranscodeBin:dest-uri only
+   * recreates the source, the demuxer and the sink, see
+   * #GstTranscodeBin:reuse-encoders.
+   */
+  g_object_class_install_property (object_class, PROP_REUSE_ENCODERS,
+      g_param_spec_boolean ("reuse-encoders", "Reuse encoders",
+          "Whether to keep the encoders alive across runs",
+          DEFAULT_REUSE_ENCODERS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:collect-stats:
+   *
+   * Whether to collect the statistics reported by
+   * #GstUriTranscodeBin:stats, see #GstTranscodeBin:collect-stats.
+   */
+  g_object_class_install_property (object_class, PROP_COLLECT_STATS,
+      g_param_spec_boolean ("collect-stats", "Collect stats",
+          "Whether to collect per stream statistics",
+          DEFAULT_COLLECT_STATS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:stats:
+   *
+   * The #GstTranscodeBin:stats of the current run, with the
+   * "throttling-time" (in nanoseconds) spent waiting on the CPU throttling
+   * clock and the "memory" the queues hold, see #GstUriTranscodeBin:memory.
+   */
+  g_object_class_install_property (object_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Stats", "Statistics of the current run",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:progress:
+   *
+   * How far the encoders got, see #GstTranscodeBin:progress.
+   */
+  g_object_class_install_property (object_class, PROP_PROGRESS,
+      g_param_spec_uint64 ("progress", "Progress",
+          "Furthest stream time reached by the encoders", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:start-time:
+   *
+   * Position in the source where transcoding starts, see
+   * #GstTranscodeBin:start-time.
+   */
+  g_object_class_install_property (object_class, PROP_START_TIME,
+      g_param_spec_uint64 ("start-time", "Start time",
+          "Position of the source where to start transcoding",
+          0, G_MAXUINT64, DEFAULT_START_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:stop-time:
+   *
+   * Position in the source where transcoding stops, see
+   * #GstTranscodeBin:stop-time.
+   */
+  g_object_class_install_property (object_class, PROP_STOP_TIME,
+      g_param_spec_uint64 ("stop-time", "Stop time",
+          "Position of the source where to stop transcoding",
+          0, G_MAXUINT64, DEFAULT_STOP_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:seek-mode:
+   *
+   * How the start of the range to transcode is found, see
+   * #GstTranscodeBin:seek-mode.
+   */
+  g_object_class_install_property (object_class, PROP_SEEK_MODE,
+      g_param_spec_enum ("seek-mode", "Seek mode",
+          "How the start of the range to transcode is found",
+          GST_TYPE_TRANSCODE_BIN_SEEK_MODE, DEFAULT_SEEK_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:live:
+   *
+   * Transcode a live source with a bounded latency, see
+   * #GstTranscodeBin:live. Live sources are not throttled, whatever
+   * #GstUriTranscodeBin:cpu-usage is, and the sinks write the output as
+   * soon as it is produced.
+   */
+  g_object_class_install_property (object_class, PROP_LIVE,
+      g_param_spec_boolean ("live", "Live",
+          "Bound the latency of live streams by dropping late frames",
+          DEFAULT_LIVE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:latency-budget:
+   *
+   * See #GstTranscodeBin:latency-budget.
+   */
+  g_object_class_install_property (object_class, PROP_LATENCY_BUDGET,
+      g_param_spec_uint64 ("latency-budget", "Latency budget",
+          "How late frames can reach the encoders in live mode (in ns)",
+          0, G_MAXUINT64, DEFAULT_LATENCY_BUDGET,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:max-memory:
+   *
+   * How many bytes the queues of the job can hold, 0 for unlimited.
+   *
+   * Past three quarters of it the queues stop growing and block upstream
+   * until they are back under half of it. If the job still needs more, a
+   * GST_RESOURCE_ERROR_NO_SPACE_LEFT error is posted with a
+   * "uritranscodebin-memory-limit" details structure carrying the "memory"
+   * and "max-memory" fields. The memory is checked only if a limit is set
+   * when going to PAUSED.
+   */
+  g_object_class_install_property (object_class, PROP_MAX_MEMORY,
+      g_param_spec_uint64 ("max-memory", "Max memory",
+          "Max bytes queued by the job, 0 for unlimited",
+          0, G_MAXUINT64, DEFAULT_MAX_MEMORY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:memory:
+   *
+   * How many bytes the queues of the job currently hold.
+   */
+  g_object_class_install_property (object_class, PROP_MEMORY,
+      g_param_spec_uint64 ("memory", "Memory",
+          "Bytes currently queued by the job", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:extra-profiles:
+   *
+   * Additional renditions to encode from the same decoded streams, see
+   * #GstTranscodeBin:extra-profiles. The Nth profile is written to the Nth
+   * #GstUriTranscodeBin:extra-dest-uris entry.
+   */
+  g_object_class_install_property (object_class, PROP_EXTRA_PROFILES,
+      gst_param_spec_array ("extra-profiles", "Extra profiles",
+          "Additional GstEncodingProfile-s to encode the streams with",
+          g_param_spec_object ("profile", "Profile",
+              "An extra GstEncodingProfile", GST_TYPE_ENCODING_PROFILE,
+              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS),
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstUriTranscodeBin:extra-dest-uris:
+   *
+   * Where to write the renditions of #GstUriTranscodeBin:extra-profiles,
+   * there must be one URI per extra profile.
+   */
+  g_object_class_install_property (object_class, PROP_EXTRA_DEST_URIS,
+      g_param_spec_boxed ("extra-dest-uris", "Extra destination URIs",
+          "URIs to put the output streams of the extra profiles",
+          G_TYPE_STRV, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
 gst_uri_transcode_bin_init (GstUriTranscodeBin * self)
 {
   self->wanted_cpu_usage = 100;
+  self->throttling_mode = DEFAULT_THROTTLING_MODE;
+  self->hardware_policy = DEFAULT_HARDWARE_POLICY;
+  self->mp4_mode = DEFAULT_MP4_MODE;
+  self->start_time = DEFAULT_START_TIME;
+  self->stop_time = DEFAULT_STOP_TIME;
+  self->seek_mode = DEFAULT_SEEK_MODE;
+  self->live = DEFAULT_LIVE;
+  self->latency_budget = DEFAULT_LATENCY_BUDGET;
+  self->deadline = DEFAULT_DEADLINE;
+  self->max_memory = DEFAULT_MAX_MEMORY;
+  self->reuse_encoders = DEFAULT_REUSE_ENCODERS;
+  self->collect_stats = DEFAULT_COLLECT_STATS;
+  self->read_ahead_size = DEFAULT_READ_AHEAD_SIZE;
+  self->read_ahead_duration = DEFAULT_READ_AHEAD_DURATION;
+  self->write_behind_size = DEFAULT_WRITE_BEHIND_SIZE;
+  self->write_block_size = DEFAULT_WRITE_BLOCK_SIZE;
+  self->accounting = gst_cpu_accounting_new ();
+  g_value_init (&self->extra_profiles, GST_TYPE_ARRAY);
 }
@@ -0,0 +1,457 @@
+/* GStreamer
+ *
+ * Copyright (C) 2015 Thibault Saunier <tsaunier@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "utils.h"
+#include "../gst-libs/gst/transcoding/transcoder/gsttranscoder.h"
+
+#ifdef G_OS_UNIX
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+#define AUDIO_RATE 48000
+#define AUDIO_SAMPLES_PER_BUFFER 1024
+
+static const gchar *HELP_SUMMARY =
+    "gst-transcoder-bench-1.0 transcodes a deterministic synthetic stream\n"
+    "(videotestsrc and audiotestsrc muxed as raw streams) with each usable\n"
+    "profile of the installed encoding targets and prints, as JSON,\n"
+    "the frame rate, realtime factor, CPU time per frame and peak\n"
+    "resident memory of each run. Each run happens in its own process so\n"
+    "that its peak memory is not the one of a previous run.\n"
+    "\n"
+    "The optional <target> arguments restrict the run to the given\n"
+    "targets, in the form <target-name>[/<profile-name>].\n";
+
+typedef struct
+{
+  gint width, height, framerate, duration, cpu_usage;
+  gboolean avoid_reencoding;
+  gchar *output;
+} Settings;
+
+typedef struct
+{
+  gint64 wall;
+  gint64 cpu;
+} Usage;
+
+static void
+get_usage (Usage * usage)
+{
+#ifdef G_OS_UNIX
+  struct rusage ru;
+
+  getrusage (RUSAGE_SELF, &ru);
+  usage->cpu = (gint64) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) *
+      G_USEC_PER_SEC + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#else
+  usage->cpu = 0;
+#endif
+  usage->wall = g_get_monotonic_time ();
+}
+
+static void
+append_json_string (GString * str, const gchar * val)
+{
+  const gchar *p;
+
+  g_string_append_c (str, '"');
+  for (p = val; p && *p; p++) {
+    switch (*p) {
+      case '"':
+        g_string_append (str, "\\\"");
+        break;
+      case '\\':
+        g_string_append (str, "\\\\");
+        break;
+      case '\n':
+        g_string_append (str, "\\n");
+        break;
+      case '\t':
+        g_string_append (str, "\\t");
+        break;
+      default:
+        if ((guchar) * p < 0x20)
+          g_string_append_printf (str, "\\u%04x", (guchar) * p);
+        else
+          g_string_append_c (str, *p);
+        break;
+    }
+  }
+  g_string_append_c (str, '"');
+}
+
+static void
+append_json_names (GString * str, GstEncodingTarget * target,
+    GstEncodingProfile * profile)
+{
+  g_string_append (str, "\"target\": ");
+  append_json_string (str, gst_encoding_target_get_name (target));
+  g_string_append (str, ", \"profile\": ");
+  append_json_string (str, gst_encoding_profile_get_name (profile));
+}
+
+static gboolean
+profile_has_video (GstEncodingProfile * profile)
+{
+  const GList *tmp;
+
+  if (GST_IS_ENCODING_VIDEO_PROFILE (profile))
+    return TRUE;
+
+  if (!GST_IS_ENCODING_CONTAINER_PROFILE (profile))
+    return FALSE;
+
+  for (tmp =
+      gst_encoding_container_profile_get_profiles
+      (GST_ENCODING_CONTAINER_PROFILE (profile)); tmp; tmp = tmp->next) {
+    if (GST_IS_ENCODING_VIDEO_PROFILE (tmp->data))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static GstElement *
+make_synthetic_source (Settings * settings, gint n_frames)
+{
+  gchar *desc;
+  GError *err = NULL;
+  GstElement *source;
+  gint n_audio_buffers = gst_util_uint64_scale_ceil (settings->duration,
+      AUDIO_RATE, AUDIO_SAMPLES_PER_BUFFER);
+
+  /* Raw streams in matroska so that the transcodebin single sink pad gets
+   * both of them, the demuxing cost is negligible compared to encoding */
+  desc = g_strdup_printf ("videotestsrc num-buffers=%d pattern=smpte"
+      " ! video/x-raw,format=I420,width=%d,height=%d,framerate=%d/1"
+      " ! queue ! mux. "
+      "audiotestsrc num-buffers=%d samplesperbuffer=%d"
+      " ! audio/x-raw,format=S16LE,rate=%d,channels=2 ! queue ! mux. "
+      "matroskamux name=mux", n_frames, settings->width, settings->height,
+      settings->framerate, n_audio_buffers, AUDIO_SAMPLES_PER_BUFFER,
+      AUDIO_RATE);
+
+  source = gst_parse_bin_from_description (desc, TRUE, &err);
+  if (!source) {
+    error ("Could not create the synthetic source: %s", err->message);
+    g_clear_error (&err);
+  }
+  g_free (desc);
+
+  return source;
+}
+
+typedef struct
+{
+  GError *error;
+} RunResult;
+
+static void
+_error_cb (GstTranscoder * transcoder, GError * err, GstStructure * details,
+    RunResult * result)
+{
+  if (!result->error)
+    result->error = g_error_copy (err);
+}
+
+/* Appends the fields of the result of the run to @json, unless the run could
+ * not be set up */
+static gboolean
+run_profile (Settings * settings, GstEncodingTarget * target,
+    GstEncodingProfile * profile, GString * json)
+{
+  Usage before, after;
+  gint n_frames = 0;
+  GError *err = NULL;
+  GstElement *source, *pipeline;
+  GstTranscoder *transcoder;
+  RunResult result = { NULL, };
+  gdouble wall, cpu;
+
+  if (profile_has_video (profile))
+    n_frames = settings->duration * settings->framerate;
+
+  source = make_synthetic_source (settings, settings->duration *
+      settings->framerate);
+  if (!source)
+    return FALSE;
+
+  transcoder = gst_transcoder_new_full ("bench://synthetic", settings->output,
+      profile, NULL);
+  gst_transcoder_set_avoid_reencoding (transcoder, settings->avoid_reencoding);
+  gst_transcoder_set_cpu_usage (transcoder, settings->cpu_usage);
+  g_signal_connect (transcoder, "error", G_CALLBACK (_error_cb), &result);
+
+  pipeline = gst_transcoder_get_pipeline (transcoder);
+  g_object_set (pipeline, "source", source, NULL);
+  gst_object_unref (pipeline);
+
+  get_usage (&before);
+  gst_transcoder_run (transcoder, &err);
+  get_usage (&after);
+  gst_object_unref (transcoder);
+
+  if (err && !result.error)
+    result.error = err;
+  else
+    g_clear_error (&err);
+
+  wall = (gdouble) (after.wall - before.wall) / G_USEC_PER_SEC;
+  cpu = (gdouble) (after.cpu - before.cpu) / G_USEC_PER_SEC;
+
+  append_json_names (json, target, profile);
+  g_string_append_printf (json, ", \"frames\": %d, \"wall-time\": %.6f,"
+      " \"cpu-time\": %.6f", n_frames, wall, cpu);
+  g_string_append_printf (json, ", \"fps\": %.3f, \"realtime-factor\": %.3f",
+      wall > 0 ? n_frames / wall : 0.0,
+      wall > 0 ? settings->duration / wall : 0.0);
+  if (n_frames)
+    g_string_append_printf (json, ", \"cpu-per-frame\": %.6f", cpu / n_frames);
+  else
+    g_string_append (json, ", \"cpu-per-frame\": null");
+  if (result.error) {
+    g_string_append (json, ", \"error\": ");
+    append_json_string (json, result.error->message);
+    g_clear_error (&result.error);
+  } else {
+    g_string_append (json, ", \"error\": null");
+  }
+
+  return TRUE;
+}
+
+#ifdef G_OS_UNIX
+/* Runs @profile in a child process, ru_maxrss being the high-water mark of
+ * the whole process. It includes the memory of the benchmark process the
+ * child touches, which is small as nothing ran in it yet */
+static gboolean
+bench_profile (Settings * settings, GstEncodingTarget * target,
+    GstEncodingProfile * profile, GString * json, gboolean first)
+{
+  pid_t pid;
+  gint fds[2], status;
+  gssize len;
+  gchar buf[4096];
+  struct rusage ru;
+  GString *result;
+
+  if (pipe (fds) < 0) {
+    error ("Could not create a pipe: %s", g_strerror (errno));
+    return FALSE;
+  }
+
+  pid = fork ();
+  if (pid < 0) {
+    error ("Could not fork: %s", g_strerror (errno));
+    close (fds[0]);
+    close (fds[1]);
+    return FALSE;
+  }
+
+  if (pid == 0) {
+    gsize written = 0;
+
+    close (fds[0]);
+    result = g_string_new (NULL);
+    run_profile (settings, target, profile, result);
+    while (written < result->len) {
+      len = write (fds[1], result->str + written, result->len - written);
+      if (len < 0 && errno != EINTR)
+        _exit (1);
+      if (len > 0)
+        written += len;
+    }
+    _exit (0);
+  }
+
+  close (fds[1]);
+  result = g_string_new (NULL);
+  while ((len = read (fds[0], buf, sizeof (buf))) != 0) {
+    if (len > 0)
+      g_string_append_len (result, buf, len);
+    else if (errno != EINTR)
+      break;
+  }
+  close (fds[0]);
+
+  while (wait4 (pid, &status, 0, &ru) < 0) {
+    if (errno != EINTR) {
+      error ("Could not wait for the benchmark process: %s",
+          g_strerror (errno));
+      g_string_free (result, TRUE);
+      return FALSE;
+    }
+  }
+
+  /* A crashed run still gets reported */
+  if (!WIFEXITED (status) || WEXITSTATUS (status)) {
+    g_string_truncate (result, 0);
+    append_json_names (result, target, profile);
+    g_string_append (result, ", \"error\": ");
+    append_json_string (result, WIFSIGNALED (status) ?
+        g_strsignal (WTERMSIG (status)) : "The benchmark process failed");
+  } else if (!result->len) {
+    g_string_free (result, TRUE);
+    return FALSE;
+  }
+
+  g_string_append (json, first ? "\n  {" : ",\n  {");
+  g_string_append_len (json, result->str, result->len);
+  g_string_append_printf (json, ", \"peak-rss-kb\": %ld}", ru.ru_maxrss);
+  g_string_free (result, TRUE);
+
+  return TRUE;
+}
+#else
+static gboolean
+bench_profile (Settings * settings, GstEncodingTarget * target,
+    GstEncodingProfile * profile, GString * json, gboolean first)
+{
+  GString *result = g_string_new (NULL);
+
+  if (!run_profile (settings, target, profile, result)) {
+    g_string_free (result, TRUE);
+    return FALSE;
+  }
+
+  g_string_append (json, first ? "\n  {" : ",\n  {");
+  g_string_append_len (json, result->str, result->len);
+  g_string_append (json, ", \"peak-rss-kb\": null}");
+  g_string_free (result, TRUE);
+
+  return TRUE;
+}
+#endif
+
+static gboolean
+target_requested (gchar ** requested, GstEncodingTarget * target,
+    GstEncodingProfile * profile)
+{
+  gint i;
+  const gchar *target_name = gst_encoding_target_get_name (target);
+
+  if (!requested || !requested[0])
+    return TRUE;
+
+  for (i = 0; requested[i]; i++) {
+    gchar **names = g_strsplit (requested[i], "/", 2);
+    gboolean matches = !g_strcmp0 (names[0], target_name) &&
+        (!names[1] || !g_strcmp0 (names[1],
+            gst_encoding_profile_get_name (profile)));
+
+    g_strfreev (names);
+    if (matches)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GError *err = NULL;
+  GOptionContext *ctx;
+  GList *tmp, *targets;
+  GString *json;
+  gboolean first = TRUE;
+  Settings settings = { 320, 240, 30, 10, 100, FALSE, NULL };
+
+  GOptionEntry options[] = {
+    {"width", 'W', 0, G_OPTION_ARG_INT, &settings.width,
+        "Width of the synthetic video stream", NULL},
+    {"height", 'H', 0, G_OPTION_ARG_INT, &settings.height,
+        "Height of the synthetic video stream", NULL},
+    {"framerate", 'f', 0, G_OPTION_ARG_INT, &settings.framerate,
+        "Frame rate of the synthetic video stream", NULL},
+    {"duration", 'd', 0, G_OPTION_ARG_INT, &settings.duration,
+        "Duration of the synthetic streams in seconds", NULL},
+    {"cpu-usage", 'c', 0, G_OPTION_ARG_INT, &settings.cpu_usage,
+        "The CPU usage to target in the transcoding process", NULL},
+    {"avoid-reencoding", 'a', 0, G_OPTION_ARG_NONE,
+          &settings.avoid_reencoding,
+        "Avoid re-encoding compatible streams", NULL},
+    {"output", 'o', 0, G_OPTION_ARG_STRING, &settings.output,
+        "The URI to write the transcoded streams to (default: /dev/null)",
+        NULL},
+    {NULL}
+  };
+
+  g_set_prgname ("gst-transcoder-bench");
+
+  ctx = g_option_context_new ("[<target>...]");
+  g_option_context_set_summary (ctx, HELP_SUMMARY);
+  g_option_context_add_main_entries (ctx, options, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_print ("Error initializing: %s\n", GST_STR_NULL (err->message));
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+  gst_pb_utils_init ();
+
+  if (settings.width <= 0 || settings.height <= 0 || settings.framerate <= 0
+      || settings.duration <= 0) {
+    error ("Width, height, framerate and duration must be positive");
+    return 1;
+  }
+
+  if (!settings.output)
+    settings.output = g_strdup ("file:///dev/null");
+  else if (!gst_uri_is_valid (settings.output)) {
+    gchar *uri = ensure_uri (settings.output);
+
+    g_free (settings.output);
+    settings.output = uri;
+  }
+
+  json = g_string_new ("[");
+  targets = gst_encoding_list_all_targets (NULL);
+  for (tmp = targets; tmp; tmp = tmp->next) {
+    GList *tmpprof, *usable_profiles = get_usable_profiles (tmp->data);
+
+    for (tmpprof = usable_profiles; tmpprof; tmpprof = tmpprof->next) {
+      if (!target_requested (argv + 1, tmp->data, tmpprof->data))
+        continue;
+
+      if (bench_profile (&settings, tmp->data, tmpprof->data, json, first))
+        first = FALSE;
+    }
+    g_list_free (usable_profiles);
+  }
+  g_list_free_full (targets, (GDestroyNotify) g_object_unref);
+
+  g_string_append (json, first ? "]\n" : "\n]\n");
+  g_print ("%s", json->str);
+  g_string_free (json, TRUE);
+  g_free (settings.output);
+
+  return 0;
+}
@@ -22,6 +22,7 @@
 
 #include "utils.h"
 #include "../gst-libs/gst/transcoding/transcoder/gsttranscoder.h"
+#include "../gst-libs/gst/transcoding/transcoder/gsttranscoderpool.h"
 
 static const gchar *HELP_SUMMARY =
     "gst-transcoder-1.0 transcodes a stream defined by its first <input-uri>\n"
@@ -54,17 +55,114 @@ static const gchar *HELP_SUMMARY =
     "\n"
     "Encoding targets describe well known formats which\n"
     "those are provided in '.gep' files. You can list\n"
-    "available ones using the `--list-targets` argument.\n";
+    "available ones using the `--list-targets` argument.\n"
+    "\n"
+    "Batch mode:\n"
+    "===========\n"
+    "\n"
+    "With `--batch <manifest>` the jobs are read from <manifest>, or from\n"
+    "the standard input if it is '-', one per line:\n"
+    "\n"
+    "    <input-uri> <output-uri> [<encoding-format> [<cpu-usage>]]\n"
+    "\n"
+    "Fields are separated by spaces or tabulations, empty lines and lines\n"
+    "starting with '#' are ignored and an <encoding-format> of '-' is\n"
+    "guessed from the <output-uri> extension. A job <cpu-usage> is kept\n"
+    "and deducted from the `--cpu-usage` budget shared by the other jobs.\n"
+    "At most `--jobs` jobs run at the same time and a result line is\n"
+    "printed on the standard output for each of them, with tabulation\n"
+    "separated fields:\n"
+    "\n"
+    "    ok <line> <input-uri> <output-uri> <elapsed-seconds> <realtime-factor>\n"
+    "    error <line> <input-uri> <output-uri> <elapsed-seconds> <message>\n";
 
 typedef struct
 {
-  gint cpu_usage, rate;
-  gboolean list;
+  gint cpu_usage, rate, jobs;
+  gboolean list, preflight;
   GstEncodingProfile *profile;
   gchar *src_uri, *dest_uri, *encoding_format, *size;
   gchar *framerate;
+  gchar *batch;
+  gchar *mp4_mode;
+  gchar *checkpoint_dir;
+  gdouble start, stop;
+  gboolean keyframe_seek;
+  gboolean live;
+  gdouble latency_budget;
+  gdouble deadline;
+  gint max_memory;
+  gchar *output_cache_dir;
 } Settings;
 
+typedef struct
+{
+  guint line;
+  gchar *src_uri, *dest_uri;
+  GstTranscoder *transcoder;
+} BatchJob;
+
+static gboolean
+run_preflight (GstTranscoder * transcoder)
+{
+  guint i;
+  gchar *tmp;
+  const GValue *streams, *missing;
+  gboolean can_transcode = FALSE;
+  GError *err = NULL;
+  GstStructure *report = gst_transcoder_preflight (transcoder, &err);
+
+  if (!report) {
+    error ("Could not check the source: %s", err->message);
+    g_clear_error (&err);
+
+    return FALSE;
+  }
+
+  streams = gst_structure_get_value (report, "streams");
+  for (i = 0; i < gst_value_array_get_size (streams); i++) {
+    const GstStructure *stream =
+        gst_value_get_structure (gst_value_array_get_value (streams, i));
+    GstCaps *input_caps = NULL, *output_caps = NULL;
+    gchar *input, *output;
+
+    gst_structure_get (stream, "input-caps", GST_TYPE_CAPS, &input_caps, NULL);
+    gst_structure_get (stream, "output-caps", GST_TYPE_CAPS, &output_caps,
+        NULL);
+    input = gst_pb_utils_get_codec_description (input_caps);
+    output = output_caps ? gst_pb_utils_get_codec_description (output_caps) :
+        NULL;
+
+    tmp = g_strdup_printf ("%s: %s%s%s", input,
+        gst_structure_get_string (stream, "decision"), output ? " to " : "",
+        output ? output : "");
+    if (output)
+      ok ("  %s", tmp);
+    else
+      warn ("  %s", tmp);
+
+    g_free (tmp);
+    g_free (input);
+    g_free (output);
+    gst_clear_caps (&input_caps);
+    gst_clear_caps (&output_caps);
+  }
+
+  missing = gst_structure_get_value (report, "missing-elements");
+  for (i = 0; i < gst_value_array_get_size (missing); i++)
+    error ("  Missing: %s",
+        g_value_get_string (gst_value_array_get_value (missing, i)));
+
+  gst_structure_get_boolean (report, "can-transcode", &can_transcode);
+  if (can_transcode)
+    ok ("Can be transcoded");
+  else
+    error ("Can not be transcoded");
+  gst_structure_free (report);
+
+  return can_transcode;
+}
+
 static void
 settings_init (Settings * settings)
 {
@@ -73,6 +171,12 @@ settings_init (Settings * settings)
   settings->encoding_format = NULL;
   settings->size = NULL;
   settings->framerate = NULL;
+  settings->batch = NULL;
+  settings->jobs = 0;
+  settings->start = 0;
+  settings->stop = -1;
+  settings->latency_budget = -1;
+  settings->deadline = -1;
 }
 
 static void
@@ -97,6 +201,27 @@ position_updated_cb (GstTranscoder * transcoder, GstClockTime pos)
   }
 }
 
+static gboolean
+set_mp4_mode (Settings * settings, GstTranscoder * transcoder)
+{
+  GEnumClass *klass;
+  GEnumValue *value;
+
+  if (!settings->mp4_mode)
+    return TRUE;
+
+  klass = g_type_class_ref (GST_TYPE_TRANSCODER_MP4_MODE);
+  value = g_enum_get_value_by_nick (klass, settings->mp4_mode);
+  if (value)
+    gst_transcoder_set_mp4_mode (transcoder, value->value);
+  else
+    error ("MP4 mode should be 'normal', 'faststart' or 'fragmented',"
+        " got %s", settings->mp4_mode);
+  g_type_class_unref (klass);
+
+  return value != NULL;
+}
+
 static GList *
 get_profiles_of_type (GstEncodingProfile * profile, GType profile_type)
 {
@@ -284,6 +409,243 @@ _warning_cb (GstTranscoder * transcoder, GError * error, GstStructure * details)
   warn ("Got warning: %s", error->message);
 }
 
+static void
+batch_job_free (BatchJob * job)
+{
+  if (job->transcoder)
+    gst_object_unref (job->transcoder);
+  g_free (job->src_uri);
+  g_free (job->dest_uri);
+  g_free (job);
+}
+
+static void
+batch_print_result (BatchJob * job, GstTranscoder * transcoder,
+    const gchar * message)
+{
+  GstClockTime elapsed = 0;
+  gdouble realtime_factor = 0.0;
+  gchar *msg = NULL;
+
+  if (transcoder) {
+    GstStructure *stats = gst_transcoder_get_stats (transcoder);
+
+    gst_structure_get (stats, "elapsed", G_TYPE_UINT64, &elapsed,
+        "realtime-factor", G_TYPE_DOUBLE, &realtime_factor, NULL);
+    gst_structure_free (stats);
+  }
+
+  if (message) {
+    /* Keep the result on a single line with a fixed number of fields */
+    msg = g_strdelimit (g_strdup (message), "\t\r\n", ' ');
+    g_print ("error\t%u\t%s\t%s\t%.3f\t%s\n", job->line, job->src_uri,
+        job->dest_uri, (gdouble) elapsed / GST_SECOND, msg);
+    g_free (msg);
+  } else {
+    g_print ("ok\t%u\t%s\t%s\t%.3f\t%.3f\n", job->line, job->src_uri,
+        job->dest_uri, (gdouble) elapsed / GST_SECOND, realtime_factor);
+  }
+}
+
+static void
+_batch_done_cb (GstTranscoder * transcoder, BatchJob * job)
+{
+  batch_print_result (job, transcoder, NULL);
+}
+
+static void
+_batch_error_cb (GstTranscoder * transcoder, GError * err,
+    GstStructure * details, BatchJob * job)
+{
+  batch_print_result (job, transcoder, err->message);
+}
+
+static gchar *
+read_batch_manifest (const gchar * location, GError ** err)
+{
+  gchar *contents = NULL;
+
+  if (g_strcmp0 (location, "-") == 0) {
+    gchar buf[4096];
+    gsize read;
+    GString *str = g_string_new (NULL);
+
+    while ((read = fread (buf, 1, sizeof (buf), stdin)) > 0)
+      g_string_append_len (str, buf, read);
+
+    if (ferror (stdin)) {
+      g_set_error (err, G_FILE_ERROR, G_FILE_ERROR_IO,
+          "Could not read the manifest from the standard input");
+      g_string_free (str, TRUE);
+
+      return NULL;
+    }
+
+    return g_string_free (str, FALSE);
+  }
+
+  if (!g_file_get_contents (location, &contents, NULL, err))
+    return NULL;
+
+  return contents;
+}
+
+/* Creates and queues a job for a line of the manifest, returns FALSE if the
+ * line is invalid */
+static gboolean
+batch_queue_line (GstTranscoderPool * pool, Settings * settings,
+    const gchar * line, guint line_num, GPtrArray * jobs)
+{
+  gchar **tokens;
+  const gchar *fields[4] = { NULL, };
+  gchar *encoding_format = NULL;
+  gint cpu_usage = -1;
+  guint i, n_fields = 0;
+  BatchJob *job;
+  gboolean res = FALSE;
+
+  tokens = g_strsplit_set (line, " \t", -1);
+  for (i = 0; tokens[i]; i++) {
+    if (!*tokens[i])
+      continue;
+
+    if (n_fields == G_N_ELEMENTS (fields)) {
+      error ("Line %u: too many fields", line_num);
+      goto done;
+    }
+    fields[n_fields++] = tokens[i];
+  }
+
+  if (n_fields < 2) {
+    error ("Line %u: expected '<input-uri> <output-uri>"
+        " [<encoding-format> [<cpu-usage>]]'", line_num);
+    goto done;
+  }
+
+  if (fields[3]) {
+    gchar *end;
+
+    cpu_usage = g_ascii_strtoll (fields[3], &end, 10);
+    if (*end || cpu_usage < 1 || cpu_usage > 100) {
+      error ("Line %u: invalid CPU usage %s", line_num, fields[3]);
+      goto done;
+    }
+  }
+
+  job = g_new0 (BatchJob, 1);
+  job->line = line_num;
+  job->src_uri = ensure_uri (fields[0]);
+  job->dest_uri = ensure_uri (fields[1]);
+  g_ptr_array_add (jobs, job);
+
+  if (fields[2] && g_strcmp0 (fields[2], "-"))
+    encoding_format = g_strdup (fields[2]);
+  else
+    encoding_format = get_file_extension (job->dest_uri);
+
+  if (encoding_format)
+    settings->profile =
+        gst_transcoder_create_encoding_profile (encoding_format);
+
+  if (!settings->profile) {
+    gchar *msg = g_strdup_printf ("Could not find any encoding format for %s",
+        GST_STR_NULL (encoding_format));
+
+    batch_print_result (job, NULL, msg);
+    g_free (msg);
+    goto done;
+  }
+
+  if (!set_video_settings (settings) || !set_audio_settings (settings)) {
+    batch_print_result (job, NULL, "Invalid encoding settings");
+    goto done;
+  }
+
+  job->transcoder = gst_transcoder_pool_create_job (pool, job->src_uri,
+      job->dest_uri, settings->profile);
+  gst_transcoder_set_avoid_reencoding (job->transcoder, TRUE);
+  if (!set_mp4_mode (settings, job->transcoder)) {
+    batch_print_result (job, NULL, "Invalid MP4 mode");
+    goto done;
+  }
+  if (cpu_usage > 0)
+    gst_transcoder_set_cpu_usage (job->transcoder, cpu_usage);
+  if (settings->max_memory > 0)
+    gst_transcoder_set_max_memory (job->transcoder,
+        (guint64) settings->max_memory * 1024 * 1024);
+  gst_transcoder_set_output_cache_dir (job->transcoder,
+      settings->output_cache_dir);
+
+  g_signal_connect (job->transcoder, "warning", G_CALLBACK (_warning_cb),
+      NULL);
+  g_signal_connect (job->transcoder, "done", G_CALLBACK (_batch_done_cb),
+      job);
+  g_signal_connect (job->transcoder, "error", G_CALLBACK (_batch_error_cb),
+      job);
+
+  gst_transcoder_pool_queue_job (pool, job->transcoder);
+  res = TRUE;
+
+done:
+  if (settings->profile) {
+    g_object_unref (settings->profile);
+    settings->profile = NULL;
+  }
+  g_free (encoding_format);
+  g_strfreev (tokens);
+
+  return res;
+}
+
+static gint
+run_batch (Settings * settings)
+{
+  gchar *contents, **lines;
+  GError *err = NULL;
+  GstTranscoderPool *pool;
+  GPtrArray *jobs;
+  guint i, n_failed = 0;
+
+  contents = read_batch_manifest (settings->batch, &err);
+  if (!contents) {
+    error ("Could not read batch manifest %s: %s", settings->batch,
+        err->message);
+    g_clear_error (&err);
+
+    return 1;
+  }
+
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  /* All the jobs share the GStreamer initialisation and registry of the
+   * process, the pool only limits how many of them run at once */
+  pool = gst_transcoder_pool_new (NULL);
+  gst_transcoder_pool_set_max_jobs (pool, settings->jobs);
+  if (settings->cpu_usage < 100)
+    gst_transcoder_pool_set_cpu_usage (pool, settings->cpu_usage);
+
+  jobs = g_ptr_array_new_with_free_func ((GDestroyNotify) batch_job_free);
+  for (i = 0; lines[i]; i++) {
+    gchar *line = g_strstrip (lines[i]);
+
+    if (!*line || *line == '#')
+      continue;
+
+    if (!batch_queue_line (pool, settings, line, i + 1, jobs))
+      n_failed++;
+  }
+  g_strfreev (lines);
+
+  n_failed += gst_transcoder_pool_wait (pool);
+
+  /* Drop the pool first so that no job is dispatching any more signal */
+  gst_object_unref (pool);
+  g_ptr_array_unref (jobs);
+
+  return n_failed ? 1 : 0;
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -309,6 +671,43 @@ main (int argc, char *argv[])
           " or a single number (24 for 24fps))", NULL},
     {"video-encoder", 'v', 0, G_OPTION_ARG_STRING, &settings.size,
         "The video encoder to use.", NULL},
+    {"batch", 'b', 0, G_OPTION_ARG_FILENAME, &settings.batch,
+        "Run the jobs listed in the given manifest, '-' for stdin", NULL},
+    {"jobs", 'j', 0, G_OPTION_ARG_INT, &settings.jobs,
+        "Maximum number of jobs run at the same time in batch mode,"
+          " 0 for one per CPU", NULL},
+    {"mp4-mode", 'm', 0, G_OPTION_ARG_STRING, &settings.mp4_mode,
+        "How MP4 outputs are laid out: 'normal', 'faststart' (moov atom"
+          " reserved at the start) or 'fragmented'", NULL},
+    {"start", 0, 0, G_OPTION_ARG_DOUBLE, &settings.start,
+        "Position of the source in seconds where to start transcoding", NULL},
+    {"stop", 0, 0, G_OPTION_ARG_DOUBLE, &settings.stop,
+        "Position of the source in seconds where to stop transcoding", NULL},
+    {"keyframe-seek", 0, 0, G_OPTION_ARG_NONE, &settings.keyframe_seek,
+          "Start on the keyframe preceding --start, so that streams which are"
+          " not re-encoded start on a decodable frame", NULL},
+    {"preflight", 'p', 0, G_OPTION_ARG_NONE, &settings.preflight,
+          "Only check what transcoding would do, the exit status is 0 if it"
+          " can be done", NULL},
+    {"live", 0, 0, G_OPTION_ARG_NONE, &settings.live,
+          "Transcode a live source with a bounded latency, dropping the"
+          " frames later than --latency-budget", NULL},
+    {"latency-budget", 0, 0, G_OPTION_ARG_DOUBLE, &settings.latency_budget,
+        "How late in seconds frames can be encoded in live mode", NULL},
+    {"deadline", 0, 0, G_OPTION_ARG_DOUBLE, &settings.deadline,
+          "Time in seconds the transcoding has to be done in, degrading the"
+          " output if needed", NULL},
+    {"max-memory", 0, 0, G_OPTION_ARG_INT, &settings.max_memory,
+          "Memory in MiB the queues of the transcoding can hold, failing it"
+          " if more is needed (default: unlimited)", NULL},
+    {"output-cache-dir", 0, 0, G_OPTION_ARG_FILENAME,
+          &settings.output_cache_dir,
+          "Keep the outputs in the given directory and reuse them instead of"
+          " transcoding the same content the same way again", NULL},
+    {"checkpoint-dir", 'k', 0, G_OPTION_ARG_FILENAME,
+          &settings.checkpoint_dir,
+          "Keep the transcoded segments in the given directory so that running"
+          " the same command again resumes an interrupted transcoding", NULL},
     {NULL}
   };
 
@@ -334,6 +733,21 @@ main (int argc, char *argv[])
     return 0;
   }
 
+  if (settings.batch) {
+    if (argc != 1 || settings.jobs < 0) {
+      g_print ("%s", g_option_context_get_help (ctx, TRUE, NULL));
+      g_option_context_free (ctx);
+
+      return -1;
+    }
+    g_option_context_free (ctx);
+
+    res = run_batch (&settings);
+    g_free (settings.batch);
+
+    return res;
+  }
+
   if (argc < 3 || argc > 4) {
     g_print ("%s", g_option_context_get_help (ctx, TRUE, NULL));
     g_option_context_free (ctx);
@@ -354,7 +768,8 @@ main (int argc, char *argv[])
     settings.encoding_format = argv[3];
   }
 
-  settings.profile = create_encoding_profile (settings.encoding_format);
+  settings.profile =
+      gst_transcoder_create_encoding_profile (settings.encoding_format);
 
   if (!settings.profile) {
     error ("Could not find any encoding format for %s\n",
@@ -379,8 +794,31 @@ main (int argc, char *argv[])
   transcoder = gst_transcoder_new_full (settings.src_uri, settings.dest_uri,
       settings.profile, NULL);
   gst_transcoder_set_avoid_reencoding (transcoder, TRUE);
+  if (!set_mp4_mode (&settings, transcoder)) {
+    gst_object_unref (transcoder);
+    res = -1;
+    goto done;
+  }
 
   gst_transcoder_set_cpu_usage (transcoder, settings.cpu_usage);
+  gst_transcoder_set_checkpoint_dir (transcoder, settings.checkpoint_dir);
+  gst_transcoder_set_output_cache_dir (transcoder, settings.output_cache_dir);
+  if (settings.start > 0)
+    gst_transcoder_set_start_time (transcoder, settings.start * GST_SECOND);
+  if (settings.stop >= 0)
+    gst_transcoder_set_stop_time (transcoder, settings.stop * GST_SECOND);
+  if (settings.keyframe_seek)
+    gst_transcoder_set_seek_mode (transcoder,
+        GST_TRANSCODER_SEEK_MODE_KEYFRAME);
+  gst_transcoder_set_live (transcoder, settings.live);
+  if (settings.latency_budget >= 0)
+    gst_transcoder_set_latency_budget (transcoder,
+        settings.latency_budget * GST_SECOND);
+  if (settings.deadline >= 0)
+    gst_transcoder_set_deadline (transcoder, settings.deadline * GST_SECOND);
+  if (settings.max_memory > 0)
+    gst_transcoder_set_max_memory (transcoder,
+        (guint64) settings.max_memory * 1024 * 1024);
   g_signal_connect (transcoder, "position-updated",
       G_CALLBACK (position_updated_cb), NULL);
   g_signal_connect (transcoder, "warning", G_CALLBACK (_warning_cb), NULL);
@@ -388,6 +826,12 @@ main (int argc, char *argv[])
 
   g_assert (transcoder);
 
+  if (settings.preflight) {
+    res = run_preflight (transcoder) ? 0 : 1;
+    gst_object_unref (transcoder);
+    goto done;
+  }
+
   ok ("Starting transcoding...");
   gst_transcoder_run (transcoder, &err);
   if (!err)
@@ -396,6 +840,8 @@ main (int argc, char *argv[])
 done:
   g_free (settings.dest_uri);
   g_free (settings.src_uri);
+  g_free (settings.checkpoint_dir);
+  g_free (settings.output_cache_dir);
 
   return res;
 
@@ -137,26 +137,6 @@ get_usable_profiles (GstEncodingTarget * target)
   return usable_profiles;
 }
 
-GstEncodingProfile *
-create_encoding_profile (const gchar * pname)
-{
-  GstEncodingProfile *profile;
-  GValue value = G_VALUE_INIT;
-
-  g_value_init (&value, GST_TYPE_ENCODING_PROFILE);
-
-  if (!gst_value_deserialize (&value, pname)) {
-    g_value_reset (&value);
-
-    return NULL;
-  }
-
-  profile = g_value_dup_object (&value);
-  g_value_reset (&value);
-
-  return profile;
-}
-
 static const gchar *
 get_profile_type (GstEncodingProfile * profile)
 {
@@ -15,7 +15,6 @@ gchar * ensure_uri (const gchar * location);
 gchar * get_file_extension (gchar * uri);
 
 GList * get_usable_profiles (GstEncodingTarget * target);
-GstEncodingProfile * create_encoding_profile (const gchar * pname);
 void describe_encoding_profile (GstEncodingProfile *profile);
 
 #endif /*__GST_TRANSCODER_UTILS_H*/